@@ -0,0 +1,98 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "audio_clock.h"
+#include "test_common.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+static const int kRate = 48000;
+static const int kPeriod = 1024;
+
+// A capture of an hour with a card off by drift ppm. Each period read is
+// followed by a status: the frames still in the buffer and a timestamp,
+// jittered, and late by a few ms now and then.
+static void TestDrift(double drift) {
+  AudioClock clock;
+  clock.Reset(kRate);
+  double us_per_frame = 1000000.0 / kRate / (1 + drift * 1e-6);
+  double start = 1e9; // the monotonic time of the first frame
+  uint64_t read = 0;
+  double max_error = 0, nominal_error = 0;
+  int periods = 3600 * kRate / kPeriod;
+  for (int i = 0; i < periods; i++) {
+    uint64_t first = read;
+    read += kPeriod;
+    uint64_t avail = rand() % 256;
+    double jitter = (rand() % 600) - 300;
+    if (i % 500 == 499)
+      jitter += 5000;
+    clock.Update(read + avail,
+                 (int64_t)(start + (read + avail) * us_per_frame + jitter));
+    double truth = start + first * us_per_frame;
+    double error = fabs(clock.TimeOf(first) - truth);
+    double seconds = first / (double)kRate;
+    if (seconds >= 60)
+      max_error = std::max(max_error, error);
+    if (seconds >= 120)
+      EXPECT(fabs(clock.GetDriftPPM() - drift) < 5,
+             "drift %.1f: %.2f ppm at %.0f s\n", drift, clock.GetDriftPPM(),
+             seconds);
+    nominal_error = fabs(start + first * 1000000.0 / kRate - truth);
+  }
+  LOG("drift %6.1f ppm: estimated %7.2f, max error %4.0f us, nominal stamps "
+      "off by %6.1f ms\n",
+      drift, clock.GetDriftPPM(), max_error, nominal_error / 1000);
+  EXPECT(fabs(clock.GetDriftPPM() - drift) < 1, "drift %.1f: %.2f ppm\n",
+         drift, clock.GetDriftPPM());
+  EXPECT(max_error < 500, "drift %.1f: error %.0f us\n", drift, max_error);
+  EXPECT(clock.GetResyncCount() == 0, "drift %.1f: %u resyncs\n", drift,
+         clock.GetResyncCount());
+}
+
+// An overrun loses a second of frames: the clock follows the gap and
+// keeps its rate. A short one is within the margin, the stream tells it.
+static void TestOverrun() {
+  AudioClock clock;
+  clock.Reset(kRate);
+  double drift = 50;
+  double us_per_frame = 1000000.0 / kRate / (1 + drift * 1e-6);
+  uint64_t read = 0, lost = 0;
+  for (int i = 0; i < 20000; i++) {
+    if (i == 10000)
+      lost += kRate;
+    if (i == 15000) {
+      lost += kRate / 50;
+      clock.Resync();
+    }
+    uint64_t first = read;
+    read += kPeriod;
+    clock.Update(read, (int64_t)((read + lost) * us_per_frame));
+    double truth = (first + lost) * us_per_frame;
+    EXPECT(i < 3 || fabs(clock.TimeOf(first) - truth) < 100,
+           "period %d: %lld, expected %.0f\n", i,
+           (long long)clock.TimeOf(first), truth);
+  }
+  EXPECT(clock.GetResyncCount() == 2, "%u resyncs\n", clock.GetResyncCount());
+  EXPECT(fabs(clock.GetDriftPPM() - drift) < 1, "%.2f ppm\n",
+         clock.GetDriftPPM());
+}
+
+int main() {
+  LOG_INIT();
+  srand(time(NULL));
+  static const double drifts[] = {-100, 0, 37, 100};
+  for (double drift : drifts)
+    TestDrift(drift);
+  TestOverrun();
+  return TestResult("audio clock");
+}
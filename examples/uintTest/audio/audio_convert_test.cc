@@ -0,0 +1,258 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "audio_convert.h"
+#include "test_common.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+// Odd sizes, so the scalar tails are run after the vector loops.
+static const size_t kSizes[] = {0, 1, 7, 8, 9, 17, 1001};
+
+static std::vector<int16_t> RandomS16(size_t n) {
+  std::vector<int16_t> v(n);
+  for (size_t i = 0; i < n; i++)
+    v[i] = (int16_t)(rand() & 0xFFFF);
+  // The extremes first.
+  static const int16_t edges[] = {-32768, 32767, 0, -1, 1};
+  for (size_t i = 0; i < n && i < sizeof(edges) / sizeof(edges[0]); i++)
+    v[i] = edges[i];
+  return v;
+}
+
+static std::vector<int32_t> RandomS32(size_t n) {
+  std::vector<int32_t> v(n);
+  for (size_t i = 0; i < n; i++)
+    v[i] = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+  static const int32_t edges[] = {INT32_MIN, INT32_MAX, 0, -1, 0x7FFF8000};
+  for (size_t i = 0; i < n && i < sizeof(edges) / sizeof(edges[0]); i++)
+    v[i] = edges[i];
+  return v;
+}
+
+static std::vector<float> RandomFloat(size_t n) {
+  std::vector<float> v(n);
+  // Beyond [-1, 1] too, to check the saturation.
+  for (size_t i = 0; i < n; i++)
+    v[i] = (rand() / (float)RAND_MAX) * 2.4f - 1.2f;
+  static const float edges[] = {-1.0f, 1.0f, 0.0f, 1e10f, -1e10f};
+  for (size_t i = 0; i < n && i < sizeof(edges) / sizeof(edges[0]); i++)
+    v[i] = edges[i];
+  return v;
+}
+
+static int64_t Saturate(double v, int64_t min, int64_t max) {
+  v = round(v);
+  if (v < min)
+    return min;
+  if (v > max)
+    return max;
+  return (int64_t)v;
+}
+
+static void TestSampleTypes() {
+  for (size_t n : kSizes) {
+    auto s16 = RandomS16(n);
+    auto s32 = RandomS32(n);
+    auto flt = RandomFloat(n);
+    std::vector<float> f(n);
+    std::vector<int16_t> o16(n);
+    std::vector<int32_t> o32(n);
+
+    AudioS16ToFloat(s16.data(), f.data(), n);
+    for (size_t i = 0; i < n; i++)
+      EXPECT(f[i] == s16[i] / 32768.0f, "s16->flt %zu: %d %f\n", i, s16[i],
+             f[i]);
+    // Exact round trip.
+    AudioFloatToS16(f.data(), o16.data(), n);
+    EXPECT(o16 == s16, "s16->flt->s16 n=%zu\n", n);
+
+    AudioFloatToS16(flt.data(), o16.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      int64_t ref = Saturate(flt[i] * 32768.0, -32768, 32767);
+      EXPECT(llabs(o16[i] - ref) <= 1, "flt->s16 %zu: %f %d\n", i, flt[i],
+             o16[i]);
+    }
+
+    AudioS16ToS32(s16.data(), o32.data(), n);
+    for (size_t i = 0; i < n; i++)
+      EXPECT(o32[i] == s16[i] * 65536, "s16->s32 %zu\n", i);
+    AudioS32ToS16(o32.data(), o16.data(), n);
+    EXPECT(o16 == s16, "s16->s32->s16 n=%zu\n", n);
+
+    AudioS32ToS16(s32.data(), o16.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      // Half up.
+      int64_t ref = std::min((int64_t)floor(s32[i] / 65536.0 + 0.5),
+                             (int64_t)32767);
+      EXPECT(o16[i] == ref, "s32->s16 %zu: %d %d\n", i, s32[i], o16[i]);
+    }
+
+    AudioS32ToFloat(s32.data(), f.data(), n);
+    for (size_t i = 0; i < n; i++)
+      EXPECT(fabs(f[i] - s32[i] / 2147483648.0) < 1e-7, "s32->flt %zu\n", i);
+
+    AudioFloatToS32(flt.data(), o32.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      int64_t ref = Saturate(flt[i] * 2147483648.0, INT32_MIN, INT32_MAX);
+      // float has 24 bits of mantissa.
+      EXPECT(llabs(o32[i] - ref) <= 128, "flt->s32 %zu: %f %d\n", i, flt[i],
+             o32[i]);
+    }
+  }
+}
+
+static void TestGain() {
+  static const float gains[] = {0.0f, 0.5f, 1.0f, 1.7f, 4.0f};
+  for (size_t n : kSizes) {
+    for (float gain : gains) {
+      auto s16 = RandomS16(n);
+      auto o16 = s16;
+      AudioGainS16(o16.data(), n, gain);
+      for (size_t i = 0; i < n; i++) {
+        int64_t ref = Saturate((double)s16[i] * gain, -32768, 32767);
+        EXPECT(llabs(o16[i] - ref) <= 1, "gain %f %zu: %d %d\n", gain, i,
+               s16[i], o16[i]);
+      }
+      auto flt = RandomFloat(n);
+      auto of = flt;
+      AudioGainFloat(of.data(), n, gain);
+      for (size_t i = 0; i < n; i++)
+        EXPECT(of[i] == flt[i] * gain, "gain flt %f %zu\n", gain, i);
+    }
+  }
+}
+
+static void TestChannels() {
+  for (size_t frames : kSizes) {
+    for (int channels = 1; channels <= 6; channels++) {
+      auto in = RandomS16(frames * channels);
+      std::vector<int16_t> planar(frames * channels);
+      std::vector<int16_t *> planes(channels);
+      for (int c = 0; c < channels; c++)
+        planes[c] = planar.data() + c * frames;
+      AudioDeinterleaveS16(in.data(), planes.data(), channels, frames);
+      for (size_t i = 0; i < frames; i++)
+        for (int c = 0; c < channels; c++)
+          EXPECT(planes[c][i] == in[i * channels + c],
+                 "deinterleave %d ch %zu\n", channels, i);
+      std::vector<int16_t> out(frames * channels);
+      AudioInterleaveS16(planes.data(), out.data(), channels, frames);
+      EXPECT(out == in, "interleave %d ch, %zu frames\n", channels, frames);
+
+      // AudioConvert, through the 32 bits layout change too.
+      std::vector<int16_t> conv(frames * channels);
+      EXPECT(AudioConvert(SAMPLE_FMT_S16, in.data(), SAMPLE_FMT_S16P,
+                          conv.data(), channels, frames),
+             "convert s16->s16p\n");
+      EXPECT(conv == planar, "convert s16->s16p %d ch\n", channels);
+      std::vector<float> f(frames * channels), fp(frames * channels);
+      EXPECT(AudioConvert(SAMPLE_FMT_S16, in.data(), SAMPLE_FMT_FLT,
+                          f.data(), channels, frames),
+             "convert s16->flt\n");
+      EXPECT(AudioConvert(SAMPLE_FMT_FLT, f.data(), SAMPLE_FMT_FLTP,
+                          fp.data(), channels, frames),
+             "convert flt->fltp\n");
+      EXPECT(AudioConvert(SAMPLE_FMT_FLTP, fp.data(), SAMPLE_FMT_S16P,
+                          conv.data(), channels, frames),
+             "convert fltp->s16p\n");
+      EXPECT(conv == planar, "convert chain %d ch\n", channels);
+    }
+
+    // Mic of mic + ref, in place as the capture does.
+    for (int ch = 0; ch < 2; ch++) {
+      auto in = RandomS16(frames * 2);
+      auto buf = in;
+      int map[] = {ch};
+      AudioRemapS16(buf.data(), 2, buf.data(), map, 1, frames);
+      for (size_t i = 0; i < frames; i++)
+        EXPECT(buf[i] == in[i * 2 + ch], "select ch %d %zu\n", ch, i);
+    }
+    // Mono to stereo.
+    {
+      auto in = RandomS16(frames);
+      std::vector<int16_t> out(frames * 2);
+      int map[] = {0, 0};
+      AudioRemapS16(in.data(), 1, out.data(), map, 2, frames);
+      for (size_t i = 0; i < frames; i++)
+        EXPECT(out[2 * i] == in[i] && out[2 * i + 1] == in[i], "dup %zu\n", i);
+    }
+    // Swap and silence, in place.
+    {
+      auto in = RandomS16(frames * 3);
+      auto buf = in;
+      int map[] = {2, -1, 0};
+      AudioRemapS16(buf.data(), 3, buf.data(), map, 3, frames);
+      for (size_t i = 0; i < frames; i++)
+        EXPECT(buf[3 * i] == in[3 * i + 2] && buf[3 * i + 1] == 0 &&
+                   buf[3 * i + 2] == in[3 * i],
+               "remap %zu\n", i);
+    }
+  }
+}
+
+static void Bench(const char *name, size_t n, const std::function<void()> &fn) {
+  const int loops = 200;
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loops; i++)
+    fn();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  LOG("%-16s %8.1f Msamples/s\n", name, n * loops / d.count() / 1e6);
+}
+
+static void Throughput() {
+  // One second of 8 channels at 48k.
+  const size_t frames = 48000, n = frames * 8;
+  auto s16 = RandomS16(n);
+  auto s32 = RandomS32(n);
+  auto flt = RandomFloat(n);
+  std::vector<int16_t> o16(n);
+  std::vector<int32_t> o32(n);
+  std::vector<float> f(n);
+  std::vector<int16_t *> planes(2);
+  planes[0] = o16.data();
+  planes[1] = o16.data() + frames;
+  int mic[] = {0};
+
+  Bench("s16->flt", n, [&] { AudioS16ToFloat(s16.data(), f.data(), n); });
+  Bench("flt->s16", n, [&] { AudioFloatToS16(flt.data(), o16.data(), n); });
+  Bench("s16->s32", n, [&] { AudioS16ToS32(s16.data(), o32.data(), n); });
+  Bench("s32->s16", n, [&] { AudioS32ToS16(s32.data(), o16.data(), n); });
+  Bench("s32->flt", n, [&] { AudioS32ToFloat(s32.data(), f.data(), n); });
+  Bench("flt->s32", n, [&] { AudioFloatToS32(flt.data(), o32.data(), n); });
+  Bench("gain s16", n, [&] { AudioGainS16(o16.data(), n, 0.8f); });
+  Bench("deinterleave 2", frames * 2, [&] {
+    AudioDeinterleaveS16(s16.data(), planes.data(), 2, frames);
+  });
+  Bench("mic of mic+ref", frames * 2, [&] {
+    AudioRemapS16(s16.data(), 2, o16.data(), mic, 1, frames);
+  });
+}
+
+int main(int argc, char **argv) {
+  LOG_INIT();
+  srand(time(NULL));
+  TestSampleTypes();
+  TestGain();
+  TestChannels();
+  if (TestResult("audio convert"))
+    return -1;
+  // -b: the throughput too.
+  if (argc > 1 && !strcmp(argv[1], "-b"))
+    Throughput();
+  return 0;
+}
@@ -0,0 +1,104 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "buffer.h"
+#include "filter.h"
+#include "key_string.h"
+#include "test_common.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+static const int kChannels = 2;
+static const int kRate = 16000;
+static const int kFrames = 160;
+
+static std::shared_ptr<Filter> CreateFifo(SampleFormat fmt) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_SAMPLE_FMT, SampleFmtToString(fmt));
+  PARAM_STRING_APPEND_TO(param, KEY_CHANNELS, kChannels);
+  PARAM_STRING_APPEND_TO(param, KEY_SAMPLE_RATE, kRate);
+  PARAM_STRING_APPEND_TO(param, KEY_FRAMES, kFrames);
+  // 2 output frames, 512 frames of ring.
+  PARAM_STRING_APPEND_TO(param, KEY_MEM_CNT, 2);
+  return REFLECTOR(Filter)::Create<Filter>("audio_fifo", param.c_str());
+}
+
+// Frame i holds i in the first channel and -i in the second.
+static std::shared_ptr<SampleBuffer> Input(SampleFormat fmt, int first,
+                                           int frames) {
+  SampleInfo info = {fmt, kChannels, kRate, frames};
+  auto in = std::make_shared<SampleBuffer>(
+      MediaBuffer::Alloc2(frames * kChannels * sizeof(int16_t)), info);
+  int16_t *p = (int16_t *)in->GetPtr();
+  for (int i = 0; i < frames; i++) {
+    if (fmt == SAMPLE_FMT_S16P) {
+      p[i] = (int16_t)(first + i);
+      p[frames + i] = (int16_t)-(first + i);
+    } else {
+      p[2 * i] = (int16_t)(first + i);
+      p[2 * i + 1] = (int16_t)-(first + i);
+    }
+  }
+  in->SetSamples(frames);
+  in->SetUSTimeStamp((int64_t)first * 1000000 / kRate);
+  return in;
+}
+
+// Fetch the outputs, checking they carry on from frame next.
+static void Drain(SampleFormat fmt, std::shared_ptr<Filter> &fifo, int &next,
+                  std::vector<std::shared_ptr<MediaBuffer>> &held) {
+  while (true) {
+    auto out = std::static_pointer_cast<SampleBuffer>(fifo->FetchOutput());
+    if (!out)
+      return;
+    int n = out->GetSamples();
+    EXPECT(n == kFrames, "%d frames out\n", n);
+    EXPECT(out->GetUSTimeStamp() == (int64_t)next * 1000000 / kRate,
+           "frame %d at %lld\n", next, (long long)out->GetUSTimeStamp());
+    const int16_t *p = (const int16_t *)out->GetPtr();
+    for (int i = 0; i < n; i++) {
+      int16_t l = fmt == SAMPLE_FMT_S16P ? p[i] : p[2 * i];
+      int16_t r = fmt == SAMPLE_FMT_S16P ? p[n + i] : p[2 * i + 1];
+      EXPECT(l == (int16_t)(next + i) && r == (int16_t) - (next + i),
+             "frame %d: %d %d\n", next + i, l, r);
+    }
+    next += n;
+    // Hold a few, so the outputs are not all the same buffer.
+    held.push_back(out);
+    if (held.size() > 3)
+      held.erase(held.begin());
+  }
+}
+
+// Inputs larger than the ring grow it, none is dropped.
+static void TestLargeInput(SampleFormat fmt) {
+  auto fifo = CreateFifo(fmt);
+  EXPECT(fifo, "create %s\n", SampleFmtToString(fmt));
+  std::vector<std::shared_ptr<MediaBuffer>> held;
+  int sent = 0, next = 0;
+  // Leave frames unread, so the growth keeps them at a wrapped position.
+  static const int kSizes[] = {100, 300, 2000, 50, 5000, 7};
+  for (int size : kSizes) {
+    EXPECT(fifo->SendInput(Input(fmt, sent, size)) == 0, "send %d\n", size);
+    sent += size;
+    Drain(fmt, fifo, next, held);
+    if (failures)
+      return;
+  }
+  EXPECT(next == sent / kFrames * kFrames, "%d of %d frames out\n", next,
+         sent);
+}
+
+int main() {
+  LOG_INIT();
+  TestLargeInput(SAMPLE_FMT_S16);
+  TestLargeInput(SAMPLE_FMT_S16P);
+  return TestResult("audio fifo");
+}
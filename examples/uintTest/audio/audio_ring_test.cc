@@ -0,0 +1,91 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "audio_ring.h"
+#include "test_common.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+// The byte at pos of the stream.
+static uint8_t At(size_t pos) { return (uint8_t)(pos * 7 + (pos >> 8)); }
+
+static void Fill(std::vector<uint8_t> &v, size_t pos) {
+  for (size_t i = 0; i < v.size(); i++)
+    v[i] = At(pos + i);
+}
+
+static bool Check(const uint8_t *p, size_t bytes, size_t pos) {
+  for (size_t i = 0; i < bytes; i++)
+    if (p[i] != At(pos + i))
+      return false;
+  return true;
+}
+
+static void TestLimits() {
+  AudioRing ring(12288);
+  EXPECT(ring.Capacity() == 16384, "capacity %zu\n", ring.Capacity());
+  EXPECT(ring.Size() == 0 && ring.Space() == 16384, "empty\n");
+  std::vector<uint8_t> buf(16384);
+  Fill(buf, 0);
+  EXPECT(!ring.Write(buf.data(), 16385), "write past the capacity\n");
+  EXPECT(ring.Write(buf.data(), 16384), "write full\n");
+  EXPECT(ring.Space() == 0 && !ring.Write(buf.data(), 1), "full\n");
+  EXPECT(!ring.Reserve(1, buf.data()), "reserve when full\n");
+  std::vector<uint8_t> out(16384);
+  EXPECT(!ring.Read(out.data(), 16385), "read past the size\n");
+  EXPECT(ring.Read(out.data(), 16384) && Check(out.data(), 16384, 0),
+         "read full\n");
+  EXPECT(!ring.Peek(1, out.data()) && !ring.Read(out.data(), 1), "empty\n");
+}
+
+// Chunks of all sizes in, frames out, as the vqe re-frames the periods.
+static void TestChunks() {
+  static const size_t frames[] = {320, 640, 1280, 1920};
+  for (size_t frame : frames) {
+    AudioRing in(12288), out(12288);
+    std::vector<uint8_t> chunk, scratch_in(frame), scratch_out(frame);
+    std::vector<uint8_t> got(8192);
+    size_t wpos = 0, rpos = 0;
+    int wrapped = 0;
+    for (int i = 0; i < 5000; i++) {
+      chunk.resize(1 + rand() % 4096);
+      Fill(chunk, wpos);
+      if (!in.Write(chunk.data(), chunk.size()))
+        continue;
+      wpos += chunk.size();
+      // The reader is random, out may fill: the frames wait in in.
+      while (in.Size() >= frame && out.Space() >= frame) {
+        const uint8_t *f = in.Peek(frame, scratch_in.data());
+        wrapped += f == scratch_in.data();
+        uint8_t *o = out.Reserve(frame, scratch_out.data());
+        EXPECT(o, "no room for a frame\n");
+        memcpy(o, f, frame);
+        out.Commit(o, frame);
+        in.Skip(frame);
+      }
+      size_t n = std::min(out.Size(), (size_t)(rand() % 8192));
+      EXPECT(out.Read(got.data(), n), "read %zu\n", n);
+      EXPECT(Check(got.data(), n, rpos), "frame %zu: data at %zu\n", frame,
+             rpos);
+      rpos += n;
+    }
+    EXPECT(wrapped > 0, "frame %zu never wrapped\n", frame);
+    EXPECT(rpos + out.Size() + in.Size() == wpos, "lost bytes\n");
+  }
+}
+
+int main() {
+  LOG_INIT();
+  srand(time(NULL));
+  TestLimits();
+  TestChunks();
+  return TestResult("audio ring");
+}
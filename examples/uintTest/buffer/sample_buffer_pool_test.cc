@@ -0,0 +1,128 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "test_common.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+// Heap allocations of the process, to check the steady state makes none.
+static std::atomic<unsigned int> allocations(0);
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+static SampleInfo Info() {
+  SampleInfo info = {SAMPLE_FMT_S16, 2, 16000, 256};
+  return info;
+}
+
+// A buffer comes back once dropped, clean, and not while it is held.
+static void TestRecycle() {
+  SampleBufferPool pool(2);
+  EXPECT(pool.Reserve(2, 1024) == 2, "reserve\n");
+  auto a = pool.Get(1024, Info());
+  auto b = pool.Get(1024, Info());
+  EXPECT(a && b && a->GetPtr() != b->GetPtr(), "two buffers\n");
+  EXPECT(pool.GetMissCount() == 0, "%u misses\n", pool.GetMissCount());
+  auto c = pool.Get(1024, Info());
+  EXPECT(c && pool.GetMissCount() == 1, "%u misses\n", pool.GetMissCount());
+  void *ptr = a->GetPtr();
+  a->SetUSTimeStamp(1234);
+  a->SetEOF(true);
+  a->GetSampleInfo().nb_samples = 1;
+  // The consumer may point the buffer elsewhere, the pool keeps its own.
+  a->SetPtr(c->GetPtr());
+  a->SetUserData(nullptr, nullptr);
+  a.reset();
+  auto d = pool.Get(1000, Info());
+  EXPECT(d->GetPtr() == ptr, "not recycled\n");
+  EXPECT(d->GetSize() == 1000 && d->GetUSTimeStamp() == 0 && !d->IsEOF() &&
+             d->GetSamples() == 256,
+         "not reset: size %zu ts %lld\n", d->GetSize(),
+         (long long)d->GetUSTimeStamp());
+  // Too small for the next one, a new buffer is allocated.
+  d.reset();
+  auto e = pool.Get(4096, Info());
+  EXPECT(e && e->GetSize() == 4096, "grow\n");
+  memset(e->GetPtr(), 0, 4096);
+}
+
+// Once the buffers are allocated, getting and dropping them allocates
+// nothing.
+static void TestNoAllocation() {
+  SampleBufferPool pool(4);
+  EXPECT(pool.Reserve(4, 2048) == 4, "reserve\n");
+  std::vector<std::shared_ptr<SampleBuffer>> held;
+  held.reserve(4);
+  unsigned int before = allocations;
+  for (int i = 0; i < 1000; i++) {
+    held.push_back(pool.Get(2048, Info()));
+    if (held.size() == 3)
+      held.erase(held.begin());
+  }
+  unsigned int count = allocations - before;
+  EXPECT(count == 0, "%u allocations\n", count);
+  EXPECT(pool.GetMissCount() == 0, "%u misses\n", pool.GetMissCount());
+}
+
+// The buffers go back from the consumer threads, and outlive the pool.
+static void TestThreads() {
+  std::shared_ptr<SampleBuffer> kept;
+  {
+    SampleBufferPool pool(4);
+    std::vector<std::thread> consumers;
+    std::atomic<int> reused(0);
+    for (int i = 0; i < 4096; i++) {
+      auto buffer = pool.Get(512, Info());
+      EXPECT(buffer, "get %d\n", i);
+      memset(buffer->GetPtr(), i & 0xff, 512);
+      consumers.emplace_back([buffer, i, &reused]() {
+        const uint8_t *p = (const uint8_t *)buffer->GetPtr();
+        for (int j = 0; j < 512; j++) {
+          if (p[j] != (i & 0xff)) {
+            reused++;
+            break;
+          }
+        }
+      });
+      if (i == 100)
+        kept = buffer;
+      if (consumers.size() == 16) {
+        for (auto &t : consumers)
+          t.join();
+        consumers.clear();
+      }
+    }
+    for (auto &t : consumers)
+      t.join();
+    EXPECT(reused == 0, "%d buffers reused while held\n", reused.load());
+  }
+  memset(kept->GetPtr(), 0, 512);
+  kept.reset();
+}
+
+int main() {
+  LOG_INIT();
+  TestRecycle();
+  TestNoAllocation();
+  TestThreads();
+  return TestResult("sample buffer pool");
+}
@@ -0,0 +1,649 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// RTSP server load and latency benchmark, over loopback only: the main
+// thread feeds the rtsp flow with synthetic h264/h265 access units, and N
+// in-process clients play the channel over UDP or TCP interleaved. Each
+// frame carries its creation time, so that a client measures the latency
+// from the flow input to its socket.
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_config.h"
+#include "media_type.h"
+#include "utils.h"
+
+static bool quit = false;
+
+static void sigterm_handler(int sig) {
+  fprintf(stderr, "signal %d\n", sig);
+  quit = true;
+}
+
+enum { STREAM_TYPE_H264, STREAM_TYPE_H265 };
+
+// The stamp after the NAL header: creation time and frame number, 7 bits
+// per byte with the high bit set, so that no start code can show up.
+#define STAMP_TIME_BYTES 10
+#define STAMP_SEQ_BYTES 5
+#define STAMP_SIZE (STAMP_TIME_BYTES + STAMP_SEQ_BYTES)
+
+static void put_stamp(uint8_t *p, int64_t time, uint32_t seq) {
+  for (int i = 0; i < STAMP_TIME_BYTES; i++)
+    p[i] = 0x80 | ((time >> (7 * i)) & 0x7F);
+  for (int i = 0; i < STAMP_SEQ_BYTES; i++)
+    p[STAMP_TIME_BYTES + i] = 0x80 | ((seq >> (7 * i)) & 0x7F);
+}
+
+static void get_stamp(const uint8_t *p, int64_t &time, uint32_t &seq) {
+  time = 0;
+  seq = 0;
+  for (int i = 0; i < STAMP_TIME_BYTES; i++)
+    time |= (int64_t)(p[i] & 0x7F) << (7 * i);
+  for (int i = 0; i < STAMP_SEQ_BYTES; i++)
+    seq |= (uint32_t)(p[STAMP_TIME_BYTES + i] & 0x7F) << (7 * i);
+}
+
+static const uint8_t h264_sps[] = {0, 0, 0, 1, 0x67, 0x42, 0xC0, 0x1F,
+                                   0x8C, 0x8D, 0x40, 0x50, 0x1E, 0xD0,
+                                   0x0F, 0x08, 0x84, 0x6A};
+static const uint8_t h264_pps[] = {0, 0, 0, 1, 0x68, 0xCE, 0x3C, 0x80};
+static const uint8_t h265_vps[] = {
+    0, 0, 0, 1, 0x40, 0x01, 0x0C, 0x01, 0xFF, 0xFF, 0x01, 0x60, 0x00,
+    0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
+    0x5D, 0x95, 0x98, 0x09};
+static const uint8_t h265_sps[] = {
+    0, 0, 0, 1, 0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
+    0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x5D, 0xA0, 0x02,
+    0x80, 0x80, 0x2D, 0x16, 0x59, 0x59, 0xA4, 0x93, 0x2B, 0xC0, 0x40};
+static const uint8_t h265_pps[] = {0, 0, 0, 1, 0x44, 0x01,
+                                   0xC1, 0x72, 0xB4, 0x62, 0x40};
+
+// One access unit as an encoder outputs it: the parameter sets before an
+// IDR, a single slice otherwise.
+static std::shared_ptr<easymedia::MediaBuffer>
+make_frame(int stream_type, bool idr, size_t slice_size, uint32_t seq) {
+  std::vector<std::pair<const uint8_t *, size_t>> sets;
+  if (idr && stream_type == STREAM_TYPE_H264) {
+    sets.push_back(std::make_pair(h264_sps, sizeof(h264_sps)));
+    sets.push_back(std::make_pair(h264_pps, sizeof(h264_pps)));
+  } else if (idr) {
+    sets.push_back(std::make_pair(h265_vps, sizeof(h265_vps)));
+    sets.push_back(std::make_pair(h265_sps, sizeof(h265_sps)));
+    sets.push_back(std::make_pair(h265_pps, sizeof(h265_pps)));
+  }
+  size_t header_size = (stream_type == STREAM_TYPE_H264) ? 1 : 2;
+  if (slice_size < header_size + STAMP_SIZE + 1)
+    slice_size = header_size + STAMP_SIZE + 1;
+  size_t size = 4 + slice_size;
+  for (auto &set : sets)
+    size += set.second;
+  auto buffer = easymedia::MediaBuffer::Alloc(size);
+  if (!buffer)
+    return nullptr;
+  uint8_t *p = (uint8_t *)buffer->GetPtr();
+  for (auto &set : sets) {
+    memcpy(p, set.first, set.second);
+    p += set.second;
+  }
+  p[0] = p[1] = p[2] = 0;
+  p[3] = 1;
+  p += 4;
+  if (stream_type == STREAM_TYPE_H264) {
+    p[0] = idr ? 0x65 : 0x41; // IDR / non-IDR slice, nal_ref_idc 3 / 2
+  } else {
+    p[0] = (idr ? 19 : 1) << 1; // IDR_W_RADL / TRAIL_R
+    p[1] = 0x01;
+  }
+  p += header_size;
+  put_stamp(p, easymedia::gettimeofday(), seq);
+  memset(p + STAMP_SIZE, 0xAA, slice_size - header_size - STAMP_SIZE);
+  buffer->SetValidSize(size);
+  buffer->SetType(Type::Video);
+  buffer->SetUserFlag(idr ? easymedia::MediaBuffer::kIntra : 0);
+  buffer->SetUSTimeStamp(easymedia::gettimeofday());
+  return buffer;
+}
+
+struct ClientResult {
+  bool ok;
+  bool tcp;
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t rtp_expected;
+  uint64_t rtp_received;
+  uint64_t frames_lost;
+  double jitter_us;
+  std::vector<int64_t> latencies; // us
+  int64_t cpu_us;
+};
+
+struct BenchClient {
+  int index;
+  int port;
+  std::string channel;
+  int stream_type;
+  bool tcp;
+  int64_t duration_us;
+
+  int rtsp_fd;
+  int rtp_fd;
+  int cseq;
+  std::string session;
+  std::string in; // bytes read from rtsp_fd, not handled yet
+  ClientResult result;
+
+  // RTP state
+  bool have_seq;
+  uint16_t last_seq;
+  bool have_transit;
+  int64_t last_transit;
+  int64_t frame_time;
+  bool have_frame_seq;
+  uint32_t last_frame_seq;
+
+  bool Request(const std::string &method, const std::string &url,
+               const std::string &headers, std::string &response);
+  bool ReadResponse(std::string &response);
+  bool Setup();
+  void OnRtp(const uint8_t *p, size_t size, int64_t now);
+  void Run();
+};
+
+static bool send_all(int fd, const std::string &s) {
+  size_t done = 0;
+  while (done < s.size()) {
+    ssize_t ret = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+    if (ret <= 0)
+      return false;
+    done += ret;
+  }
+  return true;
+}
+
+static int header_value(const std::string &response, const char *name,
+                        std::string &value) {
+  std::string key = std::string("\r\n") + name + ":";
+  size_t pos = response.find(key);
+  if (pos == std::string::npos)
+    return -1;
+  pos += key.size();
+  while (pos < response.size() && response[pos] == ' ')
+    pos++;
+  size_t end = response.find("\r\n", pos);
+  value = response.substr(pos, end - pos);
+  return 0;
+}
+
+bool BenchClient::ReadResponse(std::string &response) {
+  char buf[4096];
+  for (;;) {
+    // Skip the RTP over TCP that may come ahead of the response.
+    while (in.size() >= 4 && in[0] == '$') {
+      size_t len = ((uint8_t)in[2] << 8) | (uint8_t)in[3];
+      if (in.size() < 4 + len)
+        break;
+      in.erase(0, 4 + len);
+    }
+    size_t end = in.find("\r\n\r\n");
+    if (!in.empty() && in[0] != '$' && end != std::string::npos) {
+      std::string length;
+      size_t body = 0;
+      if (!header_value(in.substr(0, end + 2), "Content-Length", length))
+        body = atoi(length.c_str());
+      if (in.size() >= end + 4 + body) {
+        response = in.substr(0, end + 4 + body);
+        in.erase(0, end + 4 + body);
+        return response.compare(0, 12, "RTSP/1.0 200") == 0;
+      }
+    }
+    struct pollfd pfd = {rtsp_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 3000) <= 0)
+      return false;
+    ssize_t ret = recv(rtsp_fd, buf, sizeof(buf), 0);
+    if (ret <= 0)
+      return false;
+    in.append(buf, ret);
+  }
+}
+
+bool BenchClient::Request(const std::string &method, const std::string &url,
+                          const std::string &headers, std::string &response) {
+  std::string req = method + " " + url + " RTSP/1.0\r\n";
+  req += "CSeq: " + std::to_string(++cseq) + "\r\n";
+  if (!session.empty())
+    req += "Session: " + session + "\r\n";
+  req += headers + "\r\n";
+  if (!send_all(rtsp_fd, req))
+    return false;
+  if (!ReadResponse(response)) {
+    fprintf(stderr, "client %d: %s failed:\n%s\n", index, method.c_str(),
+            response.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool BenchClient::Setup() {
+  std::string base = "rtsp://127.0.0.1:" + std::to_string(port) + "/" + channel;
+  std::string response;
+  rtsp_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (rtsp_fd < 0)
+    return false;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(rtsp_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    fprintf(stderr, "client %d: connect failed, %m\n", index);
+    return false;
+  }
+  if (!Request("DESCRIBE", base, "Accept: application/sdp\r\n", response))
+    return false;
+  // The control of the first (video) media.
+  size_t media = response.find("m=video");
+  size_t control = response.find("a=control:", media);
+  if (media == std::string::npos || control == std::string::npos)
+    return false;
+  control += strlen("a=control:");
+  std::string track =
+      response.substr(control, response.find("\r\n", control) - control);
+
+  std::string transport;
+  if (tcp) {
+    transport = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
+  } else {
+    rtp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (rtp_fd < 0 || bind(rtp_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(rtp_fd, (struct sockaddr *)&addr, &len))
+      return false;
+    int rcvbuf = 4 << 20;
+    setsockopt(rtp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    int rtp_port = ntohs(addr.sin_port);
+    // RTCP is not read, the port after the RTP one is announced anyway.
+    transport = "Transport: RTP/AVP;unicast;client_port=" +
+                std::to_string(rtp_port) + "-" +
+                std::to_string(rtp_port + 1) + "\r\n";
+  }
+  if (!Request("SETUP", base + "/" + track, transport, response))
+    return false;
+  if (header_value(response, "Session", session))
+    return false;
+  session = session.substr(0, session.find(';'));
+  return Request("PLAY", base, "Range: npt=0.000-\r\n", response);
+}
+
+void BenchClient::OnRtp(const uint8_t *p, size_t size, int64_t now) {
+  if (size < 12 || (p[0] >> 6) != 2)
+    return;
+  size_t header = 12 + (p[0] & 0x0F) * 4;
+  if (size <= header)
+    return;
+  bool marker = p[1] & 0x80;
+  uint16_t seq = (p[2] << 8) | p[3];
+  uint32_t timestamp = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+  const uint8_t *payload = p + header;
+  size_t payload_size = size - header;
+
+  result.rtp_received++;
+  if (!have_seq) {
+    result.rtp_expected++;
+  } else {
+    uint16_t gap = seq - last_seq;
+    if (gap > 0 && gap < 0x8000)
+      result.rtp_expected += gap;
+  }
+  have_seq = true;
+  last_seq = seq;
+  result.bytes += size;
+
+  // RFC 3550 interarrival jitter, in us on the 90 kHz clock.
+  int64_t transit = now - (int64_t)timestamp * 100 / 9;
+  if (have_transit) {
+    int64_t d = transit - last_transit;
+    if (d < 0)
+      d = -d;
+    result.jitter_us += (d - result.jitter_us) / 16;
+  }
+  have_transit = true;
+  last_transit = transit;
+
+  // The stamp follows the NAL header, in the first fragment of a frame.
+  const uint8_t *stamp = nullptr;
+  if (stream_type == STREAM_TYPE_H264) {
+    int type = payload[0] & 0x1F;
+    if (type == 1 || type == 5)
+      stamp = payload + 1;
+    else if (type == 28 && payload_size > 2 && (payload[1] & 0x80) &&
+             ((payload[1] & 0x1F) == 1 || (payload[1] & 0x1F) == 5))
+      stamp = payload + 2;
+  } else if (payload_size > 2) {
+    int type = (payload[0] & 0x7E) >> 1;
+    if (type == 1 || type == 19)
+      stamp = payload + 2;
+    else if (type == 49 && payload_size > 3 && (payload[2] & 0x80) &&
+             ((payload[2] & 0x3F) == 1 || (payload[2] & 0x3F) == 19))
+      stamp = payload + 3;
+  }
+  if (stamp && stamp + STAMP_SIZE <= p + size) {
+    uint32_t frame_seq;
+    get_stamp(stamp, frame_time, frame_seq);
+    if (have_frame_seq && frame_seq > last_frame_seq + 1)
+      result.frames_lost += frame_seq - last_frame_seq - 1;
+    have_frame_seq = true;
+    last_frame_seq = frame_seq;
+  }
+  if (marker && frame_time > 0) {
+    result.frames++;
+    result.latencies.push_back(now - frame_time);
+    frame_time = 0;
+  }
+}
+
+#define KEEPALIVE_INTERVAL 5000000 // us
+
+void BenchClient::Run() {
+  struct timespec cpu_start, cpu_end;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  rtsp_fd = rtp_fd = -1;
+  cseq = 0;
+  have_seq = have_transit = have_frame_seq = false;
+  frame_time = 0;
+  result.ok = Setup();
+  int64_t start = easymedia::gettimeofday();
+  int64_t keepalive = start;
+  std::vector<uint8_t> packet(65536);
+  char buf[65536];
+  while (result.ok && !quit) {
+    int64_t now = easymedia::gettimeofday();
+    if (now - start >= duration_us)
+      break;
+    if (now - keepalive >= KEEPALIVE_INTERVAL) {
+      // live555 reclaims the sessions it does not hear from.
+      keepalive = now;
+      std::string req = "GET_PARAMETER rtsp://127.0.0.1:" +
+                        std::to_string(port) + "/" + channel +
+                        " RTSP/1.0\r\nCSeq: " + std::to_string(++cseq) +
+                        "\r\nSession: " + session + "\r\n\r\n";
+      send_all(rtsp_fd, req);
+    }
+    struct pollfd pfds[2] = {{rtsp_fd, POLLIN, 0}, {rtp_fd, POLLIN, 0}};
+    if (poll(pfds, tcp ? 1 : 2, 100) <= 0)
+      continue;
+    now = easymedia::gettimeofday();
+    if (!tcp && (pfds[1].revents & POLLIN)) {
+      ssize_t ret;
+      while ((ret = recv(rtp_fd, packet.data(), packet.size(), MSG_DONTWAIT)) >
+             0)
+        OnRtp(packet.data(), ret, now);
+    }
+    if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t ret = recv(rtsp_fd, buf, sizeof(buf), 0);
+      if (ret <= 0) {
+        fprintf(stderr, "client %d: server closed the connection\n", index);
+        break;
+      }
+      in.append(buf, ret);
+      // Interleaved RTP, and the keepalive responses.
+      for (;;) {
+        if (in.size() >= 4 && in[0] == '$') {
+          size_t len = ((uint8_t)in[2] << 8) | (uint8_t)in[3];
+          if (in.size() < 4 + len)
+            break;
+          if (in[1] == 0)
+            OnRtp((const uint8_t *)in.data() + 4, len, now);
+          in.erase(0, 4 + len);
+        } else if (!in.empty() && in[0] != '$') {
+          size_t end = in.find("\r\n\r\n");
+          if (end == std::string::npos)
+            break;
+          in.erase(0, end + 4);
+        } else {
+          break;
+        }
+      }
+    }
+  }
+  if (rtsp_fd >= 0) {
+    std::string response;
+    if (result.ok)
+      send_all(rtsp_fd, "TEARDOWN rtsp://127.0.0.1:" + std::to_string(port) +
+                            "/" + channel + " RTSP/1.0\r\nCSeq: " +
+                            std::to_string(++cseq) + "\r\nSession: " +
+                            session + "\r\n\r\n");
+    close(rtsp_fd);
+  }
+  if (rtp_fd >= 0)
+    close(rtp_fd);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  result.cpu_us = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000000LL +
+                  (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000;
+}
+
+static int64_t percentile(std::vector<int64_t> &v, int percent) {
+  if (v.empty())
+    return 0;
+  size_t i = v.size() * percent / 100;
+  if (i >= v.size())
+    i = v.size() - 1;
+  return v[i];
+}
+
+static int64_t process_cpu_us() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static char optstr[] = "?t:n:T:d:f:g:s:p:j:zl:";
+
+static void usage() {
+  printf("usage: rtsp_bench_test [-t h264|h265] [-n clients] "
+         "[-T udp|tcp|mix] [-d seconds]\n"
+         "  [-f fps] [-g gop] [-s frame bytes] [-p port] [-j rtsp threads] "
+         "[-z (zero copy rtp)] [-l max latency ms]\n");
+  printf("example: rtsp_bench_test -t h264 -n 16 -T mix -d 30 -s 40000\n");
+}
+
+int main(int argc, char **argv) {
+  int c;
+  int stream_type = STREAM_TYPE_H264;
+  int clients = 4;
+  std::string transport = "udp";
+  int duration = 10;
+  int fps = 30;
+  int gop = 30;
+  int frame_size = 20000;
+  int port = 8554;
+  int threads = 1;
+  bool zero_copy = false;
+  int max_latency = 0;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 't':
+      stream_type =
+          strstr(optarg, "h265") ? STREAM_TYPE_H265 : STREAM_TYPE_H264;
+      break;
+    case 'n':
+      clients = atoi(optarg);
+      break;
+    case 'T':
+      transport = optarg;
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'f':
+      fps = atoi(optarg);
+      break;
+    case 'g':
+      gop = atoi(optarg);
+      break;
+    case 's':
+      frame_size = atoi(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'z':
+      zero_copy = true;
+      break;
+    case 'l':
+      max_latency = atoi(optarg);
+      break;
+    case '?':
+    default:
+      usage();
+      exit(EXIT_SUCCESS);
+    }
+  }
+  if (clients < 1 || fps < 1 || gop < 1 || duration < 1) {
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  std::string channel = "bench";
+  std::string flow_name = "live555_rtsp_server";
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_INPUTDATATYPE,
+                      (stream_type == STREAM_TYPE_H264) ? VIDEO_H264
+                                                        : VIDEO_H265);
+  PARAM_STRING_APPEND(param, KEY_CHANNEL_NAME, channel);
+  PARAM_STRING_APPEND_TO(param, KEY_PORT_NUM, port);
+  PARAM_STRING_APPEND_TO(param, KEY_RTSP_THREADS, threads);
+  PARAM_STRING_APPEND_TO(param, KEY_RTP_ZERO_COPY, zero_copy ? 1 : 0);
+  PARAM_STRING_APPEND_TO(param, KEY_RTSP_MAX_LATENCY, max_latency);
+  printf("\nparam :\n%s\n", param.c_str());
+  auto rtsp_flow = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      flow_name.c_str(), param.c_str());
+  if (!rtsp_flow) {
+    fprintf(stderr, "Create flow %s failed\n", flow_name.c_str());
+    exit(EXIT_FAILURE);
+  }
+  signal(SIGINT, sigterm_handler);
+
+  std::vector<BenchClient> bench(clients);
+  std::vector<std::thread> client_threads;
+  int64_t start = easymedia::gettimeofday();
+  int64_t cpu_start = process_cpu_us();
+  int64_t frame_interval = 1000000 / fps;
+  int64_t next_frame = start;
+  uint32_t seq = 0;
+  for (int i = 0; i < clients; i++) {
+    BenchClient &client = bench[i];
+    client.index = i;
+    client.port = port;
+    client.channel = channel;
+    client.stream_type = stream_type;
+    client.tcp = (transport == "tcp") || (transport == "mix" && (i & 1));
+    client.duration_us = (int64_t)duration * 1000000;
+    client.result = ClientResult();
+    client.result.tcp = client.tcp;
+  }
+  for (int i = 0; i < clients; i++)
+    client_threads.push_back(std::thread(&BenchClient::Run, &bench[i]));
+
+  // Feed the flow until the last client is done, the clients ask for an
+  // IDR when they start, a GOP is sent anyway.
+  int64_t end = start + (int64_t)(duration + 2) * 1000000;
+  while (!quit && easymedia::gettimeofday() < end) {
+    auto buffer = make_frame(stream_type, (seq % gop) == 0, frame_size, seq);
+    assert(buffer);
+    rtsp_flow->SendInput(buffer, 0);
+    seq++;
+    next_frame += frame_interval;
+    int64_t wait = next_frame - easymedia::gettimeofday();
+    if (wait > 0)
+      easymedia::usleep(wait);
+  }
+  for (auto &t : client_threads)
+    t.join();
+  int64_t wall = easymedia::gettimeofday() - start;
+  int64_t cpu = process_cpu_us() - cpu_start;
+
+  printf("\n%-6s %-4s %8s %10s %9s %9s %9s %9s %8s %8s\n", "client", "tr",
+         "frames", "kbps", "lat avg", "lat p50", "lat p99", "lat max",
+         "jitter", "loss %");
+  int64_t clients_cpu = 0;
+  uint64_t total_bytes = 0;
+  std::vector<int64_t> all;
+  for (auto &client : bench) {
+    ClientResult &r = client.result;
+    clients_cpu += r.cpu_us;
+    if (!r.ok) {
+      printf("%-6d %-4s failed\n", client.index, r.tcp ? "tcp" : "udp");
+      continue;
+    }
+    total_bytes += r.bytes;
+    int64_t sum = 0;
+    for (auto l : r.latencies)
+      sum += l;
+    std::sort(r.latencies.begin(), r.latencies.end());
+    all.insert(all.end(), r.latencies.begin(), r.latencies.end());
+    double loss = r.rtp_expected
+                      ? 100.0 * (r.rtp_expected - r.rtp_received) /
+                            r.rtp_expected
+                      : 0;
+    printf("%-6d %-4s %8llu %10llu %7.2fms %7.2fms %7.2fms %7.2fms %6.2fms "
+           "%8.2f\n",
+           client.index, r.tcp ? "tcp" : "udp", (unsigned long long)r.frames,
+           (unsigned long long)(r.bytes * 8 / 1000 / duration),
+           r.latencies.empty() ? 0.0 : sum / 1000.0 / r.latencies.size(),
+           percentile(r.latencies, 50) / 1000.0,
+           percentile(r.latencies, 99) / 1000.0,
+           r.latencies.empty() ? 0.0 : r.latencies.back() / 1000.0,
+           r.jitter_us / 1000.0, loss);
+    if (r.frames_lost)
+      printf("%-6s %llu frames lost\n", "",
+             (unsigned long long)r.frames_lost);
+  }
+  std::sort(all.begin(), all.end());
+  printf("\n%d clients, %d frames sent, %llu kbps served\n", clients, (int)seq,
+         (unsigned long long)(total_bytes * 8 / 1000 / duration));
+  printf("latency p50 %.2f ms, p99 %.2f ms\n", percentile(all, 50) / 1000.0,
+         percentile(all, 99) / 1000.0);
+  // The clients run in this process too, take their threads out.
+  printf("server cpu %.1f%% (process %.1f%%, clients %.1f%%)\n",
+         100.0 * (cpu - clients_cpu) / wall, 100.0 * cpu / wall,
+         100.0 * clients_cpu / wall);
+
+  LOG("rtsp bench test reclaiming\n");
+  rtsp_flow.reset();
+  return 0;
+}
@@ -0,0 +1,34 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_UINTTEST_TEST_COMMON_H_
+#define EASYMEDIA_UINTTEST_TEST_COMMON_H_
+
+#include "utils.h"
+
+// The checks of the unit tests: a failed EXPECT logs and returns from the
+// test function, and main() returns TestResult().
+
+static int failures = 0;
+
+#define EXPECT(cond, ...)                                                      \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      LOG("FAIL %s:%d: ", __func__, __LINE__);                                 \
+      LOG(__VA_ARGS__);                                                        \
+      failures++;                                                              \
+      return;                                                                  \
+    }                                                                          \
+  } while (0)
+
+static inline int TestResult(const char *name) {
+  if (failures) {
+    LOG("%s: %d failures\n", name, failures);
+    return -1;
+  }
+  LOG("%s: all passed\n", name);
+  return 0;
+}
+
+#endif // #ifndef EASYMEDIA_UINTTEST_TEST_COMMON_H_
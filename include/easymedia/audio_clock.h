@@ -0,0 +1,50 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_AUDIO_CLOCK_H_
+#define EASYMEDIA_AUDIO_CLOCK_H_
+
+#include <stdint.h>
+
+#include "utils.h"
+
+namespace easymedia {
+
+// Follows a sound card clock against the system clock, with a second order
+// delay locked loop. It is fed the system time at which a frame position
+// was captured or played, as the alsa status timestamps give it. The noise
+// of the observations is filtered out, the frame times it gives stay on
+// the real clock of the card, and its rate against the system clock is the
+// drift.
+class _API AudioClock {
+public:
+  AudioClock();
+  void Reset(int sample_rate);
+  // The frame at pos was at time_us. A pos going back, or an error beyond
+  // the margin, as after an xrun, anchors the clock again at the
+  // observation, the rate is kept.
+  void Update(uint64_t pos, int64_t time_us);
+  // The next observation anchors the clock, when frames were lost.
+  void Resync() { resync = true; }
+  bool IsValid() const { return updates > 0; }
+  // The filtered time of the frame at pos.
+  int64_t TimeOf(uint64_t pos) const;
+  // Positive when the card is faster than the system clock.
+  double GetDriftPPM() const;
+  unsigned int GetResyncCount() const { return resyncs; }
+
+private:
+  int sample_rate;
+  double nominal; // us per frame
+  double period;  // us per frame, estimated
+  uint64_t base_pos;
+  double base_time;
+  unsigned int updates;
+  unsigned int resyncs;
+  bool resync;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_AUDIO_CLOCK_H_
@@ -0,0 +1,50 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_AUDIO_CONVERT_H_
+#define EASYMEDIA_AUDIO_CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sound.h"
+
+// PCM conversion kernels, with NEON or SSE2 code for the common cases.
+// frames counts the samples of one channel, n the samples of all channels.
+// Conversions to a narrower type round to nearest and saturate.
+namespace easymedia {
+
+_API void AudioS16ToFloat(const int16_t *in, float *out, size_t n);
+_API void AudioFloatToS16(const float *in, int16_t *out, size_t n);
+_API void AudioS16ToS32(const int16_t *in, int32_t *out, size_t n);
+_API void AudioS32ToS16(const int32_t *in, int16_t *out, size_t n);
+_API void AudioS32ToFloat(const int32_t *in, float *out, size_t n);
+_API void AudioFloatToS32(const float *in, int32_t *out, size_t n);
+
+// In place, buf may be interleaved or planar.
+_API void AudioGainS16(int16_t *buf, size_t n, float gain);
+_API void AudioGainFloat(float *buf, size_t n, float gain);
+
+// out[c][i] = in[i * channels + c]
+_API void AudioDeinterleaveS16(const int16_t *in, int16_t *const *out,
+                               int channels, size_t frames);
+// out[i * channels + c] = in[c][i]
+_API void AudioInterleaveS16(const int16_t *const *in, int16_t *out,
+                             int channels, size_t frames);
+// Interleaved to interleaved: out channel j is in channel map[j], or
+// silence if map[j] < 0. out may be in when out_channels <= in_channels.
+_API void AudioRemapS16(const int16_t *in, int in_channels, int16_t *out,
+                        const int *map, int out_channels, size_t frames);
+
+// Convert frames between the formats of the same channels. Planar data
+// are packed planes of frames samples. in and out must not overlap.
+// Returns false if the conversion is not supported: a change of both the
+// sample type and the planar layout, or u8 and g711.
+_API bool AudioConvert(SampleFormat in_fmt, const void *in,
+                       SampleFormat out_fmt, void *out, int channels,
+                       size_t frames);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_AUDIO_CONVERT_H_
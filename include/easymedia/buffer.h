@@ -9,7 +9,9 @@
 #include <string.h>
 #include <sys/time.h>
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "image.h"
 #include "lock.h"
@@ -274,6 +276,9 @@ public:
 
 public:
   void *pool;
+  // Made with the pool, held by the buffers of each GetBuffer(): the owner
+  // of the memory across them.
+  std::shared_ptr<void> token;
 
 private:
   void *ptr; // buffer virtual address
@@ -290,6 +295,9 @@ public:
 
   std::shared_ptr<MediaBuffer> GetBuffer(bool block = true);
   int PutBuffer(MediaGroupBuffer *mgb);
+  // The token of a buffer of GetBuffer(), the same for all the gets of its
+  // group buffer, nullptr if mb is not of a pool.
+  static std::shared_ptr<void> GetOwner(MediaBuffer &mb);
 
   void DumpInfo();
 
@@ -301,6 +309,38 @@ private:
   int buf_size;
 };
 
+// Recycles sample buffers, memory and shared_ptr alike: a buffer given by
+// Get() is given out again once only the pool holds it, so after its
+// consumers are done, whichever thread they drop it in. Up to num
+// are kept, the others are freed when dropped. Get(), Reserve() and
+// Clear() are for one thread. The buffers may outlive the pool.
+class _API SampleBufferPool {
+public:
+  explicit SampleBufferPool(size_t num);
+  SampleBufferPool(const SampleBufferPool &) = delete;
+  SampleBufferPool &operator=(const SampleBufferPool &) = delete;
+
+  // Allocate num buffers of size bytes ahead, returns how many.
+  int Reserve(int num, size_t size);
+  // A buffer of size bytes with info, nullptr if out of memory.
+  std::shared_ptr<SampleBuffer> Get(size_t size, const SampleInfo &info);
+  // Drop the buffers, those still held are freed by their consumers.
+  void Clear();
+  // Gets which found no unused buffer, the consumers hold them all.
+  unsigned int GetMissCount() { return misses; }
+
+private:
+  struct Slot {
+    MediaBuffer mb; // as allocated, whatever the consumers set
+    std::shared_ptr<SampleBuffer> buffer;
+  };
+
+  size_t max_buffers;
+  std::vector<Slot> slots;
+  size_t next; // where the search starts, round the slots
+  std::atomic<unsigned int> misses;
+};
+
 } // namespace easymedia
 
 #endif // EASYMEDIA_BUFFER_H_
@@ -68,6 +68,33 @@ typedef struct {
   int interval;
 } RockxFilterArg;
 
+// Congestion state of one RTSP video client, see G_RTSP_CLIENT_STATS.
+typedef struct {
+  unsigned client_id;      // live555 client session id
+  int64_t latency_us;      // age of the last frame sent
+  int64_t max_latency_us;  // highest latency_us so far
+  int send_queue_bytes;    // bytes not yet sent by the socket
+  int send_queue_percent;  // of the socket send buffer
+  uint64_t frames_sent;
+  uint64_t frames_dropped; // non-reference frames dropped
+  uint64_t frames_skipped; // frames skipped to the next IDR
+  unsigned idr_requests;
+} RtspClientStats;
+
+// Flags of a recorded segment, see S_MUXER_SEGMENT_FLAGS.
+#define MUXER_SEGMENT_EVENT (1 << 0)
+// Never deleted by loop recording.
+#define MUXER_SEGMENT_PROTECTED (1 << 1)
+
+// A segment of loop recording, see G_MUXER_SEGMENTS.
+typedef struct {
+  char path[256];
+  int64_t start_time; // seconds since the Epoch
+  int64_t end_time;   // 0 while recording
+  uint64_t size;      // bytes
+  uint32_t flags;
+} MuxerSegmentInfo;
+
 enum {
   S_FIRST_CONTROL = 10000,
   S_SUB_REQUEST, // many devices have their kernel controls
@@ -96,6 +123,14 @@ enum {
   S_VQE_ENABLE,
   S_VQE_ATTR,
   G_VQE_ATTR,
+  // unsigned int, periods captured while all the period buffers were busy
+  G_ALSA_BUFFER_UNDERFLOW,
+  // double, ppm of the card clock against CLOCK_MONOTONIC, positive if faster
+  G_ALSA_CLOCK_DRIFT,
+  // int64_t, us until the last buffer written is played, from snd_pcm_delay
+  G_ALSA_OUTPUT_DELAY,
+  // VQE_QUEUE_STATE_S, fails while the vqe is disabled
+  G_VQE_QUEUE_STATE,
 
   // Through Guard controls
   // int
@@ -132,6 +167,12 @@ enum {
   S_MUXER_FILE_DURATION,
   S_MUXER_FILE_PATH,
   S_MUXER_FILE_PREFIX,
+  // uint32_t flags: ORed into the flags of the current segment
+  S_MUXER_SEGMENT_FLAGS,
+  // int64_t start_time, int64_t end_time, MuxerSegmentInfo *infos,
+  // int *num: num is the size of infos on input, the number of segments in
+  // the time range on output, which may be more than the size.
+  G_MUXER_SEGMENTS,
 
   // Occlusion Detection
   S_OD_ROI_ENABLE = 10900,
@@ -140,6 +181,16 @@ enum {
   G_OD_ROI_RECTS,
   S_OD_SENSITIVITY,
   G_OD_SENSITIVITY,
+
+  // RTSP server
+  // RtspClientStats *stats, int *num: num is the size of stats on input,
+  // the number of clients filled on output.
+  G_RTSP_CLIENT_STATS = 11000,
+
+  // Resample controls
+  // double, ppm the output clock is faster than the input one, more frames
+  // are made for it. E.g. the drift of the playback less that of the capture.
+  S_RESAMPLE_DRIFT = 11100,
 };
 
 } // namespace easymedia
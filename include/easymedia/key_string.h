@@ -13,6 +13,12 @@
 #define KEY_SAVE_MODE "save_mode"
 #define KEY_SAVE_MODE_SINGLE "single_frame"
 #define KEY_SAVE_MODE_CONTIN "continuous_frame"
+// file write: reserve the file space by this many bytes ahead
+#define KEY_PREALLOC_SIZE "prealloc_size"
+// file write: fdatasync after this many bytes
+#define KEY_SYNC_SIZE "sync_size"
+// bytes queued to the I/O thread of a writing flow, 0 writes in the flow
+#define KEY_IO_QUEUE_SIZE "io_queue_size"
 #define KEY_DEVICE "device"
 #define KEY_CAMERA_ID "camera_id"
 
@@ -108,6 +114,15 @@
 #define KEY_FRAMES "frame_num"
 #define KEY_FLOAT_QUALITY "compress_quality"
 #define KEY_LAYOUT "layout"
+// alsa: 1 to access the dma buffer mapped, instead of read/write calls
+#define KEY_ALSA_MMAP "alsa_mmap"
+// alsa playback: 1 for a short buffer, started at one period, and
+// written as room is made; the period frames and count may be set
+#define KEY_ALSA_LOW_LATENCY "alsa_low_latency"
+#define KEY_ALSA_PERIOD_SIZE "alsa_period_size"
+#define KEY_ALSA_PERIODS "alsa_periods"
+// resample: 0 low latency, 8 taps; 1 default, 16 taps; 2 high, 32 taps
+#define KEY_RESAMPLE_QUALITY "resample_quality"
 
 // v4l2 info
 #define KEY_USE_LIBV4L2 "use_libv4l2"
@@ -125,6 +140,19 @@
 #define KEY_USERNAME "username"
 #define KEY_USERPASSWORD "userpwd"
 #define KEY_CHANNEL_NAME "channel_name"
+// event loop threads of the rtsp server, set by the first rtsp flow. Above
+// 1, rtsp over http is refused and a client must keep its session on the
+// connection that set it up.
+#define KEY_RTSP_THREADS "rtsp_threads"
+// bytes of the last GOP kept for new clients, 0 disables
+#define KEY_GOP_CACHE_SIZE "gop_cache_size"
+#define KEY_GOP_CACHE_MODE "gop_cache_mode"
+#define KEY_GOP_CACHE_FAST_FORWARD "fast_forward"
+#define KEY_GOP_CACHE_PACED "paced"
+// 1: packetize h264/h265 straight from the encoder buffers
+#define KEY_RTP_ZERO_COPY "rtp_zero_copy"
+// ms a h264/h265 client may lag behind, 0 disables the frame dropping
+#define KEY_RTSP_MAX_LATENCY "rtsp_max_latency"
 
 #define KEY_MEM_CNT "mem_cnt"
 #define KEY_MEM_TYPE "mem_type"
@@ -135,6 +163,8 @@
 #define KEY_MEM_SIZE_PERTIME "size_pertime"
 
 #define KEY_LOOP_TIME "loop_time"
+// file read: 1 sends views of the file mapped in memory, no read copy
+#define KEY_FILE_MMAP "mmap"
 
 // flow
 #define KEK_THREAD_SYNC_MODEL "thread_model"
@@ -160,6 +190,17 @@
 #define KEY_FILE_TIME "file_time"
 #define KEY_MUXER_FFMPEG_AVDICTIONARY "muxer_ffmpeg_avdictionary"
 #define KEY_ENABLE_STREAMING "enable_streaming"
+// fmp4: ms per fragment, 0 for a fragment per GOP
+#define KEY_FRAGMENT_DURATION "fragment_duration"
+// 0 to write an existing file without truncating it
+#define KEY_FILE_TRUNCATE "file_truncate"
+// Loop recording in path, by file_prefix: the oldest segments are deleted
+// to keep all segments within quota, and reserve bytes free on the disk.
+#define KEY_STORAGE_QUOTA "storage_quota"     // byte
+#define KEY_STORAGE_RESERVE "storage_reserve" // byte
+// Kept while not streaming and written first when streaming starts.
+#define KEY_PRE_RECORD_TIME "pre_record_time" // second
+#define KEY_PRE_RECORD_SIZE "pre_record_size" // byte
 
 // drm
 #define KEY_CONNECTOR_ID "connector_id"
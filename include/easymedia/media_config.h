@@ -85,6 +85,14 @@ typedef struct {
   uint32_t inverse;
   uint32_t region_id; // max = 8.
   uint8_t enable;
+  // Dirty rectangle inside the region, 16 aligned and relative to pos_x/y.
+  // If dirty_w or dirty_h is 0, the whole region is updated. Otherwise only
+  // the dirty rectangle of 'buffer' is patched into the existing region,
+  // which must already be enabled with the same geometry.
+  uint32_t dirty_x;
+  uint32_t dirty_y;
+  uint32_t dirty_w;
+  uint32_t dirty_h;
 } OsdRegionData;
 
 typedef struct {
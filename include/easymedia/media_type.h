@@ -97,6 +97,8 @@ enum class Type { None = -1, Audio = 0, Image, Video, Text };
 #define MUXER_AVI "avi"
 #define MUXER_MPEG_TS "mpegts"
 #define MUXER_MPEG_PS "mpeg"
+// fragmented mp4 of the native muxer, not ffmpeg
+#define MUXER_FMP4 "fmp4"
 
 typedef enum {
   CODEC_TYPE_NONE = -1,
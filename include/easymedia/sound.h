@@ -80,6 +80,12 @@ typedef struct rkVQE_CONFIG_S {
   };
 } VQE_CONFIG_S;
 
+typedef struct rkVQE_QUEUE_STATE_S {
+  uint32_t u32InBytes;   /* waiting for a whole frame of the algorithm */
+  uint32_t u32OutBytes;  /* processed, not read yet */
+  uint32_t u32QueueSize; /* bytes each queue holds */
+} VQE_QUEUE_STATE_S;
+
 #ifdef __cplusplus
 }
 #endif
@@ -46,6 +46,12 @@ typedef struct rkAI_RECORDVQE_CONFIG_S {
   } stAnrConfig;
 } AI_RECORDVQE_CONFIG_S;
 
+typedef struct rkAI_VQE_STATE_S {
+  RK_U32 u32InQueueBytes;  /* waiting for a whole vqe frame */
+  RK_U32 u32OutQueueBytes; /* processed, not read yet */
+  RK_U32 u32QueueSize;     /* bytes each queue holds */
+} AI_VQE_STATE_S;
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,12 @@ typedef struct rkAO_CHN_STATE_S {
   RK_U32 u32ChnBusyNum;
 } AO_CHN_STATE_S;
 
+typedef struct rkAO_VQE_STATE_S {
+  RK_U32 u32InQueueBytes;  /* waiting for a whole vqe frame */
+  RK_U32 u32OutQueueBytes; /* processed, not read yet */
+  RK_U32 u32QueueSize;     /* bytes each queue holds */
+} AO_VQE_STATE_S;
+
 #ifdef __cplusplus
 }
 #endif
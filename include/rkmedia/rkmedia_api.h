@@ -51,6 +51,14 @@ typedef struct rkMPP_CHN_S {
   RK_S32 s32ChnId;
 } MPP_CHN_S;
 
+// Statistics of the queue behind RK_MPI_SYS_GetMediaBuffer.
+typedef struct rkMB_QUEUE_STAT_S {
+  RK_U32 u32Depth;   // Max buffers kept, the oldest one is dropped beyond.
+  RK_U32 u32Queued;  // Buffers waiting to be got.
+  RK_U32 u32Pushed;  // Buffers queued since the channel was enabled.
+  RK_U32 u32Dropped; // Buffers dropped since the channel was enabled.
+} MB_QUEUE_STAT_S;
+
 /********************************************************************
  * SYS Ctrl api
  ********************************************************************/
@@ -69,6 +77,25 @@ _CAPI RK_S32 RK_MPI_SYS_SendMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
                                         MEDIA_BUFFER buffer);
 _CAPI MEDIA_BUFFER RK_MPI_SYS_GetMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
                                              RK_S32 s32MilliSec);
+// Get up to u32Count buffers with one wait: blocks like
+// RK_MPI_SYS_GetMediaBuffer until the first one is ready, then takes the
+// other queued ones without sleeping. Returns the number of buffers stored
+// in pMbs (0 on timeout), or a negative error code. Release them with
+// RK_MPI_MB_ReleaseBuffers. At most the queue depth is ever queued, see
+// RK_MPI_SYS_SetMediaBufferDepth.
+_CAPI RK_S32 RK_MPI_SYS_GetMediaBuffers(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                        MEDIA_BUFFER *pMbs, RK_U32 u32Count,
+                                        RK_S32 s32MilliSec);
+// Depth of the channel queue, default 3. Takes effect immediately.
+_CAPI RK_S32 RK_MPI_SYS_SetMediaBufferDepth(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                            RK_S32 s32Depth);
+_CAPI RK_S32 RK_MPI_SYS_GetMediaBufferStat(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                           MB_QUEUE_STAT_S *pstStat);
+// Readable once buffers are queued, for poll()/select(). It is cleared
+// when RK_MPI_SYS_GetMediaBuffer(s) finds the queue empty, so it may still
+// be readable after the last buffer is got: then a get returns none, or
+// waits. Do not read it.
+_CAPI RK_S32 RK_MPI_SYS_GetMediaBufferFd(MOD_ID_E enModID, RK_S32 s32ChnID);
 
 /********************************************************************
  * Vi api
@@ -163,6 +190,7 @@ _CAPI RK_S32 RK_MPI_AI_GetRecordVqeAttr(AI_CHN AiChn,
 _CAPI RK_S32 RK_MPI_AI_EnableVqe(AI_CHN AiChn);
 _CAPI RK_S32 RK_MPI_AI_StartStream(AI_CHN AiChn);
 _CAPI RK_S32 RK_MPI_AI_DisableVqe(AI_CHN AiChn);
+_CAPI RK_S32 RK_MPI_AI_QueryVqeStat(AI_CHN AiChn, AI_VQE_STATE_S *pstStatus);
 
 /********************************************************************
  * Ao api
@@ -177,6 +205,7 @@ _CAPI RK_S32 RK_MPI_AO_GetVqeAttr(AO_CHN AoChn, AO_VQE_CONFIG_S *pstVqeConfig);
 _CAPI RK_S32 RK_MPI_AO_EnableVqe(AO_CHN AoChn);
 _CAPI RK_S32 RK_MPI_AO_DisableVqe(AO_CHN AoChn);
 _CAPI RK_S32 RK_MPI_AO_QueryChnStat(AO_CHN AoChn, AO_CHN_STATE_S *pstStatus);
+_CAPI RK_S32 RK_MPI_AO_QueryVqeStat(AO_CHN AoChn, AO_VQE_STATE_S *pstStatus);
 _CAPI RK_S32 RK_MPI_AO_ClearChnBuf(AO_CHN AoChn);
 
 /********************************************************************
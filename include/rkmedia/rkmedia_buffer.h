@@ -49,6 +49,8 @@ _CAPI MOD_ID_E RK_MPI_MB_GetModeID(MEDIA_BUFFER mb);
 _CAPI RK_S16 RK_MPI_MB_GetChannelID(MEDIA_BUFFER mb);
 _CAPI RK_U64 RK_MPI_MB_GetTimestamp(MEDIA_BUFFER mb);
 _CAPI RK_S32 RK_MPI_MB_ReleaseBuffer(MEDIA_BUFFER mb);
+// Release the buffers got by RK_MPI_SYS_GetMediaBuffers in one call.
+_CAPI RK_S32 RK_MPI_MB_ReleaseBuffers(MEDIA_BUFFER *pMbs, RK_U32 u32Count);
 _CAPI MEDIA_BUFFER RK_MPI_MB_CreateBuffer(RK_U32 u32Size, RK_BOOL boolHardWare,
                                           RK_U8 u8Flag);
 _CAPI MEDIA_BUFFER RK_MPI_MB_ConvertToImgBuffer(MEDIA_BUFFER mb,
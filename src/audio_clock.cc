@@ -0,0 +1,84 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "audio_clock.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace easymedia {
+
+// The loop starts wide to lock in a few seconds, then narrows so that the
+// jitter of the observations is averaged over about a minute.
+static const double kStartBandwidth = 1.0; // Hz
+static const double kLockBandwidth = 0.005;
+// An observation further off is a discontinuity, not noise.
+static const double kResyncUs = 50000;
+// Crystals are within 100 ppm, beyond is a broken observation.
+static const double kMaxDrift = 2000e-6;
+
+AudioClock::AudioClock()
+    : sample_rate(0), nominal(0), period(0), base_pos(0), base_time(0),
+      updates(0), resyncs(0), resync(false) {}
+
+void AudioClock::Reset(int rate) {
+  sample_rate = rate;
+  nominal = rate > 0 ? 1000000.0 / rate : 0;
+  period = nominal;
+  base_pos = 0;
+  base_time = 0;
+  updates = 0;
+  resyncs = 0;
+  resync = false;
+}
+
+void AudioClock::Update(uint64_t pos, int64_t time_us) {
+  if (sample_rate <= 0)
+    return;
+  if (updates == 0 || pos <= base_pos || resync) {
+    if (updates > 0)
+      resyncs++;
+    base_pos = pos;
+    base_time = time_us;
+    updates = std::max(updates, 1u);
+    resync = false;
+    return;
+  }
+  double frames = (double)(pos - base_pos);
+  double predicted = base_time + frames * period;
+  double error = time_us - predicted;
+  if (fabs(error) > kResyncUs) {
+    resyncs++;
+    base_pos = pos;
+    base_time = time_us;
+    return;
+  }
+  // omega of the interval since the last update, b and c of the classic
+  // critically damped loop.
+  double bandwidth =
+      std::max(kLockBandwidth, kStartBandwidth / (1 + updates / 50.0));
+  double omega =
+      std::min(2 * M_PI * bandwidth * frames * period / 1000000.0, 0.5);
+  base_time = predicted + M_SQRT2 * omega * error;
+  period += omega * omega * error / frames;
+  period = std::min(std::max(period, nominal * (1 - kMaxDrift)),
+                    nominal * (1 + kMaxDrift));
+  base_pos = pos;
+  updates++;
+}
+
+int64_t AudioClock::TimeOf(uint64_t pos) const {
+  double frames = pos >= base_pos ? (double)(pos - base_pos)
+                                  : -(double)(base_pos - pos);
+  return (int64_t)llround(base_time + frames * period);
+}
+
+double AudioClock::GetDriftPPM() const {
+  if (period <= 0)
+    return 0;
+  return (nominal / period - 1) * 1e6;
+}
+
+} // namespace easymedia
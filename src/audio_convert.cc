@@ -0,0 +1,414 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "audio_convert.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_SSE2 1
+#endif
+
+namespace easymedia {
+
+static const float kS16Scale = 32768.0f;
+static const float kS32Scale = 2147483648.0f;
+// The largest float below 2^31, which still converts to an int32.
+static const float kS32Max = 2147483520.0f;
+static const int kMaxChannels = 32;
+
+static inline int16_t RoundToS16(float x) {
+  x = std::min(std::max(x, -32768.0f), 32767.0f);
+  return (int16_t)lrintf(x);
+}
+
+static inline int32_t RoundToS32(float x) {
+  x = std::min(std::max(x, -kS32Scale), kS32Max);
+  return (int32_t)lrintf(x);
+}
+
+#if AUDIO_NEON
+static inline int32x4_t RoundToS32x4(float32x4_t x) {
+#if defined(__aarch64__)
+  return vcvtnq_s32_f32(x);
+#else
+  // vcvt truncates: round half away from zero.
+  uint32x4_t sign =
+      vandq_u32(vreinterpretq_u32_f32(x), vdupq_n_u32(0x80000000));
+  float32x4_t half = vreinterpretq_f32_u32(
+      vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)), sign));
+  return vcvtq_s32_f32(vaddq_f32(x, half));
+#endif
+}
+
+static inline int16x8_t ScaleS16x8(int16x8_t v, float32x4_t gain) {
+  float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+  float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+  int32x4_t a = RoundToS32x4(vmulq_f32(lo, gain));
+  int32x4_t b = RoundToS32x4(vmulq_f32(hi, gain));
+  return vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+}
+#elif AUDIO_SSE2
+static inline __m128i ScaleS16x8(__m128i v, __m128 gain) {
+  __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+  __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+  __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), gain));
+  __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), gain));
+  return _mm_packs_epi32(a, b);
+}
+#endif
+
+void AudioS16ToFloat(const int16_t *in, float *out, size_t n) {
+  const float scale = 1.0f / kS16Scale;
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(in + i);
+    vst1q_f32(out + i,
+              vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+    vst1q_f32(out + i + 4,
+              vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+  }
+#elif AUDIO_SSE2
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = in[i] * scale;
+}
+
+void AudioFloatToS16(const float *in, int16_t *out, size_t n) {
+  size_t i = 0;
+#if AUDIO_NEON
+  // Clamped in float, the saturation of vqmovn is not enough above 2^31.
+  const float32x4_t min = vdupq_n_f32(-32768.0f);
+  const float32x4_t max = vdupq_n_f32(32767.0f);
+  for (; i + 8 <= n; i += 8) {
+    float32x4_t a = vmulq_n_f32(vld1q_f32(in + i), kS16Scale);
+    float32x4_t b = vmulq_n_f32(vld1q_f32(in + i + 4), kS16Scale);
+    a = vminq_f32(vmaxq_f32(a, min), max);
+    b = vminq_f32(vmaxq_f32(b, min), max);
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(RoundToS32x4(a)),
+                                    vqmovn_s32(RoundToS32x4(b))));
+  }
+#elif AUDIO_SSE2
+  const __m128 s = _mm_set1_ps(kS16Scale);
+  const __m128 min = _mm_set1_ps(-32768.0f);
+  const __m128 max = _mm_set1_ps(32767.0f);
+  for (; i + 8 <= n; i += 8) {
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), s);
+    __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), s);
+    a = _mm_min_ps(_mm_max_ps(a, min), max);
+    b = _mm_min_ps(_mm_max_ps(b, min), max);
+    _mm_storeu_si128((__m128i *)(out + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = RoundToS16(in[i] * kS16Scale);
+}
+
+void AudioS16ToS32(const int16_t *in, int32_t *out, size_t n) {
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(in + i);
+    vst1q_s32(out + i, vshll_n_s16(vget_low_s16(v), 16));
+    vst1q_s32(out + i + 4, vshll_n_s16(vget_high_s16(v), 16));
+  }
+#elif AUDIO_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(zero, v));
+    _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(zero, v));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = (int32_t)((uint32_t)(uint16_t)in[i] << 16);
+}
+
+void AudioS32ToS16(const int32_t *in, int16_t *out, size_t n) {
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 8 <= n; i += 8)
+    vst1q_s16(out + i, vcombine_s16(vqrshrn_n_s32(vld1q_s32(in + i), 16),
+                                    vqrshrn_n_s32(vld1q_s32(in + i + 4), 16)));
+#elif AUDIO_SSE2
+  // (x >> 15 + 1) >> 1 rounds without overflowing near INT32_MAX.
+  const __m128i one = _mm_set1_epi32(1);
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(in + i + 4));
+    a = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(a, 15), one), 1);
+    b = _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(b, 15), one), 1);
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = (int16_t)std::min(((in[i] >> 15) + 1) >> 1, 32767);
+}
+
+void AudioS32ToFloat(const int32_t *in, float *out, size_t n) {
+  const float scale = 1.0f / kS32Scale;
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 4 <= n; i += 4)
+    vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + i)), scale));
+#elif AUDIO_SSE2
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), s));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = in[i] * scale;
+}
+
+void AudioFloatToS32(const float *in, int32_t *out, size_t n) {
+  size_t i = 0;
+#if AUDIO_NEON
+  const float32x4_t min = vdupq_n_f32(-kS32Scale);
+  const float32x4_t max = vdupq_n_f32(kS32Max);
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vmulq_n_f32(vld1q_f32(in + i), kS32Scale);
+    vst1q_s32(out + i, RoundToS32x4(vminq_f32(vmaxq_f32(v, min), max)));
+  }
+#elif AUDIO_SSE2
+  const __m128 s = _mm_set1_ps(kS32Scale);
+  const __m128 min = _mm_set1_ps(-kS32Scale);
+  const __m128 max = _mm_set1_ps(kS32Max);
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), s);
+    v = _mm_min_ps(_mm_max_ps(v, min), max);
+    _mm_storeu_si128((__m128i *)(out + i), _mm_cvtps_epi32(v));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = RoundToS32(in[i] * kS32Scale);
+}
+
+void AudioGainS16(int16_t *buf, size_t n, float gain) {
+  size_t i = 0;
+#if AUDIO_NEON
+  const float32x4_t g = vdupq_n_f32(gain);
+  for (; i + 8 <= n; i += 8)
+    vst1q_s16(buf + i, ScaleS16x8(vld1q_s16(buf + i), g));
+#elif AUDIO_SSE2
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    _mm_storeu_si128((__m128i *)(buf + i), ScaleS16x8(v, g));
+  }
+#endif
+  for (; i < n; i++)
+    buf[i] = RoundToS16(buf[i] * gain);
+}
+
+void AudioGainFloat(float *buf, size_t n, float gain) {
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 4 <= n; i += 4)
+    vst1q_f32(buf + i, vmulq_n_f32(vld1q_f32(buf + i), gain));
+#elif AUDIO_SSE2
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+#endif
+  for (; i < n; i++)
+    buf[i] *= gain;
+}
+
+// Channel ch of stereo frames.
+static void ExtractStereoS16(const int16_t *in, int16_t *out, int ch,
+                             size_t frames) {
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 8 <= frames; i += 8) {
+    int16x8x2_t v = vld2q_s16(in + 2 * i);
+    vst1q_s16(out + i, v.val[ch]);
+  }
+#elif AUDIO_SSE2
+  for (; i + 8 <= frames; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+    if (ch == 0) {
+      a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+      b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    } else {
+      a = _mm_srai_epi32(a, 16);
+      b = _mm_srai_epi32(b, 16);
+    }
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+  }
+#endif
+  for (; i < frames; i++)
+    out[i] = in[2 * i + ch];
+}
+
+static void InterleaveStereoS16(const int16_t *l, const int16_t *r,
+                                int16_t *out, size_t frames) {
+  size_t i = 0;
+#if AUDIO_NEON
+  for (; i + 8 <= frames; i += 8) {
+    int16x8x2_t v;
+    v.val[0] = vld1q_s16(l + i);
+    v.val[1] = vld1q_s16(r + i);
+    vst2q_s16(out + 2 * i, v);
+  }
+#elif AUDIO_SSE2
+  for (; i + 8 <= frames; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(l + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(r + i));
+    _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(a, b));
+    _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+  }
+#endif
+  for (; i < frames; i++) {
+    out[2 * i] = l[i];
+    out[2 * i + 1] = r[i];
+  }
+}
+
+void AudioDeinterleaveS16(const int16_t *in, int16_t *const *out,
+                          int channels, size_t frames) {
+  if (channels == 2) {
+    ExtractStereoS16(in, out[0], 0, frames);
+    ExtractStereoS16(in, out[1], 1, frames);
+    return;
+  }
+  for (size_t i = 0; i < frames; i++)
+    for (int c = 0; c < channels; c++)
+      out[c][i] = *in++;
+}
+
+void AudioInterleaveS16(const int16_t *const *in, int16_t *out, int channels,
+                        size_t frames) {
+  if (channels == 2) {
+    InterleaveStereoS16(in[0], in[1], out, frames);
+    return;
+  }
+  for (size_t i = 0; i < frames; i++)
+    for (int c = 0; c < channels; c++)
+      *out++ = in[c][i];
+}
+
+void AudioRemapS16(const int16_t *in, int in_channels, int16_t *out,
+                   const int *map, int out_channels, size_t frames) {
+  if (in_channels == 2 && out_channels == 1 && map[0] >= 0) {
+    ExtractStereoS16(in, out, map[0], frames);
+    return;
+  }
+  if (in_channels == 1 && out_channels == 2 && map[0] == 0 && map[1] == 0) {
+    InterleaveStereoS16(in, in, out, frames);
+    return;
+  }
+  int16_t frame[kMaxChannels];
+  out_channels = std::min(out_channels, kMaxChannels);
+  for (size_t i = 0; i < frames; i++) {
+    // Read the whole frame first, out may overwrite it.
+    for (int j = 0; j < out_channels; j++)
+      frame[j] = map[j] >= 0 ? in[map[j]] : 0;
+    memcpy(out, frame, out_channels * sizeof(int16_t));
+    in += in_channels;
+    out += out_channels;
+  }
+}
+
+enum SampleType { kTypeNone, kTypeS16, kTypeS32, kTypeFloat };
+
+static SampleType GetSampleType(SampleFormat fmt, bool &planar) {
+  planar = false;
+  switch (fmt) {
+  case SAMPLE_FMT_S16P:
+    planar = true; // fall through
+  case SAMPLE_FMT_S16:
+    return kTypeS16;
+  case SAMPLE_FMT_S32P:
+    planar = true; // fall through
+  case SAMPLE_FMT_S32:
+    return kTypeS32;
+  case SAMPLE_FMT_FLTP:
+    planar = true; // fall through
+  case SAMPLE_FMT_FLT:
+    return kTypeFloat;
+  default:
+    return kTypeNone;
+  }
+}
+
+template <typename T>
+static void ChangeLayout(const T *in, T *out, bool to_planar, int channels,
+                         size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    for (int c = 0; c < channels; c++) {
+      if (to_planar)
+        out[c * frames + i] = in[i * channels + c];
+      else
+        out[i * channels + c] = in[c * frames + i];
+    }
+  }
+}
+
+bool AudioConvert(SampleFormat in_fmt, const void *in, SampleFormat out_fmt,
+                  void *out, int channels, size_t frames) {
+  bool in_planar, out_planar;
+  SampleType in_type = GetSampleType(in_fmt, in_planar);
+  SampleType out_type = GetSampleType(out_fmt, out_planar);
+  if (in_type == kTypeNone || out_type == kTypeNone || channels <= 0 ||
+      channels > kMaxChannels)
+    return false;
+  size_t n = frames * channels;
+  size_t size = in_type == kTypeS16 ? 2 : 4;
+  if (in_planar != out_planar && channels > 1) {
+    if (in_type != out_type)
+      return false;
+    if (in_type == kTypeS16) {
+      int16_t *planes[kMaxChannels];
+      for (int c = 0; c < channels; c++)
+        planes[c] = (int16_t *)(in_planar ? in : out) + c * frames;
+      if (out_planar)
+        AudioDeinterleaveS16((const int16_t *)in, planes, channels, frames);
+      else
+        AudioInterleaveS16(planes, (int16_t *)out, channels, frames);
+    } else {
+      ChangeLayout((const uint32_t *)in, (uint32_t *)out, out_planar,
+                   channels, frames);
+    }
+    return true;
+  }
+  if (in_type == out_type) {
+    memcpy(out, in, n * size);
+    return true;
+  }
+  if (in_type == kTypeS16 && out_type == kTypeFloat)
+    AudioS16ToFloat((const int16_t *)in, (float *)out, n);
+  else if (in_type == kTypeFloat && out_type == kTypeS16)
+    AudioFloatToS16((const float *)in, (int16_t *)out, n);
+  else if (in_type == kTypeS16 && out_type == kTypeS32)
+    AudioS16ToS32((const int16_t *)in, (int32_t *)out, n);
+  else if (in_type == kTypeS32 && out_type == kTypeS16)
+    AudioS32ToS16((const int32_t *)in, (int16_t *)out, n);
+  else if (in_type == kTypeS32 && out_type == kTypeFloat)
+    AudioS32ToFloat((const int32_t *)in, (float *)out, n);
+  else
+    AudioFloatToS32((const float *)in, (int32_t *)out, n);
+  return true;
+}
+
+} // namespace easymedia
@@ -11,6 +11,9 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <mutex>
+#include <set>
+
 #include "key_string.h"
 #include "utils.h"
 
@@ -489,6 +492,16 @@ MediaGroupBuffer *MediaGroupBuffer::Alloc(size_t size,
   }
 }
 
+// The group buffers of all the pools, for GetOwner().
+static std::mutex pooled_mtx;
+static std::set<void *> pooled_groups;
+
+static void UnlistGroups(const std::list<MediaGroupBuffer *> &mgbs) {
+  std::lock_guard<std::mutex> lck(pooled_mtx);
+  for (auto mgb : mgbs)
+    pooled_groups.erase(mgb);
+}
+
 BufferPool::BufferPool(int cnt, int size, MediaBuffer::MemType type) {
   bool sucess = true;
 
@@ -504,12 +517,18 @@ BufferPool::BufferPool(int cnt, int size, MediaBuffer::MemType type) {
       break;
     }
     mgb->SetBufferPool(this);
+    mgb->token.reset(mgb, [](void *) {});
+    {
+      std::lock_guard<std::mutex> lck(pooled_mtx);
+      pooled_groups.insert(mgb);
+    }
     LOGD("Create: pool:%p, mgb:%p, ptr:%p, fd:%d, size:%zu\n", this, mgb,
          mgb->GetPtr(), mgb->GetFD(), mgb->GetSize());
     ready_buffers.push_back(mgb);
   }
 
   if (!sucess) {
+    UnlistGroups(ready_buffers);
     while (ready_buffers.size() > 0)
       ready_buffers.pop_front();
     LOG("ERROR: BufferPool: Create buffer pool failed! Please check space is "
@@ -533,6 +552,8 @@ BufferPool::~BufferPool() {
     easymedia::usleep(30000); // wait 30ms
   }
 
+  UnlistGroups(ready_buffers);
+  UnlistGroups(busy_buffers);
   MediaGroupBuffer *mgb = NULL;
   while (ready_buffers.size() > 0) {
     mgb = ready_buffers.front();
@@ -570,6 +591,13 @@ static int __groupe_buffer_free(void *data) {
   return bp->PutBuffer(mgb);
 }
 
+// The userdata of the buffers of GetBuffer(): gives the group buffer back
+// once they are all dropped, and keeps its token until then.
+struct BufferPoolLease {
+  std::shared_ptr<void> token;
+  void operator()(void *mgb) { __groupe_buffer_free(mgb); }
+};
+
 std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(bool block) {
   AutoLockMutex _alm(mtx);
 
@@ -589,11 +617,24 @@ std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(bool block) {
   ready_buffers.pop_front();
   busy_buffers.push_back(mgb);
 
-  auto &&mb = std::make_shared<MediaBuffer>(
-      mgb->GetPtr(), mgb->GetSize(), mgb->GetFD(), mgb, __groupe_buffer_free);
+  auto &&mb = std::make_shared<MediaBuffer>(mgb->GetPtr(), mgb->GetSize(),
+                                            mgb->GetFD());
+  // Points at mgb, as the token does, for GetOwner().
+  mb->SetUserData(std::shared_ptr<void>(mgb->token.get(),
+                                        BufferPoolLease{mgb->token}));
   return mb;
 }
 
+std::shared_ptr<void> BufferPool::GetOwner(MediaBuffer &mb) {
+  // The userdata of a pooled buffer points at its group buffer, which is
+  // listed until its pool is destroyed.
+  void *mgb = mb.GetUserData().get();
+  std::lock_guard<std::mutex> lck(pooled_mtx);
+  if (!mgb || !pooled_groups.count(mgb))
+    return nullptr;
+  return ((MediaGroupBuffer *)mgb)->token;
+}
+
 int BufferPool::PutBuffer(MediaGroupBuffer *mgb) {
   std::list<MediaGroupBuffer *>::iterator it;
   bool sucess = false;
@@ -616,6 +657,57 @@ int BufferPool::PutBuffer(MediaGroupBuffer *mgb) {
   return sucess ? 0 : -1;
 }
 
+SampleBufferPool::SampleBufferPool(size_t num)
+    : max_buffers(num), next(0), misses(0) {}
+
+int SampleBufferPool::Reserve(int num, size_t size) {
+  int i;
+  for (i = 0; i < num && slots.size() < max_buffers; i++) {
+    MediaBuffer mb = MediaBuffer::Alloc2(size);
+    if (!mb.GetPtr())
+      break;
+    slots.push_back({mb, std::make_shared<SampleBuffer>(mb)});
+  }
+  return i;
+}
+
+std::shared_ptr<SampleBuffer>
+SampleBufferPool::Get(size_t size, const SampleInfo &info) {
+  Slot *small = nullptr;
+  for (size_t i = 0; i < slots.size(); i++) {
+    Slot &slot = slots[(next + i) % slots.size()];
+    if (slot.buffer.use_count() != 1)
+      continue;
+    // The consumers' last writes are seen before the buffer is reused.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.mb.GetSize() < size) {
+      small = &slot;
+      continue;
+    }
+    next = (next + i + 1) % slots.size();
+    // Fresh, without what the consumers set.
+    *slot.buffer = SampleBuffer(slot.mb, info);
+    slot.buffer->SetSize(size);
+    return slot.buffer;
+  }
+  misses++;
+  MediaBuffer mb = MediaBuffer::Alloc2(size);
+  if (!mb.GetPtr())
+    return nullptr;
+  auto buffer = std::make_shared<SampleBuffer>(mb, info);
+  // Those of a former format make room for the new size.
+  if (small)
+    *small = {mb, buffer};
+  else if (slots.size() < max_buffers)
+    slots.push_back({mb, buffer});
+  return buffer;
+}
+
+void SampleBufferPool::Clear() {
+  slots.clear();
+  next = 0;
+}
+
 void BufferPool::DumpInfo() {
   int id = 0;
   LOG("##BufferPool DumpInfo:%p\n", this);
@@ -6,8 +6,12 @@
 #include <condition_variable>
 #include <fcntl.h>
 #include <mutex>
+#include <poll.h>
 #include <string>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
+#include <vector>
 
 #include "encoder.h"
 #include "image.h"
@@ -23,6 +27,7 @@
 #include "rkmedia_api.h"
 #include "rkmedia_buffer.h"
 #include "rkmedia_buffer_impl.h"
+#include "rkmedia_buffer_queue.h"
 #include "rkmedia_utils.h"
 
 using namespace easymedia;
@@ -56,6 +61,19 @@ typedef struct _RkmediaADECAttr { ADEC_CHN_ATTR_S attr; } RkmediaADECAttr;
 typedef ALGO_MD_ATTR_S RkmediaMDAttr;
 typedef ALGO_OD_ATTR_S RkmediaODAttr;
 
+// Last bitmap converted for an osd region. RK_MPI_VENC_RGN_SetBitMap diffs
+// the new bitmap against it per 16x16 tile, so that only changed tiles are
+// converted to palette ids and sent to the encoder.
+typedef struct _RkmediaOsdRgnCache {
+  bool valid;
+  OSD_REGION_INFO_S rgn_info;
+  RK_U32 bmp_width;
+  RK_U32 bmp_height;
+  std::vector<RK_U32> argb; // clipped bitmap, stride: clipped width
+  std::vector<RK_U8> ids;   // palette id canvas, stride: region width
+} RkmediaOsdRgnCache;
+
+// Default depth of the channel queue, see RK_MPI_SYS_SetMediaBufferDepth.
 #define RKMEDIA_CHNNAL_BUFFER_LIMIT 3
 #define RKMEDIA_CHNNAL_BUFFER_GOD_MODE_LIMIT 1
 
@@ -85,11 +103,20 @@ typedef struct _RkmediaChannel {
     RkmediaADECAttr adec_attr;
   };
   RK_U16 bind_ref;
-  std::mutex buffer_mtx;
-  std::condition_variable buffer_cond;
-  bool buffer_cond_quit;
-  int wake_fd[2];
-  std::list<MEDIA_BUFFER> buffer_list;
+  // Recycles the MEDIA_BUFFER handles of FlowOutputCallback.
+  MediaBufferImplPool mb_pool;
+  // Buffers for RK_MPI_SYS_GetMediaBuffer. buffer_fd is an eventfd, posted
+  // when the queue turns non-empty and drained by the consumer once it
+  // finds the queue empty: buffer_signaled is set while it is posted. The
+  // consumer sleeps on it and RK_MPI_SYS_GetMediaBufferFd exports it for
+  // poll().
+  MediaBufferQueue buffer_queue;
+  std::atomic<bool> buffer_signaled{false};
+  std::atomic<RK_U32> buffer_depth{RKMEDIA_CHNNAL_BUFFER_LIMIT};
+  std::atomic<RK_U32> buffer_pushed{0};
+  std::atomic<RK_U32> buffer_dropped{0};
+  std::atomic<bool> buffer_cond_quit{false};
+  int buffer_fd = -1;
 
   // used for venc osd.
   RK_BOOL bColorTblInit;
@@ -98,6 +125,8 @@ typedef struct _RkmediaChannel {
   RK_BOOL bColorDichotomyEnable;
   // 256 color table
   RK_U32 u32ArgbColorTbl[256];
+  std::mutex osd_rgn_mtx;
+  RkmediaOsdRgnCache osd_rgn_cache[OSD_REGIONS_CNT];
 
   // used for region luma.
   std::mutex luma_buf_mtx;
@@ -137,100 +166,148 @@ std::mutex g_adec_mtx;
 RkmediaChannel g_vo_chns[RGA_MAX_CHN_NUM];
 std::mutex g_vo_mtx;
 
-static inline void RkmediaPushPipFd(int fd) {
-  int i = 0;
-  ssize_t count = write(fd, &i, sizeof(i));
-  if (count < 0)
-    LOG("ERROR: %s: write(%d) failed: %s\n", __func__, fd, strerror(errno));
+static inline void RkmediaChnPostBuffer(RkmediaChannel *ptrChn) {
+  uint64_t val = 1;
+  if (write(ptrChn->buffer_fd, &val, sizeof(val)) != sizeof(val))
+    LOG("ERROR: %s: write(%d) failed: %s\n", __func__, ptrChn->buffer_fd,
+        strerror(errno));
 }
 
-static inline void RkmediaPopPipFd(int fd) {
-  int i = 0;
-  ssize_t read_size = (ssize_t)sizeof(i);
-  ssize_t ret = read(fd, &i, sizeof(i));
-  if (ret != read_size)
-    LOG("ERROR: %s: Read(%d) failed: %s\n", __func__, fd, strerror(errno));
+// Drain the eventfd without blocking, false if it was not posted.
+static inline bool RkmediaChnTakeBuffer(RkmediaChannel *ptrChn) {
+  uint64_t val = 0;
+  return read(ptrChn->buffer_fd, &val, sizeof(val)) == sizeof(val);
+}
+
+static inline RK_U32 RkmediaChnDepth(RkmediaChannel *ptrChn) {
+  if ((ptrChn->mode_id == RK_ID_VI) &&
+      (ptrChn->vi_attr.attr.enWorkMode == VI_WORK_MODE_GOD_MODE))
+    return RKMEDIA_CHNNAL_BUFFER_GOD_MODE_LIMIT;
+  return ptrChn->buffer_depth;
 }
 
 static int RkmediaChnPushBuffer(RkmediaChannel *ptrChn, MEDIA_BUFFER buffer) {
   if (!ptrChn || !buffer)
     return -1;
 
-  ptrChn->buffer_mtx.lock();
-  if ((ptrChn->mode_id == RK_ID_VI) &&
-      (ptrChn->vi_attr.attr.enWorkMode == VI_WORK_MODE_GOD_MODE) &&
-      (ptrChn->buffer_list.size() >= RKMEDIA_CHNNAL_BUFFER_GOD_MODE_LIMIT)) {
+  if (ptrChn->buffer_cond_quit || (ptrChn->buffer_fd < 0)) {
+    RK_MPI_MB_ReleaseBuffer(buffer);
+    return 0;
+  }
+
+  // Keep the newest buffers: drop the oldest ones the application has not
+  // got in time. Drops are counted, see RK_MPI_SYS_GetMediaBufferStat.
+  RK_U32 depth = RkmediaChnDepth(ptrChn);
+  MEDIA_BUFFER mb = NULL;
+  while (ptrChn->buffer_queue.Size() >= depth &&
+         ptrChn->buffer_queue.Pop(mb)) {
+    RK_MPI_MB_ReleaseBuffer(mb);
+    ptrChn->buffer_dropped++;
     LOGD("WARN: Mode[%d]:Chn[%d] drop buffer, Please get buffer in time!\n",
          ptrChn->mode_id, ptrChn->chn_id);
-    MEDIA_BUFFER mb = ptrChn->buffer_list.front();
-    ptrChn->buffer_list.pop_front();
-    RK_MPI_MB_ReleaseBuffer(mb);
-    if (ptrChn->wake_fd[0] > 0)
-      RkmediaPopPipFd(ptrChn->wake_fd[0]);
-  } else if (ptrChn->buffer_list.size() >= RKMEDIA_CHNNAL_BUFFER_LIMIT) {
-    LOG("WARN: Mode[%d]:Chn[%d] drop buffer, Please get buffer in time!\n",
-        ptrChn->mode_id, ptrChn->chn_id);
-    MEDIA_BUFFER mb = ptrChn->buffer_list.front();
-    ptrChn->buffer_list.pop_front();
-    RK_MPI_MB_ReleaseBuffer(mb);
-    if (ptrChn->wake_fd[0] > 0)
-      RkmediaPopPipFd(ptrChn->wake_fd[0]);
   }
-  if (!ptrChn->buffer_cond_quit) {
-    ptrChn->buffer_list.push_back(buffer);
-    if (ptrChn->wake_fd[1] > 0)
-      RkmediaPushPipFd(ptrChn->wake_fd[1]);
-  } else {
+
+  if (!ptrChn->buffer_queue.Push(buffer)) {
     RK_MPI_MB_ReleaseBuffer(buffer);
+    ptrChn->buffer_dropped++;
+    return 0;
   }
-
-  ptrChn->buffer_cond.notify_all();
-  ptrChn->buffer_mtx.unlock();
-  pthread_yield();
+  ptrChn->buffer_pushed++;
+  // Only the first buffer since the consumer drained the eventfd posts it.
+  if (!ptrChn->buffer_signaled.exchange(true))
+    RkmediaChnPostBuffer(ptrChn);
 
   return 0;
 }
 
+// Milliseconds of CLOCK_MONOTONIC, the timeouts must not follow the wall
+// clock when it is stepped.
+static int64_t RkmediaMonotonicMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static MEDIA_BUFFER RkmediaChnPopBuffer(RkmediaChannel *ptrChn,
                                         RK_S32 s32MilliSec) {
-  if (!ptrChn)
+  if (!ptrChn || (ptrChn->buffer_fd < 0))
     return NULL;
 
-  std::unique_lock<std::mutex> lck(ptrChn->buffer_mtx);
-  if (ptrChn->buffer_list.empty()) {
-    if (s32MilliSec < 0 && !ptrChn->buffer_cond_quit) {
-      ptrChn->buffer_cond.wait(lck);
+  int64_t deadline = RkmediaMonotonicMs() + s32MilliSec;
+  MEDIA_BUFFER mb = NULL;
+  while (!ptrChn->buffer_cond_quit) {
+    if (ptrChn->buffer_queue.Pop(mb))
+      return mb;
+    // Empty: drain the eventfd before sleeping on it, then look again for
+    // a buffer pushed meanwhile, whose producer saw it still posted.
+    bool signaled = ptrChn->buffer_signaled.exchange(false);
+    if (RkmediaChnTakeBuffer(ptrChn) || signaled)
+      continue;
+
+    int timeout = -1;
+    if (s32MilliSec == 0) {
+      return NULL;
     } else if (s32MilliSec > 0) {
-      if (ptrChn->buffer_cond.wait_for(
-              lck, std::chrono::milliseconds(s32MilliSec)) ==
-          std::cv_status::timeout) {
-        LOG("INFO: %s: Mode[%d]:Chn[%d] get mediabuffer timeout!\n", __func__,
-            ptrChn->mode_id, ptrChn->chn_id);
+      timeout = (int)(deadline - RkmediaMonotonicMs());
+      if (timeout <= 0) {
+        LOG("INFO: %s: Mode[%d]:Chn[%d] get mediabuffer timeout!\n",
+            __func__, ptrChn->mode_id, ptrChn->chn_id);
         return NULL;
       }
-    } else {
+    }
+
+    struct pollfd pfd = {ptrChn->buffer_fd, POLLIN, 0};
+    int ret = poll(&pfd, 1, timeout);
+    if (ret < 0 && errno != EINTR) {
+      LOG("ERROR: %s: poll(%d) failed: %s\n", __func__, ptrChn->buffer_fd,
+          strerror(errno));
       return NULL;
     }
   }
 
-  MEDIA_BUFFER mb = NULL;
-  if (!ptrChn->buffer_list.empty()) {
-    if (ptrChn->wake_fd[0] > 0)
-      RkmediaPopPipFd(ptrChn->wake_fd[0]);
-    mb = ptrChn->buffer_list.front();
-    ptrChn->buffer_list.pop_front();
-  }
+  return NULL;
+}
 
-  return mb;
+// Wait like RkmediaChnPopBuffer for the first buffer, then take the ones
+// already queued without sleeping again.
+static RK_S32 RkmediaChnPopBuffers(RkmediaChannel *ptrChn, MEDIA_BUFFER *mbs,
+                                   RK_U32 count, RK_S32 s32MilliSec) {
+  MEDIA_BUFFER mb = RkmediaChnPopBuffer(ptrChn, s32MilliSec);
+  if (!mb)
+    return 0;
+
+  RK_U32 got = 0;
+  mbs[got++] = mb;
+  while ((got < count) && !ptrChn->buffer_cond_quit &&
+         ptrChn->buffer_queue.Pop(mb))
+    mbs[got++] = mb;
+
+  return (RK_S32)got;
 }
 
 static void RkmediaChnInitBuffer(RkmediaChannel *ptrChn) {
   if (!ptrChn)
     return;
 
-  ptrChn->buffer_mtx.lock();
+  // The eventfd lives as long as the process, so that a fd handed to the
+  // application never dangles.
+  if (ptrChn->buffer_fd < 0) {
+    ptrChn->buffer_fd =
+        eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ptrChn->buffer_fd < 0)
+      LOG("ERROR: Mode[%d]:Chn[%d] create eventfd failed: %s\n",
+          ptrChn->mode_id, ptrChn->chn_id, strerror(errno));
+  }
+  // Flush the buffers and the post left by the last session.
+  MEDIA_BUFFER mb = NULL;
+  while (ptrChn->buffer_queue.Pop(mb))
+    RK_MPI_MB_ReleaseBuffer(mb);
+  ptrChn->buffer_signaled = false;
+  if (ptrChn->buffer_fd >= 0)
+    RkmediaChnTakeBuffer(ptrChn);
+  ptrChn->buffer_pushed = 0;
+  ptrChn->buffer_dropped = 0;
   ptrChn->buffer_cond_quit = false;
-  ptrChn->buffer_mtx.unlock();
 }
 
 static void RkmediaChnClearBuffer(RkmediaChannel *ptrChn) {
@@ -239,20 +316,27 @@ static void RkmediaChnClearBuffer(RkmediaChannel *ptrChn) {
 
   LOGD("#%p Mode[%d]:Chn[%d] clear media buffer start...\n", ptrChn,
        ptrChn->mode_id, ptrChn->chn_id);
+  ptrChn->buffer_cond_quit = true;
   MEDIA_BUFFER mb = NULL;
-  ptrChn->buffer_mtx.lock();
-  while (!ptrChn->buffer_list.empty()) {
-    mb = ptrChn->buffer_list.front();
-    ptrChn->buffer_list.pop_front();
+  while (ptrChn->buffer_queue.Pop(mb))
     RK_MPI_MB_ReleaseBuffer(mb);
-  }
-  ptrChn->buffer_cond_quit = true;
-  ptrChn->buffer_cond.notify_all();
-  ptrChn->buffer_mtx.unlock();
+  // Wake up the consumer blocked in RkmediaChnPopBuffer.
+  if (ptrChn->buffer_fd >= 0)
+    RkmediaChnPostBuffer(ptrChn);
   LOGD("#%p Mode[%d]:Chn[%d] clear media buffer end...\n", ptrChn,
        ptrChn->mode_id, ptrChn->chn_id);
 }
 
+// s32RgnId < 0 means all regions.
+static RK_VOID RkmediaOsdRgnCacheReset(RkmediaChannel *ptrChn,
+                                       RK_S32 s32RgnId) {
+  std::lock_guard<std::mutex> lck(ptrChn->osd_rgn_mtx);
+  for (RK_S32 i = 0; i < OSD_REGIONS_CNT; i++) {
+    if ((s32RgnId < 0) || (s32RgnId == i))
+      ptrChn->osd_rgn_cache[i].valid = false;
+  }
+}
+
 /********************************************************************
  * SYS Ctrl api
  ********************************************************************/
@@ -264,6 +348,7 @@ static void Reset_Channel_Table(RkmediaChannel *tbl, int cnt, MOD_ID_E mid) {
     tbl[i].cb = nullptr;
     tbl[i].event_cb = nullptr;
     tbl[i].bind_ref = 0;
+    tbl[i].buffer_depth = RKMEDIA_CHNNAL_BUFFER_LIMIT;
     tbl[i].bColorTblInit = RK_FALSE;
     tbl[i].bColorDichotomyEnable = RK_FALSE;
     memset(tbl[i].u32ArgbColorTbl, 0, 0);
@@ -309,7 +394,10 @@ RK_VOID RK_MPI_SYS_DumpChn(MOD_ID_E enModId) {
     LOG("  Chn[%d]->status:%d\n", i, pChns[i].status);
     LOG("  Chn[%d]->bind_ref:%d\n", i, pChns[i].bind_ref);
     LOG("  Chn[%d]->output_cb:%p\n", i, pChns[i].cb);
-    LOG("  Chn[%d]->event_cb:%p\n\n", i, pChns[i].event_cb);
+    LOG("  Chn[%d]->event_cb:%p\n", i, pChns[i].event_cb);
+    LOG("  Chn[%d]->buffer:%u/%u, pushed:%u, dropped:%u\n\n", i,
+        (RK_U32)pChns[i].buffer_queue.Size(), RkmediaChnDepth(&pChns[i]),
+        (RK_U32)pChns[i].buffer_pushed, (RK_U32)pChns[i].buffer_dropped);
   }
 }
 
@@ -619,7 +707,7 @@ FlowOutputCallback(void *handle,
       return;
   }
 
-  MEDIA_BUFFER_IMPLE *mb = new MEDIA_BUFFER_IMPLE;
+  MEDIA_BUFFER_IMPLE *mb = target_chn->mb_pool.Get();
   if (!mb) {
     LOG("ERROR: %s mode[%d]:chn[%d] no space left for new mb!\n", __func__,
         target_chn->mode_id, target_chn->chn_id);
@@ -649,8 +737,8 @@ FlowOutputCallback(void *handle,
     mb->stImageInfo.u32Height = rkmedia_ib->GetHeight();
     mb->stImageInfo.u32HorStride = rkmedia_ib->GetVirWidth();
     mb->stImageInfo.u32VerStride = rkmedia_ib->GetVirHeight();
-    std::string strPixFmt = PixFmtToString(rkmedia_ib->GetPixelFormat());
-    mb->stImageInfo.enImgType = StringToImageType(strPixFmt);
+    mb->stImageInfo.enImgType =
+        PixFmtToImageType(rkmedia_ib->GetPixelFormat());
   }
   // RK_MPI_SYS_GetMediaBuffer and output callback function,
   // can only choose one.
@@ -806,58 +894,56 @@ RK_S32 RK_MPI_SYS_RegisterEventCb(const MPP_CHN_S *pstChn, EventCbFunc cb) {
   return RK_ERR_SYS_OK;
 }
 
-MEDIA_BUFFER RK_MPI_SYS_GetMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
-                                       RK_S32 s32MilliSec) {
-  RkmediaChannel *target_chn = NULL;
+// Channels that output buffers to the application.
+static RkmediaChannel *RkmediaGetOutputChn(MOD_ID_E enModID, RK_S32 s32ChnID) {
+  RkmediaChannel *pChns = NULL;
+  RK_S32 s32ChnCnt = 0;
 
   switch (enModID) {
   case RK_ID_VI:
-    if (s32ChnID < 0 || s32ChnID >= VI_MAX_CHN_NUM) {
-      LOG("ERROR: %s invalid VI ChnID[%d]\n", __func__, s32ChnID);
-      return NULL;
-    }
-    target_chn = &g_vi_chns[s32ChnID];
+    pChns = g_vi_chns;
+    s32ChnCnt = VI_MAX_CHN_NUM;
     break;
   case RK_ID_VENC:
-    if (s32ChnID < 0 || s32ChnID >= VENC_MAX_CHN_NUM) {
-      LOG("ERROR: %s invalid AENC ChnID[%d]\n", __func__, s32ChnID);
-      return NULL;
-    }
-    target_chn = &g_venc_chns[s32ChnID];
+    pChns = g_venc_chns;
+    s32ChnCnt = VENC_MAX_CHN_NUM;
     break;
   case RK_ID_AI:
-    if (s32ChnID < 0 || s32ChnID >= AI_MAX_CHN_NUM) {
-      LOG("ERROR: %s invalid AI ChnID[%d]\n", __func__, s32ChnID);
-      return NULL;
-    }
-    target_chn = &g_ai_chns[s32ChnID];
+    pChns = g_ai_chns;
+    s32ChnCnt = AI_MAX_CHN_NUM;
     break;
   case RK_ID_AENC:
-    if (s32ChnID < 0 || s32ChnID > AENC_MAX_CHN_NUM) {
-      LOG("ERROR: %s invalid AENC ChnID[%d]\n", __func__, s32ChnID);
-      return NULL;
-    }
-    target_chn = &g_aenc_chns[s32ChnID];
+    pChns = g_aenc_chns;
+    s32ChnCnt = AENC_MAX_CHN_NUM;
     break;
   case RK_ID_RGA:
-    if (s32ChnID < 0 || s32ChnID > RGA_MAX_CHN_NUM) {
-      LOG("ERROR: %s invalid RGA ChnID[%d]\n", __func__, s32ChnID);
-      return NULL;
-    }
-    target_chn = &g_rga_chns[s32ChnID];
+    pChns = g_rga_chns;
+    s32ChnCnt = RGA_MAX_CHN_NUM;
     break;
   case RK_ID_ADEC:
-    if (s32ChnID < 0 || s32ChnID > ADEC_MAX_CHN_NUM) {
-      LOG("ERROR: %s invalid RGA ChnID[%d]\n", __func__, s32ChnID);
-      return NULL;
-    }
-    target_chn = &g_adec_chns[s32ChnID];
+    pChns = g_adec_chns;
+    s32ChnCnt = ADEC_MAX_CHN_NUM;
     break;
   default:
     LOG("ERROR: %s invalid modeID[%d]\n", __func__, enModID);
     return NULL;
   }
 
+  if (s32ChnID < 0 || s32ChnID >= s32ChnCnt) {
+    LOG("ERROR: %s invalid Mode[%d]:ChnID[%d]\n", __func__, enModID,
+        s32ChnID);
+    return NULL;
+  }
+
+  return &pChns[s32ChnID];
+}
+
+MEDIA_BUFFER RK_MPI_SYS_GetMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                       RK_S32 s32MilliSec) {
+  RkmediaChannel *target_chn = RkmediaGetOutputChn(enModID, s32ChnID);
+  if (!target_chn)
+    return NULL;
+
   if (target_chn->status < CHN_STATUS_OPEN) {
     LOG("ERROR: %s Mode[%d]:Chn[%d] in status[%d], "
         "this operation is not allowed!\n",
@@ -868,6 +954,70 @@ MEDIA_BUFFER RK_MPI_SYS_GetMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
   return RkmediaChnPopBuffer(target_chn, s32MilliSec);
 }
 
+RK_S32 RK_MPI_SYS_GetMediaBuffers(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                  MEDIA_BUFFER *pMbs, RK_U32 u32Count,
+                                  RK_S32 s32MilliSec) {
+  if (!pMbs || !u32Count)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  RkmediaChannel *target_chn = RkmediaGetOutputChn(enModID, s32ChnID);
+  if (!target_chn)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  if (target_chn->status < CHN_STATUS_OPEN) {
+    LOG("ERROR: %s Mode[%d]:Chn[%d] in status[%d], "
+        "this operation is not allowed!\n",
+        __func__, enModID, s32ChnID, target_chn->status);
+    return -RK_ERR_SYS_NOTREADY;
+  }
+
+  return RkmediaChnPopBuffers(target_chn, pMbs, u32Count, s32MilliSec);
+}
+
+RK_S32 RK_MPI_SYS_SetMediaBufferDepth(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                      RK_S32 s32Depth) {
+  RkmediaChannel *target_chn = RkmediaGetOutputChn(enModID, s32ChnID);
+  if (!target_chn)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  if ((s32Depth < 1) || (s32Depth > (RK_S32)MediaBufferQueue::kCapacity)) {
+    LOG("ERROR: %s depth(%d) should be in [1, %d]\n", __func__, s32Depth,
+        (int)MediaBufferQueue::kCapacity);
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  }
+
+  // Takes effect from the next pushed buffer.
+  target_chn->buffer_depth = (RK_U32)s32Depth;
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_GetMediaBufferStat(MOD_ID_E enModID, RK_S32 s32ChnID,
+                                     MB_QUEUE_STAT_S *pstStat) {
+  if (!pstStat)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  RkmediaChannel *target_chn = RkmediaGetOutputChn(enModID, s32ChnID);
+  if (!target_chn)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  pstStat->u32Depth = RkmediaChnDepth(target_chn);
+  pstStat->u32Queued = target_chn->buffer_queue.Size();
+  pstStat->u32Pushed = target_chn->buffer_pushed;
+  pstStat->u32Dropped = target_chn->buffer_dropped;
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_GetMediaBufferFd(MOD_ID_E enModID, RK_S32 s32ChnID) {
+  RkmediaChannel *target_chn = RkmediaGetOutputChn(enModID, s32ChnID);
+  if (!target_chn)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  if ((target_chn->status < CHN_STATUS_OPEN) || (target_chn->buffer_fd < 0))
+    return -RK_ERR_SYS_NOTREADY;
+
+  return target_chn->buffer_fd;
+}
+
 RK_S32 RK_MPI_SYS_SendMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
                                   MEDIA_BUFFER buffer) {
   RkmediaChannel *target_chn = NULL;
@@ -1068,7 +1218,7 @@ RK_S32 RK_MPI_VI_DisableChn(VI_PIPE ViPipe, VI_CHN ViChn) {
   g_vi_chns[ViChn].luma_buf_mtx.unlock();
   // VI flow Should be released last
   g_vi_chns[ViChn].rkmedia_flow.reset();
-  if (!g_vi_chns[ViChn].buffer_list.empty()) {
+  if (g_vi_chns[ViChn].buffer_queue.Size()) {
     LOG("\n%s %s: clear buffer list again...\n", LOG_TAG, __func__);
     RkmediaChnClearBuffer(&g_vi_chns[ViChn]);
   }
@@ -1522,11 +1672,6 @@ static RK_S32 RkmediaCreateJpegSnapPipeline(RkmediaChannel *VenChn) {
   if (bEnableRga)
     VenChn->rkmedia_flow_list.push_back(video_rga_flow);
   VenChn->rkmedia_flow_list.push_back(video_jpeg_flow);
-  if (pipe2(VenChn->wake_fd, O_CLOEXEC) == -1) {
-    VenChn->wake_fd[0] = 0;
-    VenChn->wake_fd[1] = 0;
-    LOG("WARN: %s Create pipe failed!\n");
-  }
   VenChn->status = CHN_STATUS_OPEN;
 
   return RK_ERR_SYS_OK;
@@ -1774,11 +1919,6 @@ RK_S32 RK_MPI_VENC_CreateChn(VENC_CHN VeChn, VENC_CHN_ATTR_S *stVencChnAttr) {
   RkmediaChnInitBuffer(&g_venc_chns[VeChn]);
   g_venc_chns[VeChn].rkmedia_flow->SetOutputCallBack(&g_venc_chns[VeChn],
                                                      FlowOutputCallback);
-  if (pipe2(g_venc_chns[VeChn].wake_fd, O_CLOEXEC) == -1) {
-    g_venc_chns[VeChn].wake_fd[0] = 0;
-    g_venc_chns[VeChn].wake_fd[1] = 0;
-    LOG("WARN: %s Create pipe failed!\n");
-  }
   g_venc_chns[VeChn].status = CHN_STATUS_OPEN;
   g_venc_mtx.unlock();
   if (stVencChnAttr->stGopAttr.enGopMode >= VENC_GOPMODE_NORMALP) {
@@ -2238,11 +2378,6 @@ RK_S32 RK_MPI_VENC_CreateJpegLightChn(VENC_CHN VeChn,
 
   g_venc_chns[VeChn].rkmedia_flow = video_jpeg_flow;
   g_venc_chns[VeChn].rkmedia_flow_list.push_back(video_jpeg_flow);
-  if (pipe2(g_venc_chns[VeChn].wake_fd, O_CLOEXEC) == -1) {
-    g_venc_chns[VeChn].wake_fd[0] = 0;
-    g_venc_chns[VeChn].wake_fd[1] = 0;
-    LOG("WARN: %s Create pipe failed!\n");
-  }
   g_venc_chns[VeChn].status = CHN_STATUS_OPEN;
   g_venc_mtx.unlock();
 
@@ -2806,15 +2941,8 @@ RK_S32 RK_MPI_VENC_DestroyChn(VENC_CHN VeChn) {
     ptrRkmediaFlow0.reset();
   }
   RkmediaChnClearBuffer(&g_venc_chns[VeChn]);
+  RkmediaOsdRgnCacheReset(&g_venc_chns[VeChn], -1);
   g_venc_chns[VeChn].status = CHN_STATUS_CLOSED;
-  if (g_venc_chns[VeChn].wake_fd[0] > 0) {
-    close(g_venc_chns[VeChn].wake_fd[0]);
-    g_venc_chns[VeChn].wake_fd[0] = 0;
-  }
-  if (g_venc_chns[VeChn].wake_fd[1] > 0) {
-    close(g_venc_chns[VeChn].wake_fd[1]);
-    g_venc_chns[VeChn].wake_fd[1] = 0;
-  }
   g_venc_mtx.unlock();
   LOG("\n%s %s: Disable VENC[%d] End...\n", LOG_TAG, __func__, VeChn);
 
@@ -2831,7 +2959,7 @@ RK_S32 RK_MPI_VENC_GetFd(VENC_CHN VeChn) {
     g_venc_mtx.unlock();
     return -RK_ERR_VENC_NOTREADY;
   }
-  rcv_fd = g_venc_chns[VeChn].wake_fd[0];
+  rcv_fd = g_venc_chns[VeChn].buffer_fd;
   g_venc_mtx.unlock();
 
   return rcv_fd;
@@ -2859,10 +2987,8 @@ RK_S32 RK_MPI_VENC_QueryStatus(VENC_CHN VeChn, VENC_CHN_STATUS_S *pstStatus) {
   pstStatus->u32LeftFrames = u32BufferUsedCnt;
   pstStatus->u32TotalFrames = u32BufferTotalCnt;
 
-  g_venc_chns[VeChn].buffer_mtx.lock();
-  pstStatus->u32TotalPackets = RKMEDIA_CHNNAL_BUFFER_LIMIT;
-  pstStatus->u32LeftPackets = g_venc_chns[VeChn].buffer_list.size();
-  g_venc_chns[VeChn].buffer_mtx.unlock();
+  pstStatus->u32TotalPackets = RkmediaChnDepth(&g_venc_chns[VeChn]);
+  pstStatus->u32LeftPackets = g_venc_chns[VeChn].buffer_queue.Size();
 
   return RK_ERR_SYS_OK;
 }
@@ -2953,16 +3079,25 @@ RK_S32 RK_MPI_VENC_RGN_Init(VENC_CHN VeChn, VENC_COLOR_TBL_S *stColorTbl) {
   memcpy(g_venc_chns[VeChn].u32ArgbColorTbl, pu32ArgbColorTbl,
          VENC_RGN_COLOR_NUM * 4);
   g_venc_chns[VeChn].bColorTblInit = RK_TRUE;
+  // Palette ids of the cached bitmaps are stale now.
+  RkmediaOsdRgnCacheReset(&g_venc_chns[VeChn], -1);
   g_venc_mtx.unlock();
   return RK_ERR_SYS_OK;
 }
 
+static inline RK_U8 Argb8888_To_Color_Id(VENC_CHN VeChn, RK_U32 ColorValue) {
+  if (g_venc_chns[VeChn].bColorDichotomyEnable)
+    return find_argb_color_tbl_by_dichotomy(g_venc_chns[VeChn].u32ArgbColorTbl,
+                                            PALETTE_TABLE_LEN, ColorValue);
+  return find_argb_color_tbl_by_order(g_venc_chns[VeChn].u32ArgbColorTbl,
+                                      PALETTE_TABLE_LEN, ColorValue);
+}
+
 static RK_VOID Argb8888_To_Region_Data(VENC_CHN VeChn,
                                        const BITMAP_S *pstBitmap, RK_U8 *data,
                                        RK_U32 canvasWidth,
                                        RK_U32 canvasHeight) {
   RK_U32 TargetWidth, TargetHeight;
-  RK_U32 ColorValue;
   RK_U32 *BitmapLineStart;
   RK_U8 *CanvasLineStart;
 
@@ -2986,25 +3121,101 @@ static RK_VOID Argb8888_To_Region_Data(VENC_CHN VeChn,
   for (RK_U32 i = 0; i < TargetHeight; i++) {
     BitmapLineStart = (RK_U32 *)pstBitmap->pData + i * pstBitmap->u32Width;
     CanvasLineStart = data + i * canvasWidth;
-    for (RK_U32 j = 0; j < TargetWidth; j++) {
-      ColorValue = *(BitmapLineStart + j);
+    for (RK_U32 j = 0; j < TargetWidth; j++)
+      *(CanvasLineStart + j) =
+          Argb8888_To_Color_Id(VeChn, *(BitmapLineStart + j));
+  }
+}
 
-      if (g_venc_chns[VeChn].bColorDichotomyEnable) {
-        *(CanvasLineStart + j) = find_argb_color_tbl_by_dichotomy(
-            g_venc_chns[VeChn].u32ArgbColorTbl, PALETTE_TABLE_LEN, ColorValue);
-      } else {
-        *(CanvasLineStart + j) = find_argb_color_tbl_by_order(
-            g_venc_chns[VeChn].u32ArgbColorTbl, PALETTE_TABLE_LEN, ColorValue);
+static bool OsdRgnCacheMatch(const RkmediaOsdRgnCache *cache,
+                             const OSD_REGION_INFO_S *pstRgnInfo,
+                             const BITMAP_S *pstBitmap) {
+  return cache->valid && (cache->rgn_info.u32PosX == pstRgnInfo->u32PosX) &&
+         (cache->rgn_info.u32PosY == pstRgnInfo->u32PosY) &&
+         (cache->rgn_info.u32Width == pstRgnInfo->u32Width) &&
+         (cache->rgn_info.u32Height == pstRgnInfo->u32Height) &&
+         (cache->rgn_info.u8Inverse == pstRgnInfo->u8Inverse) &&
+         (cache->bmp_width == pstBitmap->u32Width) &&
+         (cache->bmp_height == pstBitmap->u32Height);
+}
+
+// Convert the whole bitmap and remember it as the diff reference.
+static RK_VOID OsdRgnCacheFill(VENC_CHN VeChn, RkmediaOsdRgnCache *cache,
+                               const OSD_REGION_INFO_S *pstRgnInfo,
+                               const BITMAP_S *pstBitmap) {
+  RK_U32 TargetWidth = std::min(pstBitmap->u32Width, pstRgnInfo->u32Width);
+  RK_U32 TargetHeight = std::min(pstBitmap->u32Height, pstRgnInfo->u32Height);
+
+  cache->ids.resize(pstRgnInfo->u32Width * pstRgnInfo->u32Height);
+  Argb8888_To_Region_Data(VeChn, pstBitmap, cache->ids.data(),
+                          pstRgnInfo->u32Width, pstRgnInfo->u32Height);
+
+  cache->argb.resize(TargetWidth * TargetHeight);
+  for (RK_U32 i = 0; i < TargetHeight; i++)
+    memcpy(cache->argb.data() + i * TargetWidth,
+           (RK_U32 *)pstBitmap->pData + i * pstBitmap->u32Width,
+           TargetWidth * sizeof(RK_U32));
+
+  cache->rgn_info = *pstRgnInfo;
+  cache->bmp_width = pstBitmap->u32Width;
+  cache->bmp_height = pstBitmap->u32Height;
+  cache->valid = true;
+}
+
+// Convert only the 16x16 tiles that differ from the cached bitmap, and
+// return their bounding box in pstDirty. Returns false if nothing changed.
+static bool OsdRgnCacheUpdate(VENC_CHN VeChn, RkmediaOsdRgnCache *cache,
+                              const BITMAP_S *pstBitmap,
+                              OsdRegionData *pstDirty) {
+  RK_U32 CanvasWidth = cache->rgn_info.u32Width;
+  RK_U32 TargetWidth = std::min(pstBitmap->u32Width, CanvasWidth);
+  RK_U32 TargetHeight =
+      std::min(pstBitmap->u32Height, cache->rgn_info.u32Height);
+  RK_U32 x0 = CanvasWidth, y0 = cache->rgn_info.u32Height, x1 = 0, y1 = 0;
+
+  for (RK_U32 ty = 0; ty < TargetHeight; ty += 16) {
+    RK_U32 rows = std::min(16U, TargetHeight - ty);
+    for (RK_U32 tx = 0; tx < TargetWidth; tx += 16) {
+      RK_U32 cols = std::min(16U, TargetWidth - tx);
+      bool dirty = false;
+      for (RK_U32 i = 0; i < rows && !dirty; i++) {
+        const RK_U32 *src = (RK_U32 *)pstBitmap->pData +
+                            (ty + i) * pstBitmap->u32Width + tx;
+        const RK_U32 *old = cache->argb.data() + (ty + i) * TargetWidth + tx;
+        dirty = memcmp(src, old, cols * sizeof(RK_U32)) != 0;
+      }
+      if (!dirty)
+        continue;
+
+      for (RK_U32 i = 0; i < rows; i++) {
+        const RK_U32 *src = (RK_U32 *)pstBitmap->pData +
+                            (ty + i) * pstBitmap->u32Width + tx;
+        RK_U32 *old = cache->argb.data() + (ty + i) * TargetWidth + tx;
+        RK_U8 *ids = cache->ids.data() + (ty + i) * CanvasWidth + tx;
+        for (RK_U32 j = 0; j < cols; j++)
+          ids[j] = Argb8888_To_Color_Id(VeChn, src[j]);
+        memcpy(old, src, cols * sizeof(RK_U32));
       }
+      x0 = std::min(x0, tx);
+      y0 = std::min(y0, ty);
+      x1 = std::max(x1, tx + 16);
+      y1 = std::max(y1, ty + 16);
     }
   }
+
+  if (x1 <= x0 || y1 <= y0)
+    return false;
+
+  pstDirty->dirty_x = x0;
+  pstDirty->dirty_y = y0;
+  pstDirty->dirty_w = x1 - x0;
+  pstDirty->dirty_h = y1 - y0;
+  return true;
 }
 
 RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
                                  const OSD_REGION_INFO_S *pstRgnInfo,
                                  const BITMAP_S *pstBitmap) {
-  RK_U8 *rkmedia_osd_data;
-  RK_U32 total_pix_num = 0;
   RK_S32 ret = RK_ERR_SYS_OK;
 
   if ((VeChn < 0) || (VeChn >= VENC_MAX_CHN_NUM))
@@ -3014,7 +3225,14 @@ RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
       (g_venc_chns[VeChn].bColorTblInit == RK_FALSE))
     return -RK_ERR_VENC_NOTREADY;
 
+  if (pstRgnInfo && ((RK_U32)pstRgnInfo->enRegionId >= OSD_REGIONS_CNT))
+    return -RK_ERR_VENC_ILLEGAL_PARAM;
+
+  // Held across the cache and the encoder update, so that a disable does
+  // not interleave with an upload of the same region.
+  std::lock_guard<std::mutex> lck(g_venc_chns[VeChn].osd_rgn_mtx);
   if (pstRgnInfo && !pstRgnInfo->u8Enable) {
+    g_venc_chns[VeChn].osd_rgn_cache[pstRgnInfo->enRegionId].valid = false;
     OsdRegionData rkmedia_osd_rgn;
     memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
     rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
@@ -3041,27 +3259,29 @@ RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
     return -RK_ERR_VENC_ILLEGAL_PARAM;
   }
 
-  total_pix_num = pstRgnInfo->u32Width * pstRgnInfo->u32Height;
-  rkmedia_osd_data = (RK_U8 *)malloc(total_pix_num);
-  if (!rkmedia_osd_data) {
-    LOG("ERROR: No space left! RgnInfo pixels(%d)\n", total_pix_num);
-    return -RK_ERR_VENC_NOMEM;
-  }
-
-  switch (pstBitmap->enPixelFormat) {
-  case PIXEL_FORMAT_ARGB_8888:
-    Argb8888_To_Region_Data(VeChn, pstBitmap, rkmedia_osd_data,
-                            pstRgnInfo->u32Width, pstRgnInfo->u32Height);
-    break;
-  default:
+  if (pstBitmap->enPixelFormat != PIXEL_FORMAT_ARGB_8888) {
     LOG("ERROR: Not support bitmap pixel format:%d\n",
         pstBitmap->enPixelFormat);
-    ret = -RK_ERR_VENC_NOT_SUPPORT;
-    break;
+    return -RK_ERR_VENC_NOT_SUPPORT;
   }
 
   OsdRegionData rkmedia_osd_rgn;
-  rkmedia_osd_rgn.buffer = rkmedia_osd_data;
+  memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
+
+  RkmediaOsdRgnCache *cache =
+      &g_venc_chns[VeChn].osd_rgn_cache[pstRgnInfo->enRegionId];
+  if (OsdRgnCacheMatch(cache, pstRgnInfo, pstBitmap)) {
+    // Same geometry: upload the changed tiles only.
+    if (!OsdRgnCacheUpdate(VeChn, cache, pstBitmap, &rkmedia_osd_rgn)) {
+      LOGD("%s: Region[%d] unchanged, skip\n", __func__,
+           pstRgnInfo->enRegionId);
+      return RK_ERR_SYS_OK;
+    }
+  } else {
+    OsdRgnCacheFill(VeChn, cache, pstRgnInfo, pstBitmap);
+  }
+
+  rkmedia_osd_rgn.buffer = cache->ids.data();
   rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
   rkmedia_osd_rgn.pos_x = pstRgnInfo->u32PosX;
   rkmedia_osd_rgn.pos_y = pstRgnInfo->u32PosY;
@@ -3071,11 +3291,10 @@ RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
   rkmedia_osd_rgn.enable = pstRgnInfo->u8Enable;
   ret = easymedia::video_encoder_set_osd_region(g_venc_chns[VeChn].rkmedia_flow,
                                                 &rkmedia_osd_rgn);
-  if (ret)
+  if (ret) {
+    cache->valid = false;
     ret = -RK_ERR_VENC_NOT_PERM;
-
-  if (rkmedia_osd_data)
-    free(rkmedia_osd_data);
+  }
 
   return ret;
 }
@@ -3095,6 +3314,15 @@ RK_S32 RK_MPI_VENC_RGN_SetCover(VENC_CHN VeChn,
       (g_venc_chns[VeChn].bColorTblInit == RK_FALSE))
     return -RK_ERR_VENC_NOTREADY;
 
+  if (pstRgnInfo && ((RK_U32)pstRgnInfo->enRegionId >= OSD_REGIONS_CNT))
+    return -RK_ERR_VENC_ILLEGAL_PARAM;
+
+  // Held across the cache and the encoder update, as in SetBitMap. The
+  // region no longer holds the cached bitmap.
+  std::lock_guard<std::mutex> lck(g_venc_chns[VeChn].osd_rgn_mtx);
+  if (pstRgnInfo)
+    g_venc_chns[VeChn].osd_rgn_cache[pstRgnInfo->enRegionId].valid = false;
+
   if (pstRgnInfo && !pstRgnInfo->u8Enable) {
     OsdRegionData rkmedia_osd_rgn;
     memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
@@ -3141,6 +3369,7 @@ RK_S32 RK_MPI_VENC_RGN_SetCover(VENC_CHN VeChn,
   memset(rkmedia_cover_data, color_id, total_pix_num);
 
   OsdRegionData rkmedia_osd_rgn;
+  memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
   rkmedia_osd_rgn.buffer = rkmedia_cover_data;
   rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
   rkmedia_osd_rgn.pos_x = pstRgnInfo->u32PosX;
@@ -3173,6 +3402,15 @@ RK_MPI_VENC_RGN_SetPaletteId(VENC_CHN VeChn,
       (g_venc_chns[VeChn].bColorTblInit == RK_FALSE))
     return -RK_ERR_VENC_NOTREADY;
 
+  if (pstRgnInfo && ((RK_U32)pstRgnInfo->enRegionId >= OSD_REGIONS_CNT))
+    return -RK_ERR_VENC_ILLEGAL_PARAM;
+
+  // Held across the cache and the encoder update, as in SetBitMap. The
+  // region no longer holds the cached bitmap.
+  std::lock_guard<std::mutex> lck(g_venc_chns[VeChn].osd_rgn_mtx);
+  if (pstRgnInfo)
+    g_venc_chns[VeChn].osd_rgn_cache[pstRgnInfo->enRegionId].valid = false;
+
   if (pstRgnInfo && !pstRgnInfo->u8Enable) {
     OsdRegionData rkmedia_osd_rgn;
     memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
@@ -3208,6 +3446,7 @@ RK_MPI_VENC_RGN_SetPaletteId(VENC_CHN VeChn,
   }
 
   OsdRegionData rkmedia_osd_rgn;
+  memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
   rkmedia_osd_rgn.buffer = (RK_U8 *)pstColPalBuf->pIdBuf;
   rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
   rkmedia_osd_rgn.pos_x = pstRgnInfo->u32PosX;
@@ -3429,6 +3668,28 @@ RK_S32 RK_MPI_AI_DisableVqe(AI_CHN AiChn) {
   return RK_ERR_SYS_OK;
 }
 
+RK_S32 RK_MPI_AI_QueryVqeStat(AI_CHN AiChn, AI_VQE_STATE_S *pstStatus) {
+  if ((AiChn < 0) || (AiChn >= AI_MAX_CHN_NUM))
+    return -RK_ERR_AI_INVALID_DEVID;
+  if (!pstStatus)
+    return -RK_ERR_AI_NOT_CONFIG;
+  g_ai_mtx.lock();
+  if (g_ai_chns[AiChn].status <= CHN_STATUS_READY) {
+    g_ai_mtx.unlock();
+    return -RK_ERR_AI_NOTOPEN;
+  }
+  VQE_QUEUE_STATE_S state;
+  int ret = g_ai_chns[AiChn].rkmedia_flow->Control(easymedia::G_VQE_QUEUE_STATE,
+                                                   &state);
+  g_ai_mtx.unlock();
+  if (ret)
+    return -RK_ERR_AI_NOT_CONFIG;
+  pstStatus->u32InQueueBytes = state.u32InBytes;
+  pstStatus->u32OutQueueBytes = state.u32OutBytes;
+  pstStatus->u32QueueSize = state.u32QueueSize;
+  return RK_ERR_SYS_OK;
+}
+
 RK_S32 RK_MPI_AI_SetTalkVqeAttr(AI_CHN AiChn,
                                 AI_TALKVQE_CONFIG_S *pstVqeConfig) {
   if ((AiChn < 0) || (AiChn > AI_MAX_CHN_NUM))
@@ -3612,6 +3873,29 @@ RK_S32 RK_MPI_AO_QueryChnStat(AO_CHN AoChn, AO_CHN_STATE_S *pstStatus) {
   return RK_ERR_SYS_OK;
 }
 
+RK_S32 RK_MPI_AO_QueryVqeStat(AO_CHN AoChn, AO_VQE_STATE_S *pstStatus) {
+  if ((AoChn < 0) || (AoChn >= AO_MAX_CHN_NUM))
+    return -RK_ERR_AO_INVALID_DEVID;
+  if (!pstStatus)
+    return -RK_ERR_AO_ILLEGAL_PARAM;
+  g_ao_mtx.lock();
+  if ((g_ao_chns[AoChn].status < CHN_STATUS_OPEN) ||
+      (!g_ao_chns[AoChn].rkmedia_flow)) {
+    g_ao_mtx.unlock();
+    return -RK_ERR_AO_BUSY;
+  }
+  VQE_QUEUE_STATE_S state;
+  int ret = g_ao_chns[AoChn].rkmedia_flow->Control(easymedia::G_VQE_QUEUE_STATE,
+                                                   &state);
+  g_ao_mtx.unlock();
+  if (ret)
+    return -RK_ERR_AO_NOTREADY;
+  pstStatus->u32InQueueBytes = state.u32InBytes;
+  pstStatus->u32OutQueueBytes = state.u32OutBytes;
+  pstStatus->u32QueueSize = state.u32QueueSize;
+  return RK_ERR_SYS_OK;
+}
+
 RK_S32 RK_MPI_AO_ClearChnBuf(AO_CHN AoChn) {
   if ((AoChn < 0) || (AoChn > AO_MAX_CHN_NUM))
     return -RK_ERR_AO_INVALID_DEVID;
@@ -4139,6 +4423,7 @@ RK_S32 RK_MPI_RGA_CreateChn(RGA_CHN RgaChn, RGA_ATTR_S *pstRgaAttr) {
     g_rga_mtx.unlock();
     return -RK_ERR_RGA_BUSY;
   }
+  RkmediaChnInitBuffer(&g_rga_chns[RgaChn]);
   g_rga_chns[RgaChn].rkmedia_flow->SetOutputCallBack(&g_rga_chns[RgaChn],
                                                      FlowOutputCallback);
   g_rga_chns[RgaChn].status = CHN_STATUS_OPEN;
@@ -4161,6 +4446,7 @@ RK_S32 RK_MPI_RGA_DestroyChn(RGA_CHN RgaChn) {
   }
   LOG("\n%s %s: Disable RGA[%d] Start...\n", LOG_TAG, __func__, RgaChn);
   g_rga_chns[RgaChn].rkmedia_flow.reset();
+  RkmediaChnClearBuffer(&g_rga_chns[RgaChn]);
   g_rga_chns[RgaChn].status = CHN_STATUS_CLOSED;
   g_rga_mtx.unlock();
   LOG("\n%s %s: Disable RGA[%d] End...\n", LOG_TAG, __func__, RgaChn);
@@ -8,6 +8,48 @@
 #include "rkmedia_utils.h"
 #include "rkmedia_venc.h"
 
+MediaBufferImplPool::~MediaBufferImplPool() {
+  for (auto mb : free_list)
+    delete mb;
+  free_list.clear();
+}
+
+MEDIA_BUFFER_IMPLE *MediaBufferImplPool::Get() {
+  MEDIA_BUFFER_IMPLE *mb = NULL;
+  mtx.lock();
+  if (!free_list.empty()) {
+    mb = free_list.back();
+    free_list.pop_back();
+  }
+  mtx.unlock();
+  if (!mb)
+    mb = new MEDIA_BUFFER_IMPLE;
+  if (mb)
+    mb->pool = this;
+  return mb;
+}
+
+void MediaBufferImplPool::Put(MEDIA_BUFFER_IMPLE *mb) {
+  mtx.lock();
+  if (free_list.size() < kMaxFreeCount) {
+    free_list.push_back(mb);
+    mb = NULL;
+  }
+  mtx.unlock();
+  if (mb)
+    delete mb;
+}
+
+void MediaBufferImplPool::Put(MEDIA_BUFFER_IMPLE **mbs, size_t count) {
+  size_t i = 0;
+  mtx.lock();
+  for (; i < count && free_list.size() < kMaxFreeCount; i++)
+    free_list.push_back(mbs[i]);
+  mtx.unlock();
+  for (; i < count; i++)
+    delete mbs[i];
+}
+
 void *RK_MPI_MB_GetPtr(MEDIA_BUFFER mb) {
   if (!mb)
     return NULL;
@@ -64,7 +106,41 @@ RK_S32 RK_MPI_MB_ReleaseBuffer(MEDIA_BUFFER mb) {
   if (mb_impl->rkmedia_mb)
     mb_impl->rkmedia_mb.reset();
 
-  delete mb_impl;
+  if (mb_impl->pool)
+    mb_impl->pool->Put(mb_impl);
+  else
+    delete mb_impl;
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_MB_ReleaseBuffers(MEDIA_BUFFER *pMbs, RK_U32 u32Count) {
+  if (!pMbs)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+
+  for (RK_U32 i = 0; i < u32Count; i++) {
+    if (!pMbs[i])
+      return -RK_ERR_SYS_ILLEGAL_PARAM;
+  }
+
+  // Buffers got by RK_MPI_SYS_GetMediaBuffers come from the same channel,
+  // so runs of handles sharing a pool go back with a single lock.
+  MEDIA_BUFFER_IMPLE **mb_impls = (MEDIA_BUFFER_IMPLE **)pMbs;
+  RK_U32 start = 0;
+  for (RK_U32 i = 0; i < u32Count; i++) {
+    MEDIA_BUFFER_IMPLE *mb_impl = mb_impls[i];
+    if (mb_impl->rkmedia_mb)
+      mb_impl->rkmedia_mb.reset();
+    if ((i + 1 < u32Count) && (mb_impls[i + 1]->pool == mb_impl->pool))
+      continue;
+    if (mb_impl->pool) {
+      mb_impl->pool->Put(mb_impls + start, i + 1 - start);
+    } else {
+      for (RK_U32 j = start; j <= i; j++)
+        delete mb_impls[j];
+    }
+    start = i + 1;
+  }
+
   return RK_ERR_SYS_OK;
 }
 
@@ -122,6 +198,7 @@ MEDIA_BUFFER RK_MPI_MB_CreateAudioBuffer(RK_U32 u32BufferSize,
   mb->chn_id = 0;
   mb->flag = 0;
   mb->tsvc_level = 0;
+  mb->pool = NULL;
 
   return mb;
 }
@@ -132,8 +209,7 @@ MEDIA_BUFFER RK_MPI_MB_CreateImageBuffer(MB_IMAGE_INFO_S *pstImageInfo,
       !pstImageInfo->u32VerStride || !pstImageInfo->u32HorStride)
     return NULL;
 
-  std::string strPixFormat = ImageTypeToString(pstImageInfo->enImgType);
-  PixelFormat rkmediaPixFormat = StringToPixFmt(strPixFormat.c_str());
+  PixelFormat rkmediaPixFormat = ImageTypeToPixFmt(pstImageInfo->enImgType);
   if (rkmediaPixFormat == PIX_FMT_NONE) {
     LOG("ERROR: %s: unsupport pixformat!\n", __func__);
     return NULL;
@@ -181,6 +257,7 @@ MEDIA_BUFFER RK_MPI_MB_CreateImageBuffer(MB_IMAGE_INFO_S *pstImageInfo,
   mb->chn_id = 0;
   mb->flag = 0;
   mb->tsvc_level = 0;
+  mb->pool = NULL;
 
   return mb;
 }
@@ -279,6 +356,7 @@ MEDIA_BUFFER RK_MPI_MB_CreateBuffer(RK_U32 u32Size, RK_BOOL boolHardWare,
   mb->chn_id = 0;
   mb->flag = 0;
   mb->tsvc_level = 0;
+  mb->pool = NULL;
 
   return mb;
 }
@@ -298,8 +376,7 @@ MEDIA_BUFFER RK_MPI_MB_ConvertToImgBuffer(MEDIA_BUFFER mb,
     return NULL;
   }
 
-  std::string strPixFormat = ImageTypeToString(pstImageInfo->enImgType);
-  PixelFormat rkmediaPixFormat = StringToPixFmt(strPixFormat.c_str());
+  PixelFormat rkmediaPixFormat = ImageTypeToPixFmt(pstImageInfo->enImgType);
   if (rkmediaPixFormat == PIX_FMT_NONE) {
     LOG("ERROR: %s: unsupport pixformat!\n", __func__);
     return NULL;
@@ -310,7 +387,7 @@ MEDIA_BUFFER RK_MPI_MB_ConvertToImgBuffer(MEDIA_BUFFER mb,
   if (buf_size > mb_impl->rkmedia_mb->GetSize()) {
     LOG("ERROR: %s: buffer size:%d do not match imgInfo(%dx%d, %s)!\n",
         __func__, mb_impl->rkmedia_mb->GetSize(), pstImageInfo->u32HorStride,
-        pstImageInfo->u32VerStride, strPixFormat.c_str());
+        pstImageInfo->u32VerStride, PixFmtToString(rkmediaPixFormat));
     return NULL;
   }
 
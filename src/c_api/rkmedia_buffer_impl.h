@@ -5,11 +5,16 @@
 #ifndef __RK_BUFFER_IMPL_
 #define __RK_BUFFER_IMPL_
 
+#include <mutex>
+#include <vector>
+
 #include "buffer.h"
 #include "flow.h"
 
 #include "rkmedia_common.h"
 
+class MediaBufferImplPool;
+
 typedef struct _rkMEDIA_BUFFER_S {
   MB_TYPE_E type;
   void *ptr;        // Virtual address of buffer
@@ -24,7 +29,29 @@ typedef struct _rkMEDIA_BUFFER_S {
   union {
     MB_IMAGE_INFO_S stImageInfo;
   };
-
+  // Free list to return to on release, null for standalone buffers.
+  MediaBufferImplPool *pool;
 } MEDIA_BUFFER_IMPLE;
 
+// Free list of MEDIA_BUFFER_IMPLE handles, so that the per-frame output path
+// of a channel recycles handles instead of new/delete for every buffer.
+class MediaBufferImplPool {
+public:
+  MediaBufferImplPool() = default;
+  ~MediaBufferImplPool();
+  MediaBufferImplPool(const MediaBufferImplPool &) = delete;
+  MediaBufferImplPool &operator=(const MediaBufferImplPool &) = delete;
+
+  MEDIA_BUFFER_IMPLE *Get();
+  void Put(MEDIA_BUFFER_IMPLE *mb);
+  // Put several handles of this pool under one lock.
+  void Put(MEDIA_BUFFER_IMPLE **mbs, size_t count);
+
+private:
+  // Handles beyond this count are freed on release.
+  static const size_t kMaxFreeCount = 16;
+  std::mutex mtx;
+  std::vector<MEDIA_BUFFER_IMPLE *> free_list;
+};
+
 #endif // __RK_BUFFER_IMPL_
\ No newline at end of file
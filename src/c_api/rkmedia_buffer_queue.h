@@ -0,0 +1,96 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RKMEDIA_BUFFER_QUEUE_
+#define __RKMEDIA_BUFFER_QUEUE_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rkmedia_buffer.h"
+
+// Bounded lock free queue of MEDIA_BUFFER (Vyukov's array based queue).
+// Flow threads push, the application pops, and a producer may also pop
+// the oldest buffer to make room, so both ends may have several threads.
+// The slots are fixed, the logical depth of a channel is enforced by
+// the caller with Size().
+class MediaBufferQueue {
+public:
+  // Must be a power of 2.
+  static const size_t kCapacity = 64;
+
+  MediaBufferQueue() : enqueue_pos(0), dequeue_pos(0) {
+    for (size_t i = 0; i < kCapacity; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+      cells[i].mb = NULL;
+    }
+  }
+  MediaBufferQueue(const MediaBufferQueue &) = delete;
+  MediaBufferQueue &operator=(const MediaBufferQueue &) = delete;
+
+  // Returns false if all slots are in use.
+  bool Push(MEDIA_BUFFER mb) {
+    Cell *cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & (kCapacity - 1)];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->mb = mb;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty.
+  bool Pop(MEDIA_BUFFER &mb) {
+    Cell *cell;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & (kCapacity - 1)];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    mb = cell->mb;
+    cell->seq.store(pos + kCapacity, std::memory_order_release);
+    return true;
+  }
+
+  // Approximate while other threads push or pop.
+  size_t Size() const {
+    size_t deq = dequeue_pos.load(std::memory_order_acquire);
+    size_t enq = enqueue_pos.load(std::memory_order_acquire);
+    return (enq > deq) ? (enq - deq) : 0;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    MEDIA_BUFFER mb;
+  };
+  Cell cells[kCapacity];
+  std::atomic<size_t> enqueue_pos;
+  std::atomic<size_t> dequeue_pos;
+};
+
+#endif // __RKMEDIA_BUFFER_QUEUE_
@@ -2,11 +2,51 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include "image.h"
 #include "media_type.h"
 #include "rkmedia_common.h"
 #include "rkmedia_venc.h"
 #include "utils.h"
 
+// Indexed by PixelFormat, so the lookup is a bound check and a load.
+static constexpr IMAGE_TYPE_E pix_fmt_image_type_map[PIX_FMT_NB] = {
+    IMAGE_TYPE_YUV420P,  // PIX_FMT_YUV420P
+    IMAGE_TYPE_NV12,     // PIX_FMT_NV12
+    IMAGE_TYPE_NV21,     // PIX_FMT_NV21
+    IMAGE_TYPE_YUV422P,  // PIX_FMT_YUV422P
+    IMAGE_TYPE_NV16,     // PIX_FMT_NV16
+    IMAGE_TYPE_NV61,     // PIX_FMT_NV61
+    IMAGE_TYPE_YUYV422,  // PIX_FMT_YUYV422
+    IMAGE_TYPE_UYVY422,  // PIX_FMT_UYVY422
+    IMAGE_TYPE_RGB332,   // PIX_FMT_RGB332
+    IMAGE_TYPE_RGB565,   // PIX_FMT_RGB565
+    IMAGE_TYPE_BGR565,   // PIX_FMT_BGR565
+    IMAGE_TYPE_RGB888,   // PIX_FMT_RGB888
+    IMAGE_TYPE_BGR888,   // PIX_FMT_BGR888
+    IMAGE_TYPE_ARGB8888, // PIX_FMT_ARGB8888
+    IMAGE_TYPE_ABGR8888, // PIX_FMT_ABGR8888
+    IMAGE_TYPE_FBC0,     // PIX_FMT_FBC0
+    IMAGE_TYPE_FBC2,     // PIX_FMT_FBC2
+};
+
+static_assert(PIX_FMT_NB == 17, "update pix_fmt_image_type_map");
+static_assert(pix_fmt_image_type_map[PIX_FMT_FBC2] == IMAGE_TYPE_FBC2,
+              "pix_fmt_image_type_map is out of order");
+
+IMAGE_TYPE_E PixFmtToImageType(PixelFormat fmt) {
+  if (fmt <= PIX_FMT_NONE || fmt >= PIX_FMT_NB)
+    return IMAGE_TYPE_UNKNOW;
+  return pix_fmt_image_type_map[fmt];
+}
+
+PixelFormat ImageTypeToPixFmt(IMAGE_TYPE_E type) {
+  for (int i = 0; i < PIX_FMT_NB; i++) {
+    if (pix_fmt_image_type_map[i] == type)
+      return (PixelFormat)i;
+  }
+  return PIX_FMT_NONE;
+}
+
 std::string ImageTypeToString(IMAGE_TYPE_E type) {
   switch (type) {
   case IMAGE_TYPE_GRAY8:
@@ -9,4 +9,7 @@ std::string ImageTypeToString(IMAGE_TYPE_E type);
 IMAGE_TYPE_E StringToImageType(std::string type);
 std::string CodecToString(CODEC_TYPE_E type);
 std::string SampleFormatToString(Sample_Format_E type);
+// Direct enum mapping, no string round trip. Used on per-frame paths.
+IMAGE_TYPE_E PixFmtToImageType(PixelFormat fmt);
+PixelFormat ImageTypeToPixFmt(IMAGE_TYPE_E type);
 #endif // #ifndef __RKMEDIA_UTILS_
@@ -33,6 +33,8 @@ public:
 private:
   std::string path;
   std::string oformat;
+  // false to keep the space allocated ahead in an existing file
+  bool truncate;
   AVFormatContext *context;
   AVDictionary *opt;
   std::vector<AVStream *> streams;
@@ -75,9 +77,10 @@ static bool _convert_to_avdictionary(std::string avdictionary,
 }
 
 FFMPEGMuxer::FFMPEGMuxer(const char *param)
-    : Muxer(param), context(NULL), opt(NULL), nb_streams(0) {
+    : Muxer(param), truncate(true), context(NULL), opt(NULL), nb_streams(0) {
   std::map<std::string, std::string> params;
   std::string muxer_ffmpeg_avdictionary;
+  std::string truncate_str;
   std::list<std::pair<const std::string, std::string &>> req_list;
   req_list.push_back(
       std::pair<const std::string, std::string &>(KEY_PATH, path));
@@ -85,8 +88,12 @@ FFMPEGMuxer::FFMPEGMuxer(const char *param)
       std::pair<const std::string, std::string &>(KEY_OUTPUTDATATYPE, oformat));
   req_list.push_back(std::pair<const std::string, std::string &>(
       KEY_MUXER_FFMPEG_AVDICTIONARY, muxer_ffmpeg_avdictionary));
+  req_list.push_back(std::pair<const std::string, std::string &>(
+      KEY_FILE_TRUNCATE, truncate_str));
 
   parse_media_param_match(param, params, req_list);
+  if (!truncate_str.empty())
+    truncate = !!std::stoi(truncate_str);
 
   _convert_to_avdictionary(muxer_ffmpeg_avdictionary, &opt);
 }
@@ -281,7 +288,11 @@ std::shared_ptr<MediaBuffer> FFMPEGMuxer::WriteHeader(int stream_no) {
   }
 
   if (!(context->oformat->flags & AVFMT_NOFILE)) {
-    ret = avio_open(&context->pb, url, AVIO_FLAG_WRITE);
+    AVDictionary *io_opt = NULL;
+    if (!truncate)
+      av_dict_set(&io_opt, "truncate", "0", 0);
+    ret = avio_open2(&context->pb, url, AVIO_FLAG_WRITE, NULL, &io_opt);
+    av_dict_free(&io_opt);
     if (ret < 0) {
       PrintAVError(ret, "Could not open", path.c_str());
       return nullptr;
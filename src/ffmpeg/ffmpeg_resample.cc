@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include "audio_convert.h"
 #include "buffer.h"
 #include "filter.h"
 #include <assert.h>
@@ -32,6 +33,8 @@ public:
                       std::shared_ptr<MediaBuffer> &output) override;
 
 private:
+  static const int kOutputBuffers = 4;
+
   int Resample(std::shared_ptr<SampleBuffer> src,
                SampleInfo dst_info,
                std::shared_ptr<SampleBuffer> &dst);
@@ -39,6 +42,7 @@ private:
   int sample_rate;
   SampleFormat format;
   SwrContext *swr_ctx;
+  SampleBufferPool out_pool;
 
 #if DEBUG_FILE
   std::ofstream infile;
@@ -46,7 +50,8 @@ private:
 #endif
 };
 
-ResampleFilter::ResampleFilter(const char *param) : swr_ctx(NULL) {
+ResampleFilter::ResampleFilter(const char *param)
+    : swr_ctx(NULL), out_pool(kOutputBuffers) {
   std::string s_format;
   std::string s_channels;
   std::string s_sample_rate;
@@ -95,6 +100,21 @@ int ResampleFilter::Process(std::shared_ptr<MediaBuffer> input,
     return -1;
   }
 
+  // Only the sample format changes, no need of swr.
+  if (src_info.channels == channels && src_info.sample_rate == sample_rate) {
+    size_t size = GetSampleSize(dst_info) * src_info.nb_samples;
+    dst_info.nb_samples = src_info.nb_samples;
+    dst = out_pool.Get(size, dst_info);
+    if (dst &&
+        AudioConvert(src_info.fmt, src->GetPtr(), format, dst->GetPtr(),
+                     channels, src_info.nb_samples)) {
+      dst->SetSamples(src_info.nb_samples);
+      dst->SetUSTimeStamp(src->GetUSTimeStamp());
+      output = dst;
+      return 0;
+    }
+  }
+
   Resample(src, dst_info, dst);
   output = dst;
   return 0;
@@ -184,8 +204,7 @@ int ResampleFilter::Resample(std::shared_ptr<SampleBuffer> src,
   if (size < 0)
     return size;
 
-  dst = std::make_shared<easymedia::SampleBuffer>(
-      MediaBuffer::Alloc2(size), dst_info);
+  dst = out_pool.Get(size, dst_info);
   if (!dst) {
     LOG("Alloc audio frame buffer failed:%d!\n", size);
     return -1;
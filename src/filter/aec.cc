@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include "audio_convert.h"
 #include "buffer.h"
 #include "filter.h"
 #include <assert.h>
@@ -25,6 +26,8 @@ public:
                       std::shared_ptr<MediaBuffer> &output) override;
 
 private:
+  static const int kOutputBuffers = 4;
+
   int AEC(std::shared_ptr<SampleBuffer> src, SampleInfo dst_info,
           std::shared_ptr<SampleBuffer> &dst);
   int channels;
@@ -34,13 +37,16 @@ private:
   std::string param_path;
   RKAP_Handle aec_handle;
   short *prebuf;
+  // The cancelled mic channel, nb_samples per buffer.
+  SampleBufferPool out_pool;
 #if DEBUG_FILE
   std::ofstream infile;
   std::ofstream outfile;
 #endif
 };
 
-AECFilter::AECFilter(const char *param) : aec_handle(nullptr), prebuf(nullptr) {
+AECFilter::AECFilter(const char *param)
+    : aec_handle(nullptr), prebuf(nullptr), out_pool(kOutputBuffers) {
   std::string s_format;
   std::string s_channels;
   std::string s_sample_rate;
@@ -121,41 +127,39 @@ AECFilter::~AECFilter() {
 
 int AECFilter::Process(std::shared_ptr<MediaBuffer> input,
                        std::shared_ptr<MediaBuffer> &output) {
-  if (!input)
+  if (!input || input->GetType() != Type::Audio)
     return -EINVAL;
   if (!output)
     return -EINVAL;
 
   SampleInfo dst_info = {SAMPLE_FMT_S16, 1, sample_rate, nb_samples};
   int dst_size = GetSampleSize(dst_info) * nb_samples;
-  auto dst = std::make_shared<easymedia::SampleBuffer>(
-      MediaBuffer::Alloc2(dst_size), dst_info);
-  assert(dst);
   assert(input->GetValidSize() == (dst_size * 2));
 
   short *sigin;
   short *sigref;
-  short *sigout;
   if (format == SAMPLE_FMT_S16) {
     sigin = prebuf;
     sigref =  prebuf + nb_samples;
-    sigout = (short *)dst->GetPtr();
-    for (int i = 0; i < nb_samples; i++) {
-      sigin[i] = *((short *)input->GetPtr() + i * 2);
-      sigref[i] = *((short *)input->GetPtr() + i * 2 + 1);
-    }
+    int16_t *planes[2] = {sigin, sigref};
+    AudioDeinterleaveS16((const int16_t *)input->GetPtr(), planes, 2,
+                         nb_samples);
   } else { //AUDIO_PCM_S16P
     sigin = (short *)input->GetPtr();
-    sigref = (short *)input->GetPtr() + nb_samples,
-    sigout = (short *)dst->GetPtr();
+    sigref = (short *)input->GetPtr() + nb_samples;
   }
-  AEC_Process(aec_handle, sigin, sigref, sigout);
+#if DEBUG_FILE
+  infile.write((const char *)input->GetPtr(), input->GetValidSize());
+#endif
+  auto dst = out_pool.Get(dst_size, dst_info);
+  if (!dst)
+    return -ENOMEM;
+  AEC_Process(aec_handle, sigin, sigref, (short *)dst->GetPtr());
 
   dst->SetSamples(nb_samples);
   dst->SetUSTimeStamp(input->GetUSTimeStamp());
   output = dst;
 #if DEBUG_FILE
-  infile.write((const char *)input->GetPtr(), input->GetValidSize());
   outfile.write((const char *)dst->GetPtr(), dst->GetValidSize());
 #endif
   return 0;
@@ -26,6 +26,8 @@ namespace easymedia {
     virtual int IoCtrl(unsigned long int request, ...) override;
 
   private:
+    static const int kOutputBuffers = 4;
+
     int channels;
     int sample_rate;
     SampleFormat format;
@@ -33,6 +35,8 @@ namespace easymedia {
 
     bool anr_on;
     RKAP_Handle anr_handle;
+    // ANR_Process() writes out of place, into these.
+    SampleBufferPool out_pool;
 
 #if DEBUG_FILE
     std::ofstream infile;
@@ -40,7 +44,8 @@ namespace easymedia {
 #endif
   };
 
-  ANRFilter::ANRFilter(const char *param) : anr_on(true), anr_handle(nullptr) {
+  ANRFilter::ANRFilter(const char *param)
+      : anr_on(true), anr_handle(nullptr), out_pool(kOutputBuffers) {
     std::string s_format;
     std::string s_channels;
     std::string s_sample_rate;
@@ -109,24 +114,27 @@ namespace easymedia {
 
   int ANRFilter::Process(std::shared_ptr<MediaBuffer> input,
                          std::shared_ptr<MediaBuffer> & output) {
-    if (!input)
+    if (!input || input->GetType() != Type::Audio)
       return -EINVAL;
     if (!output)
       return -EINVAL;
 
     SampleInfo dst_info = {format, channels, sample_rate, nb_samples};
     int size = GetSampleSize(dst_info) * nb_samples;
-    auto dst = std::make_shared<easymedia::SampleBuffer>(
-        MediaBuffer::Alloc2(size), dst_info);
-    assert(dst);
-    assert(size == input->GetValidSize());
-
-    if (anr_on) {
-      ANR_Process(anr_handle, (short int *)input->GetPtr(),
-                  (short int *)dst->GetPtr());
-    } else {
-      memcpy(dst->GetPtr(), input->GetPtr(), size);
+    assert(size == (int)input->GetValidSize());
+
+    // Off, the input is the output, as is.
+    if (!anr_on) {
+      output = input;
+      return 0;
     }
+    // ANR_Process() takes distinct in and out, the output is pooled rather
+    // than made in place through a copy of the input.
+    auto dst = out_pool.Get(size, dst_info);
+    if (!dst)
+      return -ENOMEM;
+    ANR_Process(anr_handle, (short int *)input->GetPtr(),
+                (short int *)dst->GetPtr());
 
     dst->SetSamples(nb_samples);
     dst->SetUSTimeStamp(input->GetUSTimeStamp());
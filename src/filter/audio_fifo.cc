@@ -0,0 +1,216 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "buffer.h"
+#include "filter.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Re-chunks PCM into frames of nb_samples, e.g. 1024 for aac, any format
+// and channels. FilterFlow calls SendInput then FetchOutput on its own
+// thread, so the fifo takes no locks, and grows to fit a larger input.
+class AudioFifoFilter : public Filter {
+public:
+  AudioFifoFilter(const char *param);
+  virtual ~AudioFifoFilter() = default;
+  static const char *GetFilterName() { return "audio_fifo"; }
+  virtual int SendInput(std::shared_ptr<MediaBuffer> input) override;
+  virtual std::shared_ptr<MediaBuffer> FetchOutput() override;
+
+private:
+  static const int kOutputBuffers = 4;
+  static const size_t kMarks = 64;
+
+  // The timestamp of the input beginning at frame pos.
+  struct Mark {
+    uint64_t pos;
+    int64_t timestamp;
+  };
+
+  void Copy(uint8_t *dst, size_t dst_frames, size_t dst_off,
+            const uint8_t *src, size_t src_frames, size_t src_off,
+            size_t frames);
+  void Grow(size_t frames);
+
+  SampleInfo info;
+  int planes;             // channels if planar, else 1
+  size_t plane_frame_size; // bytes of a frame in a plane
+  size_t capacity;         // frames, a power of 2
+  std::vector<uint8_t> ring; // planes of capacity frames
+
+  // Frames written and read since the start, the ring index is & mask.
+  uint64_t write_pos;
+  uint64_t read_pos;
+  Mark marks[kMarks];
+  uint64_t mark_write;
+  uint64_t mark_read;
+  bool finished;
+
+  Mark anchor;
+  SampleBufferPool out_pool;
+};
+
+static bool IsPlanar(SampleFormat fmt) {
+  return fmt == SAMPLE_FMT_U8P || fmt == SAMPLE_FMT_S16P ||
+         fmt == SAMPLE_FMT_S32P || fmt == SAMPLE_FMT_FLTP;
+}
+
+AudioFifoFilter::AudioFifoFilter(const char *param)
+    : planes(1), plane_frame_size(0), capacity(0), write_pos(0), read_pos(0),
+      mark_write(0), mark_read(0), finished(false), anchor({0, -1}),
+      out_pool(kOutputBuffers) {
+  memset(&info, 0, sizeof(info));
+  info.fmt = SAMPLE_FMT_NONE;
+  std::map<std::string, std::string> params;
+  if (parse_media_param_map(param, params)) {
+    const std::string &fmt = params[KEY_SAMPLE_FMT];
+    if (!fmt.empty())
+      info.fmt = StringToSampleFmt(fmt.c_str());
+    const std::string &channels = params[KEY_CHANNELS];
+    if (!channels.empty())
+      info.channels = std::stoi(channels);
+    const std::string &sample_rate = params[KEY_SAMPLE_RATE];
+    if (!sample_rate.empty())
+      info.sample_rate = std::stoi(sample_rate);
+    const std::string &frames = params[KEY_FRAMES];
+    if (!frames.empty())
+      info.nb_samples = std::stoi(frames);
+  }
+  if (!SampleInfoIsValid(info) || info.nb_samples <= 0) {
+    LOG("audio fifo: missing sample info\n");
+    SetError(-EINVAL);
+    return;
+  }
+  size_t frame_size = GetSampleSize(info);
+  if (frame_size == 0) {
+    SetError(-EINVAL);
+    return;
+  }
+  if (IsPlanar(info.fmt)) {
+    planes = info.channels;
+    plane_frame_size = frame_size / info.channels;
+  } else {
+    plane_frame_size = frame_size;
+  }
+  // Room for 8 output frames, or mem_cnt, at first.
+  size_t frames = 8 * (size_t)info.nb_samples;
+  const std::string &mem_cnt = params[KEY_MEM_CNT];
+  if (!mem_cnt.empty())
+    frames = std::max<size_t>(std::stoi(mem_cnt), 2) * info.nb_samples;
+  capacity = 1;
+  while (capacity < frames)
+    capacity <<= 1;
+  ring.resize(capacity * frame_size);
+}
+
+// Copy frames between two buffers of the same planes, wrapped at their
+// sizes in frames.
+void AudioFifoFilter::Copy(uint8_t *dst, size_t dst_frames, size_t dst_off,
+                           const uint8_t *src, size_t src_frames,
+                           size_t src_off, size_t frames) {
+  size_t done = 0;
+  while (done < frames) {
+    size_t d = (dst_off + done) % dst_frames;
+    size_t s = (src_off + done) % src_frames;
+    size_t n = std::min(frames - done, std::min(dst_frames - d,
+                                                src_frames - s));
+    for (int p = 0; p < planes; p++)
+      memcpy(dst + (p * dst_frames + d) * plane_frame_size,
+             src + (p * src_frames + s) * plane_frame_size,
+             n * plane_frame_size);
+    done += n;
+  }
+}
+
+// Make room for frames more, keeping the unread ones at their positions.
+void AudioFifoFilter::Grow(size_t frames) {
+  size_t used = write_pos - read_pos;
+  size_t new_capacity = capacity;
+  while (new_capacity < used + frames)
+    new_capacity <<= 1;
+  std::vector<uint8_t> new_ring(new_capacity * plane_frame_size * planes);
+  Copy(new_ring.data(), new_capacity, read_pos & (new_capacity - 1),
+       ring.data(), capacity, read_pos & (capacity - 1), used);
+  LOG("audio fifo: %zu frames input, grow %zu -> %zu frames\n", frames,
+      capacity, new_capacity);
+  ring.swap(new_ring);
+  capacity = new_capacity;
+}
+
+int AudioFifoFilter::SendInput(std::shared_ptr<MediaBuffer> input) {
+  if (!input || input->GetType() != Type::Audio)
+    return -EINVAL;
+  auto in = std::static_pointer_cast<SampleBuffer>(input);
+  if (!in->IsValid()) {
+    if (in->IsEOF())
+      finished = true;
+    return 0;
+  }
+  const SampleInfo &src_info = in->GetSampleInfo();
+  if (src_info.fmt != info.fmt || src_info.channels != info.channels ||
+      src_info.sample_rate != info.sample_rate) {
+    LOG("audio fifo: input %s/%d/%d, expected %s/%d/%d\n",
+        SampleFmtToString(src_info.fmt), src_info.channels,
+        src_info.sample_rate, SampleFmtToString(info.fmt), info.channels,
+        info.sample_rate);
+    return -EINVAL;
+  }
+  size_t frames = in->GetSamples();
+  if (write_pos - read_pos + frames > capacity)
+    Grow(frames);
+  if (mark_write - mark_read < kMarks)
+    marks[mark_write++ % kMarks] = {write_pos, in->GetUSTimeStamp()};
+  Copy(ring.data(), capacity, write_pos & (capacity - 1),
+       (const uint8_t *)in->GetPtr(), frames, 0, frames);
+  write_pos += frames;
+  if (in->IsEOF())
+    finished = true;
+  return 0;
+}
+
+std::shared_ptr<MediaBuffer> AudioFifoFilter::FetchOutput() {
+  uint64_t rpos = read_pos;
+  size_t frames = std::min<uint64_t>(write_pos - rpos, info.nb_samples);
+  bool eof = finished && frames == write_pos - rpos;
+  if (frames < (size_t)info.nb_samples && !(eof && frames > 0))
+    return nullptr;
+
+  // The latest input starting at or before the output.
+  while (mark_read != mark_write && marks[mark_read % kMarks].pos <= rpos)
+    anchor = marks[mark_read++ % kMarks];
+
+  auto dst = out_pool.Get(GetSampleSize(info) * info.nb_samples, info);
+  if (!dst)
+    return nullptr;
+  // Partial frames keep their planes packed.
+  Copy((uint8_t *)dst->GetPtr(), frames, 0, ring.data(), capacity,
+       rpos & (capacity - 1), frames);
+  read_pos = rpos + frames;
+
+  dst->GetSampleInfo() = info;
+  dst->SetSamples(frames);
+  if (anchor.timestamp >= 0)
+    dst->SetUSTimeStamp(anchor.timestamp + (int64_t)(rpos - anchor.pos) *
+                                               1000000 / info.sample_rate);
+  dst->SetEOF(eof);
+  return dst;
+}
+
+DEFINE_COMMON_FILTER_FACTORY(AudioFifoFilter)
+const char *FACTORY(AudioFifoFilter)::ExpectedInputDataType() {
+  return AUDIO_PCM TYPENEAR(AUDIO_G711A) TYPENEAR(AUDIO_G711U);
+}
+
+const char *FACTORY(AudioFifoFilter)::OutPutDataType() {
+  return AUDIO_PCM TYPENEAR(AUDIO_G711A) TYPENEAR(AUDIO_G711U);
+}
+
+} // namespace easymedia
@@ -0,0 +1,513 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLE_SSE2 1
+#endif
+
+#include "audio_convert.h"
+#include "buffer.h"
+#include "filter.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Polyphase FIR resampler, for the rational ratios of the usual rates.
+// An s16 input runs in Q15 fixed point, the other formats in float,
+// interleaved channels. The formats, and the channels of s16, are converted
+// on the way in and out by audio_convert.
+// The history of each channel is kept between the buffers, so the output
+// is continuous, and delayed by half the taps of the input rate.
+// S_RESAMPLE_DRIFT makes it follow a clock drift too, even between equal
+// rates, by slipping the phase a step now and then.
+class PolyphaseResampleFilter : public Filter {
+public:
+  PolyphaseResampleFilter(const char *param);
+  virtual ~PolyphaseResampleFilter() = default;
+  static const char *GetFilterName() { return "resample"; }
+  virtual int Process(std::shared_ptr<MediaBuffer> input,
+                      std::shared_ptr<MediaBuffer> &output) override;
+  virtual int IoCtrl(unsigned long int request, ...) override;
+
+private:
+  static const int kMaxPhases = 1024;
+  static const int kOutputBuffers = 4;
+
+  bool Init(const SampleInfo &in_info);
+  const void *ToWork(const SampleInfo &info, const void *in);
+  template <typename T>
+  int Run(const T *in, int in_frames, T *out, std::vector<T> &hist,
+          const T *c, double &first_time);
+
+  SampleInfo out_info;
+  int quality;
+
+  SampleInfo in_info;
+  // The format and channels the filter runs in, at the input rate, and
+  // those of the output, at its rate.
+  SampleInfo work_info;
+  SampleInfo dst_info;
+  std::vector<int> channel_map; // of the output, in the input
+  // Between the conversions, grown to the largest input once.
+  std::vector<uint8_t> convert_buf;
+  std::vector<uint8_t> remap_buf;
+  std::vector<uint8_t> out_buf;
+  std::vector<uint8_t> tmp_buf;
+  int up, down; // out / in rate, reduced
+  int taps;     // per phase, a multiple of 8
+  std::vector<int16_t> coefs16; // [phase][tap], in reversed time order
+  std::vector<float> coefs;
+  // Planar history of taps - 1 frames, then the input being processed.
+  std::vector<int16_t> history16;
+  std::vector<float> history;
+  int history_frames;
+  int history_len;
+  int phase;
+  int out_pos; // first frame of the next output window in the history
+
+  // Set by the control, from another thread.
+  std::atomic<bool> follow_drift;
+  std::atomic<double> drift; // out / in clock - 1
+  bool fine_phases;          // as many phases as allowed, for the drift
+  double slip;               // phase steps owed to the drift
+
+  SampleBufferPool out_pool;
+};
+
+PolyphaseResampleFilter::PolyphaseResampleFilter(const char *param)
+    : quality(1), up(0), down(0), taps(0), history_frames(0), history_len(0),
+      phase(0), out_pos(0), follow_drift(false), drift(0), fine_phases(false),
+      slip(0), out_pool(kOutputBuffers) {
+  memset(&in_info, 0, sizeof(in_info));
+  in_info.fmt = SAMPLE_FMT_NONE;
+  work_info = in_info;
+  dst_info = in_info;
+  memset(&out_info, 0, sizeof(out_info));
+  out_info.fmt = SAMPLE_FMT_NONE;
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  std::string value;
+  value = params[KEY_SAMPLE_FMT];
+  if (!value.empty())
+    out_info.fmt = StringToSampleFmt(value.c_str());
+  value = params[KEY_CHANNELS];
+  if (!value.empty())
+    out_info.channels = std::stoi(value);
+  value = params[KEY_SAMPLE_RATE];
+  if (!value.empty())
+    out_info.sample_rate = std::stoi(value);
+  value = params[KEY_RESAMPLE_QUALITY];
+  if (!value.empty())
+    quality = std::min(std::max(std::stoi(value), 0), 2);
+  if (out_info.sample_rate <= 0) {
+    LOG("resample: missing %s\n", KEY_SAMPLE_RATE);
+    SetError(-EINVAL);
+  }
+}
+
+static double BesselI0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+static int Gcd(int a, int b) {
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static bool IsS16(SampleFormat fmt) {
+  return fmt == SAMPLE_FMT_S16 || fmt == SAMPLE_FMT_S16P;
+}
+
+static bool IsConverted(SampleFormat fmt) {
+  return IsS16(fmt) || fmt == SAMPLE_FMT_S32 || fmt == SAMPLE_FMT_S32P ||
+         fmt == SAMPLE_FMT_FLT || fmt == SAMPLE_FMT_FLTP;
+}
+
+static SampleFormat Packed(SampleFormat fmt) {
+  switch (fmt) {
+  case SAMPLE_FMT_S16P:
+    return SAMPLE_FMT_S16;
+  case SAMPLE_FMT_S32P:
+    return SAMPLE_FMT_S32;
+  case SAMPLE_FMT_FLTP:
+    return SAMPLE_FMT_FLT;
+  default:
+    return fmt;
+  }
+}
+
+static void Reserve(std::vector<uint8_t> &buf, size_t size) {
+  if (buf.size() < size)
+    buf.resize(size);
+}
+
+// AudioConvert, in two steps through a packed format when both the sample
+// type and the layout change.
+static bool ConvertFormat(SampleFormat in_fmt, const void *in,
+                          SampleFormat out_fmt, void *out, int channels,
+                          size_t frames, std::vector<uint8_t> &tmp) {
+  if (AudioConvert(in_fmt, in, out_fmt, out, channels, frames))
+    return true;
+  SampleInfo mid = {Packed(in_fmt), channels, 0, 0};
+  if (mid.fmt == in_fmt)
+    mid.fmt = Packed(out_fmt);
+  Reserve(tmp, GetSampleSize(mid) * frames);
+  return AudioConvert(in_fmt, in, mid.fmt, tmp.data(), channels, frames) &&
+         AudioConvert(mid.fmt, tmp.data(), out_fmt, out, channels, frames);
+}
+
+bool PolyphaseResampleFilter::Init(const SampleInfo &info) {
+  dst_info = out_info;
+  if (dst_info.fmt == SAMPLE_FMT_NONE)
+    dst_info.fmt = info.fmt;
+  if (dst_info.channels <= 0)
+    dst_info.channels = info.channels;
+  if (!IsConverted(info.fmt) || !IsConverted(dst_info.fmt)) {
+    LOG("resample: %s -> %s not supported\n", SampleFmtToString(info.fmt),
+        SampleFmtToString(dst_info.fmt));
+    return false;
+  }
+  work_info = info;
+  // s16 gains nothing in float.
+  work_info.fmt = IsS16(info.fmt) ? SAMPLE_FMT_S16 : SAMPLE_FMT_FLT;
+  work_info.channels = dst_info.channels;
+  if (info.channels != dst_info.channels) {
+    if (work_info.fmt != SAMPLE_FMT_S16) {
+      LOG("resample: the channels of s16 only are converted\n");
+      return false;
+    }
+    // The first channels, and those of a smaller input repeated.
+    channel_map.resize(dst_info.channels);
+    for (int c = 0; c < dst_info.channels; c++)
+      channel_map[c] = c % info.channels;
+  }
+  int g = Gcd(info.sample_rate, out_info.sample_rate);
+  up = out_info.sample_rate / g;
+  down = info.sample_rate / g;
+  if (up > kMaxPhases) {
+    LOG("resample: %d -> %d needs %d phases, more than %d\n", info.sample_rate,
+        out_info.sample_rate, up, kMaxPhases);
+    return false;
+  }
+  // A drift slips the phase by a step of a fraction of an input frame,
+  // the finer the steps, the smaller the error of the slip.
+  fine_phases = follow_drift;
+  if (fine_phases) {
+    int k = kMaxPhases / up;
+    up *= k;
+    down *= k;
+  }
+  in_info = info;
+
+  // Quality: taps at the input rate, pass band and kaiser beta.
+  static const struct {
+    int taps;
+    double pass;
+    double beta;
+  } levels[] = {{8, 0.80, 5.0}, {16, 0.90, 7.0}, {32, 0.95, 9.0}};
+  const auto &level = levels[quality];
+  // Downsampling narrows the cutoff, the filter gets longer.
+  double ratio = std::max(1.0, (double)down / up);
+  taps = (int)ceil(level.taps * ratio);
+  taps = (taps + 7) & ~7;
+  int len = taps * up;
+  // Normalized to the upsampled rate.
+  double cutoff = 0.5 * level.pass / std::max(up, down);
+  std::vector<double> proto(len);
+  for (int n = 0; n < len; n++) {
+    double t = n - (len - 1) / 2.0;
+    double x = 2 * cutoff * t;
+    double sinc = fabs(x) < 1e-12 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    double r = 2.0 * n / (len - 1) - 1.0;
+    double window = BesselI0(level.beta * sqrt(std::max(0.0, 1 - r * r))) /
+                    BesselI0(level.beta);
+    proto[n] = sinc * window;
+  }
+  coefs.assign(up * taps, 0);
+  coefs16.assign(up * taps, 0);
+  for (int p = 0; p < up; p++) {
+    // Each phase sums to 1, so there is no gain ripple between them.
+    double sum = 0;
+    for (int k = 0; k < taps; k++)
+      sum += proto[p + k * up];
+    for (int k = 0; k < taps; k++) {
+      double c = proto[p + k * up] / sum;
+      coefs[p * taps + taps - 1 - k] = c;
+      coefs16[p * taps + taps - 1 - k] =
+          (int16_t)std::min(std::max(lrint(c * 32768), -32768L), 32767L);
+    }
+  }
+  history_len = taps - 1;
+  history_frames = 0;
+  history16.clear();
+  history.clear();
+  phase = 0;
+  out_pos = 0;
+  slip = 0;
+  out_pool.Clear();
+  LOG("resample: %d -> %d, %d phases of %d taps\n", in_info.sample_rate,
+      out_info.sample_rate, up, taps);
+  return true;
+}
+
+// The input in the work format and channels, converted in the buffers of
+// the filter if it is not.
+const void *PolyphaseResampleFilter::ToWork(const SampleInfo &info,
+                                           const void *in) {
+  size_t frames = info.nb_samples;
+  if (info.fmt != work_info.fmt) {
+    SampleInfo conv = {work_info.fmt, info.channels, 0, 0};
+    Reserve(convert_buf, GetSampleSize(conv) * frames);
+    if (!ConvertFormat(info.fmt, in, work_info.fmt, convert_buf.data(),
+                       info.channels, frames, tmp_buf))
+      return nullptr;
+    in = convert_buf.data();
+  }
+  if (info.channels != work_info.channels) {
+    Reserve(remap_buf, GetSampleSize(work_info) * frames);
+    AudioRemapS16((const int16_t *)in, info.channels,
+                  (int16_t *)remap_buf.data(), channel_map.data(),
+                  work_info.channels, frames);
+    in = remap_buf.data();
+  }
+  return in;
+}
+
+static inline int32_t Dot(const int16_t *x, const int16_t *c, int n) {
+  int i = 0;
+#if RESAMPLE_NEON
+  int32x4_t acc = vdupq_n_s32(0);
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t a = vld1q_s16(x + i);
+    int16x8_t b = vld1q_s16(c + i);
+    acc = vmlal_s16(acc, vget_low_s16(a), vget_low_s16(b));
+    acc = vmlal_s16(acc, vget_high_s16(a), vget_high_s16(b));
+  }
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  int32_t sum = vget_lane_s32(vpadd_s32(s, s), 0);
+#elif RESAMPLE_SSE2
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8)
+    acc = _mm_add_epi32(
+        acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + i)),
+                            _mm_loadu_si128((const __m128i *)(c + i))));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t sum = _mm_cvtsi128_si32(acc);
+#else
+  int32_t sum = 0;
+#endif
+  for (; i < n; i++)
+    sum += x[i] * c[i];
+  return sum;
+}
+
+static inline float Dot(const float *x, const float *c, int n) {
+  int i = 0;
+#if RESAMPLE_NEON
+  float32x4_t acc = vdupq_n_f32(0);
+  for (; i + 4 <= n; i += 4)
+    acc = vmlaq_f32(acc, vld1q_f32(x + i), vld1q_f32(c + i));
+  float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  float sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#elif RESAMPLE_SSE2
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(c + i)));
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  float sum = _mm_cvtss_f32(acc);
+#else
+  float sum = 0;
+#endif
+  for (; i < n; i++)
+    sum += x[i] * c[i];
+  return sum;
+}
+
+static inline int16_t Output(int32_t acc) {
+  acc = (acc + (1 << 14)) >> 15;
+  return (int16_t)std::min(std::max(acc, -32768), 32767);
+}
+
+static inline float Output(float acc) { return acc; }
+
+// Returns the frames written to out. first_time is the time of the first
+// output, in input frames from the first one of in, the filter delay not
+// counted.
+template <typename T>
+int PolyphaseResampleFilter::Run(const T *in, int in_frames, T *out,
+                                 std::vector<T> &hist, const T *c,
+                                 double &first_time) {
+  int channels = work_info.channels;
+  int need = history_len + in_frames;
+  if (need > history_frames) {
+    // Grows to the largest input once, the planes are moved along.
+    std::vector<T> grown(need * channels, 0);
+    for (int ch = 0; ch < channels && history_frames > 0; ch++)
+      memcpy(grown.data() + ch * need, hist.data() + ch * history_frames,
+             history_len * sizeof(T));
+    hist.swap(grown);
+    history_frames = need;
+  }
+  for (int ch = 0; ch < channels; ch++) {
+    T *plane = hist.data() + ch * history_frames + history_len;
+    const T *src = in + ch;
+    for (int i = 0; i < in_frames; i++, src += channels)
+      plane[i] = *src;
+  }
+  int total = need;
+  // An output is at the last frame of its window, plus phase / up.
+  first_time = out_pos + taps - 1 - history_len + (double)phase / up;
+  int pos = out_pos;
+  int written = 0;
+  // More outputs for a faster output clock, so shorter steps.
+  double slip_step = fine_phases ? -down * drift.load() : 0;
+  while (pos + taps <= total) {
+    const T *pc = c + phase * taps;
+    for (int ch = 0; ch < channels; ch++)
+      *out++ = Output(Dot(hist.data() + ch * history_frames + pos, pc, taps));
+    written++;
+    slip += slip_step;
+    int s = (int)slip;
+    slip -= s;
+    phase += down + s;
+    pos += phase / up;
+    phase %= up;
+  }
+  // Keep from pos on, at least taps - 1 frames.
+  int keep_from = std::min(pos, total - (taps - 1));
+  history_len = total - keep_from;
+  for (int ch = 0; ch < channels; ch++) {
+    T *plane = hist.data() + ch * history_frames;
+    memmove(plane, plane + keep_from, history_len * sizeof(T));
+  }
+  out_pos = pos - keep_from;
+  return written;
+}
+
+int PolyphaseResampleFilter::Process(std::shared_ptr<MediaBuffer> input,
+                            std::shared_ptr<MediaBuffer> &output) {
+  if (!input || input->GetType() != Type::Audio)
+    return -EINVAL;
+  auto src = std::static_pointer_cast<SampleBuffer>(input);
+  SampleInfo info = src->GetSampleInfo();
+  if (!follow_drift && info.sample_rate == out_info.sample_rate &&
+      (out_info.fmt == SAMPLE_FMT_NONE || out_info.fmt == info.fmt) &&
+      (out_info.channels <= 0 || out_info.channels == info.channels)) {
+    output = input;
+    return 0;
+  }
+  if (info.fmt != in_info.fmt || info.channels != in_info.channels ||
+      info.sample_rate != in_info.sample_rate || follow_drift != fine_phases) {
+    if (!Init(info))
+      return -EINVAL;
+  }
+  int in_frames = info.nb_samples;
+  if (in_frames <= 0)
+    return -EINVAL;
+
+  const void *in = ToWork(info, src->GetPtr());
+  if (!in)
+    return -EINVAL;
+  // And the outputs of a drift up to 1000 ppm.
+  int max_out =
+      (int)(((int64_t)in_frames + taps) * up / down) + in_frames / 512 + 2;
+  auto dst = out_pool.Get(max_out * GetSampleSize(dst_info), dst_info);
+  if (!dst) {
+    LOG("resample: alloc %d frames failed\n", max_out);
+    return -ENOMEM;
+  }
+  void *out = dst->GetPtr();
+  bool convert_out = dst_info.fmt != work_info.fmt;
+  if (convert_out) {
+    Reserve(out_buf, max_out * GetSampleSize(work_info));
+    out = out_buf.data();
+  }
+  double first_time = 0;
+  int written;
+  if (work_info.fmt == SAMPLE_FMT_S16)
+    written = Run((const int16_t *)in, in_frames, (int16_t *)out, history16,
+                  coefs16.data(), first_time);
+  else
+    written = Run((const float *)in, in_frames, (float *)out, history,
+                  coefs.data(), first_time);
+  if (convert_out &&
+      !ConvertFormat(work_info.fmt, out, dst_info.fmt, dst->GetPtr(),
+                     dst_info.channels, written, tmp_buf))
+    return -EINVAL;
+
+  dst->SetSamples(written);
+  // Less the delay of the filter, half its length.
+  double offset = first_time - (taps * up - 1) / (2.0 * up);
+  dst->SetUSTimeStamp(src->GetUSTimeStamp() +
+                      (int64_t)(offset * 1000000 / in_info.sample_rate));
+  output = dst;
+  return 0;
+}
+
+int PolyphaseResampleFilter::IoCtrl(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (!arg)
+    return -1;
+  switch (request) {
+  case S_RESAMPLE_DRIFT:
+    drift = std::min(std::max(*((double *)arg), -1000.0), 1000.0) * 1e-6;
+    // Init again at the next input, with the fine phases. The history is
+    // lost once, at the first drift.
+    follow_drift = true;
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+DEFINE_COMMON_FILTER_FACTORY(PolyphaseResampleFilter)
+#define RESAMPLE_PCM                                                           \
+  TYPENEAR(AUDIO_PCM_S16)                                                      \
+  TYPENEAR(AUDIO_PCM_S16P)                                                     \
+  TYPENEAR(AUDIO_PCM_S32)                                                      \
+  TYPENEAR(AUDIO_PCM_S32P)                                                     \
+  TYPENEAR(AUDIO_PCM_FLT)                                                      \
+  TYPENEAR(AUDIO_PCM_FLTP)
+
+const char *FACTORY(PolyphaseResampleFilter)::ExpectedInputDataType() {
+  return RESAMPLE_PCM;
+}
+
+const char *FACTORY(PolyphaseResampleFilter)::OutPutDataType() {
+  return RESAMPLE_PCM;
+}
+
+} // namespace easymedia
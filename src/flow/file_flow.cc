@@ -2,10 +2,17 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <sstream>
 
 #include "buffer.h"
 #include "flow.h"
+#include "io_worker.h"
 #include "stream.h"
 #include "utils.h"
 
@@ -19,21 +26,28 @@ public:
 
 private:
   void ReadThreadRun();
+  void MmapReadRun(size_t frame_size);
+  // Timestamp and pace the n-th buffer sent.
+  void Send(std::shared_ptr<MediaBuffer> &buffer);
 
   std::shared_ptr<Stream> fstream;
   std::string path;
   MediaBuffer::MemType mtype;
   size_t read_size;
   ImageInfo info;
-  int fps;
+  int64_t interval; // us per buffer, 0 sends as fast as downstream takes
   int loop_time;
   bool loop;
+  bool use_mmap;
+  int64_t start_ts;
+  int64_t sent;
   std::thread *read_thread;
 };
 
 FileReadFlow::FileReadFlow(const char *param)
-    : mtype(MediaBuffer::MemType::MEM_COMMON), read_size(0), fps(0),
-      loop_time(0), loop(false), read_thread(nullptr) {
+    : mtype(MediaBuffer::MemType::MEM_COMMON), read_size(0), interval(0),
+      loop_time(0), loop(false), use_mmap(false), start_ts(0), sent(0),
+      read_thread(nullptr) {
   memset(&info, 0, sizeof(info));
   info.pix_fmt = PIX_FMT_NONE;
   std::map<std::string, std::string> params;
@@ -67,11 +81,18 @@ FileReadFlow::FileReadFlow(const char *param)
     read_size = std::stoul(value);
   }
   value = params[KEY_FPS];
-  if (!value.empty())
-    fps = std::stoi(value);
+  if (!value.empty()) {
+    // "num" or "num/den"
+    int num = 0, den = 1;
+    if (sscanf(value.c_str(), "%d/%d", &num, &den) >= 1 && num > 0 && den > 0)
+      interval = 1000000LL * den / num;
+  }
   value = params[KEY_LOOP_TIME];
   if (!value.empty())
     loop_time = std::stoi(value);
+  value = params[KEY_FILE_MMAP];
+  if (!value.empty())
+    use_mmap = !!std::stoi(value);
   if (!SetAsSource(std::vector<int>({0}), void_transaction00, "FileReadFlow")) {
     SetError(-EINVAL);
     return;
@@ -111,6 +132,23 @@ void FileReadFlow::ReadThreadRun() {
     alloc_size = CalPixFmtSize(info.pix_fmt,
       info.width, info.height, 16);
   }
+  start_ts = gettimeofday();
+  if (use_mmap) {
+    size_t frame_size = read_size;
+    // The frames must be packed in the file to be sent as they are.
+    if (!frame_size && info.pix_fmt != PIX_FMT_FBC0 &&
+        info.pix_fmt != PIX_FMT_FBC2 && info.width == info.vir_width &&
+        info.height == info.vir_height) {
+      int num, den;
+      GetPixFmtNumDen(info.pix_fmt, num, den);
+      frame_size = info.width * info.height * num / den;
+    }
+    if (frame_size) {
+      MmapReadRun(frame_size);
+      return;
+    }
+    LOG("FileReadFlow: padded image, mmap disabled\n");
+  }
   while (loop) {
     if (fstream->Eof()) {
       if (loop_time-- > 0) {
@@ -153,11 +191,99 @@ void FileReadFlow::ReadThreadRun() {
         }
       }
     }
+    Send(buffer);
+  }
+}
+
+void FileReadFlow::Send(std::shared_ptr<MediaBuffer> &buffer) {
+  if (!interval) {
     buffer->SetUSTimeStamp(gettimeofday());
     SendInput(buffer, 0);
-    if (fps != 0) {
-      static int interval = 1000 / fps;
-      msleep(interval);
+    return;
+  }
+  // Paced on the start time rather than by sleeping an interval, so the
+  // time to read and send does not add up; the timestamps are exact.
+  int64_t due = start_ts + sent * interval;
+  int64_t now = gettimeofday();
+  if (due > now) {
+    usleep(due - now);
+  } else if (now - due > 1000000) {
+    // Too late, do not burst to catch up.
+    start_ts = now - sent * interval;
+    due = now;
+  }
+  buffer->SetUSTimeStamp(due);
+  SendInput(buffer, 0);
+  sent++;
+}
+
+void FileReadFlow::MmapReadRun(size_t frame_size) {
+  const size_t page_mask = ~(size_t)(getpagesize() - 1);
+  // Read ahead this many frames, and at least 1MB.
+  const size_t window = std::max<size_t>(frame_size * 4, 1 << 20) & page_mask;
+  bool is_image = (info.pix_fmt != PIX_FMT_NONE);
+  while (loop) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0) {
+      LOG("FileReadFlow: fail to open %s, %m\n", path.c_str());
+      if (fd >= 0)
+        close(fd);
+      SetDisable();
+      return;
+    }
+    size_t size = st.st_size;
+    // Private and writable: a downstream writing in place copies the page
+    // instead of changing the file. Mapped again on each loop, so that the
+    // next loop reads the file again.
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      LOG("FileReadFlow: fail to mmap %s, %m\n", path.c_str());
+      SetDisable();
+      return;
+    }
+    // Unmapped with the last buffer sent.
+    std::shared_ptr<void> mapping(addr,
+                                  [size](void *p) { munmap(p, size); });
+    madvise(addr, size, MADV_SEQUENTIAL);
+    uint8_t *base = (uint8_t *)addr;
+    size_t offset = 0, prefetched = 0;
+    while (loop) {
+      size_t len = std::min(frame_size, size - offset);
+      // A partial image at the end is not sent.
+      if (offset >= size || (is_image && len < frame_size))
+        break;
+      if (offset + len > prefetched || prefetched - offset < window / 2) {
+        size_t start = std::max(prefetched, offset & page_mask);
+        size_t end = std::min(start + window, size);
+        madvise(base + start, end - start, MADV_WILLNEED);
+        prefetched = end;
+      }
+      std::shared_ptr<MediaBuffer> buffer;
+      if (mtype == MediaBuffer::MemType::MEM_COMMON) {
+        buffer = std::make_shared<MediaBuffer>(base + offset, len);
+        buffer->SetUserData(mapping);
+      } else {
+        // Hardware buffers are wanted, copy from the mapping.
+        buffer = MediaBuffer::Alloc(len, mtype);
+        if (!buffer) {
+          LOG_NO_MEMORY();
+          break;
+        }
+        memcpy(buffer->GetPtr(), base + offset, len);
+      }
+      buffer->SetValidSize(len);
+      if (is_image)
+        buffer = std::make_shared<ImageBuffer>(*buffer.get(), info);
+      offset += len;
+      Send(buffer);
+    }
+    if (!loop)
+      break;
+    if (loop_time-- <= 0) {
+      NotifyToEventHandler(MSG_FLOW_EVENT_INFO_EOS);
+      break;
     }
   }
 }
@@ -181,9 +307,13 @@ public:
 
 private:
   friend bool save_buffer(Flow *f, MediaBufferVector &input_vector);
+  // A new file at new_path if not empty.
+  bool WriteBuffer(std::shared_ptr<MediaBuffer> &buffer, std::string new_path);
 
 private:
   std::shared_ptr<Stream> fstream;
+  // Write-behind, if io_queue_size is set.
+  std::unique_ptr<IoWorker> io_worker;
   std::string path;
   std::string save_mode;
   std::string file_path;
@@ -249,12 +379,21 @@ FileWriteFlow::FileWriteFlow(const char *param)
   PARAM_STRING_APPEND(s, KEY_PATH, path);
   PARAM_STRING_APPEND(s, KEY_OPEN_MODE, value);
   PARAM_STRING_APPEND(s, KEY_SAVE_MODE, save_mode);
+  value = params[KEY_PREALLOC_SIZE];
+  if (!value.empty())
+    PARAM_STRING_APPEND(s, KEY_PREALLOC_SIZE, value);
+  value = params[KEY_SYNC_SIZE];
+  if (!value.empty())
+    PARAM_STRING_APPEND(s, KEY_SYNC_SIZE, value);
   fstream = REFLECTOR(Stream)::Create<Stream>("file_write_stream", s.c_str());
   if (!fstream) {
     fprintf(stderr, "Create stream file_write_stream failed\n");
     SetError(-EINVAL);
     return;
   }
+  value = params[KEY_IO_QUEUE_SIZE];
+  if (!value.empty() && std::stoul(value) > 0)
+    io_worker.reset(new IoWorker("FileWriteIO", std::stoul(value)));
 
   SlotMap sm;
   sm.input_slots.push_back(0);
@@ -272,21 +411,47 @@ FileWriteFlow::FileWriteFlow(const char *param)
 
 FileWriteFlow::~FileWriteFlow() {
   StopAllThread();
+  // Write what is still queued.
+  io_worker.reset();
   fstream.reset();
 }
 
+bool FileWriteFlow::WriteBuffer(std::shared_ptr<MediaBuffer> &buffer,
+                                std::string new_path) {
+  if (!new_path.empty()) {
+    fstream->NewStream(new_path);
+    return fstream->WriteAndClose(buffer->GetPtr(), 1, buffer->GetValidSize());
+  } else {
+    return fstream->Write(buffer->GetPtr(), 1, buffer->GetValidSize());
+  }
+}
+
 bool save_buffer(Flow *f, MediaBufferVector &input_vector) {
   FileWriteFlow *flow = static_cast<FileWriteFlow *>(f);
   auto &buffer = input_vector[0];
   if (!buffer)
     return true;
 
-  if (flow->GetSaveMode() == KEY_SAVE_MODE_SINGLE) {
-    flow->fstream->NewStream(flow->GenFilePath());
-    return flow->fstream->WriteAndClose(buffer->GetPtr(), 1, buffer->GetValidSize());
-  } else {
-    return flow->fstream->Write(buffer->GetPtr(), 1, buffer->GetValidSize());
+  // The file name takes the time of the buffer arrival.
+  std::string path;
+  if (flow->GetSaveMode() == KEY_SAVE_MODE_SINGLE)
+    path = flow->GenFilePath();
+  if (!flow->io_worker)
+    return flow->WriteBuffer(buffer, path);
+
+  std::shared_ptr<MediaBuffer> mb = buffer;
+  if (mb->IsHwBuffer()) {
+    // hardware buffer is limited, copy it rather than queue it
+    mb = MediaBuffer::Clone(*buffer.get());
+    if (!mb)
+      return true;
   }
+  if (!flow->io_worker->Post([flow, mb, path]() mutable {
+        flow->WriteBuffer(mb, path);
+      }, buffer->GetValidSize()))
+    LOG("FileWriteFlow: I/O queue full, drop %d bytes\n",
+        (int)buffer->GetValidSize());
+  return true;
 }
 
 DEFINE_FLOW_FACTORY(FileWriteFlow, Flow)
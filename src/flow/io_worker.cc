@@ -0,0 +1,78 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "io_worker.h"
+
+#include <sys/prctl.h>
+
+#include "utils.h"
+
+namespace easymedia {
+
+IoWorker::IoWorker(const char *thread_name, size_t max_queued_bytes)
+    : name(thread_name), max_bytes(max_queued_bytes), queued_bytes(0),
+      running(false), quit(false), thread(nullptr) {
+  thread = new std::thread(&IoWorker::Run, this);
+}
+
+IoWorker::~IoWorker() {
+  mtx.lock();
+  quit = true;
+  mtx.notify();
+  mtx.unlock();
+  if (thread) {
+    thread->join();
+    delete thread;
+  }
+}
+
+bool IoWorker::Post(const std::function<void()> &job, size_t bytes) {
+  AutoLockMutex _alm(mtx);
+  if (bytes > 0 && queued_bytes + bytes > max_bytes)
+    return false;
+  jobs.push_back({job, bytes});
+  queued_bytes += bytes;
+  mtx.notify();
+  return true;
+}
+
+void IoWorker::Flush() {
+  AutoLockMutex _alm(mtx);
+  while (!jobs.empty() || running)
+    mtx.wait();
+}
+
+size_t IoWorker::QueuedBytes() {
+  AutoLockMutex _alm(mtx);
+  return queued_bytes;
+}
+
+void IoWorker::Run() {
+  prctl(PR_SET_NAME, name.c_str());
+  mtx.lock();
+  for (;;) {
+    if (jobs.empty()) {
+      if (quit)
+        break;
+      mtx.wait();
+      continue;
+    }
+    std::list<Job> job;
+    job.splice(job.begin(), jobs, jobs.begin());
+    running = true;
+    mtx.unlock();
+    job.front().func();
+    size_t bytes = job.front().bytes;
+    // What the job holds is released here, not in the posting thread.
+    job.clear();
+    mtx.lock();
+    queued_bytes -= bytes;
+    running = false;
+    // For Flush.
+    mtx.notify();
+  }
+  mtx.unlock();
+}
+
+} // namespace easymedia
@@ -0,0 +1,54 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_IO_WORKER_H_
+#define EASYMEDIA_IO_WORKER_H_
+
+#include <functional>
+#include <list>
+#include <string>
+#include <thread>
+
+#include "lock.h"
+
+namespace easymedia {
+
+// A thread running file jobs in order, so that slow storage does not
+// block the flow thread. The jobs that write data are bounded by their
+// bytes, the others (open, close) are always queued.
+class IoWorker {
+public:
+  IoWorker(const char *name, size_t max_bytes);
+  // Runs the jobs left before returning.
+  ~IoWorker();
+  IoWorker(const IoWorker &) = delete;
+  IoWorker &operator=(const IoWorker &) = delete;
+
+  // Returns false, and drops job, if queuing bytes more would exceed
+  // max_bytes. The job is destroyed in the worker thread.
+  bool Post(const std::function<void()> &job, size_t bytes = 0);
+  // Wait until the jobs posted so far have run.
+  void Flush();
+  size_t QueuedBytes();
+
+private:
+  struct Job {
+    std::function<void()> func;
+    size_t bytes;
+  };
+  void Run();
+
+  std::string name;
+  size_t max_bytes;
+  ConditionLockMutex mtx;
+  std::list<Job> jobs;
+  size_t queued_bytes;
+  bool running; // a job is out of the list
+  bool quit;
+  std::thread *thread;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_IO_WORKER_H_
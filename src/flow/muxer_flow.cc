@@ -17,6 +17,7 @@
 #include "stdio.h"
 #include "unistd.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace easymedia {
@@ -53,7 +54,9 @@ static int muxer_buffer_callback(void *handler, uint8_t *buf, int buf_size) {
 MuxerFlow::MuxerFlow(const char *param)
     : video_recorder(nullptr), video_in(false), audio_in(false),
       file_duration(-1), file_index(-1), last_ts(0), file_time_en(false),
-      enable_streaming(true) {
+      enable_streaming(true), pre_record_bytes(0), pre_record_time(0),
+      pre_record_max_bytes(0), io_failed(false), io_wait_intra(false),
+      storage_quota(0), storage_reserve(0), segment_prealloc(0) {
   std::list<std::string> separate_list;
   std::map<std::string, std::string> params;
 
@@ -116,8 +119,48 @@ MuxerFlow::MuxerFlow(const char *param)
   }
   LOG("Muxer:: enable_streaming is %d\n", enable_streaming);
 
+  std::string &pre_record_time_str = params[KEY_PRE_RECORD_TIME];
+  if (!pre_record_time_str.empty())
+    pre_record_time = std::stoll(pre_record_time_str) * 1000000;
+  std::string &pre_record_size_str = params[KEY_PRE_RECORD_SIZE];
+  if (!pre_record_size_str.empty())
+    pre_record_max_bytes = std::stoul(pre_record_size_str);
+  if (pre_record_time > 0 || pre_record_max_bytes > 0)
+    LOG("Muxer:: pre record %" PRId64 "sec, %d bytes\n",
+        pre_record_time / 1000000, (int)pre_record_max_bytes);
+
   ffmpeg_avdictionary = params[KEY_MUXER_FFMPEG_AVDICTIONARY];
 
+  std::string &io_queue_str = params[KEY_IO_QUEUE_SIZE];
+  if (!io_queue_str.empty() && std::stoul(io_queue_str) > 0) {
+    // Custom IO outputs in the flow, keep it on the flow thread.
+    if (is_use_customio)
+      LOG("Muxer:: io_queue_size ignored with CustomIO.\n");
+    else
+      io_worker.reset(new IoWorker("MuxerIO", std::stoul(io_queue_str)));
+  }
+
+  std::string &quota_str = params[KEY_STORAGE_QUOTA];
+  if (!quota_str.empty())
+    storage_quota = std::stoull(quota_str);
+  std::string &reserve_str = params[KEY_STORAGE_RESERVE];
+  if (!reserve_str.empty())
+    storage_reserve = std::stoull(reserve_str);
+  std::string &prealloc_str = params[KEY_PREALLOC_SIZE];
+  if (!prealloc_str.empty())
+    segment_prealloc = std::stoull(prealloc_str);
+  if (storage_quota > 0 || storage_reserve > 0) {
+    if (is_use_customio || file_prefix.empty()) {
+      LOG("Muxer:: loop recording needs path and file_prefix.\n");
+    } else {
+      storage = GetStorage();
+      // Deleting old segments and syncing the index at each new segment
+      // must not hold the flow thread either.
+      if (!io_worker)
+        io_worker.reset(new IoWorker("MuxerIO", kStorageIoQueueSize));
+    }
+  }
+
   for (auto param_str : separate_list) {
     MediaConfig enc_config;
     std::map<std::string, std::string> enc_params;
@@ -165,7 +208,70 @@ MuxerFlow::MuxerFlow(const char *param)
   SetFlowTag("MuxerFlow");
 }
 
-MuxerFlow::~MuxerFlow() { StopAllThread(); }
+MuxerFlow::~MuxerFlow() {
+  StopAllThread();
+  CloseRecorder();
+  // Write what is still queued.
+  io_worker.reset();
+}
+
+void MuxerFlow::CloseRecorder() {
+  if (!video_recorder)
+    return;
+  std::shared_ptr<VideoRecorder> recorder = video_recorder;
+  std::shared_ptr<StorageManager> sm = storage;
+  std::string path = recorder_path;
+  int64_t end_time = time(NULL);
+  video_recorder.reset();
+  auto close = [recorder, sm, path, end_time]() mutable {
+    recorder.reset();
+    if (sm)
+      sm->CloseSegment(path, end_time);
+  };
+  // The last reference goes in the worker, after the queued writes.
+  if (io_worker)
+    io_worker->Post(close);
+  else
+    close();
+}
+
+std::shared_ptr<StorageManager> MuxerFlow::GetStorage() {
+  if (storage && storage->GetDir() == file_path &&
+      storage->GetPrefix() == file_prefix)
+    return storage;
+  auto sm = std::make_shared<StorageManager>(
+      file_path, file_prefix, storage_quota, storage_reserve,
+      segment_prealloc);
+  sm->Scan();
+  return sm;
+}
+
+bool MuxerFlow::OpenRecorder() {
+  recorder_path = GenFilePath();
+  // file_path or file_prefix may have been changed by Control.
+  if (storage)
+    std::atomic_store(&storage, GetStorage());
+  if (storage && !io_worker && !storage->OpenSegment(recorder_path, time(NULL)))
+    return false;
+  video_recorder = NewRecorder(recorder_path.c_str());
+  if (!video_recorder) {
+    if (storage && !io_worker)
+      storage->CloseSegment(recorder_path, time(NULL));
+    return false;
+  }
+  if (storage && io_worker) {
+    // Ahead of the writes of the recorder, which fail if there is no room.
+    std::shared_ptr<StorageManager> sm = storage;
+    std::shared_ptr<VideoRecorder> recorder = video_recorder;
+    std::string path = recorder_path;
+    int64_t start_time = time(NULL);
+    io_worker->Post([sm, recorder, path, start_time]() {
+      if (!sm->OpenSegment(path, start_time))
+        recorder->SetFailed();
+    });
+  }
+  return true;
+}
 
 std::shared_ptr<VideoRecorder> MuxerFlow::NewRecorder(const char *path) {
   std::string param = std::string(muxer_param);
@@ -174,6 +280,9 @@ std::shared_ptr<VideoRecorder> MuxerFlow::NewRecorder(const char *path) {
   PARAM_STRING_APPEND(param, KEY_PATH, path);
   PARAM_STRING_APPEND(param, KEY_MUXER_FFMPEG_AVDICTIONARY,
                       ffmpeg_avdictionary);
+  // Keep the space allocated by the storage manager.
+  if (storage && segment_prealloc > 0)
+    PARAM_STRING_APPEND_TO(param, KEY_FILE_TRUNCATE, 0);
 
   if (is_use_customio) {
     vrecorder = std::make_shared<VideoRecorder>(param.c_str(), this);
@@ -265,6 +374,28 @@ int MuxerFlow::Control(unsigned long int request, ...) {
     if (!prefix.empty())
       file_prefix = prefix;
   } break;
+  case S_MUXER_SEGMENT_FLAGS: {
+    uint32_t flags = va_arg(vl, uint32_t);
+    auto sm = std::atomic_load(&storage);
+    if (!sm)
+      ret = -1;
+    else if (io_worker)
+      // After the OpenSegment of a cut, which may still be queued.
+      io_worker->Post([sm, flags]() { sm->MarkSegment(flags); });
+    else
+      sm->MarkSegment(flags);
+  } break;
+  case G_MUXER_SEGMENTS: {
+    int64_t start_time = va_arg(vl, int64_t);
+    int64_t end_time = va_arg(vl, int64_t);
+    MuxerSegmentInfo *infos = va_arg(vl, MuxerSegmentInfo *);
+    int *num = va_arg(vl, int *);
+    auto sm = std::atomic_load(&storage);
+    if (sm && num)
+      *num = sm->Lookup(start_time, end_time, infos, *num);
+    else
+      ret = -1;
+  } break;
   default:
     ret = -1;
     break;
@@ -278,15 +409,73 @@ void MuxerFlow::StartStream() { enable_streaming = true; }
 
 void MuxerFlow::StopStream() { enable_streaming = false; }
 
+static bool IsVideoIntra(const std::shared_ptr<MediaBuffer> &buffer) {
+  return buffer->GetType() == Type::Video &&
+         (buffer->GetUserFlag() & MediaBuffer::kIntra);
+}
+
+void MuxerFlow::PreRecord(std::shared_ptr<MediaBuffer> &buffer) {
+  bool intra = IsVideoIntra(buffer);
+  // The file has to start with an IDR.
+  if (pre_record.empty() && !intra)
+    return;
+  std::shared_ptr<MediaBuffer> mb = buffer;
+  if (mb->IsHwBuffer()) {
+    // hardware buffer is limited, copy it
+    mb = MediaBuffer::Clone(*buffer.get());
+    if (!mb)
+      return;
+  }
+  pre_record.push_back(mb);
+  pre_record_bytes += mb->GetValidSize();
+
+  bool over_size = pre_record_max_bytes > 0 &&
+                   pre_record_bytes > pre_record_max_bytes;
+  if (!intra && !over_size)
+    return;
+  // Drop the oldest GOP while the others still cover the time, or while
+  // the size is over.
+  while (pre_record.size() > 1) {
+    auto next = std::find_if(pre_record.begin() + 1, pre_record.end(),
+                             IsVideoIntra);
+    if (next == pre_record.end())
+      break;
+    int64_t covered =
+        pre_record.back()->GetUSTimeStamp() - (*next)->GetUSTimeStamp();
+    if (!(pre_record_time > 0 && covered >= pre_record_time) && !over_size)
+      break;
+    while (pre_record.begin() != next) {
+      pre_record_bytes -= pre_record.front()->GetValidSize();
+      pre_record.pop_front();
+    }
+    over_size = pre_record_max_bytes > 0 &&
+                pre_record_bytes > pre_record_max_bytes;
+  }
+  if (over_size) {
+    // A single GOP is over the size, start again from the next IDR.
+    pre_record.clear();
+    pre_record_bytes = 0;
+  }
+}
+
 bool save_buffer(Flow *f, MediaBufferVector &input_vector) {
   MuxerFlow *flow = static_cast<MuxerFlow *>(f);
   auto &&recorder = flow->video_recorder;
   int64_t duration_us = flow->file_duration;
 
+  if (flow->io_failed) {
+    flow->io_failed = false;
+    flow->CloseRecorder();
+    flow->enable_streaming = false;
+  }
+
   if (!flow->enable_streaming) {
-    if (recorder) {
-      recorder.reset();
-      recorder = nullptr;
+    flow->CloseRecorder();
+    if (flow->pre_record_time > 0 || flow->pre_record_max_bytes > 0) {
+      if (flow->audio_in && input_vector[1])
+        flow->PreRecord(input_vector[1]);
+      if (flow->video_in && input_vector[0])
+        flow->PreRecord(input_vector[0]);
     }
     return true;
   }
@@ -306,83 +495,107 @@ bool save_buffer(Flow *f, MediaBufferVector &input_vector) {
     if (!(vid_buffer->GetUserFlag() & MediaBuffer::kIntra))
       break;
     if (vid_buffer->GetUSTimeStamp() - flow->last_ts >= duration_us * 1000000) {
-      recorder.reset();
-      recorder = nullptr;
+      flow->CloseRecorder();
       flow->video_extra = nullptr;
     }
   } while (0);
 
   if (recorder == nullptr) {
-    recorder = flow->NewRecorder(flow->GenFilePath().c_str());
     flow->last_ts = 0;
-    if (recorder == nullptr)
+    flow->io_wait_intra = false;
+    if (!flow->OpenRecorder()) {
       flow->enable_streaming = false;
-  }
-
-  // process audio stream here
-  do {
-    if (!flow->audio_in) {
-      break;
+      return true;
     }
-
-    auto &aud_buffer = input_vector[1];
-
-    if (aud_buffer == nullptr) {
-      break;
+    // The buffers before the event go first.
+    while (!flow->pre_record.empty()) {
+      auto buffer = flow->pre_record.front();
+      flow->pre_record.pop_front();
+      if (!flow->WriteBuffer(buffer)) {
+        flow->pre_record.clear();
+        flow->pre_record_bytes = 0;
+        return true;
+      }
     }
+    flow->pre_record_bytes = 0;
+  }
 
-    if (!recorder->Write(flow, aud_buffer)) {
-      recorder.reset();
-      flow->enable_streaming = false;
-      return true;
-    }
-  } while (0);
+  // process audio stream here
+  if (flow->audio_in && input_vector[1] &&
+      !flow->WriteBuffer(input_vector[1]))
+    return true;
 
   // process video stream here
-  do {
-    if (!flow->video_in) {
-      break;
-    }
+  if (flow->video_in && input_vector[0])
+    flow->WriteBuffer(input_vector[0]);
 
-    auto &vid_buffer = input_vector[0];
+  return true;
+}
 
-    if (vid_buffer == nullptr) {
-      break;
-    }
+bool MuxerFlow::WriteBuffer(std::shared_ptr<MediaBuffer> &buffer) {
+  if (buffer->GetType() == Type::Video && !video_extra &&
+      (buffer->GetUserFlag() & MediaBuffer::kIntra)) {
+    CodecType c_type = vid_enc_config.vid_cfg.image_cfg.codec_type;
+    int extra_size = 0;
+    void *extra_ptr = NULL;
+    if (c_type == CODEC_TYPE_H264)
+      extra_ptr = GetSpsPpsFromBuffer(buffer, extra_size, c_type);
+    else if (c_type == CODEC_TYPE_H265)
+      extra_ptr = GetVpsSpsPpsFromBuffer(buffer, extra_size, c_type);
+
+    if (extra_ptr && (extra_size > 0)) {
+      video_extra = MediaBuffer::Alloc(extra_size);
+      if (!video_extra) {
+        LOG_NO_MEMORY();
+        return true;
+      }
+      memcpy(video_extra->GetPtr(), extra_ptr, extra_size);
+      video_extra->SetValidSize(extra_size);
+    } else
+      LOG("ERROR: Muxer Flow: Intra Frame without sps pps\n");
+  }
 
-    if (!flow->video_extra &&
-        (vid_buffer->GetUserFlag() & MediaBuffer::kIntra)) {
-      CodecType c_type = flow->vid_enc_config.vid_cfg.image_cfg.codec_type;
-      int extra_size = 0;
-      void *extra_ptr = NULL;
-      if (c_type == CODEC_TYPE_H264)
-        extra_ptr = GetSpsPpsFromBuffer(vid_buffer, extra_size, c_type);
-      else if (c_type == CODEC_TYPE_H265)
-        extra_ptr = GetVpsSpsPpsFromBuffer(vid_buffer, extra_size, c_type);
-
-      if (extra_ptr && (extra_size > 0)) {
-        flow->video_extra = MediaBuffer::Alloc(extra_size);
-        if (!flow->video_extra) {
-          LOG_NO_MEMORY();
-          break;
-        }
-        memcpy(flow->video_extra->GetPtr(), extra_ptr, extra_size);
-        flow->video_extra->SetValidSize(extra_size);
-      } else
-        LOG("ERROR: Muxer Flow: Intra Frame without sps pps\n");
+  if (io_worker) {
+    bool video = (buffer->GetType() == Type::Video);
+    if (video && io_wait_intra) {
+      if (!(buffer->GetUserFlag() & MediaBuffer::kIntra))
+        return true;
+      io_wait_intra = false;
     }
-
-    if (!recorder->Write(flow, vid_buffer)) {
-      recorder.reset();
-      flow->enable_streaming = false;
-      return true;
+    std::shared_ptr<VideoRecorder> recorder = video_recorder;
+    std::shared_ptr<MediaBuffer> extra = video_extra;
+    std::shared_ptr<MediaBuffer> mb = buffer;
+    if (mb->IsHwBuffer()) {
+      // hardware buffer is limited, copy it rather than queue it
+      mb = MediaBuffer::Clone(*buffer.get());
+      if (!mb) {
+        if (video)
+          io_wait_intra = true;
+        return true;
+      }
     }
-
-    if (flow->last_ts == 0 || vid_buffer->GetUSTimeStamp() < flow->last_ts) {
-      flow->last_ts = vid_buffer->GetUSTimeStamp();
+    MuxerFlow *flow = this;
+    if (!io_worker->Post(
+            [recorder, mb, extra, flow]() {
+              if (!recorder->Write(flow, mb, extra))
+                flow->io_failed = true;
+            },
+            buffer->GetValidSize())) {
+      LOG("Muxer:: I/O queue full, drop %s buffer\n",
+          video ? "video" : "audio");
+      if (video)
+        io_wait_intra = true;
+      return true;
     }
+  } else if (!video_recorder->Write(this, buffer, video_extra)) {
+    video_recorder.reset();
+    enable_streaming = false;
+    return false;
+  }
 
-  } while (0);
+  if (buffer->GetType() == Type::Video &&
+      (last_ts == 0 || buffer->GetUSTimeStamp() < last_ts))
+    last_ts = buffer->GetUSTimeStamp();
 
   return true;
 }
@@ -392,15 +605,31 @@ const char *FACTORY(MuxerFlow)::ExpectedInputDataType() { return nullptr; }
 const char *FACTORY(MuxerFlow)::OutPutDataType() { return ""; }
 
 VideoRecorder::VideoRecorder(const char *param, Flow *f)
-    : vid_stream_id(-1), aud_stream_id(-1), muxer_flow(f) {
+    : vid_stream_id(-1), aud_stream_id(-1), muxer_flow(f), failed(false) {
+  std::map<std::string, std::string> params;
+  parse_media_param_map(param, params);
+  // The native fmp4 muxer returns whole fragments, ffmpeg calls back with
+  // the chunks of its avio.
+  fragmented = (params[KEY_OUTPUTDATATYPE] == MUXER_FMP4);
+  const char *muxer_name = fragmented ? MUXER_FMP4 : "ffmpeg";
   muxer =
-      easymedia::REFLECTOR(Muxer)::Create<easymedia::Muxer>("ffmpeg", param);
+      easymedia::REFLECTOR(Muxer)::Create<easymedia::Muxer>(muxer_name, param);
   if (!muxer) {
-    LOG("Create muxer ffmpeg failed\n");
+    LOG("Create muxer %s failed\n", muxer_name);
     exit(EXIT_FAILURE);
   }
-  if (muxer_flow != nullptr)
+  if (fragmented) {
+    // Opened by the first Write, which may run in the I/O thread after the
+    // storage manager created the file.
+    if (muxer_flow == nullptr) {
+      PARAM_STRING_APPEND(file_param, KEY_PATH, params[KEY_PATH]);
+      // The storage manager created the file with its space allocated.
+      PARAM_STRING_APPEND(file_param, KEY_OPEN_MODE,
+                          params[KEY_FILE_TRUNCATE] == "0" ? "r+e" : "we");
+    }
+  } else if (muxer_flow != nullptr) {
     muxer->SetWriteCallback(muxer_flow, &muxer_buffer_callback);
+  }
 }
 
 VideoRecorder::~VideoRecorder() {
@@ -408,7 +637,8 @@ VideoRecorder::~VideoRecorder() {
     auto buffer = easymedia::MediaBuffer::Alloc(1);
     buffer->SetEOF(true);
     buffer->SetValidSize(0);
-    muxer->Write(buffer, vid_stream_id);
+    auto out = muxer->Write(buffer, vid_stream_id);
+    Output(out);
   }
 
   if (muxer) {
@@ -416,15 +646,34 @@ VideoRecorder::~VideoRecorder() {
   }
 }
 
+void VideoRecorder::Output(const std::shared_ptr<MediaBuffer> &buffer) {
+  // The muxer wrote to its io stream if there is no flow.
+  if (!fragmented || !muxer_flow || !buffer || buffer->GetValidSize() == 0)
+    return;
+  static_cast<MuxerFlow *>(muxer_flow)->SetOutput(buffer, 0);
+}
+
 void VideoRecorder::ClearStream() {
   vid_stream_id = -1;
   aud_stream_id = -1;
 }
 
-bool VideoRecorder::Write(MuxerFlow *f, std::shared_ptr<MediaBuffer> buffer) {
+bool VideoRecorder::Write(MuxerFlow *f, std::shared_ptr<MediaBuffer> buffer,
+                          std::shared_ptr<MediaBuffer> video_extra) {
   MuxerFlow *flow = static_cast<MuxerFlow *>(f);
-  if (flow->video_in && flow->video_extra && vid_stream_id == -1) {
-    if (!muxer->NewMuxerStream(flow->vid_enc_config, flow->video_extra,
+  if (failed)
+    return false;
+  if (!file_param.empty()) {
+    auto file = REFLECTOR(Stream)::Create<Stream>("file_write_stream",
+                                                  file_param.c_str());
+    if (file)
+      muxer->SetIoStream(file);
+    else
+      LOG("Fail to open file of %s\n", file_param.c_str());
+    file_param.clear();
+  }
+  if (flow->video_in && video_extra && vid_stream_id == -1) {
+    if (!muxer->NewMuxerStream(flow->vid_enc_config, video_extra,
                                vid_stream_id)) {
       LOG("NewMuxerStream failed for video\n");
     } else {
@@ -446,20 +695,25 @@ bool VideoRecorder::Write(MuxerFlow *f, std::shared_ptr<MediaBuffer> buffer) {
       ClearStream();
       return false;
     }
+    Output(header);
   }
 
   if (buffer->GetType() == Type::Video && vid_stream_id != -1) {
-    if (nullptr == muxer->Write(buffer, vid_stream_id)) {
+    auto out = muxer->Write(buffer, vid_stream_id);
+    if (nullptr == out) {
       LOG("Write on video stream return nullptr\n");
       ClearStream();
       return false;
     }
+    Output(out);
   } else if (buffer->GetType() == Type::Audio && aud_stream_id != -1) {
-    if (nullptr == muxer->Write(buffer, aud_stream_id)) {
+    auto out = muxer->Write(buffer, aud_stream_id);
+    if (nullptr == out) {
       LOG("Write on audio stream return nullptr\n");
       ClearStream();
       return false;
     }
+    Output(out);
   }
 
   return true;
@@ -7,9 +7,14 @@
 
 #include <sys/time.h>
 
+#include <atomic>
+#include <deque>
+
 #include "buffer.h"
 #include "flow.h"
+#include "io_worker.h"
 #include "muxer.h"
+#include "storage_manager.h"
 #include "utils.h"
 
 #include "fcntl.h"
@@ -39,6 +44,16 @@ public:
 
 private:
   std::shared_ptr<VideoRecorder> NewRecorder(const char *path);
+  // Keep buffer in the pre-record ring, which holds whole GOPs.
+  void PreRecord(std::shared_ptr<MediaBuffer> &buffer);
+  // Write buffer with video_recorder, false if it failed.
+  bool WriteBuffer(std::shared_ptr<MediaBuffer> &buffer);
+  // Release video_recorder, which writes the trailer and closes the file.
+  void CloseRecorder();
+  // Create video_recorder in a new file, false if it failed.
+  bool OpenRecorder();
+  // Loop recording in the current file_path, by file_prefix.
+  std::shared_ptr<StorageManager> GetStorage();
   friend bool save_buffer(Flow *f, MediaBufferVector &input_vector);
   friend int muxer_buffer_callback(void *handler, uint8_t *buf, int buf_size);
 
@@ -61,6 +76,26 @@ private:
   bool is_use_customio;
   std::string GenFilePath();
   bool enable_streaming;
+  // Pre-event recording, disabled if both limits are 0.
+  std::deque<std::shared_ptr<MediaBuffer>> pre_record;
+  size_t pre_record_bytes;
+  int64_t pre_record_time; // us
+  size_t pre_record_max_bytes;
+  // The recorder runs in io_worker if io_queue_size is set: its writes,
+  // file open and close do not hold the flow thread.
+  std::unique_ptr<IoWorker> io_worker;
+  // Of the I/O thread that loop recording starts without io_queue_size.
+  static const size_t kStorageIoQueueSize = 4 * 1024 * 1024;
+  std::atomic<bool> io_failed;
+  // Video dropped on a full queue, skip until the next IDR.
+  bool io_wait_intra;
+  // Loop recording, if storage_quota or storage_reserve is set.
+  // Replaced on the flow thread only, read by Control with atomic_load.
+  std::shared_ptr<StorageManager> storage;
+  uint64_t storage_quota;
+  uint64_t storage_reserve;
+  uint64_t segment_prealloc;
+  std::string recorder_path;
 };
 
 class VideoRecorder {
@@ -68,14 +103,23 @@ public:
   VideoRecorder(const char *param, Flow *f);
   ~VideoRecorder();
 
-  bool Write(MuxerFlow *f, std::shared_ptr<MediaBuffer> buffer);
+  bool Write(MuxerFlow *f, std::shared_ptr<MediaBuffer> buffer,
+             std::shared_ptr<MediaBuffer> video_extra);
+  // The file could not be made room for, the writes fail.
+  void SetFailed() { failed = true; }
 
 private:
   std::shared_ptr<Muxer> muxer;
   int vid_stream_id;
   int aud_stream_id;
   void ClearStream();
+  // Send what the fmp4 muxer returned to the flow output.
+  void Output(const std::shared_ptr<MediaBuffer> &buffer);
   Flow *muxer_flow;
+  bool fragmented;
+  // The file stream of the fmp4 muxer, not opened yet.
+  std::string file_param;
+  std::atomic<bool> failed;
 };
 } // namespace easymedia
 
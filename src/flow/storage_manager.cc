@@ -0,0 +1,262 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "storage_manager.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "utils.h"
+
+namespace easymedia {
+
+static const char *kSegmentSuffix = ".mp4";
+
+static bool HasSuffix(const std::string &s, const char *suffix) {
+  size_t len = strlen(suffix);
+  return s.size() >= len && !s.compare(s.size() - len, len, suffix);
+}
+
+// Bytes used on the disk, which counts the space allocated ahead.
+static uint64_t AllocatedSize(const struct stat &st) {
+  return std::max((uint64_t)st.st_size, (uint64_t)st.st_blocks * 512);
+}
+
+StorageManager::StorageManager(const std::string &dir_path,
+                               const std::string &file_prefix,
+                               uint64_t quota_bytes, uint64_t reserve_bytes,
+                               uint64_t prealloc_bytes)
+    : dir(dir_path), prefix(file_prefix), quota(quota_bytes),
+      reserve(reserve_bytes), prealloc(prealloc_bytes), used(0) {
+  index_path = FullPath("." + prefix + "index");
+}
+
+std::string StorageManager::FullPath(const std::string &name) const {
+  return dir + "/" + name;
+}
+
+void StorageManager::Scan() {
+  AutoLockMutex _alm(mtx);
+  segments.clear();
+  used = 0;
+
+  // name start_time end_time size flags
+  std::ifstream index(index_path);
+  std::string line;
+  while (std::getline(index, line)) {
+    std::istringstream fields(line);
+    Segment seg;
+    if (!(fields >> seg.name >> seg.start_time >> seg.end_time >> seg.size >>
+          seg.flags))
+      continue;
+    struct stat st;
+    std::string path = FullPath(seg.name);
+    if (stat(path.c_str(), &st))
+      continue;
+    if (seg.end_time == 0) {
+      // Not closed, the space allocated ahead is still there.
+      if (truncate(path.c_str(), st.st_size) == 0)
+        stat(path.c_str(), &st);
+      seg.end_time = st.st_mtime;
+    }
+    seg.size = AllocatedSize(st);
+    segments.push_back(seg);
+  }
+
+  DIR *d = opendir(dir.c_str());
+  if (d) {
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+      std::string name = entry->d_name;
+      if (name.compare(0, prefix.size(), prefix) ||
+          !HasSuffix(name, kSegmentSuffix))
+        continue;
+      if (std::find_if(segments.begin(), segments.end(),
+                       [&name](const Segment &s) { return s.name == name; }) !=
+          segments.end())
+        continue;
+      struct stat st;
+      if (stat(FullPath(name).c_str(), &st) || !S_ISREG(st.st_mode))
+        continue;
+      segments.push_back({name, st.st_mtime, st.st_mtime, AllocatedSize(st),
+                          0});
+    }
+    closedir(d);
+  }
+
+  std::stable_sort(segments.begin(), segments.end(),
+                   [](const Segment &a, const Segment &b) {
+                     return a.start_time < b.start_time;
+                   });
+  for (auto &seg : segments)
+    used += seg.size;
+  LOG("Storage:: %d segments, %" PRIu64 " bytes in %s\n", (int)segments.size(),
+      used, dir.c_str());
+  SaveIndex();
+}
+
+bool StorageManager::NeedRoom(uint64_t bytes) {
+  if (quota > 0 && used + bytes > quota)
+    return true;
+  struct statvfs vfs;
+  if (reserve > 0 && !statvfs(dir.c_str(), &vfs) &&
+      (uint64_t)vfs.f_bavail * vfs.f_frsize < reserve + bytes)
+    return true;
+  return false;
+}
+
+bool StorageManager::DeleteOldest() {
+  // The segment being written is the last one.
+  for (auto it = segments.begin(); it != segments.end(); ++it) {
+    if ((it->flags & MUXER_SEGMENT_PROTECTED) || it->end_time == 0)
+      continue;
+    std::string path = FullPath(it->name);
+    if (unlink(path.c_str()) && errno != ENOENT) {
+      LOG("Storage:: fail to delete %s, %m\n", path.c_str());
+      return false;
+    }
+    LOGD("Storage:: delete %s\n", path.c_str());
+    used -= std::min(used, it->size);
+    segments.erase(it);
+    return true;
+  }
+  return false;
+}
+
+bool StorageManager::OpenSegment(const std::string &path, int64_t start_time) {
+  AutoLockMutex _alm(mtx);
+  std::string name = path;
+  if (!name.compare(0, dir.size() + 1, dir + "/"))
+    name = name.substr(dir.size() + 1);
+  // The file is overwritten, as file_index restarts after a reboot.
+  for (auto it = segments.begin(); it != segments.end();) {
+    if (it->name == name) {
+      used -= std::min(used, it->size);
+      it = segments.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  bool deleted = false;
+  while (NeedRoom(prealloc)) {
+    if (!DeleteOldest()) {
+      LOG("Storage:: no room for %s, %" PRIu64 " bytes used\n", path.c_str(),
+          used);
+      if (deleted)
+        SaveIndex();
+      return false;
+    }
+    deleted = true;
+  }
+
+  uint64_t size = 0;
+  if (prealloc > 0) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      LOG("Storage:: fail to create %s, %m\n", path.c_str());
+      return false;
+    }
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, prealloc) == 0)
+      size = prealloc;
+    else
+      LOGD("Storage:: fallocate %s, %m\n", path.c_str());
+    close(fd);
+  }
+  segments.push_back({name, start_time, 0, size, 0});
+  used += size;
+  SaveIndex();
+  return true;
+}
+
+void StorageManager::CloseSegment(const std::string &path, int64_t end_time) {
+  AutoLockMutex _alm(mtx);
+  auto it = std::find_if(segments.rbegin(), segments.rend(),
+                         [&](const Segment &s) {
+                           return s.end_time == 0 && FullPath(s.name) == path;
+                         });
+  if (it == segments.rend())
+    return;
+  struct stat st;
+  uint64_t size = 0;
+  if (!stat(path.c_str(), &st)) {
+    // Free what was allocated ahead and not written.
+    if (AllocatedSize(st) > (uint64_t)st.st_size &&
+        truncate(path.c_str(), st.st_size) == 0)
+      stat(path.c_str(), &st);
+    size = AllocatedSize(st);
+  }
+  used = used - std::min(used, it->size) + size;
+  it->size = size;
+  it->end_time = std::max(end_time, it->start_time);
+  // Make room for the next segment now, rather than when it opens.
+  while (NeedRoom(prealloc) && DeleteOldest())
+    ;
+  SaveIndex();
+}
+
+void StorageManager::MarkSegment(uint32_t flags) {
+  AutoLockMutex _alm(mtx);
+  if (segments.empty())
+    return;
+  segments.back().flags |= flags;
+  SaveIndex();
+}
+
+int StorageManager::Lookup(int64_t start_time, int64_t end_time,
+                           MuxerSegmentInfo *infos, int num) {
+  AutoLockMutex _alm(mtx);
+  // Segments are ordered by start, so are their ends but for the last one.
+  auto it = std::lower_bound(segments.begin(), segments.end(), start_time,
+                             [](const Segment &s, int64_t t) {
+                               return s.end_time != 0 && s.end_time < t;
+                             });
+  int count = 0;
+  for (; it != segments.end() && it->start_time <= end_time; ++it) {
+    if (infos && count < num) {
+      MuxerSegmentInfo &info = infos[count];
+      snprintf(info.path, sizeof(info.path), "%s",
+               FullPath(it->name).c_str());
+      info.start_time = it->start_time;
+      info.end_time = it->end_time;
+      info.size = it->size;
+      info.flags = it->flags;
+    }
+    count++;
+  }
+  return count;
+}
+
+uint64_t StorageManager::UsedBytes() {
+  AutoLockMutex _alm(mtx);
+  return used;
+}
+
+void StorageManager::SaveIndex() {
+  // Replaced at once, a power cut leaves the previous index.
+  std::string tmp_path = index_path + ".tmp";
+  FILE *f = fopen(tmp_path.c_str(), "w");
+  if (!f) {
+    LOG("Storage:: fail to write %s, %m\n", tmp_path.c_str());
+    return;
+  }
+  for (auto &seg : segments)
+    fprintf(f, "%s %" PRId64 " %" PRId64 " %" PRIu64 " %u\n", seg.name.c_str(),
+            seg.start_time, seg.end_time, seg.size, seg.flags);
+  fflush(f);
+  fdatasync(fileno(f));
+  fclose(f);
+  rename(tmp_path.c_str(), index_path.c_str());
+}
+
+} // namespace easymedia
@@ -0,0 +1,78 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_STORAGE_MANAGER_H_
+#define EASYMEDIA_STORAGE_MANAGER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <string>
+
+#include "control.h"
+#include "lock.h"
+
+namespace easymedia {
+
+// Loop recording: the segments of a directory, by a file prefix, are
+// kept in an index ordered by time, and the oldest segments which are not
+// protected are deleted to make room for the next one. The index is saved
+// next to the segments, so the event flags survive a reboot.
+// All methods are thread safe.
+class StorageManager {
+public:
+  // quota: bytes for all the segments, 0 for no limit.
+  // reserve: free bytes to keep on the file system.
+  // prealloc: bytes reserved, and allocated, for a new segment.
+  StorageManager(const std::string &dir, const std::string &prefix,
+                 uint64_t quota, uint64_t reserve, uint64_t prealloc);
+  StorageManager(const StorageManager &) = delete;
+  StorageManager &operator=(const StorageManager &) = delete;
+
+  // Load the index and the segments missing from it.
+  void Scan();
+  // Make room for a new segment, and create path with its space allocated.
+  // Returns false if the oldest segments left are all protected.
+  bool OpenSegment(const std::string &path, int64_t start_time);
+  // The segment was closed by the muxer: account its real size and free
+  // the allocated tail. May be called from another thread than Open.
+  void CloseSegment(const std::string &path, int64_t end_time);
+  // OR flags into the segment being written, or the last one.
+  void MarkSegment(uint32_t flags);
+  // Segments overlapping [start_time, end_time], in time order.
+  // Returns the number of segments matching, which may be more than num.
+  int Lookup(int64_t start_time, int64_t end_time, MuxerSegmentInfo *infos,
+             int num);
+  uint64_t UsedBytes();
+  const std::string &GetDir() const { return dir; }
+  const std::string &GetPrefix() const { return prefix; }
+
+private:
+  struct Segment {
+    std::string name; // in dir
+    int64_t start_time; // seconds since the Epoch
+    int64_t end_time;   // 0 while writing
+    uint64_t size;      // reserved size while writing
+    uint32_t flags;
+  };
+  bool NeedRoom(uint64_t bytes);
+  bool DeleteOldest();
+  void SaveIndex();
+  std::string FullPath(const std::string &name) const;
+
+  std::string dir;
+  std::string prefix;
+  std::string index_path;
+  uint64_t quota;
+  uint64_t reserve;
+  uint64_t prealloc;
+  ReadWriteLockMutex mtx;
+  std::deque<Segment> segments;
+  uint64_t used;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_STORAGE_MANAGER_H_
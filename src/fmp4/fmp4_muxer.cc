@@ -0,0 +1,796 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "muxer.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "buffer.h"
+#include "codec.h"
+#include "key_string.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Big endian box writer.
+class BoxWriter {
+public:
+  void U8(uint8_t v) { data.push_back(v); }
+  void U16(uint16_t v) {
+    U8(v >> 8);
+    U8(v);
+  }
+  void U24(uint32_t v) {
+    U8(v >> 16);
+    U16(v);
+  }
+  void U32(uint32_t v) {
+    U16(v >> 16);
+    U16(v);
+  }
+  void U64(uint64_t v) {
+    U32(v >> 32);
+    U32(v);
+  }
+  void Zero(size_t n) { data.insert(data.end(), n, 0); }
+  void Bytes(const void *p, size_t n) {
+    const uint8_t *b = (const uint8_t *)p;
+    data.insert(data.end(), b, b + n);
+  }
+  void Tag(const char *fourcc) { Bytes(fourcc, 4); }
+  // Returns the offset to pass to End.
+  size_t Box(const char *fourcc) {
+    size_t offset = data.size();
+    U32(0);
+    Tag(fourcc);
+    return offset;
+  }
+  size_t FullBox(const char *fourcc, uint8_t version, uint32_t flags) {
+    size_t offset = Box(fourcc);
+    U8(version);
+    U24(flags);
+    return offset;
+  }
+  void End(size_t offset) { Patch32(offset, data.size() - offset); }
+  void Patch32(size_t offset, uint32_t v) {
+    data[offset] = v >> 24;
+    data[offset + 1] = v >> 16;
+    data[offset + 2] = v >> 8;
+    data[offset + 3] = v;
+  }
+  void Matrix() {
+    static const uint32_t unity[9] = {0x00010000, 0, 0, 0, 0x00010000,
+                                      0,          0, 0, 0x40000000};
+    for (uint32_t v : unity)
+      U32(v);
+  }
+
+  std::vector<uint8_t> data;
+};
+
+// Native fragmented mp4 (CMAF): WriteHeader returns the init segment,
+// then Write returns a whole moof + mdat fragment when one is complete,
+// or an empty buffer. A fragment ends before a video IDR, or, with
+// fragment_duration (ms), once it is that long; it is output one frame
+// after its end, when the duration of its last sample is known.
+// The samples are referenced from the encoder buffers until then: with
+// an io stream they are written from there, otherwise they are copied
+// once into the fragment buffer.
+class FMP4Muxer : public Muxer {
+public:
+  FMP4Muxer(const char *param);
+  virtual ~FMP4Muxer() = default;
+  static const char *GetMuxName() { return "fmp4"; }
+
+  virtual bool Init() override { return true; }
+  virtual bool
+  NewMuxerStream(const MediaConfig &mc,
+                 const std::shared_ptr<MediaBuffer> &enc_extra_data,
+                 int &stream_no) override;
+  virtual std::shared_ptr<MediaBuffer> WriteHeader(int stream_no) override;
+  virtual std::shared_ptr<MediaBuffer>
+  Write(std::shared_ptr<MediaBuffer> orig_data, int stream_no) override;
+
+private:
+  struct Range {
+    uint32_t offset;
+    uint32_t size;
+  };
+  struct Sample {
+    std::shared_ptr<MediaBuffer> buffer;
+    // NAL units without start code, or the raw audio frame.
+    std::vector<Range> ranges;
+    uint32_t size; // in mdat
+    uint32_t duration;
+    bool sync;
+  };
+  struct Track {
+    MediaConfig mc;
+    uint32_t timescale;
+    std::vector<std::vector<uint8_t>> vps, sps, pps;
+    std::deque<Sample> pending;
+    int64_t last_ts;        // us, of the last pending sample
+    uint64_t decode_time;   // of the first pending sample
+    uint32_t last_duration; // for the last sample on eof
+  };
+
+  bool IsVideo(const Track &t) const { return t.mc.type == Type::Video; }
+  bool AddSample(Track &t, std::shared_ptr<MediaBuffer> &buffer);
+  bool NeedCut(int64_t ts, bool sync) const;
+  std::shared_ptr<MediaBuffer> Flush();
+  std::shared_ptr<MediaBuffer> Output(BoxWriter &head,
+                                      std::vector<Track *> &frag_tracks,
+                                      std::vector<size_t> &counts,
+                                      size_t payload);
+  void WriteSampleEntry(BoxWriter &w, const Track &t);
+  uint64_t ToTimescale(const Track &t, int64_t us) const {
+    return (uint64_t)((us - base_ts) * t.timescale / 1000000);
+  }
+
+  std::vector<Track> tracks;
+  int64_t fragment_duration; // us, 0 for a fragment per GOP
+  int64_t base_ts;           // us, of the first sample, -1 before
+  int64_t fragment_ts;       // us, of the first sample of the fragment
+  uint32_t sequence;
+  static std::shared_ptr<MediaBuffer> empty;
+};
+
+static const size_t kMaxFragmentSamples = 512;
+static const uint32_t kSyncSampleFlags = 0x02000000;
+static const uint32_t kNonSyncSampleFlags = 0x01010000;
+
+std::shared_ptr<MediaBuffer> FMP4Muxer::empty = std::make_shared<MediaBuffer>();
+
+FMP4Muxer::FMP4Muxer(const char *param)
+    : Muxer(param), fragment_duration(0), base_ts(-1), fragment_ts(-1),
+      sequence(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  const std::string &duration = params[KEY_FRAGMENT_DURATION];
+  if (!duration.empty())
+    fragment_duration = std::stoll(duration) * 1000;
+}
+
+static void SplitNalus(const uint8_t *data, size_t size,
+                       std::vector<std::vector<uint8_t>> *out,
+                       std::vector<const uint8_t *> *starts = nullptr,
+                       std::vector<size_t> *sizes = nullptr) {
+  const uint8_t *end = data + size;
+  const uint8_t *nal = find_nalu_startcode(data, end);
+  while (nal < end) {
+    nal += (nal[2] == 1) ? 3 : 4;
+    const uint8_t *next = find_nalu_startcode(nal, end);
+    if (next > nal) {
+      if (out)
+        out->push_back(std::vector<uint8_t>(nal, next));
+      if (starts) {
+        starts->push_back(nal);
+        sizes->push_back(next - nal);
+      }
+    }
+    nal = next;
+  }
+}
+
+static int NaluType(CodecType codec, uint8_t header) {
+  return codec == CODEC_TYPE_H264 ? (header & 0x1F) : ((header >> 1) & 0x3F);
+}
+
+static bool IsParameterSet(CodecType codec, int type) {
+  if (codec == CODEC_TYPE_H264)
+    return type == 7 || type == 8;
+  return type >= 32 && type <= 34;
+}
+
+bool FMP4Muxer::NewMuxerStream(
+    const MediaConfig &mc, const std::shared_ptr<MediaBuffer> &enc_extra_data,
+    int &stream_no) {
+  Track t;
+  t.mc = mc;
+  t.last_ts = -1;
+  t.decode_time = 0;
+  t.last_duration = 0;
+  if (mc.type == Type::Video) {
+    CodecType codec = mc.vid_cfg.image_cfg.codec_type;
+    if (codec != CODEC_TYPE_H264 && codec != CODEC_TYPE_H265) {
+      LOG("fmp4 muxer: unsupported video codec %d\n", codec);
+      return false;
+    }
+    if (!enc_extra_data) {
+      LOG("fmp4 muxer: missing parameter sets\n");
+      return false;
+    }
+    std::vector<std::vector<uint8_t>> nalus;
+    SplitNalus((const uint8_t *)enc_extra_data->GetPtr(),
+               enc_extra_data->GetValidSize(), &nalus);
+    for (auto &nal : nalus) {
+      switch (NaluType(codec, nal[0])) {
+      case 7:
+      case 33:
+        t.sps.push_back(nal);
+        break;
+      case 8:
+      case 34:
+        t.pps.push_back(nal);
+        break;
+      case 32:
+        t.vps.push_back(nal);
+        break;
+      }
+    }
+    if (t.sps.empty() || t.pps.empty() ||
+        (codec == CODEC_TYPE_H265 && t.vps.empty()) || t.sps[0].size() < 4) {
+      LOG("fmp4 muxer: incomplete parameter sets\n");
+      return false;
+    }
+    t.timescale = 90000;
+    if (mc.vid_cfg.frame_rate > 0)
+      t.last_duration = 90000 * std::max(mc.vid_cfg.frame_rate_den, 1) /
+                        mc.vid_cfg.frame_rate;
+  } else if (mc.type == Type::Audio) {
+    CodecType codec = mc.aud_cfg.codec_type;
+    if (codec != CODEC_TYPE_AAC && codec != CODEC_TYPE_G711A &&
+        codec != CODEC_TYPE_G711U) {
+      LOG("fmp4 muxer: unsupported audio codec %d\n", codec);
+      return false;
+    }
+    if (mc.aud_cfg.sample_info.sample_rate <= 0 ||
+        mc.aud_cfg.sample_info.channels <= 0)
+      return false;
+    t.timescale = mc.aud_cfg.sample_info.sample_rate;
+  } else {
+    return false;
+  }
+  stream_no = tracks.size();
+  tracks.push_back(t);
+  return true;
+}
+
+static const int kAacSampleRates[] = {96000, 88200, 64000, 48000, 44100,
+                                      32000, 24000, 22050, 16000, 12000,
+                                      11025, 8000,  7350};
+
+// ISO/IEC 14496-1 descriptor, the payload is below 128 bytes.
+static void Descriptor(BoxWriter &w, uint8_t tag, const BoxWriter &payload) {
+  w.U8(tag);
+  w.U8(payload.data.size());
+  w.Bytes(payload.data.data(), payload.data.size());
+}
+
+// Removes the emulation prevention bytes.
+static std::vector<uint8_t> ToRbsp(const std::vector<uint8_t> &nal) {
+  std::vector<uint8_t> rbsp;
+  int zeros = 0;
+  for (uint8_t b : nal) {
+    if (zeros >= 2 && b == 3) {
+      zeros = 0;
+      continue;
+    }
+    zeros = b ? 0 : zeros + 1;
+    rbsp.push_back(b);
+  }
+  return rbsp;
+}
+
+void FMP4Muxer::WriteSampleEntry(BoxWriter &w, const Track &t) {
+  size_t entry;
+  if (IsVideo(t)) {
+    const ImageInfo &info = t.mc.vid_cfg.image_cfg.image_info;
+    bool h264 = t.mc.vid_cfg.image_cfg.codec_type == CODEC_TYPE_H264;
+    entry = w.Box(h264 ? "avc1" : "hvc1");
+    w.Zero(6);
+    w.U16(1); // data_reference_index
+    w.Zero(16);
+    w.U16(info.width);
+    w.U16(info.height);
+    w.U32(0x00480000); // 72 dpi
+    w.U32(0x00480000);
+    w.U32(0);
+    w.U16(1); // frame_count
+    w.Zero(32);
+    w.U16(0x0018);
+    w.U16(0xFFFF);
+    const std::vector<uint8_t> &sps = t.sps[0];
+    if (h264) {
+      size_t avcc = w.Box("avcC");
+      w.U8(1);
+      w.U8(sps[1]); // profile
+      w.U8(sps[2]);
+      w.U8(sps[3]); // level
+      w.U8(0xFF);   // 4 bytes NAL unit length
+      w.U8(0xE0 | t.sps.size());
+      for (auto &nal : t.sps) {
+        w.U16(nal.size());
+        w.Bytes(nal.data(), nal.size());
+      }
+      w.U8(t.pps.size());
+      for (auto &nal : t.pps) {
+        w.U16(nal.size());
+        w.Bytes(nal.data(), nal.size());
+      }
+      if (sps[1] == 100 || sps[1] == 110 || sps[1] == 122 || sps[1] == 144) {
+        // 4:2:0, 8 bits, as the encoders output.
+        w.U8(0xFD);
+        w.U8(0xF8);
+        w.U8(0xF8);
+        w.U8(0);
+      }
+      w.End(avcc);
+    } else {
+      // profile_tier_level follows the 2 bytes header and 1 byte of ids.
+      std::vector<uint8_t> rbsp = ToRbsp(sps);
+      rbsp.resize(std::max<size_t>(rbsp.size(), 15), 0);
+      size_t hvcc = w.Box("hvcC");
+      w.U8(1);
+      w.Bytes(&rbsp[3], 12); // general profile, flags and level
+      w.U16(0xF000);
+      w.U8(0xFC);
+      w.U8(0xFD); // 4:2:0
+      w.U8(0xF8); // 8 bits
+      w.U8(0xF8);
+      w.U16(0);
+      int sub_layers = ((rbsp[2] >> 1) & 0x7) + 1;
+      w.U8((sub_layers << 3) | ((rbsp[2] & 1) << 2) | 3);
+      w.U8(3);
+      const std::vector<std::vector<uint8_t>> *arrays[] = {&t.vps, &t.sps,
+                                                           &t.pps};
+      for (int i = 0; i < 3; i++) {
+        w.U8(0x80 | (32 + i));
+        w.U16(arrays[i]->size());
+        for (auto &nal : *arrays[i]) {
+          w.U16(nal.size());
+          w.Bytes(nal.data(), nal.size());
+        }
+      }
+      w.End(hvcc);
+    }
+  } else {
+    const SampleInfo &info = t.mc.aud_cfg.sample_info;
+    CodecType codec = t.mc.aud_cfg.codec_type;
+    entry = w.Box(codec == CODEC_TYPE_AAC
+                      ? "mp4a"
+                      : (codec == CODEC_TYPE_G711A ? "alaw" : "ulaw"));
+    w.Zero(6);
+    w.U16(1); // data_reference_index
+    w.Zero(8);
+    w.U16(info.channels);
+    w.U16(16);
+    w.U32(0);
+    w.U32(info.sample_rate < 65536 ? info.sample_rate << 16 : 0);
+    if (codec == CODEC_TYPE_AAC) {
+      int index = 0xF;
+      for (size_t i = 0; i < ARRAY_ELEMS(kAacSampleRates); i++)
+        if (kAacSampleRates[i] == info.sample_rate)
+          index = i;
+      // AAC LC AudioSpecificConfig
+      uint16_t asc = (2 << 11) | (index << 7) | ((info.channels & 0xF) << 3);
+      BoxWriter dsi, dcd, sl, es;
+      dsi.U16(asc);
+      dcd.U8(0x40); // MPEG-4 audio
+      dcd.U8(0x15); // audio stream
+      dcd.U24(0);
+      dcd.U32(t.mc.aud_cfg.bit_rate);
+      dcd.U32(t.mc.aud_cfg.bit_rate);
+      Descriptor(dcd, 0x05, dsi);
+      sl.U8(0x02);
+      es.U16(0); // ES_ID
+      es.U8(0);
+      Descriptor(es, 0x04, dcd);
+      Descriptor(es, 0x06, sl);
+      size_t esds = w.FullBox("esds", 0, 0);
+      Descriptor(w, 0x03, es);
+      w.End(esds);
+    }
+  }
+  w.End(entry);
+}
+
+std::shared_ptr<MediaBuffer> FMP4Muxer::WriteHeader(int stream_no) {
+  if (stream_no < 0 || stream_no >= (int)tracks.size()) {
+    LOG("Invalid stream no : %d\n", stream_no);
+    return nullptr;
+  }
+  BoxWriter w;
+  size_t ftyp = w.Box("ftyp");
+  w.Tag("iso6");
+  w.U32(0);
+  w.Tag("iso6");
+  w.Tag("cmfc");
+  w.Tag("mp41");
+  w.End(ftyp);
+
+  size_t moov = w.Box("moov");
+  size_t mvhd = w.FullBox("mvhd", 0, 0);
+  w.Zero(8);
+  w.U32(1000);
+  w.U32(0);
+  w.U32(0x00010000); // rate
+  w.U16(0x0100);     // volume
+  w.Zero(10);
+  w.Matrix();
+  w.Zero(24);
+  w.U32(tracks.size() + 1);
+  w.End(mvhd);
+
+  for (size_t i = 0; i < tracks.size(); i++) {
+    const Track &t = tracks[i];
+    bool video = IsVideo(t);
+    size_t trak = w.Box("trak");
+    size_t tkhd = w.FullBox("tkhd", 0, 0x3);
+    w.Zero(8);
+    w.U32(i + 1);
+    w.Zero(4);
+    w.U32(0);
+    w.Zero(8);
+    w.U32(0); // layer, alternate_group
+    w.U16(video ? 0 : 0x0100);
+    w.U16(0);
+    w.Matrix();
+    if (video) {
+      const ImageInfo &info = t.mc.vid_cfg.image_cfg.image_info;
+      w.U32(info.width << 16);
+      w.U32(info.height << 16);
+    } else {
+      w.Zero(8);
+    }
+    w.End(tkhd);
+
+    size_t mdia = w.Box("mdia");
+    size_t mdhd = w.FullBox("mdhd", 0, 0);
+    w.Zero(8);
+    w.U32(t.timescale);
+    w.U32(0);
+    w.U16(0x55C4); // und
+    w.U16(0);
+    w.End(mdhd);
+    size_t hdlr = w.FullBox("hdlr", 0, 0);
+    w.U32(0);
+    w.Tag(video ? "vide" : "soun");
+    w.Zero(12);
+    const char *name = video ? "VideoHandler" : "SoundHandler";
+    w.Bytes(name, strlen(name) + 1);
+    w.End(hdlr);
+
+    size_t minf = w.Box("minf");
+    if (video) {
+      size_t vmhd = w.FullBox("vmhd", 0, 1);
+      w.Zero(8);
+      w.End(vmhd);
+    } else {
+      size_t smhd = w.FullBox("smhd", 0, 0);
+      w.Zero(4);
+      w.End(smhd);
+    }
+    size_t dinf = w.Box("dinf");
+    size_t dref = w.FullBox("dref", 0, 0);
+    w.U32(1);
+    w.End(w.FullBox("url ", 0, 1));
+    w.End(dref);
+    w.End(dinf);
+    size_t stbl = w.Box("stbl");
+    size_t stsd = w.FullBox("stsd", 0, 0);
+    w.U32(1);
+    WriteSampleEntry(w, t);
+    w.End(stsd);
+    // The samples are in the fragments.
+    size_t box = w.FullBox("stts", 0, 0);
+    w.U32(0);
+    w.End(box);
+    box = w.FullBox("stsc", 0, 0);
+    w.U32(0);
+    w.End(box);
+    box = w.FullBox("stsz", 0, 0);
+    w.Zero(8);
+    w.End(box);
+    box = w.FullBox("stco", 0, 0);
+    w.U32(0);
+    w.End(box);
+    w.End(stbl);
+    w.End(minf);
+    w.End(mdia);
+    w.End(trak);
+  }
+
+  size_t mvex = w.Box("mvex");
+  for (size_t i = 0; i < tracks.size(); i++) {
+    size_t trex = w.FullBox("trex", 0, 0);
+    w.U32(i + 1);
+    w.U32(1);
+    w.Zero(12);
+    w.End(trex);
+  }
+  w.End(mvex);
+  w.End(moov);
+
+  if (io_output)
+    io_output->Write(w.data.data(), 1, w.data.size());
+  auto header = MediaBuffer::Alloc(w.data.size());
+  if (!header) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  memcpy(header->GetPtr(), w.data.data(), w.data.size());
+  header->SetValidSize(w.data.size());
+  header->SetUserFlag(MediaBuffer::kExtraIntra);
+  return header;
+}
+
+bool FMP4Muxer::AddSample(Track &t, std::shared_ptr<MediaBuffer> &buffer) {
+  const uint8_t *data = (const uint8_t *)buffer->GetPtr();
+  size_t size = buffer->GetValidSize();
+  Sample s;
+  s.buffer = buffer;
+  s.size = 0;
+  s.duration = 0;
+  s.sync = true;
+  if (IsVideo(t)) {
+    CodecType codec = t.mc.vid_cfg.image_cfg.codec_type;
+    std::vector<const uint8_t *> starts;
+    std::vector<size_t> sizes;
+    SplitNalus(data, size, nullptr, &starts, &sizes);
+    for (size_t i = 0; i < starts.size(); i++) {
+      // The parameter sets are in the init segment.
+      int type = NaluType(codec, starts[i][0]);
+      if (IsParameterSet(codec, type) ||
+          (codec == CODEC_TYPE_H264 && type == 9)) // access unit delimiter
+        continue;
+      s.ranges.push_back({(uint32_t)(starts[i] - data), (uint32_t)sizes[i]});
+      s.size += 4 + sizes[i];
+    }
+    s.sync = !!(buffer->GetUserFlag() & MediaBuffer::kIntra);
+  } else {
+    uint32_t offset = 0;
+    if (t.mc.aud_cfg.codec_type == CODEC_TYPE_AAC && size > 7 &&
+        data[0] == 0xFF && (data[1] & 0xF0) == 0xF0)
+      offset = (data[1] & 1) ? 7 : 9; // ADTS header
+    if (size <= offset)
+      return false;
+    s.ranges.push_back({offset, (uint32_t)(size - offset)});
+    s.size = size - offset;
+    const SampleInfo &info = t.mc.aud_cfg.sample_info;
+    if (t.mc.aud_cfg.codec_type == CODEC_TYPE_AAC)
+      s.duration = 1024;
+    else
+      s.duration = s.size / info.channels;
+  }
+  if (s.ranges.empty())
+    return false;
+
+  int64_t ts = buffer->GetUSTimeStamp();
+  // Anchored again on the timestamps, so the audio does not drift from
+  // the video with a capture clock a bit off.
+  if (t.pending.empty())
+    t.decode_time = ToTimescale(t, ts);
+  t.pending.push_back(s);
+  t.last_ts = ts;
+  return true;
+}
+
+bool FMP4Muxer::NeedCut(int64_t ts, bool sync) const {
+  if (fragment_ts < 0)
+    return false;
+  size_t count = 0;
+  for (auto &t : tracks)
+    count += t.pending.size();
+  if (count >= kMaxFragmentSamples)
+    return true;
+  if (fragment_duration > 0)
+    return ts - fragment_ts >= fragment_duration;
+  return sync;
+}
+
+std::shared_ptr<MediaBuffer>
+FMP4Muxer::Write(std::shared_ptr<MediaBuffer> orig_data, int stream_no) {
+  if (stream_no < 0 || stream_no >= (int)tracks.size()) {
+    LOG("Invalid stream no : %d\n", stream_no);
+    return nullptr;
+  }
+  if (!orig_data || orig_data->IsEOF()) {
+    for (auto &t : tracks)
+      if (!t.pending.empty() && t.pending.back().duration == 0)
+        t.pending.back().duration = t.last_duration;
+    auto frag = Flush();
+    return frag ? frag : empty;
+  }
+  if (orig_data->GetValidSize() == 0 ||
+      (orig_data->GetUserFlag() & MediaBuffer::kExtraIntra))
+    return empty;
+
+  Track &t = tracks[stream_no];
+  bool video = IsVideo(t);
+  bool has_video = false;
+  for (auto &track : tracks)
+    has_video |= IsVideo(track);
+  int64_t ts = orig_data->GetUSTimeStamp();
+  bool sync = video && (orig_data->GetUserFlag() & MediaBuffer::kIntra);
+  if (base_ts < 0) {
+    // Start with a video IDR.
+    if (has_video && !sync)
+      return empty;
+    base_ts = ts;
+  }
+  if (ts < base_ts || (t.last_ts >= 0 && ts < t.last_ts))
+    return empty;
+
+  std::shared_ptr<MediaBuffer> frag;
+  if (video && !t.pending.empty()) {
+    Sample &last = t.pending.back();
+    uint64_t end = ToTimescale(t, ts);
+    uint64_t start = t.decode_time;
+    for (size_t i = 0; i + 1 < t.pending.size(); i++)
+      start += t.pending[i].duration;
+    last.duration = end > start ? end - start : 1;
+    t.last_duration = last.duration;
+  }
+  // Cut on the video samples if any, the audio of a fragment may then
+  // end a bit before the video.
+  if (video == has_video && NeedCut(ts, sync))
+    frag = Flush();
+  if (AddSample(t, orig_data) && fragment_ts < 0)
+    fragment_ts = ts;
+  return frag ? frag : empty;
+}
+
+std::shared_ptr<MediaBuffer> FMP4Muxer::Flush() {
+  std::vector<Track *> frag_tracks;
+  std::vector<size_t> counts;
+  for (auto &t : tracks) {
+    size_t n = t.pending.size();
+    // The video sample of unknown duration stays for the next fragment.
+    if (n > 0 && t.pending.back().duration == 0)
+      n--;
+    if (n > 0) {
+      frag_tracks.push_back(&t);
+      counts.push_back(n);
+    }
+  }
+  if (frag_tracks.empty())
+    return nullptr;
+
+  BoxWriter w;
+  std::vector<size_t> data_offsets;
+  size_t moof = w.Box("moof");
+  size_t mfhd = w.FullBox("mfhd", 0, 0);
+  w.U32(++sequence);
+  w.End(mfhd);
+  for (size_t i = 0; i < frag_tracks.size(); i++) {
+    Track &t = *frag_tracks[i];
+    size_t traf = w.Box("traf");
+    size_t tfhd = w.FullBox("tfhd", 0, 0x020000); // default-base-is-moof
+    w.U32(&t - &tracks[0] + 1);
+    w.End(tfhd);
+    size_t tfdt = w.FullBox("tfdt", 1, 0);
+    w.U64(t.decode_time);
+    w.End(tfdt);
+    // data offset, sample duration, size and flags
+    size_t trun = w.FullBox("trun", 0, 0x000701);
+    w.U32(counts[i]);
+    data_offsets.push_back(w.data.size());
+    w.U32(0);
+    for (size_t j = 0; j < counts[i]; j++) {
+      const Sample &s = t.pending[j];
+      w.U32(s.duration);
+      w.U32(s.size);
+      w.U32(s.sync ? kSyncSampleFlags : kNonSyncSampleFlags);
+    }
+    w.End(trun);
+    w.End(traf);
+  }
+  w.End(moof);
+
+  size_t payload = 0;
+  for (size_t i = 0; i < frag_tracks.size(); i++) {
+    w.Patch32(data_offsets[i], w.data.size() + 8 + payload);
+    for (size_t j = 0; j < counts[i]; j++)
+      payload += frag_tracks[i]->pending[j].size;
+  }
+  w.U32(8 + payload);
+  w.Tag("mdat");
+
+  auto frag = Output(w, frag_tracks, counts, payload);
+  fragment_ts = -1;
+  for (size_t i = 0; i < frag_tracks.size(); i++) {
+    Track &t = *frag_tracks[i];
+    for (size_t j = 0; j < counts[i]; j++) {
+      t.decode_time += t.pending.front().duration;
+      t.pending.pop_front();
+    }
+    if (!t.pending.empty() &&
+        (fragment_ts < 0 || t.pending.front().buffer->GetUSTimeStamp() <
+                                fragment_ts))
+      fragment_ts = t.pending.front().buffer->GetUSTimeStamp();
+  }
+  return frag;
+}
+
+std::shared_ptr<MediaBuffer>
+FMP4Muxer::Output(BoxWriter &head, std::vector<Track *> &frag_tracks,
+                  std::vector<size_t> &counts, size_t payload) {
+  // The mdat payload, a null pointer stands for a NAL unit length.
+  std::vector<std::pair<const uint8_t *, uint32_t>> pieces;
+  std::vector<uint32_t> lengths;
+  for (size_t i = 0; i < frag_tracks.size(); i++) {
+    Track *t = frag_tracks[i];
+    for (size_t j = 0; j < counts[i]; j++) {
+      const Sample &s = t->pending[j];
+      const uint8_t *data = (const uint8_t *)s.buffer->GetPtr();
+      for (auto &r : s.ranges) {
+        if (IsVideo(*t)) {
+          lengths.push_back(r.size);
+          pieces.push_back({nullptr, 4});
+        }
+        pieces.push_back({data + r.offset, r.size});
+      }
+    }
+  }
+
+  int64_t ts = -1;
+  bool sync = false;
+  for (auto t : frag_tracks) {
+    int64_t first = t->pending.front().buffer->GetUSTimeStamp();
+    if (ts < 0 || first < ts)
+      ts = first;
+    if (IsVideo(*t))
+      sync = t->pending.front().sync;
+  }
+
+  if (io_output) {
+    io_output->Write(head.data.data(), 1, head.data.size());
+    size_t l = 0;
+    for (auto &p : pieces) {
+      if (p.first) {
+        io_output->Write(p.first, 1, p.second);
+      } else {
+        uint8_t len[4] = {(uint8_t)(lengths[l] >> 24),
+                          (uint8_t)(lengths[l] >> 16),
+                          (uint8_t)(lengths[l] >> 8), (uint8_t)lengths[l]};
+        io_output->Write(len, 1, 4);
+        l++;
+      }
+    }
+    return empty;
+  }
+
+  size_t total = head.data.size() + payload;
+  auto frag = MediaBuffer::Alloc(total);
+  if (!frag) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  uint8_t *p = (uint8_t *)frag->GetPtr();
+  memcpy(p, head.data.data(), head.data.size());
+  p += head.data.size();
+  size_t l = 0;
+  for (auto &piece : pieces) {
+    if (piece.first) {
+      memcpy(p, piece.first, piece.second);
+    } else {
+      p[0] = lengths[l] >> 24;
+      p[1] = lengths[l] >> 16;
+      p[2] = lengths[l] >> 8;
+      p[3] = lengths[l];
+      l++;
+    }
+    p += piece.second;
+  }
+  frag->SetValidSize(total);
+  frag->SetUSTimeStamp(ts);
+  if (sync)
+    frag->SetUserFlag(MediaBuffer::kIntra);
+  return frag;
+}
+
+DEFINE_COMMON_MUXER_FACTORY(FMP4Muxer)
+const char *FACTORY(FMP4Muxer)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+const char *FACTORY(FMP4Muxer)::OutPutDataType() { return MUXER_FMP4; }
+
+} // namespace easymedia
@@ -9,6 +9,7 @@
 
 #include "media_type.h"
 #include "utils.h"
+#include "zero_copy_rtp_sink.hh"
 
 namespace easymedia {
 H264ServerMediaSubsession *
@@ -19,7 +20,8 @@ H264ServerMediaSubsession::createNew(UsageEnvironment &env,
 
 H264ServerMediaSubsession::H264ServerMediaSubsession(
     UsageEnvironment &env, Live555MediaInput &mediaInput)
-    : OnDemandServerMediaSubsession(env, True /*reuse the first source*/),
+    // Under latency control, each client reads at its own pace.
+    : OnDemandServerMediaSubsession(env, mediaInput.maxLatency() <= 0),
       fMediaInput(mediaInput), fEstimatedKbps(1000), fDoneFlag(0),
       fDummyRTPSink(NULL), fGetSdpCount(10), fAuxSDPLine(NULL) {}
 
@@ -48,6 +50,8 @@ void H264ServerMediaSubsession::startStream(
   if (fMediaInput.GetStartVideoStreamCallback() != NULL) {
     fMediaInput.GetStartVideoStreamCallback()();
   }
+  if (fMediaInput.maxLatency() > 0)
+    trackClient(clientSessionId, streamToken);
   if (kSessionIdList.empty())
     fMediaInput.Start(envir());
   LOG("%s:%s:%p - clientSessionId: 0x%08x\n", __FILE__, __func__, this,
@@ -66,6 +70,21 @@ void H264ServerMediaSubsession::deleteStream(unsigned clientSessionId,
   OnDemandServerMediaSubsession::deleteStream(clientSessionId, streamToken);
 }
 
+void H264ServerMediaSubsession::trackClient(unsigned clientSessionId,
+                                            void *streamToken) {
+  Destinations *dests = (Destinations *)fDestinationsHashTable->Lookup(
+      (char const *)(uintptr_t)clientSessionId);
+  StreamState *state = (StreamState *)streamToken;
+  if (!dests || !state || !state->mediaSource() || !state->rtpSink())
+    return;
+  FramedSource *source = state->mediaSource();
+  if (!fMediaInput.zeroCopyRtp())
+    source = ((FramedFilter *)source)->inputSource();
+  int sock = dests->isTCP ? dests->tcpSocketNum
+                          : state->rtpSink()->groupsockBeingUsed().socketNum();
+  ((VideoFramedSource *)source)->SetClient(clientSessionId, sock);
+}
+
 static void afterPlayingDummy(void *clientData) {
   H264ServerMediaSubsession *subsess = (H264ServerMediaSubsession *)clientData;
   LOG("%s, set done.\n", __func__);
@@ -145,6 +164,9 @@ H264ServerMediaSubsession::createNewStreamSource(unsigned clientSessionId,
   if (estBitrate < fEstimatedKbps)
     estBitrate = fEstimatedKbps;
 
+  if (fMediaInput.zeroCopyRtp())
+    return fMediaInput.videoSource(CODEC_TYPE_H264);
+
   // Create a framer for the Video Elementary Stream:
   FramedSource *source = H264VideoStreamDiscreteFramer::createNew(
       envir(), fMediaInput.videoSource(CODEC_TYPE_H264));
@@ -159,6 +181,11 @@ RTPSink *H264ServerMediaSubsession::createNewRTPSink(
     LOG("inputSource is not ready, can not create new rtp sink\n");
     return NULL;
   }
+  if (fMediaInput.zeroCopyRtp()) {
+    setZeroCopyRTPSinkBufferSize();
+    return H264ZeroCopyRTPSink::createNew(envir(), rtpGroupsock,
+                                         rtpPayloadTypeIfDynamic);
+  }
   setVideoRTPSinkBufferSize();
   LOG_FILE_FUNC_LINE();
   RTPSink *rtp_sink = H264VideoRTPSink::createNew(envir(), rtpGroupsock,
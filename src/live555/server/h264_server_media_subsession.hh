@@ -33,6 +33,8 @@ protected: // we're a virtual base class
       ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler,
       void *serverRequestAlternativeByteHandlerClientData) override;
   void deleteStream(unsigned clientSessionId, void *&streamToken) override;
+  // Hand the socket of the client to its source, for the latency control.
+  void trackClient(unsigned clientSessionId, void *streamToken);
 
 protected:
   Live555MediaInput &fMediaInput;
@@ -6,6 +6,10 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <linux/sockios.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -19,36 +23,23 @@ namespace easymedia {
 
 Live555MediaInput::Live555MediaInput(UsageEnvironment &env)
     : Medium(env), connecting(false), video_callback(nullptr),
-      audio_callback(nullptr), m_max_idr_size(0) {}
+      audio_callback(nullptr), max_latency(0), m_max_idr_size(0),
+      gop_cache_bytes(0), gop_cache_max_bytes(0), gop_cache_paced(false),
+      gop_cache_valid(false), zero_copy_rtp(false) {
+  video_ring = MediaRing::Create(env);
+  audio_ring = MediaRing::Create(env);
+  muxer_ring = MediaRing::Create(env);
+}
 
 Live555MediaInput::~Live555MediaInput() {
   LOG_FILE_FUNC_LINE();
-  video_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-
-  audio_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-
-  muxer_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
+  // The rings stay alive as long as a source reads them.
+  video_mtx.lock();
+  video_ring.reset();
+  gop_cache.clear();
+  video_mtx.unlock();
+  audio_ring.reset();
+  muxer_ring.reset();
   connecting = false;
 }
 
@@ -67,99 +58,33 @@ Live555MediaInput *Live555MediaInput::createNew(UsageEnvironment &env) {
   return new Live555MediaInput(env);
 }
 
-#define MAX_CACHE_NUMBER 60
-static void common_reduction(void *userdata,
-                             std::list<std::shared_ptr<MediaBuffer>> &mb_list) {
-  Source *source = (Source *)userdata;
-  if (mb_list.size() > source->GetCachedBufSize()) {
-    for (unsigned i = 0; i < source->GetCachedBufSize() / 2; i++) {
-      mb_list.pop_front();
-      if (source) {
-        int j = 0;
-        ssize_t read_size = (ssize_t)sizeof(j);
-        ssize_t ret = read(source->GetReadFd(), &j, sizeof(j));
-        if (ret != read_size) {
-          LOG("%s:%d, read from pipe error, %m\n", __func__, __LINE__);
-        }
-      }
-    }
-    LOG("call common_reduction.\n");
-  }
-}
-
-static void
-h264_packet_reduction(void *userdata _UNUSED,
-                      std::list<std::shared_ptr<MediaBuffer>> &mb_list) {
-  if (mb_list.size() < MAX_CACHE_NUMBER)
-    return;
-  // only remain one I frame
-  auto i = mb_list.rbegin();
-  for (; i != mb_list.rend(); ++i) {
-    auto &b = *i;
-    if (b->GetUserFlag() & MediaBuffer::kIntra)
-      break;
-  }
-  if (i == mb_list.rend())
-    return;
-  auto iter = mb_list.begin();
-  for (; iter != mb_list.end(); ++iter) {
-    auto &b = *iter;
-    if (!(b->GetUserFlag() & MediaBuffer::kExtraIntra))
-      break;
-  }
-  LOG("h264 reduction before, num: %d \n", (int)mb_list.size());
-  mb_list.erase(iter, (++i).base());
-  LOG("h264 reduction after, num: %d \n", (int)mb_list.size());
-}
-
 FramedSource *Live555MediaInput::videoSource(CodecType c_type) {
-  // if (!video_source)
-  Source *source = new Source();
-  if (!source)
+  if (!video_ring)
     return nullptr;
-  ListReductionPtr func;
   if (c_type == CODEC_TYPE_JPEG)
-    func = common_reduction;
-  else
-    func = h264_packet_reduction;
-  if (!source->Init(func)) {
-    delete source;
-    return nullptr;
-  }
-  video_list.push_back(source);
-  if (c_type == CODEC_TYPE_JPEG) {
-    return new CommonFramedSource(envir(), *source);
-  } else {
-    VideoFramedSource *video_source = new VideoFramedSource(envir(), *source);
-    video_source->SetCodecType(c_type);
-    return video_source;
-  }
+    return new CommonFramedSource(envir(), video_ring);
+
+  // Under video_mtx, so that the live frames follow the cached ones
+  // without a gap.
+  AutoLockMutex _alm(video_mtx);
+  VideoFramedSource *video_source =
+      new VideoFramedSource(envir(), video_ring, this);
+  video_source->SetCodecType(c_type);
+  if (gop_cache_valid && !gop_cache.empty())
+    video_source->Prime(gop_cache, gop_cache_paced);
+  return video_source;
 }
 
 FramedSource *Live555MediaInput::audioSource() {
-  Source *source = new Source();
-  if (!source)
-    return nullptr;
-  if (!source->Init(common_reduction)) {
-    delete source;
+  if (!audio_ring)
     return nullptr;
-  }
-  audio_list.push_back(source);
-  ListSource *audio_source = new CommonFramedSource(envir(), *source);
-  return audio_source;
+  return new CommonFramedSource(envir(), audio_ring);
 }
 
 FramedSource *Live555MediaInput::muxerSource() {
-  Source *source = new Source();
-  if (!source)
-    return nullptr;
-  if (!source->Init(common_reduction)) {
-    delete source;
+  if (!muxer_ring)
     return nullptr;
-  }
-  muxer_list.push_back(source);
-  ListSource *muxer_source = new CommonFramedSource(envir(), *source);
-  return muxer_source;
+  return new CommonFramedSource(envir(), muxer_ring);
 }
 #if 0
 static void printErr(UsageEnvironment& env, char const* str = NULL) {
@@ -170,70 +95,81 @@ static void printErr(UsageEnvironment& env, char const* str = NULL) {
 #endif
 
 void Live555MediaInput::PushNewVideo(std::shared_ptr<MediaBuffer> &buffer) {
-  if (!buffer)
+  if (!buffer || !video_ring)
     return;
   if ((buffer->GetUserFlag() & MediaBuffer::kIntra)) {
     if (m_max_idr_size < buffer->GetValidSize())
       m_max_idr_size = buffer->GetValidSize();
   }
-  video_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
+  AutoLockMutex _alm(video_mtx);
+  UpdateGopCache(buffer);
+  video_ring->Push(buffer);
+}
 
-  for (auto video : video_list) {
-    if (video) {
-      if (!video->GetReadFdStatus()) {
-        video->Push(buffer);
-      }
+void Live555MediaInput::SetGopCache(size_t max_bytes, bool paced) {
+  AutoLockMutex _alm(video_mtx);
+  gop_cache_max_bytes = max_bytes;
+  gop_cache_paced = paced;
+  gop_cache.clear();
+  gop_cache_bytes = 0;
+  gop_cache_valid = false;
+}
+
+// Ring room beyond the cached GOP, for the live frames pushed while a
+// client replays it, and the most the ring grows to.
+#define GOP_CACHE_RING_HEADROOM 64
+#define GOP_CACHE_RING_MAX 4096
+
+void Live555MediaInput::UpdateGopCache(std::shared_ptr<MediaBuffer> &buffer) {
+  if (!gop_cache_max_bytes)
+    return;
+
+  uint32_t flag = buffer->GetUserFlag();
+  if (flag & (MediaBuffer::kIntra | MediaBuffer::kExtraIntra)) {
+    // A GOP starts with its parameter sets, or with the IDR if they are
+    // not sent separately.
+    if (gop_cache.empty() ||
+        !(gop_cache.back()->GetUserFlag() & MediaBuffer::kExtraIntra)) {
+      gop_cache.clear();
+      gop_cache_bytes = 0;
+      gop_cache_valid = true;
     }
+  } else if (!gop_cache_valid) {
+    return;
+  }
+
+  if (gop_cache_bytes + buffer->GetValidSize() > gop_cache_max_bytes) {
+    // The frames after a hole would not decode, drop the GOP entirely and
+    // wait for the next IDR.
+    LOGD("%s: GOP exceeds %d bytes, not cached\n", __func__,
+         (int)gop_cache_max_bytes);
+    gop_cache.clear();
+    gop_cache_bytes = 0;
+    gop_cache_valid = false;
+    return;
   }
+  gop_cache.push_back(buffer);
+  gop_cache_bytes += buffer->GetValidSize();
+  // A new client replays the cache while the live frames queue behind its
+  // cursor, the ring must hold them all or the client loses its IDR.
+  if (gop_cache.size() + GOP_CACHE_RING_HEADROOM > MediaRing::kCapacity)
+    video_ring->Reserve(
+        std::min<uint64_t>(gop_cache.size() + GOP_CACHE_RING_HEADROOM,
+                           GOP_CACHE_RING_MAX));
 }
 
 void Live555MediaInput::PushNewAudio(std::shared_ptr<MediaBuffer> &buffer) {
-  if (!buffer)
+  if (!buffer || !audio_ring)
     return;
-  audio_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-  for (auto audio : audio_list) {
-    if (audio) {
-      if (!audio->GetReadFdStatus()) {
-        audio->Push(buffer);
-      }
-    }
-  }
+  audio_ring->Push(buffer);
 }
 
 void Live555MediaInput::PushNewMuxer(std::shared_ptr<MediaBuffer> &buffer) {
-  if (!buffer)
+  if (!buffer || !muxer_ring)
     return;
-  muxer_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-  for (auto muxer : muxer_list) {
-    if (muxer) {
-      if (!muxer->GetReadFdStatus()) {
-        muxer->SetCachedBufSize(buffer->GetValidSize());
-        muxer->Push(buffer);
-      }
-    }
-  }
+  muxer_ring->Push(buffer);
 }
+
 void Live555MediaInput::SetStartVideoStreamCallback(
     const StartStreamCallback &cb) {
   AutoLockMutex _alm(video_callback_mtx);
@@ -253,199 +189,492 @@ StartStreamCallback Live555MediaInput::GetStartAudioStreamCallback() {
   return audio_callback;
 }
 
+int Live555MediaInput::GetClientStats(RtspClientStats *stats, int num) {
+  AutoLockMutex _alm(clients_mtx);
+  int i = 0;
+  for (auto client : clients) {
+    if (i < num)
+      stats[i] = client->stats;
+    i++;
+  }
+  return i;
+}
+
 unsigned Live555MediaInput::getMaxIdrSize() {
   return (m_max_idr_size * 13 / 10) * 3 * 2 / 25;
 }
-Source::Source()
-    : reduction(nullptr), m_cached_buffers_size(MAX_CACHE_NUMBER),
-      m_read_fd_status(false) {
-  wakeFds[0] = wakeFds[1] = -1;
-  LOG("Source :: %p wakeFds[0] = %d, wakeFds[1]= %d.\n", this, wakeFds[0],
-      wakeFds[1]);
+
+std::shared_ptr<MediaRing> MediaRing::Create(UsageEnvironment &env) {
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    LOG("eventfd failed: %m\n");
+    return nullptr;
+  }
+  return std::shared_ptr<MediaRing>(new MediaRing(env, fd));
+}
+
+MediaRing::MediaRing(UsageEnvironment &env, int fd)
+    : env(env), slots(kCapacity), push_times(kCapacity), capacity(kCapacity),
+      head(0), tail(0), readers(0), waiting(false), event_fd(fd) {
+  // Registered once, it only fires when Push has a client to wake.
+  env.taskScheduler().turnOnBackgroundReadHandling(
+      event_fd, (TaskScheduler::BackgroundHandlerProc *)&incomingDataHandler,
+      this);
 }
 
-void Source::CloseReadFd() {
-  if (wakeFds[0] >= 0) {
-    m_read_fd_status = true;
+MediaRing::~MediaRing() {
+  env.taskScheduler().turnOffBackgroundReadHandling(event_fd);
+  ::close(event_fd);
+  event_fd = -1;
+}
+
+void MediaRing::Push(std::shared_ptr<MediaBuffer> &buffer) {
+  bool wake;
+  int64_t now = easymedia::gettimeofday();
+  mtx.lock();
+  if (!readers) {
+    mtx.unlock();
+    return;
+  }
+  slots[tail % capacity] = buffer;
+  push_times[tail % capacity] = now;
+  tail++;
+  if (tail - head > capacity)
+    head = tail - capacity;
+  wake = waiting;
+  waiting = false;
+  mtx.unlock();
+
+  if (wake) {
+    uint64_t val = 1;
+    if (write(event_fd, &val, sizeof(val)) != sizeof(val))
+      LOG("write eventfd failed: %m\n");
   }
 }
 
-Source::~Source() {
-  if (wakeFds[0] >= 0) {
-    ::close(wakeFds[0]);
-    wakeFds[0] = -1;
+void MediaRing::Attach() {
+  AutoLockMutex _alm(mtx);
+  readers++;
+}
+
+void MediaRing::Detach() {
+  AutoLockMutex _alm(mtx);
+  if (--readers > 0)
+    return;
+  // Nobody reads, do not hold the last buffers.
+  for (uint64_t i = head; i < tail; i++)
+    slots[i % capacity].reset();
+  head = tail;
+}
+
+uint64_t MediaRing::Tail() {
+  AutoLockMutex _alm(mtx);
+  return tail;
+}
+
+void MediaRing::Reserve(uint64_t num) {
+  AutoLockMutex _alm(mtx);
+  if (num <= capacity)
+    return;
+  uint64_t new_capacity = capacity;
+  while (new_capacity < num)
+    new_capacity <<= 1;
+  std::vector<std::shared_ptr<MediaBuffer>> new_slots(new_capacity);
+  std::vector<int64_t> new_times(new_capacity);
+  for (uint64_t i = head; i < tail; i++) {
+    new_slots[i % new_capacity] = std::move(slots[i % capacity]);
+    new_times[i % new_capacity] = push_times[i % capacity];
+  }
+  slots.swap(new_slots);
+  push_times.swap(new_times);
+  capacity = new_capacity;
+}
+
+std::shared_ptr<MediaBuffer> MediaRing::Get(uint64_t &cursor, bool &overrun,
+                                            int64_t *push_time) {
+  AutoLockMutex _alm(mtx);
+  overrun = false;
+  if (cursor < head) {
+    overrun = true;
+    cursor = head;
+    return nullptr;
   }
-  if (wakeFds[1] >= 0) {
-    ::close(wakeFds[1]);
-    wakeFds[1] = -1;
+  if (cursor >= tail)
+    return nullptr;
+  if (push_time)
+    *push_time = push_times[cursor % capacity];
+  return slots[cursor++ % capacity];
+}
+
+uint64_t MediaRing::LastKeyFrame() {
+  AutoLockMutex _alm(mtx);
+  uint64_t i = tail;
+  while (i > head) {
+    i--;
+    if (!(slots[i % capacity]->GetUserFlag() & MediaBuffer::kIntra))
+      continue;
+    while (i > head && (slots[(i - 1) % capacity]->GetUserFlag() &
+                        MediaBuffer::kExtraIntra))
+      i--;
+    return i;
   }
-  LOG("~Source::%p remain %d buffers, will auto release\n", this,
-      (int)cached_buffers.size());
+  return tail;
 }
 
-bool Source::Init(ListReductionPtr func) {
-  // create pipe fds
-  int ret = pipe2(wakeFds, O_CLOEXEC);
-  if (ret) {
-    LOG("pipe2 failed: %m\n");
+bool MediaRing::Wait(ListSource *source, uint64_t cursor) {
+  mtx.lock();
+  if (cursor < tail) {
+    mtx.unlock();
     return false;
   }
-  assert(wakeFds[0] >= 0 && wakeFds[1] >= 0);
-  reduction = func;
+  waiting = true;
+  mtx.unlock();
+  if (std::find(waiters.begin(), waiters.end(), source) == waiters.end())
+    waiters.push_back(source);
   return true;
 }
 
-void Source::Push(std::shared_ptr<MediaBuffer> &buffer) {
-  AutoLockMutex _alm(mtx);
-  if (reduction)
-    reduction(this, cached_buffers);
-  cached_buffers.push_back(buffer);
-  // mtx.notify();
-  int i = 0;
-  ssize_t count = write(wakeFds[1], &i, sizeof(i));
-  if (count < 0) {
-    LOG("write failed: %s, %p, fd = %d\n", strerror(errno), this, wakeFds[1]);
+void MediaRing::Cancel(ListSource *source) {
+  waiters.remove(source);
+  woken.remove(source);
+}
+
+void MediaRing::incomingDataHandler(MediaRing *ring, int /*mask*/) {
+  ring->incomingDataHandler1();
+}
+
+void MediaRing::incomingDataHandler1() {
+  uint64_t val;
+  if (read(event_fd, &val, sizeof(val)) != sizeof(val))
+    return;
+  // A woken source may wait again or be closed meanwhile, see Cancel.
+  woken.splice(woken.end(), waiters);
+  while (!woken.empty()) {
+    ListSource *source = woken.front();
+    woken.pop_front();
+    source->Wake();
   }
 }
 
-std::shared_ptr<MediaBuffer> Source::Pop() {
-  AutoLockMutex _alm(mtx);
-  if (cached_buffers.empty())
-    return nullptr;
-  auto buffer = cached_buffers.front();
-  cached_buffers.pop_front();
-  return std::move(buffer);
+ListSource::ListSource(UsageEnvironment &env, std::shared_ptr<MediaRing> ring)
+    : FramedSource(env), fRing(ring), fPrimedPaced(false), fLastPrimedTs(-1),
+      fBufferFunc(NULL), fBufferClientData(NULL) {
+  fRing->Attach();
+  fCursor = fRing->Tail();
+}
+
+ListSource::~ListSource() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+  fRing->Cancel(this);
+  fRing->Detach();
 }
 
-void Source::SetCachedBufSize(size_t one_buf_size) {
-  // max: 5 M/s
-  if (one_buf_size > 0)
-    m_cached_buffers_size = 1024 * 1024 * 5 / one_buf_size;
+void ListSource::Prime(const std::list<std::shared_ptr<MediaBuffer>> &gop,
+                       bool paced) {
+  fPrimed = gop;
+  fPrimedPaced = paced;
+  fLastPrimedTs = -1;
+  LOG("ListSource :: %p primed with %d cached frames\n", this,
+      (int)gop.size());
 }
+
+std::shared_ptr<MediaBuffer> ListSource::Next(int64_t *push_time) {
+  if (!fPrimed.empty()) {
+    auto buffer = fPrimed.front();
+    fPrimed.pop_front();
+    fLastPrimedTs = buffer->GetUSTimeStamp();
+    if (push_time)
+      *push_time = -1;
+    return buffer;
+  }
+  bool overrun = false;
+  auto buffer = fRing->Get(fCursor, overrun, push_time);
+  if (overrun) {
+    LOG("ListSource :: %p too slow, lost buffers\n", this);
+    Resync();
+    buffer = fRing->Get(fCursor, overrun, push_time);
+  }
+  return buffer;
+}
+
+// The cached frames go out at twice their real rate, so that a paced
+// client catches up with the live stream after one GOP.
+#define GOP_CACHE_PACE_SPEED 2
+#define GOP_CACHE_PACE_MAX_DELAY 100000 // us
+
+int64_t ListSource::NextPrimedDelay() {
+  if (!fPrimedPaced || fPrimed.empty())
+    return -1;
+  if (fLastPrimedTs < 0)
+    return 0;
+  int64_t delay = fPrimed.front()->GetUSTimeStamp() - fLastPrimedTs;
+  delay /= GOP_CACHE_PACE_SPEED;
+  if (delay < 0)
+    delay = 0;
+  else if (delay > GOP_CACHE_PACE_MAX_DELAY)
+    delay = GOP_CACHE_PACE_MAX_DELAY;
+  return delay;
+}
+
 void ListSource::doGetNextFrame() {
-  assert(fSource.GetReadFd() >= 0);
-  // Await the next incoming data on our FID:
-  envir().taskScheduler().turnOnBackgroundReadHandling(
-      fSource.GetReadFd(),
-      (TaskScheduler::BackgroundHandlerProc *)&incomingDataHandler, this);
+  int64_t delay = NextPrimedDelay();
+  if (delay < 0) {
+    // Await the next buffer of the ring.
+    if (fPrimed.empty() && fRing->Wait(this, fCursor))
+      return;
+    delay = 0;
+  }
+  // Deliver from the event loop rather than recursing into the sink.
+  nextTask() = envir().taskScheduler().scheduleDelayedTask(
+      delay, (TaskFunc *)&deliverHandler, this);
 }
 
 void ListSource::doStopGettingFrames() {
   LOG_FILE_FUNC_LINE();
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+  fRing->Cancel(this);
+  fBufferFunc = NULL;
   FramedSource::doStopGettingFrames();
 }
 
-void ListSource::incomingDataHandler(ListSource *source, int /*mask*/) {
-  source->incomingDataHandler1();
+void ListSource::getNextBuffer(afterGettingBufferFunc *func,
+                               void *clientData) {
+  fBufferFunc = func;
+  fBufferClientData = clientData;
+  doGetNextFrame();
 }
 
-void ListSource::incomingDataHandler1() {
-  // Read the data from our file into the client's buffer:
-  readFromList();
+void ListSource::Wake() {
+  if (isCurrentlyAwaitingData() || fBufferFunc)
+    deliver();
+}
 
-  assert(fSource.GetReadFd() >= 0);
-  // Stop handling any more input, until we're ready again:
-  envir().taskScheduler().turnOffBackgroundReadHandling(fSource.GetReadFd());
+void ListSource::deliverHandler(ListSource *source) {
+  source->nextTask() = NULL;
+  source->deliver();
+}
+
+void ListSource::deliver() {
+  // readFrame skips what can not be sent (video before the first IDR).
+  std::shared_ptr<MediaBuffer> buffer;
+  uint8_t *data = NULL;
+  unsigned size = 0;
+  while (!(buffer = readFrame(data, size))) {
+    if (fPrimed.empty() && fRing->Wait(this, fCursor))
+      return;
+  }
+
+  struct timeval presentation_time = buffer->GetTimeVal();
+  presentation_time.tv_sec += 1;
+  if (fBufferFunc) {
+    afterGettingBufferFunc *func = fBufferFunc;
+    fBufferFunc = NULL;
+    func(fBufferClientData, buffer, data, size, presentation_time);
+    return;
+  }
+
+  // Copy the frame into the client's buffer:
+  fPresentationTime = presentation_time;
+  fFrameSize = size;
+  if (fFrameSize > fMaxSize) {
+    LOG("%s : %d, fFrameSize(%d) > fMaxSize(%d)\n", __func__, __LINE__,
+        fFrameSize, fMaxSize);
+    fNumTruncatedBytes = fFrameSize - fMaxSize;
+    fFrameSize = fMaxSize;
+  } else {
+    fNumTruncatedBytes = 0;
+  }
+  memcpy(fTo, data, fFrameSize);
 
   // Tell our client that we have new data:
   afterGetting(this);
 }
 
-bool ListSource::readFromList(bool flush _UNUSED) { return false; }
-
 void ListSource::flush() {
-  readFromList(true);
+  fPrimed.clear();
+  fCursor = fRing->Tail();
   fFrameSize = 0;
   fNumTruncatedBytes = 0;
 }
 
-VideoFramedSource::VideoFramedSource(UsageEnvironment &env, Source &source)
-    : ListSource(env, source), got_iframe(false) {
-  // fReadFd = input.vs->GetReadFd();
+VideoFramedSource::VideoFramedSource(UsageEnvironment &env,
+                                     std::shared_ptr<MediaRing> ring,
+                                     Live555MediaInput *input)
+    : ListSource(env, ring), got_iframe(false), input(input), sock(-1),
+      sndbuf(0), skipping(false), last_idr_request(0) {
+  memset(&stats, 0, sizeof(stats));
 }
 
 VideoFramedSource::~VideoFramedSource() {
   LOG_FILE_FUNC_LINE();
-  // fInput.video_source = NULL;
+  if (sock >= 0) {
+    AutoLockMutex _alm(input->clients_mtx);
+    input->clients.remove(this);
+    LOG("rtsp client 0x%08x: sent %llu, dropped %llu, skipped %llu frames, "
+        "max latency %lld ms\n",
+        stats.client_id, (unsigned long long)stats.frames_sent,
+        (unsigned long long)stats.frames_dropped,
+        (unsigned long long)stats.frames_skipped,
+        (long long)stats.max_latency_us / 1000);
+  }
 }
 
-bool VideoFramedSource::readFromList(bool flush _UNUSED) {
-#ifdef DEBUG_SEND
-  fprintf(stderr, "$$$$ %s, %d\n", __func__, __LINE__);
-#endif
-  std::shared_ptr<MediaBuffer> buffer;
-  int i = 0;
-  ssize_t read_size = (ssize_t)sizeof(i);
-  ssize_t ret = read(fSource.GetReadFd(), &i, sizeof(i));
-  if (ret != read_size) {
-    LOG("video %s:%d, fd = %d. read from pipe error, %m\n", __func__, __LINE__,
-        fSource.GetReadFd());
-    envir() << __LINE__ << " read from pipe error: " << errno << "\n";
-    goto err;
+void VideoFramedSource::SetClient(unsigned client_id, int socket) {
+  if (sock >= 0 || socket < 0 || input->maxLatency() <= 0)
+    return;
+  socklen_t len = sizeof(sndbuf);
+  if (getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len))
+    sndbuf = 0;
+  sock = socket;
+  AutoLockMutex _alm(input->clients_mtx);
+  stats.client_id = client_id;
+  input->clients.push_back(this);
+}
+
+// Whether no other frame refers to this one: nal_ref_idc is 0 in h264, a
+// sub-layer non-reference picture in h265. Only the first NAL unit is
+// looked at, anything else than a slice is kept.
+static bool IsNonReferenceFrame(std::shared_ptr<MediaBuffer> &buffer,
+                                CodecType codec_type) {
+  uint8_t *p = (uint8_t *)buffer->GetPtr();
+  size_t size = buffer->GetValidSize();
+  if (size < 5)
+    return false;
+  uint8_t nal = (p[2] == 1) ? p[3] : p[4];
+  if (codec_type == CODEC_TYPE_H264)
+    return (nal & 0x1F) == 1 && !(nal & 0x60);
+  if (codec_type == CODEC_TYPE_H265) {
+    int type = (nal & 0x7E) >> 1;
+    return type <= 14 && !(type & 1);
   }
+  return false;
+}
 
-  buffer = fSource.Pop();
-  if (buffer) {
-    if (!got_iframe) {
-      got_iframe = buffer->GetUserFlag() & MediaBuffer::kIntra;
-      if (!got_iframe && !(buffer->GetUserFlag() & MediaBuffer::kExtraIntra))
-        goto err;
+// Late over half the latency budget, or the send buffer over a quarter
+// full: drop the non-reference frames. Late over the budget, or the send
+// buffer over 3/4 full: drop everything up to a fresh IDR.
+#define RTSP_DROP_SEND_QUEUE_PERCENT 25
+#define RTSP_SKIP_SEND_QUEUE_PERCENT 75
+#define RTSP_IDR_REQUEST_INTERVAL 1000000 // us
+
+bool VideoFramedSource::Drop(std::shared_ptr<MediaBuffer> &buffer,
+                             int64_t push_time) {
+  int64_t now = easymedia::gettimeofday();
+  int64_t latency = now - push_time;
+  int64_t max_latency = (int64_t)input->maxLatency() * 1000;
+  int queued = 0;
+  int percent = 0;
+  if (ioctl(sock, SIOCOUTQ, &queued) == 0 && sndbuf > 0)
+    percent = (int)((int64_t)queued * 100 / sndbuf);
+  bool key = buffer->GetUserFlag() &
+             (MediaBuffer::kIntra | MediaBuffer::kExtraIntra);
+  bool request_idr = false;
+  bool drop = false;
+
+  input->clients_mtx.lock();
+  stats.send_queue_bytes = queued;
+  stats.send_queue_percent = percent;
+  if (!key && (latency > max_latency ||
+               percent > RTSP_SKIP_SEND_QUEUE_PERCENT)) {
+    uint64_t tail = fRing->Tail();
+    stats.frames_skipped += tail - fCursor + 1;
+    fCursor = tail;
+    got_iframe = false;
+    skipping = true;
+    if (now - last_idr_request >= RTSP_IDR_REQUEST_INTERVAL) {
+      last_idr_request = now;
+      stats.idr_requests++;
+      request_idr = true;
     }
-    fPresentationTime = buffer->GetTimeVal();
-    fPresentationTime.tv_sec += 1;
-// gettimeofday(&fPresentationTime, NULL);
+    drop = true;
+  } else if (!key &&
+             (latency > max_latency / 2 ||
+              percent > RTSP_DROP_SEND_QUEUE_PERCENT) &&
+             IsNonReferenceFrame(buffer, codec_type)) {
+    stats.frames_dropped++;
+    drop = true;
+  } else {
+    stats.frames_sent++;
+    stats.latency_us = latency;
+    if (stats.max_latency_us < latency)
+      stats.max_latency_us = latency;
+  }
+  input->clients_mtx.unlock();
+
+  if (request_idr) {
+    LOG("rtsp client 0x%08x: %lld ms late, skip to the next IDR\n",
+        stats.client_id, (long long)latency / 1000);
+    auto callback = input->GetStartVideoStreamCallback();
+    if (callback)
+      callback();
+  }
+  return drop;
+}
+
+std::shared_ptr<MediaBuffer> VideoFramedSource::readFrame(uint8_t *&data,
+                                                          unsigned &size) {
 #ifdef DEBUG_SEND
-    fprintf(stderr, "video frame time: %ld, %ld.\n", fPresentationTime.tv_sec,
-            fPresentationTime.tv_usec);
+  fprintf(stderr, "$$$$ %s, %d\n", __func__, __LINE__);
 #endif
-    fFrameSize = buffer->GetValidSize();
+  unsigned start_code_size;
+  int64_t push_time = -1;
+  std::shared_ptr<MediaBuffer> buffer = Next(&push_time);
+  if (!buffer)
+    return nullptr;
+
+  if (!got_iframe) {
+    got_iframe = buffer->GetUserFlag() & MediaBuffer::kIntra;
+    if (!got_iframe && !(buffer->GetUserFlag() & MediaBuffer::kExtraIntra)) {
+      if (skipping) {
+        AutoLockMutex _alm(input->clients_mtx);
+        stats.frames_skipped++;
+      }
+      return nullptr;
+    }
+    if (got_iframe)
+      skipping = false;
+  }
+  if (sock >= 0 && push_time >= 0 && Drop(buffer, push_time))
+    return nullptr;
+  size = buffer->GetValidSize();
 #ifdef DEBUG_SEND
-    envir() << "video frame size: " << fFrameSize << "\n";
+  envir() << "video frame size: " << size << "\n";
 #endif
-    assert(fFrameSize > 0);
-    uint8_t *p = (uint8_t *)buffer->GetPtr();
-    if (buffer->GetUserFlag() & MediaBuffer::kIntra) {
-      int intra_size = 0;
-      uint8_t *intra_ptr =
-          (uint8_t *)GetIntraFromBuffer(buffer, intra_size, codec_type);
-      assert(intra_ptr);
-      assert(intra_size > 0);
-      p = intra_ptr;
-      fFrameSize = intra_size;
-    }
-    assert(p[0] == 0);
-    assert(p[1] == 0);
-    if (p[2] == 0) {
-      assert(p[3] == 1);
-      read_size = 4;
-    } else {
-      assert(p[2] == 1);
-      read_size = 3;
-    }
-    fFrameSize -= read_size;
-    if (fFrameSize > fMaxSize) {
-      LOG("%s : %d, fFrameSize(%d) > fMaxSize(%d)\n", __func__, __LINE__,
-          fFrameSize, fMaxSize);
-      fNumTruncatedBytes = fFrameSize - fMaxSize;
-      fFrameSize = fMaxSize;
-    } else {
-      fNumTruncatedBytes = 0;
-    }
-    memcpy(fTo, p + read_size, fFrameSize);
-    return true;
+  assert(size > 0);
+  uint8_t *p = (uint8_t *)buffer->GetPtr();
+  if (buffer->GetUserFlag() & MediaBuffer::kIntra) {
+    int intra_size = 0;
+    uint8_t *intra_ptr =
+        (uint8_t *)GetIntraFromBuffer(buffer, intra_size, codec_type);
+    assert(intra_ptr);
+    assert(intra_size > 0);
+    p = intra_ptr;
+    size = intra_size;
   }
-
-err:
-  fFrameSize = 0;
-  fNumTruncatedBytes = 0;
-  return false;
+  assert(p[0] == 0);
+  assert(p[1] == 0);
+  if (p[2] == 0) {
+    assert(p[3] == 1);
+    start_code_size = 4;
+  } else {
+    assert(p[2] == 1);
+    start_code_size = 3;
+  }
+  data = p + start_code_size;
+  size -= start_code_size;
+  return buffer;
 }
 
-CommonFramedSource::CommonFramedSource(UsageEnvironment &env, Source &source)
-    : ListSource(env, source) {
-  // fReadFd = input.as->GetReadFd();
+void VideoFramedSource::Resync() {
+  // Continue at the newest IDR kept, or wait for the next one.
+  fCursor = fRing->LastKeyFrame();
+  got_iframe = false;
 }
 
+CommonFramedSource::CommonFramedSource(UsageEnvironment &env,
+                                       std::shared_ptr<MediaRing> ring)
+    : ListSource(env, ring) {}
+
 CommonFramedSource::~CommonFramedSource() {
   LOG_FILE_FUNC_LINE();
   // fInput.audio_source = NULL;
@@ -455,63 +684,32 @@ CommonFramedSource::~CommonFramedSource() {
 static unsigned sg_fFramesize = 0;
 static long sg_lastTvsec = 0;
 #endif
-bool CommonFramedSource::readFromList(bool flush _UNUSED) {
+std::shared_ptr<MediaBuffer> CommonFramedSource::readFrame(uint8_t *&data,
+                                                           unsigned &size) {
 #ifdef DEBUG_SEND
   fprintf(stderr, "$$$$ %s, %d\n", __func__, __LINE__);
 #endif
-  std::shared_ptr<MediaBuffer> buffer;
-  uint8_t *p;
-
-  int i = 0;
-  ssize_t read_size = (ssize_t)sizeof(i);
-  ssize_t ret = read(fSource.GetReadFd(), &i, sizeof(i));
-  if (ret != read_size) {
-    LOG("common %s:%d, fd = %d. read from pipe error, %m\n", __func__, __LINE__,
-        fSource.GetReadFd());
-    envir() << __LINE__ << " read from pipe error: " << errno << "\n";
-    goto err;
-  }
+  std::shared_ptr<MediaBuffer> buffer = Next();
+  if (!buffer)
+    return nullptr;
 
-  buffer = fSource.Pop();
-  if (buffer) {
-    p = (uint8_t *)buffer->GetPtr();
-    fPresentationTime = buffer->GetTimeVal();
-    fPresentationTime.tv_sec += 1;
-#ifdef DEBUG_SEND
-    fprintf(stderr, "common frame time: %ld, %ld.\n", fPresentationTime.tv_sec,
-            fPresentationTime.tv_usec);
-#endif
-    fFrameSize = buffer->GetValidSize();
+  data = (uint8_t *)buffer->GetPtr();
+  size = buffer->GetValidSize();
 #ifdef DEBUG_FRAME
-    sg_fFramesize += fFrameSize;
-    struct timeval t_now;
-    gettimeofday(&t_now, NULL);
-    if (sg_lastTvsec != t_now.tv_sec) {
-      sg_lastTvsec = t_now.tv_sec;
-      envir() << "RTSP::audio frame in one sec is: " << sg_fFramesize << "\n";
-      sg_fFramesize = 0;
-    }
+  sg_fFramesize += size;
+  struct timeval t_now;
+  gettimeofday(&t_now, NULL);
+  if (sg_lastTvsec != t_now.tv_sec) {
+    sg_lastTvsec = t_now.tv_sec;
+    envir() << "RTSP::audio frame in one sec is: " << sg_fFramesize << "\n";
+    sg_fFramesize = 0;
+  }
 #endif
 #ifdef DEBUG_SEND
-    envir() << "audio frame size: " << fFrameSize << "\n";
+  envir() << "audio frame size: " << size << "\n";
 #endif
-    assert(fFrameSize > 0);
-    if (fFrameSize > fMaxSize) {
-      LOG("%s : %d, fFrameSize(%d) > fMaxSize(%d)\n", __func__, __LINE__,
-          fFrameSize, fMaxSize);
-      fNumTruncatedBytes = fFrameSize - fMaxSize;
-      fFrameSize = fMaxSize;
-    } else {
-      fNumTruncatedBytes = 0;
-    }
-    memcpy(fTo, p, fFrameSize);
-    return true;
-  }
-
-err:
-  fFrameSize = 0;
-  fNumTruncatedBytes = 0;
-  return false;
+  assert(size > 0);
+  return buffer;
 }
 
 } // namespace easymedia
@@ -5,48 +5,82 @@
 #ifndef EASYMEDIA_LIVE555_MEDIA_INPUT_HH_
 #define EASYMEDIA_LIVE555_MEDIA_INPUT_HH_
 
+#include <stdint.h>
+
 #include <functional>
 #include <list>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include <liveMedia/MediaSink.hh>
 
+#include "control.h"
 #include "lock.h"
 #include "media_type.h"
 
 namespace easymedia {
 
 class MediaBuffer;
+class ListSource;
 class VideoFramedSource;
-class CommonFramedSource;
-using ListReductionPtr = std::add_pointer<void(
-    void *userdata, std::list<std::shared_ptr<MediaBuffer>> &mb_list)>::type;
 
 // using StartStreamCallback = std::add_pointer<void(void)>::type;
 typedef std::function<void()> StartStreamCallback;
 
-class Source {
+// The buffers of one media of a channel, shared by all its clients. The
+// flow thread stores every buffer once and signals one eventfd, each
+// client reads at its own cursor in the live555 thread. A client more than
+// the capacity behind loses the oldest ones, the producer never waits.
+class MediaRing {
 public:
-  Source();
-  ~Source();
-  bool Init(ListReductionPtr func = nullptr);
-  void Push(std::shared_ptr<easymedia::MediaBuffer> &);
-  std::shared_ptr<MediaBuffer> Pop();
-  int GetReadFd() { return wakeFds[0]; }
-  int GetWriteFd() { return wakeFds[1]; }
-  Boolean GetReadFdStatus() { return m_read_fd_status; }
-  void CloseReadFd();
-  unsigned GetCachedBufSize() { return m_cached_buffers_size; }
-  void SetCachedBufSize(size_t one_buf_size);
+  // Initial capacity, in buffers.
+  static const uint64_t kCapacity = 64;
+
+  static std::shared_ptr<MediaRing> Create(UsageEnvironment &env);
+  ~MediaRing();
+
+  // Flow thread.
+  void Push(std::shared_ptr<MediaBuffer> &buffer);
+
+  // Live555 thread.
+  void Attach();
+  void Detach();
+  uint64_t Tail();
+  // Grow the capacity to at least num buffers, the cursors stay valid.
+  void Reserve(uint64_t num);
+  // The buffer at cursor, cursor is advanced. Returns nullptr if there is
+  // none yet, or if it was overwritten: then overrun is set and cursor
+  // moved to the oldest buffer kept. push_time gets when it was pushed.
+  std::shared_ptr<MediaBuffer> Get(uint64_t &cursor, bool &overrun,
+                                   int64_t *push_time = nullptr);
+  // Where the newest key frame starts (its parameter sets or the IDR),
+  // Tail() if none is kept.
+  uint64_t LastKeyFrame();
+  // Returns false if a buffer is already available at cursor, otherwise
+  // source->Wake() is called after the next Push.
+  bool Wait(ListSource *source, uint64_t cursor);
+  void Cancel(ListSource *source);
 
 private:
-  std::list<std::shared_ptr<MediaBuffer>> cached_buffers;
+  MediaRing(UsageEnvironment &env, int fd);
+  static void incomingDataHandler(MediaRing *ring, int mask);
+  void incomingDataHandler1();
+
+  UsageEnvironment &env;
   ConditionLockMutex mtx;
-  ListReductionPtr reduction;
-  int wakeFds[2]; // Live555's EventTrigger is poor for multithread, use fds
-  unsigned m_cached_buffers_size;
-  Boolean m_read_fd_status;
+  // Of capacity, a power of 2.
+  std::vector<std::shared_ptr<MediaBuffer>> slots;
+  std::vector<int64_t> push_times; // us
+  uint64_t capacity;
+  uint64_t head; // oldest buffer kept
+  uint64_t tail; // next buffer to write
+  int readers;
+  // Whether Push should signal event_fd, under mtx.
+  bool waiting;
+  int event_fd;
+  std::list<ListSource *> waiters;
+  std::list<ListSource *> woken;
 };
 
 class Live555MediaInput : public Medium {
@@ -69,15 +103,34 @@ public:
 
   unsigned getMaxIdrSize();
 
+  // Keep the last IDR, its parameter sets and the frames after it, up to
+  // max_bytes (0 disables), and start new h264/h265 clients with them.
+  // The burst is sent at once, or paced on the frame timestamps.
+  void SetGopCache(size_t max_bytes, bool paced);
+
+  // Send h264/h265 through ZeroCopyRTPSink rather than framer, fragmenter
+  // and H264or5VideoRTPSink. Set before the first client.
+  void SetZeroCopyRtp(bool enable) { zero_copy_rtp = enable; }
+  bool zeroCopyRtp() { return zero_copy_rtp; }
+
+  // Keep each h264/h265 client within max_ms of the live stream (0
+  // disables): a late client drops its non-reference frames, then skips
+  // to a fresh IDR. The clients then get their own source, so set it
+  // before the subsessions are created.
+  void SetMaxLatency(int max_ms) { max_latency = max_ms; }
+  int maxLatency() { return max_latency; }
+  // Fills up to num clients, returns how many there are.
+  int GetClientStats(RtspClientStats *stats, int num);
+
 protected:
   virtual ~Live555MediaInput();
 
 private:
   Live555MediaInput(UsageEnvironment &env);
 
-  std::list<Source *> video_list;
-  std::list<Source *> audio_list;
-  std::list<Source *> muxer_list;
+  std::shared_ptr<MediaRing> video_ring;
+  std::shared_ptr<MediaRing> audio_ring;
+  std::shared_ptr<MediaRing> muxer_ring;
   volatile bool connecting;
 
   StartStreamCallback video_callback;
@@ -88,54 +141,116 @@ private:
 
   friend class VideoFramedSource;
   friend class CommonFramedSource;
+  // The clients under latency control and their stats.
+  ConditionLockMutex clients_mtx;
+  std::list<VideoFramedSource *> clients;
+  int max_latency; // ms
   unsigned m_max_idr_size;
+
+  void UpdateGopCache(std::shared_ptr<MediaBuffer> &buffer);
+  // Taken by PushNewVideo, so that a new client gets the GOP cache and
+  // then the live frames without a gap.
+  ConditionLockMutex video_mtx;
+  std::list<std::shared_ptr<MediaBuffer>> gop_cache;
+  size_t gop_cache_bytes;
+  size_t gop_cache_max_bytes;
+  bool gop_cache_paced;
+  // False if a frame of the current GOP is missing from the cache.
+  bool gop_cache_valid;
+  bool zero_copy_rtp;
 };
 
 class ListSource : public FramedSource {
+public:
+  // Queue the GOP cache ahead of the live buffers.
+  void Prime(const std::list<std::shared_ptr<MediaBuffer>> &gop, bool paced);
+  // Called by the ring once a buffer is available.
+  void Wake();
+
+  // Zero-copy alternative to getNextFrame(): func gets the payload of the
+  // next frame inside its MediaBuffer instead of a copy in fTo.
+  typedef void(afterGettingBufferFunc)(void *clientData,
+                                       std::shared_ptr<MediaBuffer> &buffer,
+                                       uint8_t *data, unsigned size,
+                                       struct timeval presentationTime);
+  void getNextBuffer(afterGettingBufferFunc *func, void *clientData);
+
 protected:
-  ListSource(UsageEnvironment &env, Source &source)
-      : FramedSource(env), fSource(source) {}
-  virtual ~ListSource() {
-    if (fSource.GetReadFd() >= 0)
-      envir().taskScheduler().turnOffBackgroundReadHandling(
-          fSource.GetReadFd());
-    fSource.CloseReadFd();
-  }
-
-  virtual bool readFromList(bool flush = false) = 0;
+  ListSource(UsageEnvironment &env, std::shared_ptr<MediaRing> ring);
+  virtual ~ListSource();
+
+  // The next frame to send and its payload, nullptr if there is none or
+  // if the buffer read was skipped.
+  virtual std::shared_ptr<MediaBuffer> readFrame(uint8_t *&data,
+                                                 unsigned &size) = 0;
   virtual void flush();
+  // Next buffer of this client, nullptr if it has read everything.
+  // push_time is -1 for the GOP cache.
+  std::shared_ptr<MediaBuffer> Next(int64_t *push_time = nullptr);
+  // Move fCursor after the ring overwrote buffers this client had not read.
+  virtual void Resync() {}
 
-  Source &fSource;
+  std::shared_ptr<MediaRing> fRing;
+  uint64_t fCursor;
 
 private: // redefined virtual functions:
   virtual void doGetNextFrame();
   virtual void doStopGettingFrames();
 
-  static void incomingDataHandler(ListSource *source, int mask);
-  void incomingDataHandler1();
+  // Microseconds to hold back the next frame of a paced GOP cache burst,
+  // -1 if the next frame is to be sent as soon as it is ready.
+  int64_t NextPrimedDelay();
+  static void deliverHandler(ListSource *source);
+  void deliver();
+
+  std::list<std::shared_ptr<MediaBuffer>> fPrimed;
+  bool fPrimedPaced;
+  int64_t fLastPrimedTs;
+  afterGettingBufferFunc *fBufferFunc;
+  void *fBufferClientData;
 };
 
 class VideoFramedSource : public ListSource {
 public:
-  VideoFramedSource(UsageEnvironment &env, Source &source);
+  VideoFramedSource(UsageEnvironment &env, std::shared_ptr<MediaRing> ring,
+                    Live555MediaInput *input);
   virtual ~VideoFramedSource();
 
   void SetCodecType(CodecType type) { codec_type = type; }
   CodecType GetCodecType() { return codec_type; }
+  // Start the latency control of the client sending on socket.
+  void SetClient(unsigned client_id, int socket);
 
 protected: // redefined virtual functions:
-  virtual bool readFromList(bool flush = false);
+  virtual std::shared_ptr<MediaBuffer> readFrame(uint8_t *&data,
+                                                 unsigned &size);
+  virtual void Resync();
   bool got_iframe;
   CodecType codec_type;
+
+private:
+  // Whether the client is too late to send buffer, pushed at push_time.
+  bool Drop(std::shared_ptr<MediaBuffer> &buffer, int64_t push_time);
+
+  friend class Live555MediaInput;
+  Live555MediaInput *input;
+  int sock;
+  int sndbuf;
+  // Waiting for an IDR after being too late.
+  bool skipping;
+  int64_t last_idr_request;
+  // Under input->clients_mtx.
+  RtspClientStats stats;
 };
 
 class CommonFramedSource : public ListSource {
 public:
-  CommonFramedSource(UsageEnvironment &env, Source &source);
+  CommonFramedSource(UsageEnvironment &env, std::shared_ptr<MediaRing> ring);
   virtual ~CommonFramedSource();
 
 protected: // redefined virtual functions:
-  virtual bool readFromList(bool flush = false);
+  virtual std::shared_ptr<MediaBuffer> readFrame(uint8_t *&data,
+                                                 unsigned &size);
 };
 
 // Functions to set the optimal buffer size for RTP sink objects.
@@ -148,6 +263,8 @@ inline void setAudioRTPSinkBufferSize() {
 inline void setVideoRTPSinkBufferSize() {
   OutPacketBuffer::maxSize = VIDEO_MAX_FRAME_SIZE;
 }
+// ZeroCopyRTPSink does not use the buffer of MultiFramedRTPSink.
+inline void setZeroCopyRTPSinkBufferSize() { OutPacketBuffer::maxSize = 1500; }
 
 } // namespace easymedia
 
@@ -12,6 +12,7 @@
 #ifndef _RTSP_SERVER_HH
 #include <liveMedia/RTSPServer.hh>
 #endif
+#include <liveMedia/liveMedia_version.hh>
 
 #if !defined(LIVE555_SERVER_H264) && !defined(LIVE555_SERVER_H265)
 #error                                                                         \
@@ -38,29 +39,136 @@
 #include "media_reflector.h"
 #include "media_type.h"
 
+#include <arpa/inet.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <netinet/in.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 namespace easymedia {
 
+// live555 2020.10.16 and later listen on an IPv4 and an IPv6 socket.
+#define LIVE555_IPV6_SERVER_VERSION_INT 1602806400
+
+// A listening socket with SO_REUSEPORT on any address of family, -1 on
+// failure.
+static int ReusePortSocket(int family, Port ourPort) {
+  int sock = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    LOG("%s: socket failed: %m\n", __func__);
+    return -1;
+  }
+  int on = 1;
+  struct sockaddr_storage addr;
+  socklen_t len;
+  memset(&addr, 0, sizeof(addr));
+  if (family == AF_INET6) {
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&addr;
+    addr6->sin6_family = AF_INET6;
+    addr6->sin6_addr = in6addr_any;
+    addr6->sin6_port = ourPort.num();
+    len = sizeof(*addr6);
+    // The IPv4 clients go to the IPv4 socket.
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on))) {
+      ::close(sock);
+      return -1;
+    }
+  } else {
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)&addr;
+    addr4->sin_family = AF_INET;
+    addr4->sin_addr.s_addr = htonl(INADDR_ANY);
+    addr4->sin_port = ourPort.num();
+    len = sizeof(*addr4);
+  }
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+      setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) ||
+      bind(sock, (struct sockaddr *)&addr, len) || listen(sock, 20)) {
+    LOG("%s: listen on port %d failed: %m\n", __func__, ntohs(ourPort.num()));
+    ::close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+// An RTSPServer whose listening sockets have SO_REUSEPORT, so that several
+// shards can listen on the same port. The kernel picks the shard of each
+// TCP connection, and a session only exists in the shard that set it up.
+// RTSP over HTTP pairs a GET and a POST connection by their session
+// cookie, they may land on two shards, so it is refused.
+class ReusePortRTSPServer : public RTSPServer {
+public:
+  static ReusePortRTSPServer *
+  createNew(UsageEnvironment &env, Port ourPort,
+            UserAuthenticationDatabase *authDatabase,
+            unsigned reclamationSeconds) {
+    int sock = ReusePortSocket(AF_INET, ourPort);
+    if (sock < 0)
+      return nullptr;
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= LIVE555_IPV6_SERVER_VERSION_INT
+    // live555 serves IPv4 only as well if there is no IPv6.
+    int sock6 = ReusePortSocket(AF_INET6, ourPort);
+    return new ReusePortRTSPServer(env, sock, sock6, ourPort, authDatabase,
+                                   reclamationSeconds);
+#else
+    return new ReusePortRTSPServer(env, sock, ourPort, authDatabase,
+                                   reclamationSeconds);
+#endif
+  }
+
+protected:
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= LIVE555_IPV6_SERVER_VERSION_INT
+  typedef struct sockaddr_storage const &ClientAddr;
+  ReusePortRTSPServer(UsageEnvironment &env, int ourSocket, int ourSocketIPv6,
+                      Port ourPort, UserAuthenticationDatabase *authDatabase,
+                      unsigned reclamationSeconds)
+      : RTSPServer(env, ourSocket, ourSocketIPv6, ourPort, authDatabase,
+                   reclamationSeconds) {}
+#else
+  typedef struct sockaddr_in ClientAddr;
+  ReusePortRTSPServer(UsageEnvironment &env, int ourSocket, Port ourPort,
+                      UserAuthenticationDatabase *authDatabase,
+                      unsigned reclamationSeconds)
+      : RTSPServer(env, ourSocket, ourPort, authDatabase, reclamationSeconds) {}
+#endif
+
+  class NoTunnelClientConnection : public RTSPClientConnection {
+  public:
+    NoTunnelClientConnection(RTSPServer &ourServer, int clientSocket,
+                             ClientAddr clientAddr)
+        : RTSPClientConnection(ourServer, clientSocket, clientAddr) {}
+
+  protected:
+    virtual void handleHTTPCmd_TunnelingGET(char const *) override {
+      LOG("rtsp over http is not supported with rtsp_threads > 1\n");
+      handleHTTPCmd_notSupported();
+    }
+    // False makes live555 answer not supported.
+    virtual Boolean handleHTTPCmd_TunnelingPOST(char const *,
+                                                unsigned char const *,
+                                                unsigned) override {
+      return False;
+    }
+  };
+
+  virtual ClientConnection *createNewClientConnection(int clientSocket,
+                                                      ClientAddr clientAddr)
+      override {
+    return new NoTunnelClientConnection(*this, clientSocket, clientAddr);
+  }
+};
+
 std::mutex RtspConnection::kMutex;
 std::shared_ptr<RtspConnection> RtspConnection::m_rtspConnection = nullptr;
 volatile bool RtspConnection::init_ok = false;
-volatile char RtspConnection::out_loop_cond = 1;
 
-RtspConnection::RtspConnection(int port, std::string username,
-                               std::string userpwd)
-    : scheduler(nullptr), env(nullptr), authDB(nullptr), rtspServer(nullptr),
-      session_thread(nullptr) {
-  if (!username.empty() && !userpwd.empty()) {
-    authDB = new UserAuthenticationDatabase;
-    if (!authDB) {
-      goto err;
-    }
-    authDB->addUserRecord(username.c_str(), userpwd.c_str());
-  }
+RtspServerShard::RtspServerShard(int index, int port,
+                                 UserAuthenticationDatabase *authDB,
+                                 bool reuse_port)
+    : index(index), scheduler(nullptr), env(nullptr), rtspServer(nullptr),
+      session_thread(nullptr), out_loop_cond(1), flag(false) {
+  msg_fd[0] = msg_fd[1] = -1;
   scheduler = BasicTaskScheduler::createNew();
   if (!scheduler) {
     goto err;
@@ -70,7 +178,10 @@ RtspConnection::RtspConnection(int port, std::string username,
     goto err;
   }
 
-  rtspServer = RTSPServer::createNew(*env, port, authDB, 10);
+  if (reuse_port)
+    rtspServer = ReusePortRTSPServer::createNew(*env, port, authDB, 10);
+  else
+    rtspServer = RTSPServer::createNew(*env, port, authDB, 10);
 
   if (!rtspServer) {
     goto err;
@@ -82,41 +193,29 @@ RtspConnection::RtspConnection(int port, std::string username,
   }
 
   out_loop_cond = 0;
-  session_thread = new std::thread(&RtspConnection::service_session_run, this);
+  session_thread = new std::thread(&RtspServerShard::service_session_run, this);
   if (!session_thread) {
     LOG_NO_MEMORY();
     goto err;
   }
-  init_ok = true;
   return;
 err:
-  LOG("=============== RtspConnection error. =================\n");
-  init_ok = false;
+  LOG("=============== RtspServerShard %d error. =================\n", index);
 }
 
-void RtspConnection::service_session_run() {
+void RtspServerShard::service_session_run() {
   AutoPrintLine apl(__func__);
-  LOG("================ service_session_run =================\n");
-  prctl(PR_SET_NAME, "live555_server");
+  LOG("================ service_session_run %d =================\n", index);
+  char name[16];
+  snprintf(name, sizeof(name), "live555_server%d", index);
+  prctl(PR_SET_NAME, index ? name : "live555_server");
   env->taskScheduler().turnOnBackgroundReadHandling(
       msg_fd[0], (TaskScheduler::BackgroundHandlerProc *)&incomingMsgHandler,
       this);
   env->taskScheduler().doEventLoop(&out_loop_cond);
 }
 
-Live555MediaInput *RtspConnection::createNewChannel(
-    std::string channel_name, std::string video_type, std::string audio_type,
-    int channels, int sample_rate, unsigned bitrate, int profile) {
-  struct message msg;
-  msg.cmd_type = CMD_TYPE::NewSession;
-  strcpy(msg.channel_name, channel_name.c_str());
-  strcpy(msg.videoType, video_type.c_str());
-  strcpy(msg.audioType, audio_type.c_str());
-  msg.channels = channels;
-  msg.sample_rate = sample_rate;
-  msg.bitrate = bitrate;
-  msg.profile = profile;
-  sendMessage(msg);
+Live555MediaInput *RtspServerShard::getInput(std::string channel_name) {
   auto search = input_map.find(channel_name);
   if (search != input_map.end()) {
     return search->second;
@@ -124,18 +223,11 @@ Live555MediaInput *RtspConnection::createNewChannel(
   return nullptr;
 }
 
-void RtspConnection::removeChannel(std::string channel_name) {
-  struct message msg;
-  msg.cmd_type = CMD_TYPE::RemoveSession;
-  strcpy(msg.channel_name, channel_name.c_str());
-  sendMessage(msg);
-}
-
-void RtspConnection::incomingMsgHandler(RtspConnection *rtsp, int) {
-  rtsp->incomingMsgHandler1();
+void RtspServerShard::incomingMsgHandler(RtspServerShard *shard, int) {
+  shard->incomingMsgHandler1();
 }
 
-void RtspConnection::incomingMsgHandler1() {
+void RtspServerShard::incomingMsgHandler1() {
   struct message msg;
   ssize_t count = read(msg_fd[0], &msg, sizeof(msg));
   if (count < 0) {
@@ -162,10 +254,10 @@ void RtspConnection::incomingMsgHandler1() {
   mtx.unlock();
   LOG("%s: after mtx.notify\n", __func__);
 }
-
-void RtspConnection::addSession(struct message msg) {
+void RtspServerShard::addSession(struct message msg) {
   // 1. server_input
   Live555MediaInput *server_input = Live555MediaInput::createNew(*env);
+  server_input->SetMaxLatency(msg.max_latency);
   auto search = input_map.find(msg.channel_name);
   if (search != input_map.end()) {
     LOG("%s:%s:: input_map, %s already exists, so we have to delete it.\n",
@@ -226,15 +318,14 @@ void RtspConnection::addSession(struct message msg) {
     sms->addSubsession(subsession);
 }
 
-void RtspConnection::removeSession(struct message msg) {
+void RtspServerShard::removeSession(struct message msg) {
   if (rtspServer != nullptr) {
     rtspServer->deleteServerMediaSession(msg.channel_name);
     input_map.erase(msg.channel_name);
     LOG("RtspConnection delete %s.\n", msg.channel_name);
   }
 }
-void RtspConnection::sendMessage(struct message msg) {
-  lock_msg.lock();
+void RtspServerShard::sendMessage(struct message msg) {
   mtx.lock();
   flag = true;
   ssize_t count = write(msg_fd[1], (void *)&msg, sizeof(msg));
@@ -246,13 +337,12 @@ void RtspConnection::sendMessage(struct message msg) {
     mtx.wait();
   }
   mtx.unlock();
-  lock_msg.unlock();
   LOG("%s: after mtx.wait.\n", __func__);
 }
 
-RtspConnection::~RtspConnection() {
+RtspServerShard::~RtspServerShard() {
   out_loop_cond = 1;
-  if (msg_fd[0] > 0) {
+  if (msg_fd[0] >= 0 && env) {
     env->taskScheduler().turnOffBackgroundReadHandling(msg_fd[0]);
   }
   if (msg_fd[0] >= 0) {
@@ -273,10 +363,6 @@ RtspConnection::~RtspConnection() {
     Medium::close(rtspServer);
     rtspServer = nullptr;
   }
-  if (authDB) {
-    delete authDB;
-    authDB = nullptr;
-  }
   if (env && env->reclaim() == True)
     env = nullptr;
   if (scheduler) {
@@ -285,4 +371,85 @@ RtspConnection::~RtspConnection() {
   }
 }
 
+RtspConnection::RtspConnection(int port, std::string username,
+                               std::string userpwd, int threads)
+    : authDB(nullptr) {
+  if (!username.empty() && !userpwd.empty()) {
+    authDB = new UserAuthenticationDatabase;
+    if (!authDB) {
+      goto err;
+    }
+    authDB->addUserRecord(username.c_str(), userpwd.c_str());
+  }
+  if (threads < 1)
+    threads = 1;
+  for (int i = 0; i < threads; i++) {
+    RtspServerShard *shard =
+        new RtspServerShard(i, port, authDB, threads > 1);
+    if (!shard || !shard->Ok()) {
+      delete shard;
+      // Serve with the shards already running.
+      if (i > 0) {
+        LOG("rtsp server runs %d of %d threads\n", i, threads);
+        break;
+      }
+      goto err;
+    }
+    shards.push_back(shard);
+  }
+  init_ok = true;
+  return;
+err:
+  LOG("=============== RtspConnection error. =================\n");
+  init_ok = false;
+}
+
+std::vector<Live555MediaInput *> RtspConnection::createNewChannel(
+    std::string channel_name, std::string video_type, std::string audio_type,
+    int channels, int sample_rate, unsigned bitrate, int profile,
+    int max_latency) {
+  struct message msg;
+  std::vector<Live555MediaInput *> inputs;
+  msg.cmd_type = CMD_TYPE::NewSession;
+  strcpy(msg.channel_name, channel_name.c_str());
+  strcpy(msg.videoType, video_type.c_str());
+  strcpy(msg.audioType, audio_type.c_str());
+  msg.channels = channels;
+  msg.sample_rate = sample_rate;
+  msg.bitrate = bitrate;
+  msg.profile = profile;
+  msg.max_latency = max_latency;
+  sendMessage(msg);
+  for (auto shard : shards) {
+    Live555MediaInput *input = shard->getInput(channel_name);
+    if (input)
+      inputs.push_back(input);
+  }
+  return inputs;
+}
+
+void RtspConnection::removeChannel(std::string channel_name) {
+  struct message msg;
+  msg.cmd_type = CMD_TYPE::RemoveSession;
+  strcpy(msg.channel_name, channel_name.c_str());
+  sendMessage(msg);
+}
+
+void RtspConnection::sendMessage(struct message msg) {
+  lock_msg.lock();
+  for (auto shard : shards)
+    shard->sendMessage(msg);
+  lock_msg.unlock();
+}
+
+RtspConnection::~RtspConnection() {
+  for (auto shard : shards)
+    delete shard;
+  shards.clear();
+  if (authDB) {
+    delete authDB;
+    authDB = nullptr;
+  }
+}
+
 } // namespace easymedia
@@ -6,6 +6,7 @@
 #define EASYMEDIA_LIVE555_SERVER_HH_
 #include "live555_media_input.hh"
 #include <map>
+#include <vector>
 namespace easymedia {
 enum CMD_TYPE { NewSession, RemoveSession };
 struct message {
@@ -17,20 +18,57 @@ struct message {
   int sample_rate;
   unsigned bitrate;
   int profile;
+  int max_latency; // ms
+};
+
+// One live555 event loop: a scheduler, an RTSPServer and the sessions of
+// every channel, run by its own thread. Shards share the RTSP port through
+// SO_REUSEPORT, so the kernel spreads the client connections among them.
+// The sessions of a shard are unknown to the others.
+class RtspServerShard {
+public:
+  RtspServerShard(int index, int port, UserAuthenticationDatabase *authDB,
+                  bool reuse_port);
+  ~RtspServerShard();
+  bool Ok() { return session_thread != nullptr; }
+  // Blocks until the event loop has handled msg.
+  void sendMessage(struct message msg);
+  Live555MediaInput *getInput(std::string channel_name);
+
+private:
+  void service_session_run();
+  static void incomingMsgHandler(RtspServerShard *shard, int mask);
+  void incomingMsgHandler1();
+  void addSession(struct message msg);
+  void removeSession(struct message msg);
+
+  int index;
+  TaskScheduler *scheduler;
+  UsageEnvironment *env;
+  RTSPServer *rtspServer;
+  std::thread *session_thread;
+  volatile char out_loop_cond;
+  int msg_fd[2];
+  std::map<std::string, Live555MediaInput *> input_map;
+  ConditionLockMutex mtx;
+  volatile bool flag;
 };
 
 class RtspConnection {
 public:
+  // threads is the number of event loops, taken from the first caller.
   static std::shared_ptr<RtspConnection>
-  getInstance(int port, std::string username, std::string userpwd) {
+  getInstance(int port, std::string username, std::string userpwd,
+              int threads = 1) {
     kMutex.lock();
     if (m_rtspConnection == nullptr) {
       struct make_shared_enabler : public RtspConnection {
-        make_shared_enabler(int port, std::string username, std::string userpwd)
-            : RtspConnection(port, username, userpwd){};
+        make_shared_enabler(int port, std::string username, std::string userpwd,
+                            int threads)
+            : RtspConnection(port, username, userpwd, threads){};
       };
-      m_rtspConnection =
-          std::make_shared<make_shared_enabler>(port, username, userpwd);
+      m_rtspConnection = std::make_shared<make_shared_enabler>(
+          port, username, userpwd, threads);
       if (!init_ok) {
         m_rtspConnection = nullptr;
       }
@@ -38,40 +76,29 @@ public:
     kMutex.unlock();
     return m_rtspConnection;
   }
-  Live555MediaInput *createNewChannel(std::string channel_name,
-                                      std::string video_type,
-                                      std::string audio_type, int channels = 0,
-                                      int sample_rate = 0, unsigned bitrate = 0,
-                                      int profile = 1);
+  // Returns the input of the channel in every shard.
+  std::vector<Live555MediaInput *>
+  createNewChannel(std::string channel_name, std::string video_type,
+                   std::string audio_type, int channels = 0,
+                   int sample_rate = 0, unsigned bitrate = 0, int profile = 1,
+                   int max_latency = 0);
   void removeChannel(std::string channel_name);
 
   ~RtspConnection();
 
 private:
   static volatile bool init_ok;
-  static volatile char out_loop_cond;
 
-  RtspConnection(int port, std::string username, std::string userpwd);
+  RtspConnection(int port, std::string username, std::string userpwd,
+                 int threads);
 
-  void service_session_run();
-  static void incomingMsgHandler(RtspConnection *rtsp, int mask);
-  void incomingMsgHandler1();
   void sendMessage(struct message msg);
-  void addSession(struct message msg);
-  void removeSession(struct message msg);
   static std::mutex kMutex;
   static std::shared_ptr<RtspConnection> m_rtspConnection;
 
-  TaskScheduler *scheduler;
-  UsageEnvironment *env;
   UserAuthenticationDatabase *authDB;
-  RTSPServer *rtspServer;
-  std::thread *session_thread;
-  int msg_fd[2];
-  std::map<std::string, Live555MediaInput *> input_map;
-  ConditionLockMutex mtx;
+  std::vector<RtspServerShard *> shards;
   std::mutex lock_msg;
-  volatile bool flag;
 };
 
 class RKServerMediaSession : public ServerMediaSession {
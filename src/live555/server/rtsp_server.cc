@@ -44,9 +44,11 @@ public:
   RtspServerFlow(const char *param);
   virtual ~RtspServerFlow();
   static const char *GetFlowName() { return "live555_rtsp_server"; }
+  int Control(unsigned long int request, ...);
 
 private:
-  Live555MediaInput *server_input;
+  // The channel input of every event loop of the connection.
+  std::vector<Live555MediaInput *> server_inputs;
   std::shared_ptr<RtspConnection> rtspConnection;
 
   std::string channel_name;
@@ -81,19 +83,24 @@ bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector) {
                                      buffer->GetValidSize(),
                                      buffer->GetUSTimeStamp());
       }
-      // Independently send vps, sps, pps packets to live555.
-      for (auto &buf : spspps)
-        rtsp_flow->server_input->PushNewVideo(buf);
-      // The original Intr frame information is sent to live555.
-      // At this time it still contains extra information.
-      rtsp_flow->server_input->PushNewVideo(buffer);
-    } else if (buffer->GetType() == Type::Audio)
-      rtsp_flow->server_input->PushNewAudio(buffer);
-    else if (buffer->GetType() == Type::Video)
-      rtsp_flow->server_input->PushNewVideo(buffer);
-    else {
+      for (auto server_input : rtsp_flow->server_inputs) {
+        // Independently send vps, sps, pps packets to live555.
+        for (auto &buf : spspps)
+          server_input->PushNewVideo(buf);
+        // The original Intr frame information is sent to live555.
+        // At this time it still contains extra information.
+        server_input->PushNewVideo(buffer);
+      }
+    } else if (buffer->GetType() == Type::Audio) {
+      for (auto server_input : rtsp_flow->server_inputs)
+        server_input->PushNewAudio(buffer);
+    } else if (buffer->GetType() == Type::Video) {
+      for (auto server_input : rtsp_flow->server_inputs)
+        server_input->PushNewVideo(buffer);
+    } else {
       // muxer buffer
-      rtsp_flow->server_input->PushNewMuxer(buffer);
+      for (auto server_input : rtsp_flow->server_inputs)
+        server_input->PushNewMuxer(buffer);
     }
   }
 
@@ -116,7 +123,12 @@ RtspServerFlow::RtspServerFlow(const char *param) {
   int port = std::stoi(value);
   std::string &username = params[KEY_USERNAME];
   std::string &userpwd = params[KEY_USERPASSWORD];
-  rtspConnection = RtspConnection::getInstance(port, username, userpwd);
+  int threads = 1;
+  value = params[KEY_RTSP_THREADS];
+  if (!value.empty())
+    threads = std::stoi(value);
+  rtspConnection =
+      RtspConnection::getInstance(port, username, userpwd, threads);
   int sample_rate = 0, channels = 0, profiles = 0;
   unsigned bitrate = 0;
   value = params[KEY_SAMPLE_RATE];
@@ -135,6 +147,20 @@ RtspServerFlow::RtspServerFlow(const char *param) {
   if (!value.empty())
     bitrate = std::stoi(value);
 
+  int gop_cache_size = 0;
+  value = params[KEY_GOP_CACHE_SIZE];
+  if (!value.empty())
+    gop_cache_size = std::stoi(value);
+  bool gop_cache_paced = (params[KEY_GOP_CACHE_MODE] == KEY_GOP_CACHE_PACED);
+  bool zero_copy_rtp = false;
+  value = params[KEY_RTP_ZERO_COPY];
+  if (!value.empty())
+    zero_copy_rtp = (std::stoi(value) != 0);
+  int max_latency = 0;
+  value = params[KEY_RTSP_MAX_LATENCY];
+  if (!value.empty())
+    max_latency = std::stoi(value);
+
   if (rtspConnection) {
     int in_idx = 0;
     std::string markname;
@@ -152,13 +178,22 @@ RtspServerFlow::RtspServerFlow(const char *param) {
       sm.input_slots.push_back(in_idx);
       in_idx++;
     }
-    server_input = rtspConnection->createNewChannel(
+    server_inputs = rtspConnection->createNewChannel(
         channel_name, video_type, audio_type, channels, sample_rate, bitrate,
-        profiles);
-    server_input->SetStartVideoStreamCallback(
-        std::bind(&RtspServerFlow::CallPlayVideoHandler, this));
-    server_input->SetStartAudioStreamCallback(
-        std::bind(&RtspServerFlow::CallPlayAudioHandler, this));
+        profiles, max_latency);
+    if (server_inputs.empty()) {
+      LOG("Fail to create rtsp channel %s\n", channel_name.c_str());
+      goto err;
+    }
+    for (auto server_input : server_inputs) {
+      server_input->SetStartVideoStreamCallback(
+          std::bind(&RtspServerFlow::CallPlayVideoHandler, this));
+      server_input->SetStartAudioStreamCallback(
+          std::bind(&RtspServerFlow::CallPlayAudioHandler, this));
+      if (gop_cache_size > 0)
+        server_input->SetGopCache(gop_cache_size, gop_cache_paced);
+      server_input->SetZeroCopyRtp(zero_copy_rtp);
+    }
     sm.process = SendMediaToServer;
     sm.thread_model = Model::ASYNCCOMMON;
     sm.mode_when_full = InputMode::BLOCKING;
@@ -192,6 +227,36 @@ void RtspServerFlow::CallPlayAudioHandler() {
   }
 }
 
+int RtspServerFlow::Control(unsigned long int request, ...) {
+  int ret = 0;
+  va_list vl;
+  va_start(vl, request);
+
+  switch (request) {
+  case G_RTSP_CLIENT_STATS: {
+    RtspClientStats *stats = va_arg(vl, RtspClientStats *);
+    int *num = va_arg(vl, int *);
+    if (!stats || !num) {
+      ret = -1;
+      break;
+    }
+    int count = 0;
+    for (auto server_input : server_inputs) {
+      int room = (count < *num) ? (*num - count) : 0;
+      count += server_input->GetClientStats(room ? stats + count : stats,
+                                            room);
+    }
+    *num = count;
+  } break;
+  default:
+    ret = -1;
+    break;
+  }
+
+  va_end(vl);
+  return ret;
+}
+
 RtspServerFlow::~RtspServerFlow() {
   AutoPrintLine apl(__func__);
   StopAllThread();
@@ -199,7 +264,7 @@ RtspServerFlow::~RtspServerFlow() {
   if (rtspConnection) {
     rtspConnection->removeChannel(channel_name);
   }
-  server_input = nullptr;
+  server_inputs.clear();
 }
 
 DEFINE_FLOW_FACTORY(RtspServerFlow, Flow)
@@ -0,0 +1,188 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_ZERO_COPY_RTP_SINK_HH_
+#define EASYMEDIA_ZERO_COPY_RTP_SINK_HH_
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <liveMedia/H264VideoRTPSink.hh>
+#include <liveMedia/H265VideoRTPSink.hh>
+
+#include "buffer.h"
+#include "live555_media_input.hh"
+#include "utils.h"
+
+namespace easymedia {
+
+// RTP packet size, headers included.
+#define ZERO_COPY_RTP_PACKET_SIZE 1456
+
+// A H264VideoRTPSink or H265VideoRTPSink fed straight by a ListSource,
+// without framer and fragmenter: each NAL unit is fragmented (FU-A,
+// RFC 6184 / FU, RFC 7798) from the MediaBuffer of the encoder, so the
+// only copy left is the gather of one packet for RTPInterface, which also
+// carries RTP over the RTSP connection. The parameter sets seen are kept
+// for the SDP, like the framer does.
+template <class Base> class ZeroCopyRTPSink : public Base {
+public:
+  static ZeroCopyRTPSink *createNew(UsageEnvironment &env, Groupsock *RTPgs,
+                                    unsigned char rtpPayloadFormat) {
+    return new ZeroCopyRTPSink(env, RTPgs, rtpPayloadFormat);
+  }
+
+protected:
+  ZeroCopyRTPSink(UsageEnvironment &env, Groupsock *RTPgs,
+                  unsigned char rtpPayloadFormat)
+      : Base(env, RTPgs, rtpPayloadFormat) {}
+
+  virtual Boolean sourceIsCompatibleWithUs(MediaSource &source _UNUSED) {
+    // Only created with a ListSource, see createNewStreamSource.
+    return True;
+  }
+
+  virtual Boolean continuePlaying() {
+    if (this->fSource == NULL)
+      return False;
+    ((ListSource *)this->fSource)->getNextBuffer(afterGettingBuffer, this);
+    return True;
+  }
+
+private:
+  static void afterGettingBuffer(void *clientData,
+                                 std::shared_ptr<MediaBuffer> &buffer,
+                                 uint8_t *data, unsigned size,
+                                 struct timeval presentationTime) {
+    ZeroCopyRTPSink *sink = (ZeroCopyRTPSink *)clientData;
+    // Parameter sets belong to the access unit of the following IDR.
+    bool last = !(buffer->GetUserFlag() & MediaBuffer::kExtraIntra);
+    if (!last)
+      sink->saveParameterSet(data, size);
+    sink->sendNalu(data, size, presentationTime, last);
+    sink->continuePlaying();
+  }
+
+  void saveParameterSet(uint8_t *nal, unsigned size) {
+    u_int8_t **set = NULL;
+    unsigned *set_size = NULL;
+    if (this->fHNumber == 264) {
+      switch (nal[0] & 0x1F) {
+      case 7:
+        set = &this->fSPS, set_size = &this->fSPSSize;
+        break;
+      case 8:
+        set = &this->fPPS, set_size = &this->fPPSSize;
+        break;
+      }
+    } else {
+      switch ((nal[0] & 0x7E) >> 1) {
+      case 32:
+        set = &this->fVPS, set_size = &this->fVPSSize;
+        break;
+      case 33:
+        set = &this->fSPS, set_size = &this->fSPSSize;
+        break;
+      case 34:
+        set = &this->fPPS, set_size = &this->fPPSSize;
+        break;
+      }
+    }
+    if (!set || (*set_size == size && !memcmp(*set, nal, size)))
+      return;
+    delete[] *set;
+    *set = new u_int8_t[size];
+    memcpy(*set, nal, size);
+    *set_size = size;
+  }
+
+  void sendNalu(uint8_t *nal, unsigned size, struct timeval presentationTime,
+                bool last) {
+    if (size == 0)
+      return;
+    u_int32_t timestamp = this->convertToRTPTimestamp(presentationTime);
+    this->fCurrentTimestamp = timestamp;
+    this->fMostRecentPresentationTime = presentationTime;
+    if (this->fInitialPresentationTime.tv_sec == 0 &&
+        this->fInitialPresentationTime.tv_usec == 0)
+      this->fInitialPresentationTime = presentationTime;
+
+    const unsigned max_payload = ZERO_COPY_RTP_PACKET_SIZE - 12;
+    if (size <= max_payload) {
+      sendPacket(timestamp, last, NULL, 0, nal, size);
+      return;
+    }
+
+    // Fragmentation units: the NAL header is replaced by the FU headers.
+    uint8_t fu[3];
+    unsigned fu_size, nal_header_size;
+    if (this->fHNumber == 264) {
+      fu[0] = (nal[0] & 0xE0) | 28;
+      fu[1] = nal[0] & 0x1F;
+      fu_size = 2;
+      nal_header_size = 1;
+    } else {
+      fu[0] = (nal[0] & 0x81) | (49 << 1);
+      fu[1] = nal[1];
+      fu[2] = (nal[0] & 0x7E) >> 1;
+      fu_size = 3;
+      nal_header_size = 2;
+    }
+    uint8_t &fu_header = fu[fu_size - 1];
+    const uint8_t nal_type = fu_header;
+    uint8_t *p = nal + nal_header_size;
+    unsigned remain = size - nal_header_size;
+    bool start = true;
+    while (remain > 0) {
+      unsigned len = max_payload - fu_size;
+      if (len > remain)
+        len = remain;
+      bool end = (len == remain);
+      fu_header = nal_type | (start ? 0x80 : 0) | (end ? 0x40 : 0);
+      sendPacket(timestamp, last && end, fu, fu_size, p, len);
+      p += len;
+      remain -= len;
+      start = false;
+    }
+  }
+
+  void sendPacket(u_int32_t timestamp, bool marker, const uint8_t *head,
+                  unsigned head_size, const uint8_t *payload,
+                  unsigned payload_size) {
+    u_int32_t rtp_header[3];
+    u_int32_t word = 0x80000000 | (this->rtpPayloadType() << 16) |
+                     this->fSeqNo;
+    if (marker)
+      word |= 0x00800000;
+    rtp_header[0] = htonl(word);
+    rtp_header[1] = htonl(timestamp);
+    rtp_header[2] = htonl(this->SSRC());
+
+    unsigned char *packet = fPacket;
+    memcpy(packet, rtp_header, sizeof(rtp_header));
+    packet += sizeof(rtp_header);
+    if (head_size) {
+      memcpy(packet, head, head_size);
+      packet += head_size;
+    }
+    memcpy(packet, payload, payload_size);
+    packet += payload_size;
+
+    unsigned packet_size = packet - fPacket;
+    this->fRTPInterface.sendPacket(fPacket, packet_size);
+    ++this->fSeqNo;
+    ++this->fPacketCount;
+    this->fTotalOctetCount += packet_size;
+    this->fOctetCount += packet_size - sizeof(rtp_header);
+  }
+
+  unsigned char fPacket[ZERO_COPY_RTP_PACKET_SIZE];
+};
+
+typedef ZeroCopyRTPSink<H264VideoRTPSink> H264ZeroCopyRTPSink;
+typedef ZeroCopyRTPSink<H265VideoRTPSink> H265ZeroCopyRTPSink;
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_ZERO_COPY_RTP_SINK_HH_
@@ -569,13 +569,49 @@ int video_encoder_set_osd_region(std::shared_ptr<Flow> &enc_flow,
     return -EINVAL;
   }
 
-  int buffer_size = region_data->width * region_data->height;
+  bool partial = region_data->enable && region_data->dirty_w &&
+                 region_data->dirty_h;
+  if (partial && ((region_data->dirty_x % 16) || (region_data->dirty_y % 16) ||
+                  (region_data->dirty_w % 16) || (region_data->dirty_h % 16) ||
+                  (region_data->dirty_x + region_data->dirty_w >
+                   region_data->width) ||
+                  (region_data->dirty_y + region_data->dirty_h >
+                   region_data->height))) {
+    LOG("ERROR: osd dirty rect must be 16 aligned and inside the region.");
+    return -EINVAL;
+  }
+
+  // Only the dirty rectangle is carried to the encoder thread, packed with
+  // stride dirty_w, so that small updates cost a small copy there too.
+  int buffer_size = 0;
+  if (partial)
+    buffer_size = region_data->dirty_w * region_data->dirty_h;
+  else if (region_data->enable)
+    buffer_size = region_data->width * region_data->height;
   OsdRegionData *rdata =
       (OsdRegionData *)malloc(sizeof(OsdRegionData) + buffer_size);
+  if (!rdata)
+    return -ENOMEM;
   memcpy((void *)rdata, (void *)region_data, sizeof(OsdRegionData));
+  if (!partial) {
+    rdata->dirty_x = rdata->dirty_y = 0;
+    rdata->dirty_w = rdata->dirty_h = 0;
+  }
   if (buffer_size) {
     rdata->buffer = (uint8_t *)rdata + sizeof(OsdRegionData);
-    memcpy(rdata->buffer, region_data->buffer, buffer_size);
+    if (partial) {
+      uint8_t *src = region_data->buffer +
+                     region_data->dirty_y * region_data->width +
+                     region_data->dirty_x;
+      uint8_t *dst = rdata->buffer;
+      for (uint32_t i = 0; i < region_data->dirty_h; i++) {
+        memcpy(dst, src, region_data->dirty_w);
+        src += region_data->width;
+        dst += region_data->dirty_w;
+      }
+    } else {
+      memcpy(rdata->buffer, region_data->buffer, buffer_size);
+    }
   }
 
   auto pbuff = std::make_shared<ParameterBuffer>(0);
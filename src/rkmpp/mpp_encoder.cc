@@ -547,6 +547,8 @@ static void OsdDummpRegions(OsdRegionData *rdata) {
   LOG("\t pos_y:%u\n", rdata->pos_y);
   LOG("\t width:%u\n", rdata->width);
   LOG("\t height:%u\n", rdata->height);
+  LOG("\t dirty:<%u, %u, %u, %u>\n", rdata->dirty_x, rdata->dirty_y,
+      rdata->dirty_w, rdata->dirty_h);
 }
 
 static void OsdDummpMppOsd(MppEncOSDData *osd) {
@@ -629,6 +631,35 @@ static int OsdUpdateRegionInfo(MppEncOSDData *osd, OsdRegionData *region_data,
     return 0;
   }
 
+  // Patch only the dirty rectangle into the region already in use.
+  if (region_data->dirty_w && region_data->dirty_h) {
+    if (!osd->buf || !osd->region[rid].enable ||
+        (osd->region[rid].start_mb_x != region_data->pos_x / 16) ||
+        (osd->region[rid].start_mb_y != region_data->pos_y / 16) ||
+        (osd->region[rid].num_mb_x != region_data->width / 16) ||
+        (osd->region[rid].num_mb_y != region_data->height / 16)) {
+      LOG("ERROR: MPP Encoder: Region[%d] partial update without a matching "
+          "region\n",
+          rid);
+      return -1;
+    }
+    LOGD("MPP Encoder: Region[%d] patch <%u, %u, %u, %u>\n", rid,
+         region_data->dirty_x, region_data->dirty_y, region_data->dirty_w,
+         region_data->dirty_h);
+    osd->region[rid].inverse = region_data->inverse;
+    region_src = region_data->buffer;
+    region_dst = (uint8_t *)mpp_buffer_get_ptr(osd->buf);
+    region_dst += osd->region[rid].buf_offset;
+    region_dst += region_data->dirty_y * region_data->width;
+    region_dst += region_data->dirty_x;
+    for (uint32_t i = 0; i < region_data->dirty_h; i++) {
+      memcpy(region_dst, region_src, region_data->dirty_w);
+      region_src += region_data->dirty_w;
+      region_dst += region_data->width;
+    }
+    return 0;
+  }
+
   // get buffer size to compare.
   new_size = region_data->width * region_data->height;
   // If there is enough space, reuse the previous buffer.
@@ -753,6 +784,13 @@ int MPPEncoder::OsdRegionSet(OsdRegionData *rdata) {
     return -EINVAL;
   }
 
+  if (rdata->dirty_w && rdata->dirty_h &&
+      ((rdata->dirty_x + rdata->dirty_w > rdata->width) ||
+       (rdata->dirty_y + rdata->dirty_h > rdata->height))) {
+    LOG("ERROR: MPP Encoder: osd dirty rect out of region\n");
+    return -EINVAL;
+  }
+
   if ((rdata->width % 16) || (rdata->height % 16) || (rdata->pos_x % 16) ||
       (rdata->pos_y % 16)) {
     LOG("WARN: MPP Encoder: osd size must be 16 aligned\n");
@@ -7,9 +7,14 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
 #include "alsa_utils.h"
 #include "alsa_volume.h"
-#include "buffer.h"
+#include "audio_clock.h"
+#include "audio_convert.h"
 #include "buffer.h"
 #include "media_type.h"
 #include "utils.h"
@@ -45,6 +50,8 @@ public:
 private:
   size_t Readi(void *ptr, size_t size, size_t nmemb);
   size_t Readn(void *ptr, size_t size, size_t nmemb);
+  int MmapRead(uint8_t *ptr, snd_pcm_uframes_t nb_samples, int channel);
+  int64_t ClockTime(int frames, bool xrun);
 
 private:
   SampleInfo alsa_sample_info;  // for capture
@@ -53,6 +60,7 @@ private:
   snd_pcm_t *alsa_handle;
   size_t frame_size;
   int interleaved;
+  bool mmap;
   int64_t buffer_time;
   int buffer_duration;
   AI_LAYOUT_E layout;
@@ -61,18 +69,42 @@ private:
   bool bVqeEnable;
   VQE_CONFIG_S stVqeConfig;
   AUDIO_VQE_S *pstVqeHandle;
+  // The vqe state, set by IoCtrl() while Read() runs the vqe.
+  std::mutex vqe_mtx;
+
+  // Period buffers allocated at Open(), recycled once the consumers have
+  // dropped them.
+  int period_buffer_num;
+  std::unique_ptr<SampleBufferPool> period_pool;
+
+  // The card clock, followed from the status after each read. The periods
+  // are stamped with it, rather than with their nominal duration, which
+  // drifts from the system clock by the card error.
+  AudioClock clock;
+  bool htimestamp;
+  uint64_t frames_read;
 };
 
 AlsaCaptureStream::AlsaCaptureStream(const char *param)
-    : alsa_handle(NULL), frame_size(0), buffer_time(-1), buffer_duration(-1),
-    layout(AI_LAYOUT_NORMAL), bVqeEnable(false), pstVqeHandle(NULL) {
+    : alsa_handle(NULL), frame_size(0), mmap(false), buffer_time(-1),
+    buffer_duration(-1),
+    layout(AI_LAYOUT_NORMAL), bVqeEnable(false), pstVqeHandle(NULL),
+    period_buffer_num(8),
+    htimestamp(false), frames_read(0) {
   memset(&output_sample_info, 0, sizeof(output_sample_info));
   output_sample_info.fmt = SAMPLE_FMT_NONE;
   std::map<std::string, std::string> params;
   int ret = ParseAlsaParams(param, params, device, output_sample_info, layout);
   UNUSED(ret);
+  const std::string &mem_cnt = params[KEY_MEM_CNT];
+  if (!mem_cnt.empty())
+    period_buffer_num = std::max(std::stoi(mem_cnt), 1);
+  const std::string &alsa_mmap = params[KEY_ALSA_MMAP];
+  if (!alsa_mmap.empty())
+    mmap = !!std::stoi(alsa_mmap);
   if (device.empty())
     device = "default";
+  period_pool.reset(new SampleBufferPool(period_buffer_num));
   if (SampleInfoIsValid(output_sample_info))
     SetReadable(true);
   else
@@ -178,15 +210,96 @@ size_t AlsaCaptureStream::Readn(void *ptr, size_t size, size_t nmemb) {
   return gotten * frame_size / size;
 }
 
+// Copy nb_samples frames out of the mapped dma buffer. If channel is not
+// negative, only that channel is copied, into a mono ptr.
+int AlsaCaptureStream::MmapRead(uint8_t *ptr, snd_pcm_uframes_t nb_samples,
+                                int channel) {
+  int channels = alsa_sample_info.channels;
+  size_t sample_size = frame_size / channels;
+  snd_pcm_uframes_t gotten = 0;
+  int status = 0;
+  while (gotten < nb_samples) {
+    if (snd_pcm_state(alsa_handle) == SND_PCM_STATE_PREPARED &&
+        (status = snd_pcm_start(alsa_handle)) < 0)
+      break;
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa_handle);
+    if (avail < 0) {
+      status = avail;
+      break;
+    }
+    if ((snd_pcm_uframes_t)avail < nb_samples - gotten) {
+      status = snd_pcm_wait(alsa_handle, 1000);
+      if (status < 0)
+        break;
+      if (status == 0) {
+        errno = EAGAIN;
+        return gotten;
+      }
+      continue;
+    }
+    const snd_pcm_channel_area_t *areas = NULL;
+    snd_pcm_uframes_t offset = 0;
+    snd_pcm_uframes_t frames = nb_samples - gotten;
+    if ((status = snd_pcm_mmap_begin(alsa_handle, &areas, &offset, &frames)) <
+        0)
+      break;
+    if (channel >= 0)
+      AlsaMmapCopy(areas + channel, offset, ptr, nb_samples, gotten, frames, 1,
+                   sample_size, true, false);
+    else
+      AlsaMmapCopy(areas, offset, ptr, nb_samples, gotten, frames, channels,
+                   sample_size, interleaved, false);
+    snd_pcm_sframes_t committed =
+        snd_pcm_mmap_commit(alsa_handle, offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+      status = committed < 0 ? committed : -EPIPE;
+      break;
+    }
+    gotten += frames;
+  }
+  if (status < 0) {
+    status = snd_pcm_recover(alsa_handle, status, 0);
+    if (status < 0)
+      LOG("ALSA mmap read failed (unrecoverable): %s\n", snd_strerror(status));
+    errno = EIO;
+  }
+  return gotten;
+}
+
+// Counts the frames read, and observes the capture position. Returns the
+// time of the first of the frames, or -1 if the clock is unknown.
+int64_t AlsaCaptureStream::ClockTime(int frames, bool xrun) {
+  frames_read += frames;
+  if (xrun)
+    clock.Resync();
+  snd_pcm_uframes_t avail = 0;
+  int64_t time_us = 0;
+  // The frames not read yet were captured before the status.
+  if (AlsaGetAvailTime(alsa_handle, htimestamp, avail, time_us) == 0)
+    clock.Update(frames_read + avail, time_us);
+  if (!clock.IsValid())
+    return -1;
+  return clock.TimeOf(frames_read - frames);
+}
+
 std::shared_ptr<MediaBuffer> AlsaCaptureStream::Read() {
+  int64_t timestamp = -1;
   int buffer_size = frame_size * alsa_sample_info.nb_samples;
   int read_cnt = -1;
   int output_frame_size = frame_size;
-
-  auto sample_buffer = std::make_shared<easymedia::SampleBuffer>(
-      MediaBuffer::Alloc2(buffer_size), alsa_sample_info);
-
-  if (!sample_buffer) {
+  int mic_channel = -1; // the channel kept of mic + ref
+  if (output_sample_info.channels == 1 && layout == AI_LAYOUT_MIC_REF)
+    mic_channel = 0;
+  else if (output_sample_info.channels == 1 && layout == AI_LAYOUT_REF_MIC)
+    mic_channel = 1;
+
+  unsigned int misses = period_pool->GetMissCount();
+  auto sample_buffer = period_pool->Get(buffer_size, alsa_sample_info);
+  // All held downstream, the consumers are too slow for the periods.
+  if (period_pool->GetMissCount() != misses && misses % 100 == 0)
+    LOG("audio capture: %d period buffers all busy, underflow %u\n",
+        period_buffer_num, misses + 1);
+  if (!sample_buffer || !sample_buffer->GetPtr()) {
     LOG("Alloc audio frame buffer failed:%d,%d!\n", buffer_size, frame_size);
     return nullptr;
   }
@@ -198,36 +311,43 @@ std::shared_ptr<MediaBuffer> AlsaCaptureStream::Read() {
                                  alsa_sample_info.sample_rate);
   }
 
+  AUDIO_VQE_S *vqe;
 read_one_frame:
-  read_cnt = Read(sample_buffer->GetPtr(), frame_size, alsa_sample_info.nb_samples);
-  // dynamic close audio vqe
-  if (pstVqeHandle && !bVqeEnable) {
-    RK_AUDIO_VQE_Deinit(pstVqeHandle);
-    pstVqeHandle = NULL;
+  // dynamic close audio vqe. Only here is the handle freed, it is kept
+  // for the period.
+  {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
+    if (pstVqeHandle && !bVqeEnable) {
+      RK_AUDIO_VQE_Deinit(pstVqeHandle);
+      pstVqeHandle = NULL;
+    }
+    vqe = pstVqeHandle;
   }
-
-  if (pstVqeHandle && read_cnt > 0) {
-    int ret = RK_AUDIO_VQE_Handle(pstVqeHandle, sample_buffer->GetPtr(), read_cnt * frame_size);
+  // Without vqe, which needs the ref, the mic is picked out of the dma
+  // buffer rather than from a copy of both.
+  errno = 0;
+  if (mmap)
+    read_cnt = MmapRead((uint8_t *)sample_buffer->GetPtr(),
+                        alsa_sample_info.nb_samples,
+                        vqe ? -1 : mic_channel);
+  else
+    read_cnt = Read(sample_buffer->GetPtr(), frame_size,
+                    alsa_sample_info.nb_samples);
+  if (read_cnt > 0)
+    timestamp = ClockTime(read_cnt, errno == EIO);
+
+  if (vqe && read_cnt > 0) {
+    std::unique_lock<std::mutex> lk(vqe_mtx);
+    int ret = RK_AUDIO_VQE_Handle(vqe, sample_buffer->GetPtr(), read_cnt * frame_size);
+    lk.unlock();
     if (ret < 0)
       goto read_one_frame;
   }
 
-  if (read_cnt > 0 && (layout == AI_LAYOUT_MIC_REF && output_sample_info.channels == 1)) {
-    int16_t *in = (int16_t *)sample_buffer->GetPtr();
-    int16_t *out = in;
-    for (int j = 0; j < read_cnt; j++) {
-      *out++ = *in++;
-      in++;
-    }
-    sample_buffer->SetChannels(1);
-    output_frame_size = frame_size / 2;
-    sample_buffer->SetSize(buffer_size / 2);  // fix for AAC
-  } else if (read_cnt > 0 && (layout == AI_LAYOUT_REF_MIC && output_sample_info.channels == 1)) {
-    int16_t *in = (int16_t *)sample_buffer->GetPtr();
-    int16_t *out = in;
-    for (int j = 0; j < read_cnt; j++) {
-      in++;
-      *out++ = *in++;
+  if (read_cnt > 0 && mic_channel >= 0) {
+    if (!mmap || vqe) {
+      int16_t *ptr = (int16_t *)sample_buffer->GetPtr();
+      AudioRemapS16(ptr, 2, ptr, &mic_channel, 1, read_cnt);
     }
     sample_buffer->SetChannels(1);
     output_frame_size = frame_size / 2;
@@ -236,8 +356,10 @@ read_one_frame:
 
   sample_buffer->SetValidSize(read_cnt * output_frame_size);
   sample_buffer->SetSamples(read_cnt);
-  sample_buffer->SetUSTimeStamp(buffer_time);
-  buffer_time += buffer_duration;
+  if (timestamp < 0)
+    timestamp = buffer_time;
+  sample_buffer->SetUSTimeStamp(timestamp);
+  buffer_time = timestamp + buffer_duration;
 
   return sample_buffer;
 }
@@ -253,7 +375,7 @@ int AlsaCaptureStream::Open() {
     return -1;
   }
   pcm_handle = AlsaCommonOpenSetHwParams(device.c_str(), SND_PCM_STREAM_CAPTURE,
-                                         0, alsa_sample_info, hwparams);
+                                         0, alsa_sample_info, hwparams, &mmap);
   if (!pcm_handle)
     goto err;
   if ((status = snd_pcm_hw_params(pcm_handle, hwparams)) < 0) {
@@ -273,6 +395,7 @@ int AlsaCaptureStream::Open() {
         period_size, periods, bufsize);
   } while (0);
 #endif
+  htimestamp = AlsaSetMonotonicTimestamp(pcm_handle);
   if ((status = snd_pcm_prepare(pcm_handle)) < 0) {
     LOG("cannot prepare audio interface for use (%s)\n", snd_strerror(status));
     goto err;
@@ -283,6 +406,13 @@ int AlsaCaptureStream::Open() {
   snd_pcm_hw_params_free(hwparams);
   frame_size = snd_pcm_frames_to_bytes(pcm_handle, 1);
   alsa_handle = pcm_handle;
+  period_pool->Clear();
+  clock.Reset(alsa_sample_info.sample_rate);
+  frames_read = 0;
+  if (period_pool->Reserve(period_buffer_num,
+                           frame_size * alsa_sample_info.nb_samples) <
+      period_buffer_num)
+    LOG("Alloc audio period buffers failed\n");
   return 0;
 
 err:
@@ -299,6 +429,8 @@ err:
 int AlsaCaptureStream::Close() {
   buffer_time = -1;
   buffer_duration = -1;
+  // Buffers still held downstream are freed with their last reference.
+  period_pool->Clear();
   if (alsa_handle) {
     snd_pcm_drop(alsa_handle);
     snd_pcm_close(alsa_handle);
@@ -326,7 +458,8 @@ int AlsaCaptureStream::IoCtrl(unsigned long int request, ...) {
     ret = GetCaptureVolume(device, volume);
     *((int *)arg) = volume;
     break;
-  case S_VQE_ENABLE:
+  case S_VQE_ENABLE: {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
     bVqeEnable = *((int *)arg);
     if (bVqeEnable) {
       if (pstVqeHandle) {
@@ -343,16 +476,30 @@ int AlsaCaptureStream::IoCtrl(unsigned long int request, ...) {
         return -1;
     }
     break;
-  case S_VQE_ATTR:
+  }
+  case S_VQE_ATTR: {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
     if (bVqeEnable) {
       LOG("bVqeEnable already enable, please disable it before set attr");
       return -1;
     }
     stVqeConfig = *((VQE_CONFIG_S *)arg);
     break;
+  }
   case G_VQE_ATTR:
     *((VQE_CONFIG_S *)arg) = stVqeConfig;
     break;
+  case G_VQE_QUEUE_STATE: {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
+    ret = RK_AUDIO_VQE_GetQueueState(pstVqeHandle, (VQE_QUEUE_STATE_S *)arg);
+    break;
+  }
+  case G_ALSA_BUFFER_UNDERFLOW:
+    *((unsigned int *)arg) = period_pool->GetMissCount();
+    break;
+  case G_ALSA_CLOCK_DRIFT:
+    *((double *)arg) = clock.GetDriftPPM();
+    break;
   default:
     ret = -1;
     break;
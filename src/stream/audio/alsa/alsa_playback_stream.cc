@@ -7,9 +7,14 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
 #include "alsa_utils.h"
 #include "../rk_audio.h"
 #include "alsa_volume.h"
+#include "audio_convert.h"
 #include "buffer.h"
 #include "media_type.h"
 #include "utils.h"
@@ -42,18 +47,45 @@ public:
 private:
   size_t Writei(const void *ptr, size_t size, size_t nmemb);
   size_t Writen(const void *ptr, size_t size, size_t nmemb);
+  size_t MmapWrite(const void *ptr, size_t size, size_t nmemb);
+  size_t WaitWrite(const void *ptr, size_t size, size_t nmemb);
+  size_t WriteFrames(const void *ptr, size_t size, size_t nmemb);
+  int Recover(int err);
+  int WriteSilence();
 
 private:
   SampleInfo sample_info;
+  // The device side, stereo if it refuses mono.
+  SampleInfo alsa_sample_info;
+  std::vector<int16_t> upmix_buffer;
   std::string device;
   snd_pcm_t *alsa_handle;
   size_t frame_size;
   int interleaved;
+  bool mmap;
+  // mmap writes start the stream themselves, after this many frames
+  snd_pcm_uframes_t start_threshold;
+  snd_pcm_uframes_t buffer_frames;
   AI_LAYOUT_E layout;
 
+  // Low latency: a buffer of periods frames * periods, started at one
+  // period, and written as room is made rather than in blocking calls.
+  bool low_latency;
+  int period_frames;
+  int periods;
+  snd_pcm_uframes_t period_size;
+  int wait_ms;
+  // A period to prime the stream again after an underrun.
+  std::vector<uint8_t> silence;
+  unsigned int xrun_cnt;
+  // us until the last buffer written is played
+  int64_t output_delay;
+
   bool bVqeEnable;
   VQE_CONFIG_S stVqeConfig;
   AUDIO_VQE_S *pstVqeHandle;
+  // The vqe state, set by IoCtrl() while Write() runs the vqe.
+  std::mutex vqe_mtx;
 };
 
 const int AlsaPlayBackStream::kStartDelays = 2; // number delays of periods
@@ -61,13 +93,31 @@ const int AlsaPlayBackStream::kPresetFrames = 1024;
 const int AlsaPlayBackStream::kPresetSampleRate =
     48000; // the same to asound.conf
 const int AlsaPlayBackStream::kPresetMinBufferSize = 8192;
+// Recovered xruns in a write, before it gives up.
+static const int kMaxRecovers = 3;
+
 AlsaPlayBackStream::AlsaPlayBackStream(const char *param)
-    : alsa_handle(NULL), frame_size(0), bVqeEnable(false), pstVqeHandle(NULL) {
+    : alsa_handle(NULL), frame_size(0), mmap(false), start_threshold(0),
+      buffer_frames(0), low_latency(false), period_frames(0), periods(3),
+      period_size(0), wait_ms(1000), xrun_cnt(0), output_delay(0),
+      bVqeEnable(false), pstVqeHandle(NULL) {
   memset(&sample_info, 0, sizeof(sample_info));
   sample_info.fmt = SAMPLE_FMT_NONE;
   std::map<std::string, std::string> params;
   int ret = ParseAlsaParams(param, params, device, sample_info, layout);
   UNUSED(ret);
+  const std::string &alsa_mmap = params[KEY_ALSA_MMAP];
+  if (!alsa_mmap.empty())
+    mmap = !!std::stoi(alsa_mmap);
+  const std::string &alsa_low_latency = params[KEY_ALSA_LOW_LATENCY];
+  if (!alsa_low_latency.empty())
+    low_latency = !!std::stoi(alsa_low_latency);
+  const std::string &alsa_period_size = params[KEY_ALSA_PERIOD_SIZE];
+  if (!alsa_period_size.empty())
+    period_frames = std::stoi(alsa_period_size);
+  const std::string &alsa_periods = params[KEY_ALSA_PERIODS];
+  if (!alsa_periods.empty())
+    periods = std::max(std::stoi(alsa_periods), 2);
   if (device.empty())
     device = "default";
   if (SampleInfoIsValid(sample_info))
@@ -75,6 +125,7 @@ AlsaPlayBackStream::AlsaPlayBackStream(const char *param)
   else
     LOG("missing some necessary param\n");
   interleaved = SampleFormatToInterleaved(sample_info.fmt);
+  alsa_sample_info = sample_info;
 
   memset(&stVqeConfig, 0, sizeof(stVqeConfig));
   stVqeConfig.u32VQEMode = VQE_MODE_BUTT;
@@ -86,6 +137,24 @@ AlsaPlayBackStream::~AlsaPlayBackStream() {
 }
 
 size_t AlsaPlayBackStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  if (alsa_sample_info.channels == sample_info.channels)
+    return WriteFrames(ptr, size, nmemb);
+  // Mono to stereo.
+  static const int map[] = {0, 0};
+  size_t frames = size * nmemb / (frame_size / 2);
+  if (upmix_buffer.size() < frames * 2)
+    upmix_buffer.resize(frames * 2);
+  AudioRemapS16((const int16_t *)ptr, 1, upmix_buffer.data(), map, 2, frames);
+  frames = WriteFrames(upmix_buffer.data(), frame_size, frames);
+  return frames * (frame_size / 2) / size;
+}
+
+size_t AlsaPlayBackStream::WriteFrames(const void *ptr, size_t size,
+                                       size_t nmemb) {
+  if (mmap)
+    return MmapWrite(ptr, size, nmemb);
+  if (low_latency)
+    return WaitWrite(ptr, size, nmemb);
   if (interleaved)
     return Writei(ptr, size, nmemb);
   else
@@ -127,7 +196,7 @@ out:
 
 size_t AlsaPlayBackStream::Writen(const void *ptr, size_t size, size_t nmemb) {
   uint8_t *bufs[32];
-  int channels = sample_info.channels;
+  int channels = alsa_sample_info.channels;
   size_t sample_size = frame_size / channels;
   size_t buffer_len = size * nmemb;
   snd_pcm_sframes_t frames =
@@ -166,9 +235,169 @@ out:
   return (buffer_len - frames * frame_size) / size;
 }
 
+// Copy straight into the mapped dma buffer.
+size_t AlsaPlayBackStream::MmapWrite(const void *ptr, size_t size,
+                                     size_t nmemb) {
+  size_t buffer_len = size * nmemb;
+  snd_pcm_uframes_t nb_frames =
+      (size == frame_size ? nmemb : buffer_len / frame_size);
+  snd_pcm_uframes_t written = 0;
+  int channels = alsa_sample_info.channels;
+  int status = 0;
+  int recovers = 0;
+again:
+  while (written < nb_frames) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa_handle);
+    if (avail < 0) {
+      status = avail;
+      break;
+    }
+    if (avail == 0) {
+      if (snd_pcm_state(alsa_handle) == SND_PCM_STATE_PREPARED &&
+          (status = snd_pcm_start(alsa_handle)) < 0)
+        break;
+      status = snd_pcm_wait(alsa_handle, wait_ms);
+      if (status < 0)
+        break;
+      if (status == 0) {
+        errno = EAGAIN;
+        return written * frame_size / size;
+      }
+      continue;
+    }
+    const snd_pcm_channel_area_t *areas = NULL;
+    snd_pcm_uframes_t offset = 0;
+    snd_pcm_uframes_t frames = nb_frames - written;
+    if ((status = snd_pcm_mmap_begin(alsa_handle, &areas, &offset, &frames)) <
+        0)
+      break;
+    AlsaMmapCopy(areas, offset, (uint8_t *)ptr, nb_frames, written, frames,
+                 channels, frame_size / channels, interleaved, true);
+    snd_pcm_sframes_t committed =
+        snd_pcm_mmap_commit(alsa_handle, offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+      status = committed < 0 ? committed : -EPIPE;
+      break;
+    }
+    written += frames;
+    // Unlike writei, committing does not start the stream.
+    if (snd_pcm_state(alsa_handle) == SND_PCM_STATE_PREPARED) {
+      avail = snd_pcm_avail_update(alsa_handle);
+      if (avail >= 0 && (snd_pcm_uframes_t)avail + start_threshold <=
+                            buffer_frames &&
+          (status = snd_pcm_start(alsa_handle)) < 0)
+        break;
+    }
+  }
+  if (status < 0 && low_latency) {
+    // Primed again, the rest of the frames follow.
+    if (recovers++ < kMaxRecovers && (status = Recover(status)) == 0)
+      goto again;
+    errno = EIO;
+  } else if (status < 0) {
+    status = snd_pcm_recover(alsa_handle, status, 0);
+    if (status < 0)
+      LOG("ALSA mmap write failed (unrecoverable): %s\n",
+          snd_strerror(status));
+    errno = EIO;
+  }
+  return written * frame_size / size;
+}
+
+// Low latency: write what there is room for, and wait for a period of room
+// with snd_pcm_wait() rather than in a blocking write. An xrun is recovered
+// in place, then the rest of the frames are written.
+size_t AlsaPlayBackStream::WaitWrite(const void *ptr, size_t size,
+                                     size_t nmemb) {
+  uint8_t *bufs[32];
+  int channels = alsa_sample_info.channels;
+  size_t sample_size = frame_size / channels;
+  size_t buffer_len = size * nmemb;
+  snd_pcm_uframes_t nb_frames =
+      (size == frame_size ? nmemb : buffer_len / frame_size);
+  snd_pcm_uframes_t written = 0;
+  int recovers = 0;
+  while (written < nb_frames) {
+    snd_pcm_uframes_t left = nb_frames - written;
+    snd_pcm_sframes_t status = snd_pcm_avail_update(alsa_handle);
+    // Below the start threshold there is always a period of room, a
+    // stream not started is not waited for.
+    if (status >= 0 &&
+        (snd_pcm_uframes_t)status < std::min<snd_pcm_uframes_t>(left,
+                                                                 period_size)) {
+      status = snd_pcm_wait(alsa_handle, wait_ms);
+      if (status == 0) {
+        errno = EAGAIN;
+        break;
+      }
+      if (status > 0)
+        continue;
+    }
+    if (status >= 0) {
+      snd_pcm_uframes_t frames = std::min<snd_pcm_uframes_t>(status, left);
+      if (interleaved) {
+        status = snd_pcm_writei(alsa_handle,
+                                (const uint8_t *)ptr + written * frame_size,
+                                frames);
+      } else {
+        for (int channel = 0; channel < channels; channel++)
+          bufs[channel] = (uint8_t *)ptr +
+                          (channel * nb_frames + written) * sample_size;
+        status = snd_pcm_writen(alsa_handle, (void **)bufs, frames);
+      }
+      if (status >= 0) {
+        written += status;
+        continue;
+      }
+      if (status == -EAGAIN)
+        continue;
+    }
+    if (recovers++ >= kMaxRecovers || Recover(status) < 0) {
+      errno = EIO;
+      break;
+    }
+  }
+  return written * frame_size / size;
+}
+
+// Recovers an xrun or a suspend without reopening the device. After an
+// underrun a period of silence is queued first, which starts the stream
+// again with the margin of the start threshold.
+int AlsaPlayBackStream::Recover(int err) {
+  if (err == -EPIPE && (xrun_cnt++ % 100) == 0)
+    LOG("audio playback: underrun, %u so far\n", xrun_cnt);
+  int status = snd_pcm_recover(alsa_handle, err, 1);
+  if (status < 0) {
+    LOG("ALSA write failed (unrecoverable): %s\n", snd_strerror(status));
+    return status;
+  }
+  if (err != -EPIPE)
+    return 0;
+  status = WriteSilence();
+  if (status < 0) {
+    LOG("ALSA prime failed: %s\n", snd_strerror(status));
+    return status;
+  }
+  return 0;
+}
+
+int AlsaPlayBackStream::WriteSilence() {
+  void *bufs[32];
+  int channels = alsa_sample_info.channels;
+  // The planes all read the same silence.
+  for (int channel = 0; channel < channels; channel++)
+    bufs[channel] = silence.data();
+  if (interleaved)
+    return mmap ? snd_pcm_mmap_writei(alsa_handle, silence.data(), period_size)
+                : snd_pcm_writei(alsa_handle, silence.data(), period_size);
+  return mmap ? snd_pcm_mmap_writen(alsa_handle, bufs, period_size)
+              : snd_pcm_writen(alsa_handle, bufs, period_size);
+}
+
 bool AlsaPlayBackStream::Write(std::shared_ptr<MediaBuffer> mb) {
 
   if (mb->IsValid()) {
+    std::unique_lock<std::mutex> lk(vqe_mtx);
     if (pstVqeHandle && !bVqeEnable) {
       RK_AUDIO_VQE_Deinit(pstVqeHandle);
       pstVqeHandle = NULL;
@@ -179,7 +408,11 @@ bool AlsaPlayBackStream::Write(std::shared_ptr<MediaBuffer> mb) {
       if (ret < 0)
         return 0;
     }
+    lk.unlock();
     Write(mb->GetPtr(), 1, mb->GetValidSize());
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(alsa_handle, &delay) == 0)
+      output_delay = delay * 1000000LL / alsa_sample_info.sample_rate;
     return 0;
   }
   return -1;
@@ -277,6 +510,34 @@ static int ALSA_set_period_size(snd_pcm_t *pcm_handle, uint32_t samples,
                                 period_size);
 }
 
+static int ALSA_set_periods(snd_pcm_t *pcm_handle, uint32_t samples,
+                            unsigned int periods, snd_pcm_hw_params_t *params,
+                            snd_pcm_uframes_t *period_size) {
+  int status;
+  snd_pcm_hw_params_t *hwparams;
+  snd_pcm_uframes_t frames = samples;
+  /* Copy the hardware parameters for this setup */
+  snd_pcm_hw_params_alloca(&hwparams);
+  snd_pcm_hw_params_copy(hwparams, params);
+
+  status = snd_pcm_hw_params_set_period_size_near(pcm_handle, hwparams, &frames,
+                                                  NULL);
+  if (status < 0) {
+    LOG("Couldn't set period size<%d> : %s\n", (int)frames,
+        snd_strerror(status));
+    return -1;
+  }
+  status =
+      snd_pcm_hw_params_set_periods_near(pcm_handle, hwparams, &periods, NULL);
+  if (status < 0) {
+    LOG("Couldn't set periods<%d> : %s\n", periods, snd_strerror(status));
+    return -1;
+  }
+
+  return ALSA_finalize_hardware(pcm_handle, frames * periods, 1, hwparams,
+                                period_size);
+}
+
 static int ALSA_set_buffer_size(snd_pcm_t *pcm_handle, uint32_t samples,
                                 int sample_size, snd_pcm_hw_params_t *params,
                                 snd_pcm_uframes_t *period_size) {
@@ -308,8 +569,9 @@ int AlsaPlayBackStream::Open() {
   snd_pcm_t *pcm_handle = NULL;
   snd_pcm_hw_params_t *hwparams = NULL;
   snd_pcm_sw_params_t *swparams = NULL;
-  snd_pcm_uframes_t period_size = 0;
   uint32_t frames;
+  // Non blocking, the low latency writes wait themselves.
+  int mode = low_latency ? SND_PCM_NONBLOCK : 0;
   if (!Writeable())
     return -1;
   int status = snd_pcm_hw_params_malloc(&hwparams);
@@ -322,25 +584,47 @@ int AlsaPlayBackStream::Open() {
     LOG("snd_pcm_sw_params_malloc failed\n");
     goto err;
   }
+  alsa_sample_info = sample_info;
   pcm_handle = AlsaCommonOpenSetHwParams(
-      device.c_str(), SND_PCM_STREAM_PLAYBACK, 0, sample_info, hwparams);
+      device.c_str(), SND_PCM_STREAM_PLAYBACK, mode, alsa_sample_info,
+      hwparams, &mmap);
+  if (!pcm_handle && sample_info.channels == 1 &&
+      sample_info.fmt == SAMPLE_FMT_S16) {
+    LOG("%s refuses mono, upmix to stereo\n", device.c_str());
+    alsa_sample_info.channels = 2;
+    pcm_handle = AlsaCommonOpenSetHwParams(
+        device.c_str(), SND_PCM_STREAM_PLAYBACK, mode, alsa_sample_info,
+        hwparams, &mmap);
+  }
   if (!pcm_handle)
     goto err;
+  frame_size = GetSampleSize(alsa_sample_info);
+  if (frame_size == 0)
+    goto err;
+  if (low_latency) {
+    // 5 ms periods by default, and no minimum buffer size.
+    frames = period_frames > 0 ? period_frames : sample_info.sample_rate / 200;
+    if (ALSA_set_periods(pcm_handle, frames, periods, hwparams,
+                         &period_size) < 0)
+      goto err;
+    goto sw_params;
+  }
   frames = std::min<int>(kPresetFrames,
                          2 << (MATH_LOG2(sample_info.sample_rate *
                                          kPresetFrames / kPresetSampleRate) -
                                1));
   /* fix underrun, set period size not less than transport chunk size */
   frames = std::max<int>(sample_info.nb_samples, frames);
-  frame_size = GetSampleSize(sample_info);
-  if (frame_size == 0)
-    goto err;
   if (ALSA_set_period_size(pcm_handle, frames, frame_size, hwparams,
                            &period_size) < 0 &&
       ALSA_set_buffer_size(pcm_handle, frames, frame_size, hwparams,
                            &period_size) < 0) {
     goto err;
   }
+sw_params:
+  snd_pcm_get_params(pcm_handle, &buffer_frames, &period_size);
+  start_threshold =
+      std::min(period_size * (low_latency ? 1 : kStartDelays), buffer_frames);
   status = snd_pcm_sw_params_current(pcm_handle, swparams);
   if (status < 0) {
     LOG("Couldn't get alsa software config: %s\n", snd_strerror(status));
@@ -353,7 +637,7 @@ int AlsaPlayBackStream::Open() {
     goto err;
   }
   status = snd_pcm_sw_params_set_start_threshold(pcm_handle, swparams,
-                                                 period_size * kStartDelays);
+                                                 start_threshold);
   if (status < 0) {
     LOG("Unable to set start threshold mode for playback: %s\n",
         snd_strerror(status));
@@ -367,6 +651,20 @@ int AlsaPlayBackStream::Open() {
   /* Switch to blocking mode for playback */
   // snd_pcm_nonblock(pcm_handle, 0);
 
+  silence.clear();
+  xrun_cnt = 0;
+  output_delay = 0;
+  if (low_latency) {
+    silence.resize(period_size * frame_size);
+    snd_pcm_format_set_silence(SampleFormatToAlsaFormat(alsa_sample_info.fmt),
+                               silence.data(),
+                               period_size * alsa_sample_info.channels);
+    // A few periods, woken up by the period interrupts.
+    wait_ms = std::max<int>(
+        10, period_size * 4000 / alsa_sample_info.sample_rate);
+    LOG("audio playback: low latency, %lu frames in periods of %lu\n",
+        buffer_frames, period_size);
+  }
   snd_pcm_hw_params_free(hwparams);
   snd_pcm_sw_params_free(swparams);
   alsa_handle = pcm_handle;
@@ -412,7 +710,8 @@ int AlsaPlayBackStream::IoCtrl(unsigned long int request, ...) {
     ret = GetPlaybackVolume(device, volume);
     *((int *)arg) = volume;
     break;
-  case S_VQE_ENABLE:
+  case S_VQE_ENABLE: {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
     bVqeEnable = *((int *)arg);
     if (bVqeEnable) {
       if (pstVqeHandle) {
@@ -428,16 +727,27 @@ int AlsaPlayBackStream::IoCtrl(unsigned long int request, ...) {
         return -1;
     }
     break;
-  case S_VQE_ATTR:
+  }
+  case S_VQE_ATTR: {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
     if (bVqeEnable) {
       LOG("bVqeEnable already enable, please disable it before set attr");
       return -1;
     }
     stVqeConfig = *((VQE_CONFIG_S *)arg);
     break;
+  }
   case G_VQE_ATTR:
     *((VQE_CONFIG_S *)arg) = stVqeConfig;
     break;
+  case G_VQE_QUEUE_STATE: {
+    std::lock_guard<std::mutex> _lk(vqe_mtx);
+    ret = RK_AUDIO_VQE_GetQueueState(pstVqeHandle, (VQE_QUEUE_STATE_S *)arg);
+    break;
+  }
+  case G_ALSA_OUTPUT_DELAY:
+    *((int64_t *)arg) = output_delay;
+    break;
   default:
     ret = -1;
     break;
@@ -4,6 +4,9 @@
 
 #include "alsa_utils.h"
 
+#include <string.h>
+#include <time.h>
+
 #include "key_string.h"
 #include "utils.h"
 
@@ -82,10 +85,12 @@ int ParseAlsaParams(const char *param,
 }
 
 // open device, and set format/channel/samplerate.
+// *mmap asks for mmap access, it is cleared if the device cannot.
 snd_pcm_t *AlsaCommonOpenSetHwParams(const char *device,
                                      snd_pcm_stream_t stream, int mode,
                                      SampleInfo &sample_info,
-                                     snd_pcm_hw_params_t *hwparams) {
+                                     snd_pcm_hw_params_t *hwparams,
+                                     bool *mmap) {
   snd_pcm_t *pcm_handle = NULL;
   unsigned int rate = sample_info.sample_rate;
   unsigned int channels;
@@ -118,12 +123,25 @@ snd_pcm_t *AlsaCommonOpenSetHwParams(const char *device,
   }
 #endif
 
-  if (interleaved)
-    status = snd_pcm_hw_params_set_access(pcm_handle, hwparams,
-                                        SND_PCM_ACCESS_RW_INTERLEAVED);
-  else
-    status = snd_pcm_hw_params_set_access(pcm_handle, hwparams,
-                                        SND_PCM_ACCESS_RW_NONINTERLEAVED);
+  status = -1;
+  if (mmap && *mmap) {
+    status = snd_pcm_hw_params_set_access(
+        pcm_handle, hwparams,
+        interleaved ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+                    : SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+    if (status < 0) {
+      LOG("%s does not support mmap access, use read/write\n", device);
+      *mmap = false;
+    }
+  }
+  if (status < 0) {
+    if (interleaved)
+      status = snd_pcm_hw_params_set_access(pcm_handle, hwparams,
+                                            SND_PCM_ACCESS_RW_INTERLEAVED);
+    else
+      status = snd_pcm_hw_params_set_access(pcm_handle, hwparams,
+                                            SND_PCM_ACCESS_RW_NONINTERLEAVED);
+  }
   if (status < 0) {
     LOG("Couldn't set access type: %s\n", snd_strerror(status));
     goto err;
@@ -169,3 +187,83 @@ err:
   }
   return NULL;
 }
+
+void AlsaMmapCopy(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset,
+                  uint8_t *buf, size_t buf_frames, size_t buf_offset,
+                  snd_pcm_uframes_t frames, int channels, size_t sample_size,
+                  bool interleaved, bool to_areas) {
+  size_t frame_size = sample_size * channels;
+  unsigned int sample_bits = sample_size * 8;
+  // The usual hw layout, a whole block of frames at once.
+  bool packed = true;
+  for (int c = 0; c < channels && packed; c++) {
+    if (interleaved)
+      packed = areas[c].addr == areas[0].addr &&
+               areas[c].first == areas[0].first + c * sample_bits &&
+               areas[c].step == channels * sample_bits;
+    else
+      packed = areas[c].step == sample_bits;
+    packed = packed && areas[c].first % 8 == 0;
+  }
+  for (int c = 0; c < channels; c++) {
+    uint8_t *area = (uint8_t *)areas[c].addr +
+                    (areas[c].first + offset * areas[c].step) / 8;
+    uint8_t *b = buf + (interleaved
+                            ? buf_offset * frame_size + c * sample_size
+                            : (c * buf_frames + buf_offset) * sample_size);
+    if (packed) {
+      size_t len = frames * (interleaved ? frame_size : sample_size);
+      if (to_areas)
+        memcpy(area, b, len);
+      else
+        memcpy(b, area, len);
+      if (interleaved)
+        break;
+      continue;
+    }
+    size_t buf_step = interleaved ? frame_size : sample_size;
+    size_t area_step = areas[c].step / 8;
+    for (snd_pcm_uframes_t i = 0; i < frames; i++) {
+      if (to_areas)
+        memcpy(area, b, sample_size);
+      else
+        memcpy(b, area, sample_size);
+      area += area_step;
+      b += buf_step;
+    }
+  }
+}
+
+bool AlsaSetMonotonicTimestamp(snd_pcm_t *pcm_handle) {
+  snd_pcm_sw_params_t *swparams = NULL;
+  int status = snd_pcm_sw_params_malloc(&swparams);
+  if (status < 0)
+    return false;
+  if ((status = snd_pcm_sw_params_current(pcm_handle, swparams)) < 0 ||
+      (status = snd_pcm_sw_params_set_tstamp_mode(pcm_handle, swparams,
+                                                  SND_PCM_TSTAMP_ENABLE)) < 0 ||
+      (status = snd_pcm_sw_params_set_tstamp_type(
+           pcm_handle, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0 ||
+      (status = snd_pcm_sw_params(pcm_handle, swparams)) < 0)
+    LOG("no monotonic alsa timestamps: %s\n", snd_strerror(status));
+  snd_pcm_sw_params_free(swparams);
+  return status >= 0;
+}
+
+int AlsaGetAvailTime(snd_pcm_t *pcm_handle, bool htimestamp,
+                     snd_pcm_uframes_t &avail, int64_t &time_us) {
+  struct timespec ts = {0, 0};
+  // The status timestamp is taken with the hw pointer, in the kernel.
+  if (htimestamp && snd_pcm_htimestamp(pcm_handle, &avail, &ts) == 0 &&
+      (ts.tv_sec || ts.tv_nsec)) {
+    time_us = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    return 0;
+  }
+  snd_pcm_sframes_t frames = snd_pcm_avail(pcm_handle);
+  if (frames < 0)
+    return frames;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  avail = frames;
+  time_us = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  return 0;
+}
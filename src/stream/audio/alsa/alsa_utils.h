@@ -43,6 +43,22 @@ int ParseAlsaParams(const char *param,
 snd_pcm_t *AlsaCommonOpenSetHwParams(const char *device,
                                      snd_pcm_stream_t stream, int mode,
                                      SampleInfo &sample_info,
-                                     snd_pcm_hw_params_t *hwparams);
+                                     snd_pcm_hw_params_t *hwparams,
+                                     bool *mmap = nullptr);
+
+// Copy frames between the mmap areas at offset and buf, at buf_offset.
+// buf is laid out as the stream access, planar buffers hold buf_frames
+// per channel.
+void AlsaMmapCopy(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset,
+                  uint8_t *buf, size_t buf_frames, size_t buf_offset,
+                  snd_pcm_uframes_t frames, int channels, size_t sample_size,
+                  bool interleaved, bool to_areas);
+
+// Ask for the status timestamps in CLOCK_MONOTONIC. Returns false if the
+// device or alsa-lib cannot, AlsaGetAvailTime() then reads the clock.
+bool AlsaSetMonotonicTimestamp(snd_pcm_t *pcm_handle);
+// The frames available and the CLOCK_MONOTONIC time in us they were at.
+int AlsaGetAvailTime(snd_pcm_t *pcm_handle, bool htimestamp,
+                     snd_pcm_uframes_t &avail, int64_t &time_us);
 
 #endif // EASYMEDIA_ALSA_UTILS_H_
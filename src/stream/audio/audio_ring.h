@@ -0,0 +1,109 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_AUDIO_RING_H_
+#define EASYMEDIA_AUDIO_RING_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace easymedia {
+
+// Byte ring of a power of 2, without locks: the vqe writes and reads it
+// in RK_AUDIO_VQE_Handle(), and the streams serialize that with the queue
+// state under their vqe mutex. Chunks of any size go in and out across
+// the wrap, data is never moved inside the ring. Peek() and Reserve()
+// give a chunk in place when it does not wrap, else through a scratch of
+// the caller.
+class AudioRing {
+public:
+  explicit AudioRing(size_t min_capacity) : write_pos(0), read_pos(0) {
+    size_t capacity = 1;
+    while (capacity < min_capacity)
+      capacity <<= 1;
+    ring.resize(capacity);
+    mask = capacity - 1;
+  }
+
+  size_t Capacity() const { return ring.size(); }
+  // Readable bytes.
+  size_t Size() const { return write_pos - read_pos; }
+  // Writable bytes.
+  size_t Space() const { return ring.size() - (write_pos - read_pos); }
+
+  // All or nothing.
+  bool Write(const void *data, size_t bytes) {
+    if (bytes > Space())
+      return false;
+    CopyIn(write_pos, (const uint8_t *)data, bytes);
+    write_pos += bytes;
+    return true;
+  }
+
+  bool Read(void *data, size_t bytes) {
+    if (bytes > Size())
+      return false;
+    CopyOut(read_pos, (uint8_t *)data, bytes);
+    read_pos += bytes;
+    return true;
+  }
+
+  // The next bytes to read, in the ring, or copied into scratch if they
+  // wrap. Null if fewer are readable. Skip() them once used.
+  const uint8_t *Peek(size_t bytes, uint8_t *scratch) const {
+    if (bytes > Size())
+      return nullptr;
+    size_t off = read_pos & mask;
+    if (off + bytes <= ring.size())
+      return ring.data() + off;
+    CopyOut(read_pos, scratch, bytes);
+    return scratch;
+  }
+  void Skip(size_t bytes) { read_pos += bytes; }
+
+  // Where to write the next bytes: in the ring, or scratch if the room
+  // wraps. Null if there is not room. Commit() them once written.
+  uint8_t *Reserve(size_t bytes, uint8_t *scratch) {
+    if (bytes > Space())
+      return nullptr;
+    size_t off = write_pos & mask;
+    if (off + bytes <= ring.size())
+      return ring.data() + off;
+    return scratch;
+  }
+  void Commit(const uint8_t *reserved, size_t bytes) {
+    if (reserved != ring.data() + (write_pos & mask))
+      CopyIn(write_pos, reserved, bytes);
+    write_pos += bytes;
+  }
+
+  void Clear() { read_pos = write_pos; }
+
+private:
+  void CopyIn(size_t pos, const uint8_t *data, size_t bytes) {
+    size_t off = pos & mask;
+    size_t first = std::min(bytes, ring.size() - off);
+    memcpy(ring.data() + off, data, first);
+    memcpy(ring.data(), data + first, bytes - first);
+  }
+  void CopyOut(size_t pos, uint8_t *data, size_t bytes) const {
+    size_t off = pos & mask;
+    size_t first = std::min(bytes, ring.size() - off);
+    memcpy(data, ring.data() + off, first);
+    memcpy(data + first, ring.data(), bytes - first);
+  }
+
+  std::vector<uint8_t> ring;
+  size_t mask;
+  // Bytes written and read since the start, the ring offset is & mask.
+  size_t write_pos;
+  size_t read_pos;
+};
+
+} // namespace easymedia
+
+#endif // EASYMEDIA_AUDIO_RING_H_
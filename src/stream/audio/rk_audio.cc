@@ -3,7 +3,10 @@
 // found in the LICENSE file.
 #include <string.h>
 
+#include <vector>
+
 #include "alsa/alsa_utils.h"
+#include "audio_ring.h"
 #include "rk_audio.h"
 #include "sound.h"
 
@@ -18,75 +21,20 @@ extern "C" {
 #define RK_AUDIO_BUFFER_MAX_SIZE 12288
 #define ALGO_FRAME_TIMS_MS 20 // 20ms
 
-typedef struct rkAUDIO_QUEUE_S {
-  int buffer_size;
-  char *buffer;
-  int roffset;
-} AUDIO_QUEUE_S;
+using easymedia::AudioRing;
 
 struct rkAUDIO_VQE_S {
-  AUDIO_QUEUE_S *in_queue;  /* for before process */
-  AUDIO_QUEUE_S *out_queue; /* for after process */
+  AudioRing *in_queue;  /* for before process */
+  AudioRing *out_queue; /* for after process */
+  /* frames across the wrap of the queues */
+  std::vector<unsigned char> in_scratch;
+  std::vector<unsigned char> out_scratch;
   VQE_CONFIG_S stVqeConfig;
   SampleInfo sample_info;
   RKAP_Handle ap_handle;
   AI_LAYOUT_E layout;
 };
 
-static AUDIO_QUEUE_S *queue_create(int buf_size) {
-  AUDIO_QUEUE_S *queue = (AUDIO_QUEUE_S *)calloc(sizeof(AUDIO_QUEUE_S), 1);
-  if (!queue)
-    return NULL;
-  queue->buffer = (char *)malloc(buf_size);
-  return queue;
-}
-static void queue_free(AUDIO_QUEUE_S *queue) {
-  if (queue) {
-    if (queue->buffer)
-      free(queue->buffer);
-    free(queue);
-  }
-}
-
-static int queue_size(AUDIO_QUEUE_S *queue) { return queue->buffer_size; }
-
-static int queue_write(AUDIO_QUEUE_S *queue, const unsigned char *buffer,
-                       int bytes) {
-  if ((buffer == NULL) || (bytes <= 0)) {
-    LOG("queue_capture_buffer buffer error!");
-    return -1;
-  }
-  if (queue->buffer_size + bytes > RK_AUDIO_BUFFER_MAX_SIZE) {
-    LOG("unexpected cap buffer size too big!! return!");
-    return -1;
-  }
-
-  memcpy((char *)queue->buffer + queue->buffer_size, (char *)buffer, bytes);
-  queue->buffer_size += bytes;
-  return bytes;
-}
-
-static int queue_read(AUDIO_QUEUE_S *queue, unsigned char *buffer, int bytes) {
-  if ((buffer == NULL) || (bytes <= 0)) {
-    LOG("queue_capture_buffer buffer error!");
-    return -1;
-  }
-  if ((queue->roffset + bytes) > queue->buffer_size) {
-    LOG("queue_read  error!");
-    return -1;
-  }
-  memcpy(buffer, queue->buffer + queue->roffset, bytes);
-  queue->roffset += bytes;
-  return bytes;
-}
-
-static void queue_tune(AUDIO_QUEUE_S *queue) {
-  /* Copy the rest of the sample to the beginning of the Buffer */
-  memcpy(queue->buffer, queue->buffer + queue->roffset, queue->buffer_size - queue->roffset);
-  queue->buffer_size = queue->buffer_size - queue->roffset;
-  queue->roffset = 0;
-}
-
 int AI_TALKVQE_Init(AUDIO_VQE_S *handle, VQE_CONFIG_S *config) {
   SampleInfo sample_info = handle->sample_info;
 
@@ -290,12 +238,10 @@ AUDIO_VQE_S *RK_AUDIO_VQE_Init(const SampleInfo &sample_info,
                                AI_LAYOUT_E layout,
                                VQE_CONFIG_S *config) {
   int ret = -1;
-  AUDIO_VQE_S *handle = (AUDIO_VQE_S *)calloc(sizeof(AUDIO_VQE_S), 1);
-  if (!handle)
-    return NULL;
+  AUDIO_VQE_S *handle = new AUDIO_VQE_S();
 
-  handle->in_queue = queue_create(RK_AUDIO_BUFFER_MAX_SIZE);
-  handle->out_queue = queue_create(RK_AUDIO_BUFFER_MAX_SIZE);
+  handle->in_queue = new AudioRing(RK_AUDIO_BUFFER_MAX_SIZE);
+  handle->out_queue = new AudioRing(RK_AUDIO_BUFFER_MAX_SIZE);
 
   handle->sample_info = sample_info;
   handle->layout = layout;
@@ -320,9 +266,9 @@ AUDIO_VQE_S *RK_AUDIO_VQE_Init(const SampleInfo &sample_info,
     return handle;
 
   if (handle) {
-    free(handle->in_queue);
-    free(handle->out_queue);
-    free(handle);
+    delete handle->in_queue;
+    delete handle->out_queue;
+    delete handle;
   }
   return NULL;
 }
@@ -333,33 +279,52 @@ int RK_AUDIO_VQE_Handle(AUDIO_VQE_S *handle, void *buffer, int bytes) {
   int16_t frame_bytes = nm_samples * 2 * handle->sample_info.channels;
 
   // 1. data in queue
-  queue_write(handle->in_queue, (unsigned char *)buffer, bytes);
-
-  // 2. peek data from in queue, do audio process, data out queue
-  for (int i = 0; i < queue_size(handle->in_queue) / frame_bytes; i++) {
-    unsigned char in[frame_bytes] = {0};
-    unsigned char out[frame_bytes] = {0};
-    queue_read(handle->in_queue, in, frame_bytes);
-    VQE_Process(handle, in, out);
-    queue_write(handle->out_queue, out, frame_bytes);
+  if (!handle->in_queue->Write(buffer, bytes)) {
+    LOG("%s: in queue full, %d + %d > %d, vqe behind\n", __func__,
+        (int)handle->in_queue->Size(), bytes,
+        (int)handle->in_queue->Capacity());
+    return -1;
+  }
+
+  // 2. peek data from in queue, do audio process, data out queue. The
+  // frames are processed in the queues, unless they wrap.
+  handle->in_scratch.resize(frame_bytes);
+  handle->out_scratch.resize(frame_bytes);
+  while ((int)handle->in_queue->Size() >= frame_bytes) {
+    const unsigned char *in =
+        handle->in_queue->Peek(frame_bytes, handle->in_scratch.data());
+    unsigned char *out =
+        handle->out_queue->Reserve(frame_bytes, handle->out_scratch.data());
+    if (!out) {
+      LOG("%s: out queue full, %d not read\n", __func__,
+          (int)handle->out_queue->Size());
+      break;
+    }
+    VQE_Process(handle, (unsigned char *)in, out);
+    handle->out_queue->Commit(out, frame_bytes);
+    handle->in_queue->Skip(frame_bytes);
   }
-  /* Copy the rest of the sample to the beginning of the Buffer */
-  queue_tune(handle->in_queue);
 
   // 2. peek data from out queue
-  if (queue_size(handle->out_queue) >= bytes) {
-    queue_read(handle->out_queue, (unsigned char *)buffer, bytes);
-    queue_tune(handle->out_queue);
+  if (handle->out_queue->Read(buffer, bytes))
     return 0;
-  } else {
-    LOG("%s: queue size %d less than %d\n", __func__, queue_size(handle->out_queue), bytes);
+  LOG("%s: queue size %d less than %d\n", __func__,
+      (int)handle->out_queue->Size(), bytes);
+  return -1;
+}
+
+int RK_AUDIO_VQE_GetQueueState(AUDIO_VQE_S *handle, VQE_QUEUE_STATE_S *state) {
+  if (!handle || !state)
     return -1;
-  }
+  state->u32InBytes = handle->in_queue->Size();
+  state->u32OutBytes = handle->out_queue->Size();
+  state->u32QueueSize = handle->in_queue->Capacity();
+  return 0;
 }
 
 void RK_AUDIO_VQE_Deinit(AUDIO_VQE_S *handle) {
-  queue_free(handle->in_queue);
-  queue_free(handle->out_queue);
+  delete handle->in_queue;
+  delete handle->out_queue;
 
   switch (handle->stVqeConfig.u32VQEMode) {
   case VQE_MODE_AI_TALK:
@@ -375,6 +340,7 @@ void RK_AUDIO_VQE_Deinit(AUDIO_VQE_S *handle) {
   default:
     break;
   }
+  delete handle;
 }
 // void rk_audio_process_bind(AUDIO_VQE_S *tx, AUDIO_VQE_S *rx) {
 //}
@@ -386,6 +352,10 @@ int RK_AUDIO_VQE_Init(const SampleInfo &sample_info, VQE_CONFIG_S *config) {
 }
 int RK_AUDIO_VQE_Handle(void *buffer _UNUSED, int bytes _UNUSED) {}
 void RK_AUDIO_VQE_Deinit() {}
+int RK_AUDIO_VQE_GetQueueState(AUDIO_VQE_S *handle _UNUSED,
+                               VQE_QUEUE_STATE_S *state _UNUSED) {
+  return -1;
+}
 void rk_audio_process_bind(AUDIO_VQE_S *tx, AUDIO_VQE_S *rx); // for aec tx rx
 
 #endif
@@ -18,6 +18,8 @@ AUDIO_VQE_S *RK_AUDIO_VQE_Init(const SampleInfo &sample_info,
                                        VQE_CONFIG_S *config);
 void RK_AUDIO_VQE_Deinit(AUDIO_VQE_S *handle);
 int RK_AUDIO_VQE_Handle(AUDIO_VQE_S *handle, void *buffer, int bytes);
+// The bytes waiting in the queues, to tell the processing falls behind.
+int RK_AUDIO_VQE_GetQueueState(AUDIO_VQE_S *handle, VQE_QUEUE_STATE_S *state);
 // void rk_audio_vqe_bind(AUDIO_VQE_S *tx, AUDIO_VQE_S *rx); //for
 // aec tx rx
 
@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <map>
+
 #include "buffer.h"
 #include "control.h"
 #include "drm_stream.h"
@@ -23,19 +25,40 @@ struct plane_property_ids {
   uint32_t feature;
 };
 
+// The framebuffer of a dma-buf. It holds the buffer memory but not the
+// ImageBuffer, the cache drops it once the memory owner is gone.
 class DRMDisplayBuffer {
 public:
   DRMDisplayBuffer(std::shared_ptr<ImageBuffer> buffer,
                    const std::shared_ptr<DRMDevice> &dev, uint32_t drm_fmt,
                    int num = 1, int den = 1)
-      : ib(buffer), drm_dev(dev), drm_fd(dev->GetDeviceFd()), handle(0),
-        fb_id(0) {
+      : drm_dev(dev), drm_fd(dev->GetDeviceFd()), fb_id(0) {
+    uint32_t handle = 0;
     int fd = buffer->GetFD();
     int ret = drmPrimeFDToHandle(drm_fd, fd, &handle);
     if (ret) {
       LOG("Fail to drmPrimeFDToHandle, ret=%d, %m\n", ret);
       return;
     }
+    AddFB(buffer, drm_fmt, handle, num, den);
+    // The framebuffer keeps its own reference of the gem object. The handle
+    // is shared by all the imports of a dma-buf, do not keep it.
+    struct drm_gem_close data = {
+        .handle = handle,
+    };
+    ret = drmIoctl(drm_fd, DRM_IOCTL_GEM_CLOSE, &data);
+    if (ret)
+      LOG("Fail to free drm handle <%d>: %m\n", handle);
+  }
+  ~DRMDisplayBuffer() {
+    if (fb_id > 0)
+      drmModeRmFB(drm_fd, fb_id);
+  }
+  uint32_t GetFBID() { return fb_id; }
+
+private:
+  void AddFB(const std::shared_ptr<ImageBuffer> &buffer, uint32_t drm_fmt,
+             uint32_t handle, int num, int den) {
     int w = buffer->GetVirWidth() * num / den;
     int h = buffer->GetVirHeight();
     uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
@@ -76,33 +99,18 @@ public:
       LOG("TODO format for drm %c%c%c%c\n", DUMP_FOURCC(drm_fmt));
       return;
     }
-    ret = drmModeAddFB2(drm_fd, w, h, drm_fmt, handles, pitches, offsets,
-                        &fb_id, 0);
+    int ret = drmModeAddFB2(drm_fd, w, h, drm_fmt, handles, pitches, offsets,
+                            &fb_id, 0);
     if (ret) {
       LOG("Fail to drmModeAddFB2, ret=%d, %m\n", ret);
       LOG("num/den=%d/%d, w=%d, h=%d, drm_fmt=%c%c%c%c\n", num, den, w, h,
           DUMP_FOURCC(drm_fmt));
+      fb_id = 0;
     }
   }
-  ~DRMDisplayBuffer() {
-    if (fb_id > 0)
-      drmModeRmFB(drm_fd, fb_id);
-    if (handle > 0) {
-      struct drm_mode_destroy_dumb data = {
-          .handle = handle,
-      };
-      int ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &data);
-      if (ret)
-        LOG("Fail to free drm handle <%d>: %m\n", handle);
-    }
-  }
-  uint32_t GetFBID() { return fb_id; }
 
-private:
-  std::shared_ptr<ImageBuffer> ib;
   std::shared_ptr<DRMDevice> drm_dev;
   int drm_fd;
-  uint32_t handle;
   uint32_t fb_id;
 };
 
@@ -118,19 +126,43 @@ public:
 
 private:
   static const PixelFormat defaultPixFmt = PIX_FMT_ARGB8888;
+  // Enough for the pools of v4l2, which cycle a few buffers.
+  static const size_t kMaxFBCache = 32;
+
+  // A framebuffer per dma-buf fd, while the memory behind the fd lives.
+  // owner frees the memory, the token of a BufferPool buffer, else the
+  // userdata: once it expires, the fd may be reopened for other memory.
+  struct FBCacheEntry {
+    std::weak_ptr<void> owner;
+    size_t size;
+    uint64_t last_use;
+    std::shared_ptr<DRMDisplayBuffer> disp;
+  };
+  std::shared_ptr<DRMDisplayBuffer>
+  GetDisplayBuffer(const std::shared_ptr<ImageBuffer> &img, int num, int den);
+
   struct plane_property_ids plane_prop_ids;
   int zindex;
   bool support_scale;
 
   bool plane_set;
   std::shared_ptr<DRMDisplayBuffer> disp_buffer;
+  // On screen, not to be given back to its pool until the next one is.
+  std::shared_ptr<ImageBuffer> disp_image;
+  std::map<int, FBCacheEntry> fb_cache;
+  // The layout of all the cached framebuffers, flushed on a change.
+  uint32_t cache_fmt;
+  int cache_width; // the stride, in pixels of drm_fmt
+  int cache_height;
+  uint64_t write_count;
   ImageRect src_rect;
   ImageRect dst_rect;
 };
 
 DRMOutPutStream::DRMOutPutStream(const char *param)
     : DRMStream(param, true), zindex(-1), support_scale(false),
-      plane_set(false) {
+      plane_set(false), cache_fmt(0), cache_width(0), cache_height(0),
+      write_count(0) {
   if (device.empty())
     return;
   memset(&plane_prop_ids, 0, sizeof(plane_prop_ids));
@@ -259,6 +291,8 @@ int DRMOutPutStream::Open() {
 int DRMOutPutStream::Close() {
   int ret = DRMStream::Close();
   disp_buffer = nullptr;
+  disp_image = nullptr;
+  fb_cache.clear();
   return ret;
 }
 
@@ -343,6 +377,57 @@ int DRMOutPutStream::IoCtrl(unsigned long int request, ...) {
   return ret;
 }
 
+std::shared_ptr<DRMDisplayBuffer>
+DRMOutPutStream::GetDisplayBuffer(const std::shared_ptr<ImageBuffer> &img,
+                                  int num, int den) {
+  int fd = img->GetFD();
+  // A pooled frame has new userdata on every get, but the same token.
+  std::shared_ptr<void> owner = BufferPool::GetOwner(*img);
+  if (!owner)
+    owner = img->GetUserData();
+  if (fd < 0 || !owner)
+    return std::make_shared<DRMDisplayBuffer>(img, dev, drm_fmt, num, den);
+  int w = img->GetVirWidth() * num / den;
+  int h = img->GetVirHeight();
+  if (drm_fmt != cache_fmt || w != cache_width || h != cache_height) {
+    fb_cache.clear();
+    cache_fmt = drm_fmt;
+    cache_width = w;
+    cache_height = h;
+  }
+  write_count++;
+  auto oldest = fb_cache.end();
+  for (auto it = fb_cache.begin(); it != fb_cache.end();) {
+    if (it->second.owner.expired()) {
+      it = fb_cache.erase(it);
+      continue;
+    }
+    if (oldest == fb_cache.end() ||
+        it->second.last_use < oldest->second.last_use)
+      oldest = it;
+    it++;
+  }
+  auto it = fb_cache.find(fd);
+  if (it != fb_cache.end()) {
+    FBCacheEntry &entry = it->second;
+    if (entry.owner.lock() == owner && entry.size == img->GetSize()) {
+      entry.last_use = write_count;
+      return entry.disp;
+    }
+    // The fd of other memory, still alive.
+    if (oldest == it)
+      oldest = fb_cache.end();
+    fb_cache.erase(it);
+  }
+  auto disp = std::make_shared<DRMDisplayBuffer>(img, dev, drm_fmt, num, den);
+  if (disp->GetFBID() == 0)
+    return disp;
+  if (fb_cache.size() >= kMaxFBCache && oldest != fb_cache.end())
+    fb_cache.erase(oldest);
+  fb_cache[fd] = {owner, img->GetSize(), write_count, disp};
+  return disp;
+}
+
 bool DRMOutPutStream::Write(std::shared_ptr<MediaBuffer> input) {
   if (input->GetType() != Type::Image)
     return false;
@@ -366,8 +451,7 @@ bool DRMOutPutStream::Write(std::shared_ptr<MediaBuffer> input) {
   }
 
   uint32_t disp_fb_id = 0;
-  auto disp =
-      std::make_shared<DRMDisplayBuffer>(input_img, dev, drm_fmt, num, den);
+  auto disp = GetDisplayBuffer(input_img, num, den);
   if (!disp || (disp_fb_id = disp->GetFBID()) == 0)
     return false;
   int ret = 0;
@@ -386,6 +470,7 @@ bool DRMOutPutStream::Write(std::shared_ptr<MediaBuffer> input) {
 	drmModeAtomicFree(req);
   if (!ret) {
     disp_buffer = disp;
+    disp_image = input_img;
     return true;
   }
   LOG("ERROR: DrmDisp: %d:%d::Imgbuf<%d,%d,%d,%d> display with <%d,%d,%d,%d> failed!\n",
@@ -6,7 +6,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 #include "media_type.h"
 #include "utils.h"
@@ -46,13 +51,16 @@ public:
     if (!Writeable())
       return -1;
     CHECK_FILE(file)
-    return fwrite(ptr, size, nmemb, file);
+    size_t ret = fwrite(ptr, size, nmemb, file);
+    AfterWrite(ret * size);
+    return ret;
   }
   virtual size_t WriteAndClose(const void *ptr, size_t size, size_t nmemb) final {
     if (!Writeable())
       return -1;
     CHECK_FILE(file)
-    fwrite(ptr, size, nmemb, file);
+    size_t ret = fwrite(ptr, size, nmemb, file);
+    AfterWrite(ret * size);
     return Close();
   }
 
@@ -94,6 +102,8 @@ protected:
     if (!file)
       return -1;
     eof = false;
+    allocated = 0;
+    unsynced = 0;
     SetReadable(true);
     SetWriteable(true);
     SetSeekable(true);
@@ -104,6 +114,14 @@ protected:
       errno = EBADF;
       return EOF;
     }
+    if (allocated > 0) {
+      // Give back the space reserved past the end.
+      struct stat st;
+      fflush(file);
+      if (!fstat(fileno(file), &st) && st.st_size < allocated &&
+          ftruncate(fileno(file), st.st_size))
+        LOG("ftruncate %s failed, %m\n", path.c_str());
+    }
     eof = true;
     int ret = fclose(file);
     file = NULL;
@@ -111,16 +129,48 @@ protected:
   }
 
 private:
+  void AfterWrite(size_t bytes);
+
   std::string path;
   std::string open_mode;
   std::string save_mode;
   FILE *file;
   bool eof;
   int open_late;
+  size_t prealloc_size;
+  size_t sync_size;
+  off_t allocated;
+  size_t unsynced;
 };
 
+void FileStream::AfterWrite(size_t bytes) {
+  if (prealloc_size > 0) {
+    off_t end = ftello(file);
+    if (end >= 0 && end + (off_t)prealloc_size / 2 > allocated) {
+      // Fewer, larger extents, and no allocation on the next writes.
+      off_t offset = std::max(allocated, end);
+      if (fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, offset,
+                    prealloc_size)) {
+        LOG("fallocate %s failed, %m, no more preallocation\n", path.c_str());
+        prealloc_size = 0;
+      } else {
+        allocated = offset + prealloc_size;
+      }
+    }
+  }
+  if (sync_size > 0) {
+    unsynced += bytes;
+    if (unsynced >= sync_size) {
+      fflush(file);
+      fdatasync(fileno(file));
+      unsynced = 0;
+    }
+  }
+}
+
 FileStream::FileStream(const char *param)
-    : file(NULL), eof(true), open_late (0) {
+    : file(NULL), eof(true), open_late (0), prealloc_size(0), sync_size(0),
+      allocated(0), unsynced(0) {
   std::map<std::string, std::string> params;
   std::list<std::pair<const std::string, std::string &>> req_list;
   req_list.push_back(
@@ -133,6 +183,12 @@ FileStream::FileStream(const char *param)
     save_mode = KEY_SAVE_MODE_CONTIN;
   if (save_mode == KEY_SAVE_MODE_SINGLE)
     open_late = 1;
+  std::string value = params[KEY_PREALLOC_SIZE];
+  if (!value.empty())
+    prealloc_size = std::stoul(value);
+  value = params[KEY_SYNC_SIZE];
+  if (!value.empty())
+    sync_size = std::stoul(value);
   UNUSED(ret);
 }
 